@@ -343,6 +343,266 @@ InputContains(const Input& input, uint8_t toFind)
   }
 }
 
+// LargeInput and LargeReader are like Input and Reader, except they can
+// reference up to 2^32 - 1 bytes, for structures that may be larger than an
+// Input, such as full CRLs, bulk OCSP responses, and PKCS#7 bundles. They
+// make the same guarantees: they never copy or modify the data, and every
+// access is bounds-checked.
+//
+// Only the outer layers of such structures need to be large; the elements
+// within them are read into an Input or Reader (which fails with
+// ERROR_BAD_DER if an element is too large) and parsed with the usual
+// functions. Certificates and everything else that always fits in an Input
+// should continue to use Input and Reader.
+class LargeInput final
+{
+public:
+  typedef uint32_t size_type;
+
+  template <size_type N>
+  explicit LargeInput(const uint8_t (&data)[N])
+    : data(data)
+    , len(N)
+  {
+  }
+
+  // Construct a valid, empty, Init-able LargeInput.
+  LargeInput()
+    : data(nullptr)
+    , len(0u)
+  {
+  }
+
+  // Every Input is a valid LargeInput.
+  explicit LargeInput(Input input)
+    : data(input.UnsafeGetData())
+    , len(input.GetLength())
+  {
+  }
+
+  // This is intentionally not explicit in order to allow value semantics.
+  LargeInput(const LargeInput&) = default;
+
+  // Initialize the input. data must be non-null and len must be less than
+  // 2^32. Init may not be called more than once.
+  Result Init(const uint8_t* data, size_t len)
+  {
+    if (this->data) {
+      // already initialized
+      return Result::FATAL_ERROR_INVALID_ARGS;
+    }
+    if (!data || len > 0xffffffffu) {
+      // input too large
+      return Result::ERROR_BAD_DER;
+    }
+
+    this->data = data;
+    this->len = static_cast<size_type>(len);
+
+    return Success;
+  }
+
+  // Initialize the input to be equivalent to the given input. Init may not be
+  // called more than once.
+  Result Init(LargeInput other)
+  {
+    return Init(other.data, other.len);
+  }
+
+  // Initialize the Input to be equivalent to this input, if it is small
+  // enough.
+  Result ToInput(/*out*/ Input& input) const
+  {
+    return input.Init(data, len);
+  }
+
+  size_type GetLength() const { return len; }
+
+  // Don't use this. It is here because we have some "friend" functions that we
+  // don't want to declare in this header file.
+  const uint8_t* UnsafeGetData() const { return data; }
+
+private:
+  const uint8_t* data;
+  size_type len;
+
+  void operator=(const LargeInput&) = delete; // Use Init instead.
+};
+
+// See LargeInput. The Skip and GetInput functions that output an Input or
+// Reader fail with ERROR_BAD_DER if the output would be too large for it.
+class LargeReader final
+{
+public:
+  LargeReader()
+    : input(nullptr)
+    , end(nullptr)
+  {
+  }
+
+  explicit LargeReader(LargeInput input)
+    : input(input.UnsafeGetData())
+    , end(input.UnsafeGetData() + input.GetLength())
+  {
+  }
+
+  Result Init(LargeInput input)
+  {
+    if (this->input) {
+      return Result::FATAL_ERROR_INVALID_ARGS;
+    }
+    this->input = input.UnsafeGetData();
+    this->end = input.UnsafeGetData() + input.GetLength();
+    return Success;
+  }
+
+  bool Peek(uint8_t expectedByte) const
+  {
+    return input < end && *input == expectedByte;
+  }
+
+  Result Read(uint8_t& out)
+  {
+    Result rv = EnsureLength(1);
+    if (rv != Success) {
+      return rv;
+    }
+    out = *input++;
+    return Success;
+  }
+
+  Result Read(uint16_t& out)
+  {
+    Result rv = EnsureLength(2);
+    if (rv != Success) {
+      return rv;
+    }
+    out = *input++;
+    out <<= 8u;
+    out |= *input++;
+    return Success;
+  }
+
+  Result Skip(LargeInput::size_type len)
+  {
+    Result rv = EnsureLength(len);
+    if (rv != Success) {
+      return rv;
+    }
+    input += len;
+    return Success;
+  }
+
+  Result Skip(LargeInput::size_type len, /*out*/ LargeReader& skipped)
+  {
+    LargeInput skippedInput;
+    Result rv = Skip(len, skippedInput);
+    if (rv != Success) {
+      return rv;
+    }
+    return skipped.Init(skippedInput);
+  }
+
+  Result Skip(LargeInput::size_type len, /*out*/ LargeInput& skipped)
+  {
+    Result rv = EnsureLength(len);
+    if (rv != Success) {
+      return rv;
+    }
+    rv = skipped.Init(input, len);
+    if (rv != Success) {
+      return rv;
+    }
+    input += len;
+    return Success;
+  }
+
+  Result Skip(LargeInput::size_type len, /*out*/ Reader& skipped)
+  {
+    Input skippedInput;
+    Result rv = Skip(len, skippedInput);
+    if (rv != Success) {
+      return rv;
+    }
+    return skipped.Init(skippedInput);
+  }
+
+  Result Skip(LargeInput::size_type len, /*out*/ Input& skipped)
+  {
+    Result rv = EnsureLength(len);
+    if (rv != Success) {
+      return rv;
+    }
+    rv = skipped.Init(input, len);
+    if (rv != Success) {
+      return rv;
+    }
+    input += len;
+    return Success;
+  }
+
+  void SkipToEnd()
+  {
+    input = end;
+  }
+
+  Result SkipToEnd(/*out*/ LargeInput& skipped)
+  {
+    return Skip(static_cast<LargeInput::size_type>(end - input), skipped);
+  }
+
+  Result EnsureLength(LargeInput::size_type len)
+  {
+    if (static_cast<size_t>(end - input) < len) {
+      return Result::ERROR_BAD_DER;
+    }
+    return Success;
+  }
+
+  bool AtEnd() const { return input == end; }
+
+  class Mark final
+  {
+  public:
+    Mark(const Mark&) = default; // Intentionally not explicit.
+  private:
+    friend class LargeReader;
+    Mark(const LargeReader& input, const uint8_t* mark)
+      : input(input)
+      , mark(mark)
+    {
+    }
+    const LargeReader& input;
+    const uint8_t* const mark;
+    void operator=(const Mark&) = delete;
+  };
+
+  Mark GetMark() const { return Mark(*this, input); }
+
+  Result GetInput(const Mark& mark, /*out*/ LargeInput& item)
+  {
+    if (&mark.input != this || mark.mark > input) {
+      return NotReached("invalid mark", Result::FATAL_ERROR_INVALID_ARGS);
+    }
+    return item.Init(mark.mark, static_cast<size_t>(input - mark.mark));
+  }
+
+  Result GetInput(const Mark& mark, /*out*/ Input& item)
+  {
+    if (&mark.input != this || mark.mark > input) {
+      return NotReached("invalid mark", Result::FATAL_ERROR_INVALID_ARGS);
+    }
+    return item.Init(mark.mark, static_cast<size_t>(input - mark.mark));
+  }
+
+private:
+  const uint8_t* input;
+  const uint8_t* end;
+
+  LargeReader(const LargeReader&) = delete;
+  void operator=(const LargeReader&) = delete;
+};
+
 } } // namespace mozilla::pkix
 
 #endif // mozilla_pkix_Input_h
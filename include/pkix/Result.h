@@ -185,6 +185,16 @@ static const unsigned int FATAL_ERROR_FLAG = 0x800;
                      MOZILLA_PKIX_ERROR_OCSP_RESPONSE_FOR_CERT_MISSING) \
     MOZILLA_PKIX_MAP(ERROR_VALIDITY_TOO_LONG, 50, \
                      MOZILLA_PKIX_ERROR_VALIDITY_TOO_LONG) \
+    MOZILLA_PKIX_MAP(ERROR_CRL_BAD_SIGNATURE, 51, \
+                     SEC_ERROR_CRL_BAD_SIGNATURE) \
+    MOZILLA_PKIX_MAP(ERROR_CRL_EXPIRED, 52, \
+                     SEC_ERROR_CRL_EXPIRED) \
+    MOZILLA_PKIX_MAP(ERROR_CRL_INVALID, 53, \
+                     SEC_ERROR_CRL_INVALID) \
+    MOZILLA_PKIX_MAP(ERROR_CRL_NOT_YET_VALID, 54, \
+                     SEC_ERROR_CRL_NOT_YET_VALID) \
+    MOZILLA_PKIX_MAP(ERROR_OCSP_RESPONSE_FIELD_TOO_LONG, 55, \
+                     MOZILLA_PKIX_ERROR_OCSP_RESPONSE_FIELD_TOO_LONG) \
     MOZILLA_PKIX_MAP(FATAL_ERROR_INVALID_ARGS, FATAL_ERROR_FLAG | 1, \
                      SEC_ERROR_INVALID_ARGS) \
     MOZILLA_PKIX_MAP(FATAL_ERROR_INVALID_STATE, FATAL_ERROR_FLAG | 2, \
@@ -25,6 +25,8 @@
 #ifndef mozilla_pkix_pkix_h
 #define mozilla_pkix_pkix_h
 
+#include <mutex>
+
 #include "pkixtypes.h"
 
 namespace mozilla { namespace pkix {
@@ -118,6 +120,373 @@ Result BuildCertChain(TrustDomain& trustDomain, Input cert,
 // - A wildcard in a DNS-ID may only appear as the entirety of the first label.
 Result CheckCertHostname(Input cert, Input hostname);
 
+// The presented identifiers of an end-entity certificate, parsed once so that
+// the certificate can be matched against many hostnames (e.g. by a server
+// choosing a certificate for each SNI value) without parsing it again for
+// each one. CheckHostname(hostname) has the same result as
+// CheckCertHostname(cert, hostname), but its cost doesn't depend on the number
+// of names in the certificate: the subjectAltName's dNSNames, the suffixes of
+// its wildcard dNSNames, and its iPAddresses are kept in a hash table, and the
+// most specific subject CN, if it is needed, is remembered.
+//
+// The certificate is referenced, not copied, so it must outlive the
+// CertHostnameMatcher, as must the caller-provided entry storage.
+class CertHostnameMatcher final
+{
+public:
+  // Storage for the hash table, provided by the caller. The contents are
+  // opaque.
+  struct Entry
+  {
+    uint16_t offset; // of the name, within the certificate
+    uint16_t length;
+    uint16_t index; // of the name, within the subjectAltName
+    uint8_t type;
+    uint8_t hashByte;
+  };
+
+  CertHostnameMatcher();
+
+  // If the certificate can't be parsed, this returns the error that
+  // CheckCertHostname would return for every hostname. entries must have room
+  // for at least MaxEntryCount(cert) entries.
+  Result Init(Input cert, /*out*/ Entry* entries, size_t entryCapacity);
+
+  // Every dNSName and iPAddress in a subjectAltName takes at least three
+  // bytes, and the hash table is kept at most half full.
+  static size_t MaxEntryCount(Input cert)
+  {
+    size_t entryCount = 1;
+    while (entryCount < 2u * (cert.GetLength() / 3u)) {
+      entryCount <<= 1;
+    }
+    return entryCount;
+  }
+
+  Result CheckHostname(Input hostname) const;
+
+private:
+  Result ReadSubjectAltName(const Input* subjectAltName, bool insert,
+                            /*out*/ size_t& nameCount);
+  void Insert(uint8_t type, Input name, size_t index);
+  size_t Find(uint8_t type, Input name) const;
+  Input ValueOf(const Entry& entry) const;
+
+  Input cert;
+  Entry* entries;
+  size_t entryCount; // zero or a power of two
+
+  // An invalid dNSName, or a malformed subjectAltName, is an error for a
+  // hostname unless the hostname matches an earlier name.
+  size_t dNSNameErrorIndex;
+  Result dNSNameError;
+  size_t iPAddressErrorIndex;
+  Result iPAddressError;
+
+  // The subject CN is only used when the subjectAltName has no dNSName or
+  // iPAddress.
+  bool fallBackToCommonName;
+  Result subjectError;
+  uint8_t commonNameType;
+  Input commonName; // or, for a wildcard, the suffix after "*."
+  uint8_t commonNameIPv4Address[4];
+
+  CertHostnameMatcher(const CertHostnameMatcher&) = delete;
+  void operator=(const CertHostnameMatcher&) = delete;
+};
+
+// An index of the hostnames that many end-entity certificates are valid for,
+// e.g. for a TLS server that chooses among many certificates by SNI. The IDs
+// of each certificate that CheckCertHostname could match (dNSNames, the
+// suffixes of wildcard dNSNames, iPAddresses, and the subject CN when it
+// would be used) are extracted by the same rules as CertHostnameMatcher and
+// kept in a hash table in caller-provided storage. FindCertificates(hostname)
+// finds exactly the certificates for which CheckCertHostname(cert, hostname)
+// would return Success, in time that depends on the number of matching
+// certificates but not on the number of certificates in the index.
+//
+// Certificates are identified by caller-chosen IDs. They are referenced, not
+// copied, so each must outlive its presence in the index, as must the entry
+// storage. The index is not thread-safe: lookups may run concurrently with
+// each other, but not with AddCertificate or RemoveCertificate.
+class CertHostnameIndex final
+{
+public:
+  // Storage for the hash table, provided by the caller. The contents are
+  // opaque.
+  struct Entry
+  {
+    const uint8_t* name; // within the certificate, or null for an IPv4 CN
+    size_t certID;
+    uint32_t hash;
+    uint16_t length;
+    uint8_t type;
+    uint8_t commonNameIPv4Address[4];
+  };
+
+  CertHostnameIndex();
+
+  // entryCapacity must be a power of two. The table is kept at most three
+  // quarters full; a certificate typically needs one entry per name.
+  Result Init(/*out*/ Entry* entries, size_t entryCapacity);
+
+  // Adds all of the certificate's IDs, or none of them: if the certificate
+  // can't be parsed, the error that CheckCertHostname would return for every
+  // hostname is returned, and if the table doesn't have room,
+  // Result::FATAL_ERROR_NO_MEMORY is returned. Adding a certificate again with
+  // the same ID has no effect.
+  Result AddCertificate(Input cert, size_t certID);
+
+  // Removes the IDs that AddCertificate added for the same certificate, which
+  // may be another copy of it.
+  Result RemoveCertificate(Input cert, size_t certID);
+
+  // Finds the IDs of the certificates that match the hostname. Up to
+  // certIDsCapacity of them are stored in certIDs; certIDCount is set to the
+  // number of matching certificates, which may be larger.
+  Result FindCertificates(Input hostname, /*out*/ size_t* certIDs,
+                          size_t certIDsCapacity,
+                          /*out*/ size_t& certIDCount) const;
+
+  // The number of entries in use.
+  size_t GetEntryCount() const { return entryCount; }
+
+private:
+  template <typename IDHandler>
+  static Result ReadHostnameIDs(Input cert, IDHandler idHandler);
+  size_t Find(uint8_t type, Input name, uint32_t hash, size_t certID) const;
+  void Erase(size_t i);
+  Input ValueOf(const Entry& entry) const;
+
+  Entry* entries;
+  size_t entryCapacity; // a power of two
+  size_t entryCount;
+
+  CertHostnameIndex(const CertHostnameIndex&) = delete;
+  void operator=(const CertHostnameIndex&) = delete;
+};
+
+// A NameConstraints extension value compiled into lookup tables, so that a
+// constrained CA's name constraints don't have to be parsed again, and every
+// subtree compared, for each name of each certificate it issues. It is built
+// once per extension value and can be kept alongside the CA certificate; see
+// TrustDomain::IssuerChecker::CheckWithNameConstraints.
+//
+// The results are always the same as those of checking the encoded
+// extension directly. dNSName and rfc822Name constraints are kept in sorted
+// tables of label-aligned suffixes, looked up once per suffix of the
+// presented name (like walking a trie of reversed labels). iPAddress
+// constraints are kept in a table sorted by prefix length and masked address.
+// directoryName constraints are kept in their original order and compared
+// as prefixes of the presented name. An extension that is malformed in a way
+// whose detection depends on the names being checked is not compiled; it is
+// checked by walking the encoded extension instead.
+//
+// The extension value is referenced, not copied, so it must outlive the
+// CompiledNameConstraints, as must the caller-provided entry storage.
+class CompiledNameConstraints final
+{
+public:
+  // Storage for the compiled tables, provided by the caller. The contents
+  // are opaque.
+  struct Entry
+  {
+    uint16_t offset; // of the constraint's value, within the extension
+    uint16_t length;
+    uint8_t flags;
+    uint8_t prefixLength;
+    uint16_t key; // a hash of one RDN of a directoryName constraint
+  };
+
+  CompiledNameConstraints();
+
+  // entries must have room for at least
+  // MaxEntryCount(encodedNameConstraints) entries.
+  Result Init(Input encodedNameConstraints, /*out*/ Entry* entries,
+              size_t entryCapacity);
+
+  // A GeneralSubtree yields at most one entry for every two bytes of its
+  // encoding.
+  static size_t MaxEntryCount(Input encodedNameConstraints)
+  {
+    return encodedNameConstraints.GetLength() / 2u;
+  }
+
+  Input GetEncoded() const { return encoded; }
+
+  // Checks the presented GeneralName with the given tag (e.g.
+  // der::CONTEXT_SPECIFIC | 2 for a dNSName) and value against the
+  // constraints, returning Success or Result::ERROR_CERT_NOT_IN_NAME_SPACE,
+  // or another error if the name or the constraints are malformed.
+  Result CheckPresentedID(uint8_t presentedIDTag, Input presentedID) const;
+
+private:
+  // Each kind of constraint that is compiled into a table has a section of
+  // entries for permittedSubtrees followed by one for excludedSubtrees.
+  enum Table
+  {
+    DNSNameTable = 0,
+    IPAddressTable = 2,
+    RFC822DomainTable = 4,
+    RFC822MailboxTable = 6,
+    DirectoryNameTable = 8,
+    TableCount = 10
+  };
+
+  Result Compile(Entry* entries, size_t entryCapacity);
+  Result CheckDirectoryName(Input presentedID, size_t subtreesIndex,
+                            /*out*/ bool& matches) const;
+  bool MatchDNSName(Input presentedID, size_t subtreesIndex) const;
+  bool MatchRFC822Name(Input presentedID, size_t subtreesIndex) const;
+  bool MatchIPAddress(Input presentedID, size_t subtreesIndex) const;
+
+  Input ValueOf(const Entry& entry) const;
+  bool FindName(size_t table, Input name, uint8_t flags) const;
+
+  Input encoded;
+  bool compiled;
+  const Entry* entries;
+  size_t tableBegin[TableCount];
+  size_t tableEnd[TableCount];
+  // Bit n is set if there is a constraint of the type with tag
+  // (der::CONTEXT_SPECIFIC | n), in permittedSubtrees ([0]) or
+  // excludedSubtrees ([1]).
+  uint16_t typesPresent[2];
+  // Whether there is a dNSName or domain rfc822Name constraint of "", which
+  // matches every name of that type.
+  bool emptyDNSName[2];
+  bool emptyRFC822Domain[2];
+  // Whether each permitted directoryName constraint's entry is followed by
+  // the keys of its RDNs, which is the case unless one of the constraints is
+  // malformed or has more than 255 RDNs.
+  bool directoryNameKeys;
+
+  CompiledNameConstraints(const CompiledNameConstraints&) = delete;
+  void operator=(const CompiledNameConstraints&) = delete;
+};
+
+// Checks certDER against nameConstraints the way BuildCertChain does for a
+// certificate issued by the constrained CA, without building a chain or
+// checking anything else about the certificate, e.g. to check everything a
+// name-constrained CA has issued. endEntityOrCA and requiredEKUIfPresent
+// determine whether the subject CN is checked, as they do for BuildCertChain.
+// This may be called from several threads at once with the same
+// nameConstraints.
+//
+// When the result is Result::ERROR_CERT_NOT_IN_NAME_SPACE, violatingName, if
+// given, is set to the first of the certificate's names that violates the
+// constraints, and violatingNameTag to the tag of the type of GeneralName it
+// was checked as (e.g. der::CONTEXT_SPECIFIC | 2 for a dNSName). A name from
+// the subject (the subject itself, an emailAddress, or a CN) is given as
+// encoded there; for example, an IPv4 address in a CN is a dotted string.
+// Otherwise violatingNameTag is set to 0 and violatingName is left
+// uninitialized.
+Result CheckCertNameConstraints(
+         const CompiledNameConstraints& nameConstraints, Input certDER,
+         EndEntityOrCA endEntityOrCA, KeyPurposeId requiredEKUIfPresent,
+         /*optional out*/ uint8_t* violatingNameTag = nullptr,
+         /*optional out*/ Input* violatingName = nullptr);
+
+struct NameConstraintsCheckResult final
+{
+  NameConstraintsCheckResult()
+    : result(Result::FATAL_ERROR_INVALID_STATE)
+    , violatingNameTag(0)
+  {
+  }
+
+  Result result;
+  uint8_t violatingNameTag;
+  Input violatingName;
+
+  NameConstraintsCheckResult(const NameConstraintsCheckResult&) = delete;
+  void operator=(const NameConstraintsCheckResult&) = delete;
+};
+
+// The most threads that any of the functions below that divide their work
+// among threads will use. Those functions start their threads with
+// std::thread, which reports a failure to create a thread by throwing
+// std::system_error; when mozilla::pkix is built without exceptions, as it
+// usually is, such a failure terminates the process. Callers that can't
+// tolerate that, or that must control how threads are created, should pass a
+// threadCount of 1, which never creates a thread, and divide the certificates
+// among their own threads instead.
+static const unsigned int MAX_PARALLEL_THREADS = 64;
+
+// Does CheckCertNameConstraints for each of certDERs, setting the
+// corresponding element of results, which must be newly constructed. The
+// certificates are divided among threadCount threads (including the calling
+// one), which must be from 1 to MAX_PARALLEL_THREADS. The return value is
+// Success unless the arguments are invalid; the results of the checks are in
+// results.
+Result CheckCertsNameConstraints(
+         const CompiledNameConstraints& nameConstraints,
+         const Input* certDERs, size_t certCount,
+         EndEntityOrCA endEntityOrCA, KeyPurposeId requiredEKUIfPresent,
+         /*out*/ NameConstraintsCheckResult* results,
+         unsigned int threadCount);
+
+// The columns of a batch of certificates' fields, as filled in by
+// ExtractCertFields. Each non-null column points to an array with an element
+// for each certificate; null columns are not extracted. The Input elements
+// must be newly constructed, and they refer to the certificates' own DER
+// rather than to copies of it.
+//
+// Every subjectAltName entry of certificate i is counted in
+// subjectAltNameCounts[i], but only the first subjectAltNamesPerCert of them
+// are stored, in subjectAltNames[i * subjectAltNamesPerCert + j], with their
+// GeneralName tags (e.g. der::CONTEXT_SPECIFIC | 2 for a dNSName) in the
+// same element of subjectAltNameTags.
+//
+// If results[i] isn't Success, the other columns' elements for certificate i
+// are unspecified.
+struct CertFieldColumns final
+{
+  CertFieldColumns()
+    : results(nullptr)
+    , serialNumbers(nullptr)
+    , issuers(nullptr)
+    , subjects(nullptr)
+    , notBefores(nullptr)
+    , notAfters(nullptr)
+    , publicKeyTypes(nullptr)
+    , publicKeySizesInBits(nullptr)
+    , extendedKeyUsages(nullptr)
+    , subjectAltNameCounts(nullptr)
+    , subjectAltNamesPerCert(0)
+    , subjectAltNames(nullptr)
+    , subjectAltNameTags(nullptr)
+  {
+  }
+
+  Result* results; // required
+  Input* serialNumbers;
+  Input* issuers;
+  Input* subjects;
+  Time* notBefores;
+  Time* notAfters;
+  PublicKeyType* publicKeyTypes;
+  unsigned int* publicKeySizesInBits;
+  uint16_t* extendedKeyUsages; // 0 if there is no EKU extension
+  size_t* subjectAltNameCounts;
+  size_t subjectAltNamesPerCert;
+  Input* subjectAltNames;
+  uint8_t* subjectAltNameTags;
+
+  CertFieldColumns(const CertFieldColumns&) = delete;
+  void operator=(const CertFieldColumns&) = delete;
+};
+
+// Parses each of certDERs as an end-entity certificate, as BackCert does for
+// path building, and fills in its elements of the given columns. The
+// certificates are divided among threadCount threads (including the calling
+// one), which must be from 1 to MAX_PARALLEL_THREADS. The return value is
+// Success unless the arguments are invalid; whether each certificate could be
+// parsed is in columns.results.
+Result ExtractCertFields(const Input* certDERs, size_t certCount,
+                         const CertFieldColumns& columns,
+                         unsigned int threadCount);
+
 // Construct an RFC-6960-encoded OCSP request, ready for submission to a
 // responder, for the provided CertID. The request has no extensions.
 static const size_t OCSP_REQUEST_MAX_LENGTH = 127;
@@ -126,6 +495,88 @@ Result CreateEncodedOCSPRequest(TrustDomain& trustDomain,
                                 /*out*/ uint8_t (&out)[OCSP_REQUEST_MAX_LENGTH],
                                 /*out*/ size_t& outLen);
 
+// A small cache of delegated OCSP response signing certificates that have
+// already been validated (RFC 6960 section 4.2.2.2) by
+// VerifyEncodedOCSPResponse. A responder usually signs millions of responses
+// with the same delegated certificate, so remembering that a given signer
+// certificate was found valid for a given issuer lets us skip re-verifying the
+// signer's signature and the other checks of the signer for every response.
+// The signer is still parsed and matched against the responder ID every time;
+// the key is only computed for the signer that matches.
+//
+// Entries are keyed by the SHA-256 digests (computed with
+// TrustDomain::DigestBuf) of the signer certificate and of the issuer's
+// SubjectPublicKeyInfo, and they are only used while the time given to
+// VerifyEncodedOCSPResponse is within the signer's validity period. The
+// signer's issuer name is still compared against the CertID on every use.
+//
+// The checks that are skipped depend on the TrustDomain's policy (e.g.
+// GetCertTrust and the algorithm and key size checks), so a cache must only
+// be used with one TrustDomain and it must be cleared whenever that
+// TrustDomain's policy changes. OCSPSignerCache does no locking; callers that
+// share one across threads must synchronize access to it.
+class OCSPSignerCache final
+{
+public:
+  static const size_t CAPACITY = 16;
+  static const size_t DIGEST_LENGTH = 256 / 8;
+
+  OCSPSignerCache();
+
+  void Clear();
+
+  class Key final
+  {
+  public:
+    Key() { }
+
+    Result Init(TrustDomain& trustDomain, Input signerDER,
+                const CertID& certID);
+
+  private:
+    uint8_t signerDigest[DIGEST_LENGTH];
+    uint8_t issuerSubjectPublicKeyInfoDigest[DIGEST_LENGTH];
+
+    Key(const Key&) = delete;
+    void operator=(const Key&) = delete;
+
+    friend class OCSPSignerCache;
+  };
+
+  // Return true if signerDER (identified by key) has been recorded as a
+  // valid delegated signer and time is within its validity period.
+  bool Find(const Key& key, Input signerDER, Time time) const;
+
+  // Record that signerDER (identified by key) is a valid delegated signer
+  // between notBefore and notAfter. When the cache is full, the oldest entry
+  // is replaced.
+  void Add(const Key& key, Input signerDER, Time notBefore, Time notAfter);
+
+private:
+  struct Entry
+  {
+    Entry()
+      : inUse(false)
+      , notBefore(Time::uninitialized)
+      , notAfter(Time::uninitialized)
+    {
+    }
+
+    bool inUse;
+    uint8_t signerDigest[DIGEST_LENGTH];
+    uint8_t issuerSubjectPublicKeyInfoDigest[DIGEST_LENGTH];
+    Input::size_type signerLength;
+    Time notBefore;
+    Time notAfter;
+  };
+
+  Entry entries[CAPACITY];
+  size_t nextEntry;
+
+  OCSPSignerCache(const OCSPSignerCache&) = delete;
+  void operator=(const OCSPSignerCache&) = delete;
+};
+
 // The out parameter expired will be true if the response has expired. If the
 // response also indicates a revoked or unknown certificate, that error
 // will be returned. Otherwise, Result::ERROR_OCSP_OLD_RESPONSE will be
@@ -139,14 +590,503 @@ Result CreateEncodedOCSPRequest(TrustDomain& trustDomain,
 // which the encoded response is considered trustworthy (that is, as long as
 // the given time at which to validate is less than or equal to validThrough,
 // the response will be considered trustworthy).
+//
+// If signerCache is given, delegated signer certificates embedded in the
+// response are looked up in it before being validated, and are added to it
+// once they have been validated. See OCSPSignerCache.
+//
+// The optional parameter signerNotAfter will be the end of the validity
+// period of the delegated signing certificate that signed a trustworthy
+// response, after which the response is no longer trustworthy even if
+// validThrough is later. For a response signed by the issuer itself, whose
+// validity isn't checked here, it will be the latest representable time.
+//
+// VerifyEncodedOCSPResponse keeps no state of its own between calls, so it is
+// reentrant: it may be called from several threads at once, provided that
+// the TrustDomain allows that and that no OCSPSignerCache is shared between
+// the threads.
 Result VerifyEncodedOCSPResponse(TrustDomain& trustDomain,
                                  const CertID& certID, Time time,
                                  uint16_t maxLifetimeInDays,
                                  Input encodedResponse,
                        /* out */ bool& expired,
               /* optional out */ Time* thisUpdate = nullptr,
+              /* optional out */ Time* validThrough = nullptr,
+                  /* optional */ OCSPSignerCache* signerCache = nullptr,
+              /* optional out */ Time* signerNotAfter = nullptr);
+
+// A cache of the results of verifying stapled OCSP responses. A server
+// staples the same response to every handshake until it fetches a new one,
+// so remembering the result of verifying a staple for a certificate lets
+// later handshakes skip parsing the response and verifying its signature.
+//
+// Entries are keyed by the SHA-256 digests (computed with
+// TrustDomain::DigestBuf) of the response and of each field of the CertID,
+// and by the maxLifetimeInDays the response was verified with, since that
+// determines both validThrough and whether the response is trustworthy.
+// An entry holds what VerifyEncodedOCSPResponse returned for a trustworthy,
+// unexpired response (Success, Result::ERROR_REVOKED_CERTIFICATE, or
+// Result::ERROR_OCSP_UNKNOWN_CERT, along with thisUpdate and validThrough)
+// and the time of that verification. It is used for times from the time of
+// the verification through validThrough or, if earlier, the end of the
+// validity period of the delegated signing certificate that signed the
+// response, during which VerifyEncodedOCSPResponse would return the same
+// result.
+//
+// The TrustDomain is not part of the key, and the decisions it made (e.g.
+// whether to trust a delegated responder) are remembered along with the
+// result. So, like OCSPSignerCache, a cache must never be shared between
+// TrustDomains, and it must be cleared whenever its TrustDomain's policy
+// changes (e.g. when it starts to distrust a responder). Unlike
+// OCSPSignerCache, it is meant to be shared by all connections, so it may be
+// used from multiple threads concurrently.
+class StapledOCSPCache final
+{
+public:
+  static const size_t CAPACITY = 64;
+  static const size_t DIGEST_LENGTH = 256 / 8;
+
+  StapledOCSPCache();
+
+  void Clear();
+
+  class Key final
+  {
+  public:
+    Key() { }
+
+    Result Init(TrustDomain& trustDomain, const CertID& certID,
+                uint16_t maxLifetimeInDays, Input encodedResponse);
+
+  private:
+    enum { Response, Issuer, IssuerSubjectPublicKeyInfo, SerialNumber,
+           DigestCount };
+    uint8_t digests[DigestCount][DIGEST_LENGTH];
+    uint16_t maxLifetimeInDays;
+
+    Key(const Key&) = delete;
+    void operator=(const Key&) = delete;
+
+    friend class StapledOCSPCache;
+  };
+
+  // If a result for key that is valid at time has been recorded, return true
+  // and set the out parameters to the recorded values. Otherwise, return
+  // false.
+  bool Find(const Key& key, Time time, /*out*/ Result& result,
+            /*out*/ Time& thisUpdate, /*out*/ Time& validThrough) const;
+
+  // Record the result of verifying a response (identified by key) at
+  // verificationTime, to be used until the earlier of validThrough and
+  // signerNotAfter (see VerifyEncodedOCSPResponse). Results other than the
+  // trustworthy ones listed above are not recorded. When the cache is full,
+  // the oldest entry is replaced.
+  void Add(const Key& key, Time verificationTime, Result result,
+           Time thisUpdate, Time validThrough, Time signerNotAfter);
+
+private:
+  struct Entry
+  {
+    Entry()
+      : inUse(false)
+      , result(Result::FATAL_ERROR_INVALID_STATE)
+      , verificationTime(Time::uninitialized)
+      , thisUpdate(Time::uninitialized)
+      , validThrough(Time::uninitialized)
+      , cachedThrough(Time::uninitialized)
+    {
+    }
+
+    bool inUse;
+    uint8_t digests[Key::DigestCount][DIGEST_LENGTH];
+    uint16_t maxLifetimeInDays;
+    Result result;
+    Time verificationTime;
+    Time thisUpdate;
+    Time validThrough;
+    Time cachedThrough;
+  };
+
+  mutable std::mutex mutex;
+  Entry entries[CAPACITY];
+  size_t nextEntry;
+
+  StapledOCSPCache(const StapledOCSPCache&) = delete;
+  void operator=(const StapledOCSPCache&) = delete;
+};
+
+// Like VerifyEncodedOCSPResponse, for stapled responses: the result is taken
+// from cache when possible, and otherwise the response is verified and the
+// result is added to cache. It takes no OCSPSignerCache, since that cache
+// isn't synchronized and this function is meant to be called from many
+// threads at once.
+Result VerifyStapledOCSPResponse(StapledOCSPCache& cache,
+                                 TrustDomain& trustDomain,
+                                 const CertID& certID, Time time,
+                                 uint16_t maxLifetimeInDays,
+                                 Input encodedResponse,
+                       /* out */ bool& expired,
+              /* optional out */ Time* thisUpdate = nullptr,
               /* optional out */ Time* validThrough = nullptr);
 
+// Verifies an OCSP response incrementally, as it arrives, so that responses
+// too large for VerifyEncodedOCSPResponse (which is limited to what fits in
+// an Input, 64KiB) can be processed with bounded memory. The encodings of the
+// response, the ResponseBytes, the BasicOCSPResponse, the ResponseData, and
+// the sequence of SingleResponses may have lengths of up to 2^32 - 1 bytes;
+// every other element of the response (in particular each SingleResponse and
+// each certificate) must be smaller than 64KiB.
+//
+// Each SingleResponse is processed as soon as it has been received. Since the
+// signature follows the ResponseData, tbsResponseDataDigest is used to digest
+// the ResponseData as it passes through, and the signature is verified once
+// the signature (for responses signed by the issuer) or the delegated signer
+// certificate has been received. Nothing is reported as trustworthy until
+// Finish is called.
+//
+// Usage:
+//
+//    StreamingOCSPResponse response(trustDomain, certID, time,
+//                                   maxLifetimeInDays, digestStream);
+//    while (there is more data) {
+//      append the new data to the unconsumed data from the previous call;
+//      rv = response.Update(data, consumed);
+//      if (rv != Success) { fail }
+//      keep only the data after the first consumed bytes;
+//    }
+//    rv = response.Finish(expired, &thisUpdate, &validThrough);
+//
+// The results of Finish are the same as the results of
+// VerifyEncodedOCSPResponse, except that responses that are malformed in
+// more than one way may be reported with a different error.
+//
+// The responder ID and the signature have to be kept until the signer is
+// known, so they are copied into fixed-size buffers. Update fails with
+// Result::ERROR_OCSP_RESPONSE_FIELD_TOO_LONG for a response whose responder
+// ID value is longer than MAX_RESPONDER_ID_LENGTH bytes or whose signature is
+// longer than MAX_SIGNATURE_LENGTH bytes (enough for an 8192-bit RSA key),
+// even though VerifyEncodedOCSPResponse would accept it; callers that may
+// see such responses should fall back to VerifyEncodedOCSPResponse.
+class StreamingOCSPResponse final
+{
+public:
+  StreamingOCSPResponse(TrustDomain& trustDomain, const CertID& certID,
+                        Time time, uint16_t maxLifetimeInDays,
+                        DigestStream& tbsResponseDataDigest,
+           /*optional*/ OCSPSignerCache* signerCache = nullptr);
+
+  // Processes as much of data as possible. data must start with the first
+  // byte that wasn't consumed by the previous call. consumed will be set to
+  // the number of bytes at the start of data that were processed; the bytes
+  // after them must be passed again, with more data appended, to the next
+  // call. If consumed is zero then more data must be appended before calling
+  // Update again. Since no element that must be processed as a whole is
+  // larger than an Input, passing as much of the unconsumed data as fits in
+  // an Input always makes progress once enough data has arrived.
+  Result Update(Input data, /*out*/ size_t& consumed);
+
+  // Finishes verification once the entire response has been passed to
+  // Update. The parameters and results are the same as those of
+  // VerifyEncodedOCSPResponse.
+  Result Finish(/*out*/ bool& expired,
+                /*optional out*/ Time* thisUpdate = nullptr,
+                /*optional out*/ Time* validThrough = nullptr);
+
+  static const size_t MAX_RESPONDER_ID_LENGTH = 1024;
+  static const size_t MAX_SIGNATURE_LENGTH = 1024;
+
+private:
+  enum class State : uint8_t
+  {
+    OCSPResponse,
+    ResponseStatus,
+    ResponseBytesExplicit,
+    ResponseBytes,
+    ResponseType,
+    Response,
+    BasicOCSPResponse,
+    TBSResponseData,
+    Version,
+    ResponderID,
+    ProducedAt,
+    Responses,
+    SingleResponse,
+    ResponseExtensions,
+    SkipTBSResponseData,
+    SignatureAlgorithm,
+    Signature,
+    CertsExplicit,
+    Certs,
+    Certificate,
+    Done,
+    Failed,
+  };
+
+  Result Step(Input remaining, /*out*/ Input::size_type& stepLength,
+              /*out*/ bool& needMoreData);
+  Result ReadHeader(Input remaining, Reader& input, uint64_t limit,
+                    /*out*/ uint8_t& tag, /*out*/ uint64_t& end,
+                    /*out*/ bool& needMoreData);
+  Result ReadTLV(Input remaining, Reader& input, uint64_t limit,
+                 /*out*/ Input& tlv, /*out*/ bool& needMoreData);
+  Result DeferTBSResponseDataError(Result rv);
+  Result ProcessSingleResponse(Input tlv);
+  void ProcessSignatureAlgorithm(Input algorithm);
+  void ProcessSigner(/*optional*/ const Input* signerDER);
+  Result VerifyResponseSignature(Input signerSubjectPublicKeyInfo);
+
+  TrustDomain& trustDomain;
+  const CertID& certID;
+  const Time time;
+  const uint16_t maxLifetimeInDays;
+  DigestStream& tbsResponseDataDigest;
+  OCSPSignerCache* const signerCache;
+
+  State state;
+  uint64_t position; // The number of bytes consumed so far.
+  uint64_t responseEnd;
+  uint64_t tbsResponseDataStart;
+  uint64_t tbsResponseDataEnd;
+  uint64_t responsesEnd;
+  size_t certCount;
+
+  uint8_t responderIDType;
+  uint8_t responderID[MAX_RESPONDER_ID_LENGTH];
+  size_t responderIDLength;
+
+  // The result of parsing the signature algorithm and finishing
+  // tbsResponseDataDigest; signatureAlgorithm and digest are only valid when
+  // it is Success.
+  Result signatureAlgorithmResult;
+  uint8_t publicKeyAlgorithm;
+  DigestAlgorithm digestAlgorithm;
+  uint8_t digest[512 / 8]; // sha-512
+  size_t digestLength;
+  uint8_t signature[MAX_SIGNATURE_LENGTH];
+  size_t signatureLength;
+
+  // The result of signature verification, once it is final.
+  bool signatureVerificationDone;
+  Result signatureVerificationResult;
+
+  // An error in the ResponseData that is only reported if the signature is
+  // valid, the same way VerifyEncodedOCSPResponse only processes the
+  // ResponseData after verifying the signature.
+  Result tbsResponseDataResult;
+
+  uint8_t certStatus;
+  bool expired;
+  bool matchFound;
+  Time thisUpdate;
+  Time validThrough;
+
+  StreamingOCSPResponse(const StreamingOCSPResponse&) = delete;
+  void operator=(const StreamingOCSPResponse&) = delete;
+};
+
+// A parsed and verified CRL, with an index of the serial numbers of the
+// revoked certificates for fast lookups by CheckRevocation implementations.
+//
+// CRLs may be much larger than what fits in an Input, so the CRL is given as a
+// pointer and length; the CRL, its TBSCertList, and its revokedCertificates
+// may each be up to 2^32 - 1 bytes long, and every other element must fit in
+// an Input. Nothing is copied: the CRL must outlive the IndexedCRL.
+//
+// The index is an array of indexCapacity offsets into the CRL (one per
+// revoked certificate) provided by the caller, which must also outlive the
+// IndexedCRL. MaxEntryCount(crlLength) entries are always enough. Lookups are
+// binary searches of the index, sorted by serial number when the CRL is
+// parsed.
+//
+// Init verifies that the CRL was issued and signed by the given issuer, using
+// tbsCertListDigest to digest the TBSCertList and the TrustDomain's signature
+// verification functions, and that it is valid at the given time. CRLs
+// without a nextUpdate are rejected, as are CRLs with critical extensions,
+// since none of them (delta CRL indicators, issuing distribution points, and
+// indirect CRL certificate issuers) are supported. Serial numbers longer than
+// 127 bytes are rejected.
+class IndexedCRL final
+{
+public:
+  IndexedCRL();
+
+  Result Init(TrustDomain& trustDomain, DigestStream& tbsCertListDigest,
+              const uint8_t* crl, size_t crlLength, Input issuerSubject,
+              Input issuerSubjectPublicKeyInfo, Time time,
+              /*out*/ uint32_t* index, size_t indexCapacity);
+
+  // Sets revoked to whether the certificate with the given serial number (the
+  // value of the serialNumber field of the certificate) is listed in the CRL.
+  // Fails with Result::FATAL_ERROR_INVALID_STATE, rather than reporting the
+  // certificate as not revoked, if Init hasn't succeeded.
+  Result IsRevoked(Input serialNumber, /*out*/ bool& revoked) const;
+
+  size_t GetEntryCount() const { return entryCount; }
+  Time GetThisUpdate() const { return thisUpdate; }
+  Time GetNextUpdate() const { return nextUpdate; }
+
+  // The smallest possible encoding of a revoked certificate's entry is a
+  // SEQUENCE containing a one-byte INTEGER and a UTCTime.
+  static const size_t MIN_ENTRY_LENGTH = 2 + 3 + 15;
+  static size_t MaxEntryCount(size_t crlLength)
+  {
+    return crlLength / MIN_ENTRY_LENGTH;
+  }
+
+private:
+  const uint8_t* crl;
+  const uint32_t* index;
+  size_t entryCount;
+  Time thisUpdate;
+  Time nextUpdate;
+
+  IndexedCRL(const IndexedCRL&) = delete;
+  void operator=(const IndexedCRL&) = delete;
+};
+
+// A compact, precomputed set of revoked certificates covering many issuers,
+// in the form of a cascade of Bloom filters (as in CRLite), that can be
+// checked locally without fetching OCSP responses or CRLs.
+//
+// Each certificate is identified by the SHA-256 digest of its issuer's
+// SubjectPublicKeyInfo followed by the value of its serial number. The first
+// filter contains the revoked certificates; each following filter contains
+// the false positives of the previous filter among the certificates that
+// the previous filter was not built from. When the cascade is built from the
+// complete sets of revoked and non-revoked certificates, it has no false
+// positives or false negatives for the certificates in those sets.
+//
+// The data is referenced, not copied, so a file containing a cascade can be
+// mapped into memory and used directly; it must outlive the
+// RevocationFilterCascade. tools/BuildRevocationFilterCascade.py builds such
+// files. The format is, with all integers big-endian:
+//
+//    magic        4 bytes, "pkfc"
+//    version      1 byte, 1
+//    levelCount   1 byte, 1..MAX_LEVELS
+//    levels       levelCount times:
+//      bitCount     4 bytes, nonzero
+//      hashCount    1 byte, 1..MAX_HASH_COUNT
+//      bits         (bitCount + 7) / 8 bytes; bit i is (bits[i / 8] >> (i % 8))
+//                   & 1, and any unused bits must be zero
+//
+// Hash i of level l of a certificate is the 32-bit MurmurHash3 (x86_32) of
+// the certificate's identifier, with the seed (l << 16) | i, modulo bitCount.
+class RevocationFilterCascade final
+{
+public:
+  RevocationFilterCascade();
+
+  Result Init(const uint8_t* data, size_t length);
+
+  // Returns Success if the certificate is not revoked, and
+  // Result::ERROR_REVOKED_CERTIFICATE if it is. issuerSPKIHash must be the
+  // SHA-256 digest of the issuer's SubjectPublicKeyInfo, and serialNumber the
+  // value of the certificate's serial number (as in CertID).
+  Result CheckRevocation(Input issuerSPKIHash, Input serialNumber) const;
+
+  // Returns the bit index that hash hashIndex of the given level selects in
+  // a filter of bitCount bits. This is exposed for tools that build cascades.
+  static Result Hash(uint8_t level, uint8_t hashIndex, uint32_t bitCount,
+                     Input issuerSPKIHash, Input serialNumber,
+                     /*out*/ uint32_t& bitIndex);
+
+  static const size_t MAX_LEVELS = 32;
+  static const uint8_t MAX_HASH_COUNT = 32;
+  static const size_t ISSUER_SPKI_HASH_LENGTH = 256 / 8;
+  static const size_t MAX_SERIAL_NUMBER_LENGTH = 127;
+
+private:
+  struct Level
+  {
+    const uint8_t* bits;
+    uint32_t bitCount;
+    uint8_t hashCount;
+  };
+  Level levels[MAX_LEVELS];
+  size_t levelCount;
+
+  RevocationFilterCascade(const RevocationFilterCascade&) = delete;
+  void operator=(const RevocationFilterCascade&) = delete;
+};
+
+// Reads the complete certificates at the start of data, which is the part of
+// a sequence of concatenated DER certificates (such as a certificate chain
+// arriving over the network) that has been received so far. Each certificate
+// is parsed, as BackCert::Init does, as soon as all of it has arrived, so that
+// parsing overlaps with I/O and malformed certificates are rejected without
+// waiting for the rest of the sequence.
+//
+// Usage is like that of StreamingOCSPResponse::Update:
+//
+//    while (there is more data) {
+//      append the new data to the unconsumed data from the previous call;
+//      rv = ReadReceivedCerts(data, certs, maxCerts, certCount, consumed);
+//      if (rv != Success) { fail }
+//      use certs[0] through certs[certCount - 1];
+//      keep only the data after the first consumed bytes;
+//    }
+//    if (any data is left over) { fail: the last certificate is truncated }
+//
+// certs must point to maxCerts newly-constructed Inputs; certCount is set to
+// the number of them that were filled in, which refer to the first consumed
+// bytes of data. Reading stops at the first certificate that is incomplete or
+// doesn't fit in certs.
+Result ReadReceivedCerts(Input data, /*out*/ Input* certs, size_t maxCerts,
+                         /*out*/ size_t& certCount, /*out*/ size_t& consumed);
+
+// Reads the certificates in a corpus held in memory, such as a memory-mapped
+// PEM bundle or a dump of concatenated DER certificates, so that they can be
+// given to BuildCertChain (or parsed some other way) in bulk. The format is
+// chosen by the first byte: a corpus that starts with 0x30 (SEQUENCE) is read
+// as DER certificates with nothing between them; any other corpus is read as
+// PEM, where only "CERTIFICATE" blocks are read and other blocks and any
+// text outside blocks are skipped.
+//
+// DER certificates are returned in place. PEM certificates are decoded into
+// the caller-provided arena, which is reused by every call to ReadCerts, so
+// the certificates returned by one call are only valid until the next call.
+// The corpus is referenced, not copied, so it must outlive the reader.
+//
+// An error ends reading; GetOffset then gives the offset of the certificate
+// (or PEM block) that couldn't be read. Certificates larger than an Input can
+// hold are errors.
+class CertCorpusReader final
+{
+public:
+  // The arena needs room for one decoded certificate at least, and more for
+  // ReadCerts to be able to return more than one PEM certificate at a time.
+  CertCorpusReader(const uint8_t* corpus, size_t corpusLength,
+                   /*out*/ uint8_t* arena, size_t arenaLength);
+
+  // Reads up to maxCerts certificates into certs, which must not have been
+  // initialized, stopping early when the arena is full. certCount is set to
+  // zero at the end of the corpus. If a certificate doesn't fit in the empty
+  // arena, Result::FATAL_ERROR_INVALID_ARGS is returned.
+  Result ReadCerts(/*out*/ Input* certs, size_t maxCerts,
+                   /*out*/ size_t& certCount);
+
+  size_t GetOffset() const { return offset; }
+
+private:
+  Result ReadDER(/*out*/ Input& cert, /*out*/ bool& atEnd);
+  Result ReadPEM(/*out*/ Input& cert, /*out*/ bool& atEnd,
+                 /*out*/ bool& arenaFull);
+
+  enum class Format { Unknown, DER, PEM };
+
+  const uint8_t* const corpus;
+  const size_t corpusLength;
+  uint8_t* const arena;
+  const size_t arenaLength;
+  size_t arenaUsed;
+  size_t offset;
+  Format format;
+
+  CertCorpusReader(const CertCorpusReader&) = delete;
+  void operator=(const CertCorpusReader&) = delete;
+};
+
 } } // namespace mozilla::pkix
 
 #endif // mozilla_pkix_pkix_h
@@ -25,23 +25,95 @@
 #ifndef mozilla_pkix_pkixnss_h
 #define mozilla_pkix_pkixnss_h
 
+#include <mutex>
+
 #include "pkixtypes.h"
 #include "prerror.h"
 #include "seccomon.h"
 
+struct PK11ContextStr;
+struct SECKEYPublicKeyStr;
+
 namespace mozilla { namespace pkix {
 
+// A cache of the public keys that VerifyRSAPKCS1SignedDigestNSS and
+// VerifyECDSASignedDigestNSS decode from SubjectPublicKeyInfos. Almost every
+// signature is verified with one of a small number of issuer keys, and
+// without a cache each verification decodes the same key again.
+//
+// Keys are identified by the bytes of the SubjectPublicKeyInfo. A key is only
+// added after it has been used to verify a signature successfully. NSS copies
+// the key for each verification, so a cached key may be used by several
+// threads at once. Each key has a reference count: a key that is in
+// use when its entry is evicted or the cache is cleared is destroyed when the
+// last user releases it, and entries whose keys are in use are not chosen for
+// eviction. The cache must outlive all of its users.
+class PublicKeyCacheNSS final
+{
+public:
+  static const size_t CAPACITY = 64;
+
+  PublicKeyCacheNSS();
+  ~PublicKeyCacheNSS();
+
+  void Clear();
+
+  struct Stats
+  {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+
+  Stats GetStats() const;
+
+  // If a key decoded from subjectPublicKeyInfo is cached, return it with a
+  // reference held for the caller, which must be given back with Release.
+  // Otherwise, return nullptr.
+  SECKEYPublicKeyStr* Acquire(Input subjectPublicKeyInfo);
+  void Release(SECKEYPublicKeyStr* publicKey);
+
+  // Take ownership of publicKey, decoded from subjectPublicKeyInfo, and cache
+  // it. When the cache is full, the oldest entry that is not in use is
+  // replaced; if every entry is in use, publicKey is destroyed instead.
+  void Add(Input subjectPublicKeyInfo, SECKEYPublicKeyStr* publicKey);
+
+private:
+  struct Entry
+  {
+    uint64_t hash;
+    SECItem* subjectPublicKeyInfo; // nullptr if the entry is unused.
+    SECKEYPublicKeyStr* publicKey;
+    size_t refCount;
+    bool removed; // Destroy the entry once refCount reaches zero.
+  };
+
+  static void Destroy(Entry& entry);
+
+  mutable std::mutex mutex;
+  Entry entries[CAPACITY];
+  size_t nextEntry;
+  Stats stats;
+
+  PublicKeyCacheNSS(const PublicKeyCacheNSS&) = delete;
+  void operator=(const PublicKeyCacheNSS&) = delete;
+};
+
 // Verifies the PKCS#1.5 signature on the given data using the given RSA public
-// key.
+// key. If publicKeyCache is given, the decoded key is looked up in it and
+// added to it.
 Result VerifyRSAPKCS1SignedDigestNSS(const SignedDigest& sd,
                                      Input subjectPublicKeyInfo,
-                                     void* pkcs11PinArg);
+                                     void* pkcs11PinArg,
+                   /*optional*/ PublicKeyCacheNSS* publicKeyCache = nullptr);
 
 // Verifies the ECDSA signature on the given data using the given ECC public
-// key.
+// key. If publicKeyCache is given, the decoded key is looked up in it and
+// added to it.
 Result VerifyECDSASignedDigestNSS(const SignedDigest& sd,
                                   Input subjectPublicKeyInfo,
-                                  void* pkcs11PinArg);
+                                  void* pkcs11PinArg,
+                   /*optional*/ PublicKeyCacheNSS* publicKeyCache = nullptr);
 
 // Computes the digest of the given data using the given digest algorithm.
 //
@@ -59,6 +131,29 @@ Result DigestBufNSS(Input item,
                     /*out*/ uint8_t* digestBuf,
                     size_t digestBufLen);
 
+// A DigestStream that computes SHA-1, SHA-256, SHA-384, and SHA-512 digests
+// of the data at the same time after Begin(), since the algorithm isn't known
+// until Finish is called, or just one of them after Begin(digestAlg).
+class DigestStreamNSS final : public DigestStream
+{
+public:
+  DigestStreamNSS();
+  ~DigestStreamNSS();
+
+  Result Begin() override;
+  Result Begin(DigestAlgorithm digestAlg) override;
+  Result Update(Input data) override;
+  Result Finish(DigestAlgorithm digestAlg, /*out*/ uint8_t* digestBuf,
+                size_t digestBufLen) override;
+
+private:
+  void DestroyContexts();
+  Result BeginContext(size_t i);
+
+  static const size_t DIGEST_ALGORITHM_COUNT = 4;
+  PK11ContextStr* contexts[DIGEST_ALGORITHM_COUNT];
+};
+
 Result MapPRErrorCodeToResult(PRErrorCode errorCode);
 PRErrorCode MapResultToPRErrorCode(Result result);
 
@@ -84,6 +179,7 @@ enum ErrorCode
   MOZILLA_PKIX_ERROR_SIGNATURE_ALGORITHM_MISMATCH = ERROR_BASE + 7,
   MOZILLA_PKIX_ERROR_OCSP_RESPONSE_FOR_CERT_MISSING = ERROR_BASE + 8,
   MOZILLA_PKIX_ERROR_VALIDITY_TOO_LONG = ERROR_BASE + 9,
+  MOZILLA_PKIX_ERROR_OCSP_RESPONSE_FIELD_TOO_LONG = ERROR_BASE + 10,
 };
 
 void RegisterErrorTable();
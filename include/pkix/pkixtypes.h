@@ -51,6 +51,17 @@ enum class NamedCurve
   secp256r1 = 3,
 };
 
+enum class PublicKeyType : uint8_t
+{
+  unsupported = 0,
+
+  // rsaEncryption (OID 1.2.840.113549.1.1.1, RFC 3279)
+  RSA = 1,
+
+  // id-ecPublicKey (OID 1.2.840.10045.2.1, RFC 5480) on a NamedCurve
+  EC = 2,
+};
+
 struct SignedDigest final
 {
   Input digest;
@@ -60,6 +71,16 @@ struct SignedDigest final
   void operator=(const SignedDigest&) = delete;
 };
 
+// One of the signatures given to TrustDomain::VerifySignedDigests.
+// publicKeyType is RSA for RSA PKCS#1.5 signatures and EC for ECDSA
+// signatures.
+struct SignedDigestToVerify final
+{
+  PublicKeyType publicKeyType;
+  const SignedDigest* signedDigest;
+  Input subjectPublicKeyInfo;
+};
+
 enum class EndEntityOrCA { MustBeEndEntity = 0, MustBeCA = 1 };
 
 enum class KeyUsage : uint8_t
@@ -86,6 +107,18 @@ enum class KeyPurposeId
   id_kp_OCSPSigning = 9,          // id-kp-OCSPSigning
 };
 
+// ExtractCertFields reports the extended key usages of a certificate as a set
+// of bits: ExtendedKeyUsageBit(keyPurpose) for each KeyPurposeId in the
+// extension, EXTENDED_KEY_USAGE_OTHER if there are any other key purposes,
+// and EXTENDED_KEY_USAGE_PRESENT if there is an extension at all.
+inline uint16_t
+ExtendedKeyUsageBit(KeyPurposeId keyPurpose)
+{
+  return static_cast<uint16_t>(1u << static_cast<unsigned int>(keyPurpose));
+}
+static const uint16_t EXTENDED_KEY_USAGE_OTHER = 1u << 14;
+static const uint16_t EXTENDED_KEY_USAGE_PRESENT = 1u << 15;
+
 struct CertPolicyId final
 {
   uint16_t numBytes;
@@ -105,6 +138,52 @@ enum class TrustLevel
   InheritsTrust = 3       // certificate must chain to a trust anchor
 };
 
+class TrustDomain;
+
+// The fingerprints of some DER, such as a certificate or its subject or
+// SubjectPublicKeyInfo. Each is computed the first time it is requested and
+// then remembered, so that the caches, trust lookups, loop detection, and
+// revocation indexes that use the same certificate during path building share
+// a single computation. BuildCertChain gives the TrustDomain the fingerprints
+// of each issuer's SubjectPublicKeyInfo through CertID.
+//
+// GetFastHash is a non-cryptographic hash for in-memory hash tables. It isn't
+// collision resistant (so equal hashes must be confirmed by comparing the DER)
+// and it may differ between platforms. GetSHA256 uses TrustDomain::DigestBuf.
+//
+// The bytes of der are read when a fingerprint is first computed, so they must
+// remain valid for as long as the Fingerprint is used. A Fingerprint must not
+// be used on more than one thread at once.
+class Fingerprint final
+{
+public:
+  explicit Fingerprint(Input der)
+    : der(der)
+    , fastHashComputed(false)
+    , fastHash(0)
+    , sha256Computed(false)
+  {
+  }
+
+  uint64_t GetFastHash() const;
+
+  static const size_t SHA256_LENGTH = 256 / 8;
+
+  // sha256 must be newly constructed; it refers to the Fingerprint's copy of
+  // the digest.
+  Result GetSHA256(TrustDomain& trustDomain, /*out*/ Input& sha256) const;
+
+private:
+  const Input der;
+  mutable bool fastHashComputed;
+  mutable uint64_t fastHash;
+  mutable bool sha256Computed;
+  mutable uint8_t sha256[SHA256_LENGTH];
+
+  Fingerprint(const Fingerprint&) = delete;
+  void operator=(const Fingerprint&) = delete;
+};
+
 // CertID references the information needed to do revocation checking for the
 // certificate issued by the given issuer with the given serial number.
 //
@@ -115,19 +194,27 @@ enum class TrustLevel
 // issuerSubjectPublicKeyInfo is the entire DER-encoded subjectPublicKeyInfo
 // field from the issuer's certificate. serialNumber is the entire DER-encoded
 // serial number from the subject certificate (the certificate for which we are
-// checking the revocation status).
+// checking the revocation status). issuerSubjectPublicKeyInfoFingerprint, if
+// given, is the Fingerprint of issuerSubjectPublicKeyInfo; BuildCertChain
+// always gives it, so that the TrustDomain (and the OCSP caches) can use the
+// issuer key's SHA-256 digest without computing it again.
 struct CertID final
 {
 public:
-  CertID(Input issuer, Input issuerSubjectPublicKeyInfo, Input serialNumber)
+  CertID(Input issuer, Input issuerSubjectPublicKeyInfo, Input serialNumber,
+         /*optional*/ const Fingerprint* issuerSubjectPublicKeyInfoFingerprint
+           = nullptr)
     : issuer(issuer)
     , issuerSubjectPublicKeyInfo(issuerSubjectPublicKeyInfo)
     , serialNumber(serialNumber)
+    , issuerSubjectPublicKeyInfoFingerprint(
+        issuerSubjectPublicKeyInfoFingerprint)
   {
   }
   const Input issuer;
   const Input issuerSubjectPublicKeyInfo;
   const Input serialNumber;
+  const Fingerprint* const issuerSubjectPublicKeyInfoFingerprint;
 
   void operator=(const CertID&) = delete;
 };
@@ -147,6 +234,8 @@ protected:
   virtual ~DERArray() { }
 };
 
+class CompiledNameConstraints;
+
 // Applications control the behavior of path building and verification by
 // implementing the TrustDomain interface. The TrustDomain is used for all
 // cryptography and for determining which certificates are trusted or
@@ -186,6 +275,17 @@ public:
     virtual Result Check(Input potentialIssuerDER,
             /*optional*/ const Input* additionalNameConstraints,
                  /*out*/ bool& keepGoing) = 0;
+
+    // Like Check, for a potential issuer whose name constraints extension
+    // the caller has already compiled, typically once when loading the CA
+    // certificate; this saves parsing the extension again for every path
+    // through that CA. nameConstraints is used only if it was initialized
+    // with the value of potentialIssuerDER's name constraints extension.
+    virtual Result CheckWithNameConstraints(
+                     Input potentialIssuerDER,
+        /*optional*/ const Input* additionalNameConstraints,
+                     const CompiledNameConstraints& nameConstraints,
+             /*out*/ bool& keepGoing);
   protected:
     IssuerChecker();
     virtual ~IssuerChecker();
@@ -214,6 +314,11 @@ public:
   // * The given time parameter may be used to filter out certificates that are
   //   not valid at the given time, or it may be ignored.
   //
+  // When no issuer is found among candidates that don't all have the issuer's
+  // name, FindIssuer may be called a second time with the same name and
+  // checker, to check the extensions of the candidates with other names.
+  // Filtering candidates by name avoids that.
+  //
   // Note on reentrancy and stack usage: checker.Check will attempt to
   // recursively build a certificate path from the potential issuer it is given
   // to a trusted root, as determined by this TrustDomain. That means that
@@ -318,6 +423,22 @@ public:
   virtual Result VerifyECDSASignedDigest(const SignedDigest& signedDigest,
                                          Input subjectPublicKeyInfo) = 0;
 
+  // Verify several independent signatures at once, setting results[i] to the
+  // result of verifying signatures[i] as VerifyRSAPKCS1SignedDigest or
+  // VerifyECDSASignedDigest would. The same checks are done before calling
+  // this function as before calling those functions.
+  //
+  // mozilla::pkix calls this when it has more than one signature to verify
+  // and none of them depends on the result of verifying another, so that
+  // backends that can verify signatures in batches (e.g. ECDSA batch
+  // verification or multi-buffer RSA) may do so. The default implementation
+  // calls VerifyRSAPKCS1SignedDigest or VerifyECDSASignedDigest for each
+  // signature in turn. Return an error only if it prevents every signature
+  // from being verified; in that case, results are ignored.
+  virtual Result VerifySignedDigests(const SignedDigestToVerify* signatures,
+                                     size_t count,
+                                     /*out*/ Result* results);
+
   // Check that the validity duration is acceptable.
   //
   // Return Success if the validity duration is acceptable,
@@ -348,6 +469,40 @@ protected:
   void operator=(const TrustDomain&) = delete;
 };
 
+// Computes a digest of data that is given to it in pieces, for signed data
+// that is too large to be passed to TrustDomain::DigestBuf in a single Input.
+//
+// When the signed data is streamed, the digest algorithm is not known until
+// after all of it has been processed, because the signature algorithm follows
+// the signed data in the encoding. Consequently, after Begin(), Finish may be
+// called with any DigestAlgorithm, and implementations must be able to
+// compute the digest for every algorithm that the TrustDomain accepts. When
+// the algorithm is known in advance, Begin(digestAlg) avoids that work.
+class DigestStream
+{
+public:
+  virtual ~DigestStream() { }
+
+  // Start a new digest computation, discarding any previous state.
+  virtual Result Begin() = 0;
+
+  // Like Begin(), but Finish will only be called with digestAlg.
+  virtual Result Begin(DigestAlgorithm) { return Begin(); }
+
+  virtual Result Update(Input data) = 0;
+
+  // digestBufLen will be the size of the digest output (20 for SHA-1, 32 for
+  // SHA-256, etc.).
+  virtual Result Finish(DigestAlgorithm digestAlg,
+                        /*out*/ uint8_t* digestBuf,
+                        size_t digestBufLen) = 0;
+protected:
+  DigestStream() { }
+
+  DigestStream(const DigestStream&) = delete;
+  void operator=(const DigestStream&) = delete;
+};
+
 } } // namespace mozilla::pkix
 
 #endif // mozilla_pkix_pkixtypes_h
@@ -41,6 +41,16 @@ static Result BuildForward(TrustDomain& trustDomain,
 TrustDomain::IssuerChecker::IssuerChecker() { }
 TrustDomain::IssuerChecker::~IssuerChecker() { }
 
+Result
+TrustDomain::IssuerChecker::CheckWithNameConstraints(
+  Input potentialIssuerDER,
+  /*optional*/ const Input* additionalNameConstraints,
+  const CompiledNameConstraints&,
+  /*out*/ bool& keepGoing)
+{
+  return Check(potentialIssuerDER, additionalNameConstraints, keepGoing);
+}
+
 // The implementation of TrustDomain::IssuerTracker is in a subclass only to
 // hide the implementation from external users.
 class PathBuildingStep final : public TrustDomain::IssuerChecker
@@ -61,15 +71,30 @@ public:
     , deferredSubjectError(deferredSubjectError)
     , result(Result::FATAL_ERROR_LIBRARY_FAILURE)
     , resultWasSet(false)
+    , skippedExtensions(false)
+    , checkingSkippedExtensions(false)
   {
   }
 
   Result Check(Input potentialIssuerDER,
                /*optional*/ const Input* additionalNameConstraints,
                /*out*/ bool& keepGoing) override;
+  Result CheckWithNameConstraints(
+                      Input potentialIssuerDER,
+         /*optional*/ const Input* additionalNameConstraints,
+                      const CompiledNameConstraints& nameConstraints,
+              /*out*/ bool& keepGoing) override;
 
   Result CheckResult() const;
 
+  // Candidates whose names don't match are skipped without parsing their
+  // extensions, but before that optimization invalid extensions in them were
+  // reported like any other error. When that could change the result, the
+  // TrustDomain is asked for the candidates again and only the extensions of
+  // the mismatched ones are checked, so that the result is unaffected.
+  bool NeedsSkippedExtensionsChecked() const;
+  void StartCheckingSkippedExtensions() { checkingSkippedExtensions = true; }
+
 private:
   TrustDomain& trustDomain;
   const BackCert& subject;
@@ -85,9 +110,15 @@ private:
   der::PublicKeyAlgorithm subjectSignaturePublicKeyAlg;
   SignedDigest subjectSignature;
 
+  Result Check(Input potentialIssuerDER,
+               /*optional*/ const Input* additionalNameConstraints,
+               /*optional*/ const CompiledNameConstraints* nameConstraints,
+               /*out*/ bool& keepGoing);
   Result RecordResult(Result currentResult, /*out*/ bool& keepGoing);
   Result result;
   bool resultWasSet;
+  bool skippedExtensions;
+  bool checkingSkippedExtensions;
 
   PathBuildingStep(const PathBuildingStep&) = delete;
   void operator=(const PathBuildingStep&) = delete;
@@ -133,15 +164,58 @@ PathBuildingStep::CheckResult() const
   return result;
 }
 
+bool
+PathBuildingStep::NeedsSkippedExtensionsChecked() const
+{
+  // Once a chain has been found, or once the candidates have had different
+  // problems, another error can't change the result.
+  return skippedExtensions &&
+         !(resultWasSet && (result == Success ||
+                            result == Result::ERROR_UNKNOWN_ISSUER));
+}
+
+Result
+PathBuildingStep::Check(Input potentialIssuerDER,
+           /*optional*/ const Input* additionalNameConstraints,
+                /*out*/ bool& keepGoing)
+{
+  return Check(potentialIssuerDER, additionalNameConstraints, nullptr,
+               keepGoing);
+}
+
+Result
+PathBuildingStep::CheckWithNameConstraints(
+                     Input potentialIssuerDER,
+        /*optional*/ const Input* additionalNameConstraints,
+                     const CompiledNameConstraints& nameConstraints,
+             /*out*/ bool& keepGoing)
+{
+  return Check(potentialIssuerDER, additionalNameConstraints,
+               &nameConstraints, keepGoing);
+}
+
 // The code that executes in the inner loop of BuildForward
 Result
 PathBuildingStep::Check(Input potentialIssuerDER,
            /*optional*/ const Input* additionalNameConstraints,
+           /*optional*/ const CompiledNameConstraints* nameConstraints,
                 /*out*/ bool& keepGoing)
 {
   BackCert potentialIssuer(potentialIssuerDER, EndEntityOrCA::MustBeCA,
                            &subject);
-  Result rv = potentialIssuer.Init();
+  Result rv = potentialIssuer.InitWithoutExtensions();
+  if (checkingSkippedExtensions) {
+    // Everything but the skipped extensions was already checked.
+    if (rv == Success &&
+        !InputsAreEqual(potentialIssuer.GetSubject(), subject.GetIssuer())) {
+      rv = potentialIssuer.InitExtensions();
+      if (rv != Success) {
+        return RecordResult(rv, keepGoing);
+      }
+    }
+    keepGoing = true;
+    return Success;
+  }
   if (rv != Success) {
     return RecordResult(rv, keepGoing);
   }
@@ -153,18 +227,34 @@ PathBuildingStep::Check(Input potentialIssuerDER,
   // we treat the case where the TrustDomain only asks us to check CA
   // certificates with mismatched names as equivalent to the case where the
   // TrustDomain never called Check() at all.
+  //
+  // Such certificates' extensions are only parsed if path building fails;
+  // see NeedsSkippedExtensionsChecked.
   if (!InputsAreEqual(potentialIssuer.GetSubject(), subject.GetIssuer())) {
+    skippedExtensions = true;
     keepGoing = true;
     return Success;
   }
 
+  rv = potentialIssuer.InitExtensions();
+  if (rv != Success) {
+    return RecordResult(rv, keepGoing);
+  }
+
   // Loop prevention, done as recommended by RFC4158 Section 5.2
   // TODO: this doesn't account for subjectAltNames!
-  // TODO(perf): This probably can and should be optimized in some way.
+  // Each certificate's fast hashes are computed once and then compared with
+  // those of every potential issuer above it, so that the keys and names are
+  // only compared in full when they are almost certainly equal.
+  uint64_t subjectPublicKeyInfoHash =
+    potentialIssuer.GetSubjectPublicKeyInfoFastHash();
+  uint64_t subjectHash = potentialIssuer.GetSubjectFastHash();
   bool loopDetected = false;
   for (const BackCert* prev = potentialIssuer.childCert;
        !loopDetected && prev != nullptr; prev = prev->childCert) {
-    if (InputsAreEqual(potentialIssuer.GetSubjectPublicKeyInfo(),
+    if (prev->GetSubjectPublicKeyInfoFastHash() == subjectPublicKeyInfoHash &&
+        prev->GetSubjectFastHash() == subjectHash &&
+        InputsAreEqual(potentialIssuer.GetSubjectPublicKeyInfo(),
                        prev->GetSubjectPublicKeyInfo()) &&
         InputsAreEqual(potentialIssuer.GetSubject(), prev->GetSubject())) {
       // XXX: error code
@@ -173,8 +263,15 @@ PathBuildingStep::Check(Input potentialIssuerDER,
   }
 
   if (potentialIssuer.GetNameConstraints()) {
-    rv = CheckNameConstraints(*potentialIssuer.GetNameConstraints(),
-                              subject, requiredEKUIfPresent);
+    if (nameConstraints &&
+        InputsAreEqual(nameConstraints->GetEncoded(),
+                       *potentialIssuer.GetNameConstraints())) {
+      rv = CheckNameConstraints(*nameConstraints, subject,
+                                requiredEKUIfPresent);
+    } else {
+      rv = CheckNameConstraints(*potentialIssuer.GetNameConstraints(),
+                                subject, requiredEKUIfPresent);
+    }
     if (rv != Success) {
        return RecordResult(rv, keepGoing);
     }
@@ -222,8 +319,13 @@ PathBuildingStep::Check(Input potentialIssuerDER,
   // responders return an error when asked for the status of an expired
   // certificate.
   if (deferredSubjectError != Result::ERROR_EXPIRED_CERTIFICATE) {
+    // The TrustDomain and the OCSP caches share the SHA-256 digest of the
+    // issuer's key through the fingerprint.
+    Fingerprint issuerSubjectPublicKeyInfoFingerprint(
+      potentialIssuer.GetSubjectPublicKeyInfo());
     CertID certID(subject.GetIssuer(), potentialIssuer.GetSubjectPublicKeyInfo(),
-                  subject.GetSerialNumber());
+                  subject.GetSerialNumber(),
+                  &issuerSubjectPublicKeyInfoFingerprint);
     Time notBefore(Time::uninitialized);
     Time notAfter(Time::uninitialized);
     // This should never fail. If we're here, we've already checked that the
@@ -324,6 +426,14 @@ BuildForward(TrustDomain& trustDomain,
     return rv;
   }
 
+  if (pathBuilder.NeedsSkippedExtensionsChecked()) {
+    pathBuilder.StartCheckingSkippedExtensions();
+    rv = trustDomain.FindIssuer(subject.GetIssuer(), pathBuilder, time);
+    if (rv != Success) {
+      return rv;
+    }
+  }
+
   rv = pathBuilder.CheckResult();
   if (rv != Success) {
     return rv;
@@ -349,7 +459,8 @@ BuildCertChain(TrustDomain& trustDomain, Input certDER,
 {
   // XXX: Support the legacy use of the subject CN field for indicating the
   // domain name the certificate is valid for.
-  BackCert cert(certDER, endEntityOrCA, nullptr);
+  NameConstraintsPresentedIDsBuffer presentedIDs;
+  BackCert cert(certDER, endEntityOrCA, nullptr, &presentedIDs);
   Result rv = cert.Init();
   if (rv != Success) {
     return rv;
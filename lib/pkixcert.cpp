@@ -22,12 +22,84 @@
  * limitations under the License.
  */
 
+#include <cstring>
+#include <limits>
+
+#include "pkix/pkix.h"
+#include "pkixcheck.h"
 #include "pkixutil.h"
 
 namespace mozilla { namespace pkix {
 
+uint64_t
+Fingerprint::GetFastHash() const
+{
+  if (!fastHashComputed) {
+    // A multiply-and-fold hash of eight bytes at a time, which is several
+    // times faster than hashing a byte at a time like FNV-1a.
+    static const uint64_t MULTIPLIER = 0x9e3779b97f4a7c15u;
+    auto mix = [](uint64_t hash, uint64_t word) {
+      hash = (hash ^ word) * MULTIPLIER;
+      return hash ^ (hash >> 32);
+    };
+    const uint8_t* data = der.UnsafeGetData();
+    size_t length = der.GetLength();
+    uint64_t hash = mix(0, length);
+    size_t i = 0;
+    for (; length - i >= sizeof(uint64_t); i += sizeof(uint64_t)) {
+      uint64_t word;
+      std::memcpy(&word, data + i, sizeof word);
+      hash = mix(hash, word);
+    }
+    if (i < length) {
+      uint64_t word = 0;
+      std::memcpy(&word, data + i, length - i);
+      hash = mix(hash, word);
+    }
+    fastHash = hash;
+    fastHashComputed = true;
+  }
+  return fastHash;
+}
+
+Result
+Fingerprint::GetSHA256(TrustDomain& trustDomain, /*out*/ Input& sha256Out)
+  const
+{
+  if (!sha256Computed) {
+    Result rv = trustDomain.DigestBuf(der, DigestAlgorithm::sha256, sha256,
+                                      sizeof sha256);
+    if (rv != Success) {
+      return rv;
+    }
+    sha256Computed = true;
+  }
+  return sha256Out.Init(sha256, sizeof sha256);
+}
+
+void
+BackCert::ComputeFastHashes() const
+{
+  if (!fastHashesComputed) {
+    subjectFastHash = Fingerprint(subject).GetFastHash();
+    subjectPublicKeyInfoFastHash =
+      Fingerprint(subjectPublicKeyInfo).GetFastHash();
+    fastHashesComputed = true;
+  }
+}
+
 Result
 BackCert::Init()
+{
+  Result rv = InitWithoutExtensions();
+  if (rv != Success) {
+    return rv;
+  }
+  return InitExtensions();
+}
+
+Result
+BackCert::InitWithoutExtensions()
 {
   Result rv;
 
@@ -128,8 +200,38 @@ BackCert::Init()
     }
   }
 
-  rv = der::OptionalExtensions(
-         tbsCertificate, CSC | 3,
+  if (tbsCertificate.Peek(CSC | 3)) {
+    rv = der::ExpectTagAndGetTLV(tbsCertificate, CSC | 3, extensions);
+    if (rv != Success) {
+      return rv;
+    }
+  }
+
+  rv = der::End(tbsCertificate);
+  if (rv != Success) {
+    // Init would have reported any error in the extensions first.
+    Result extensionsResult = InitExtensions();
+    if (extensionsResult != Success) {
+      return extensionsResult;
+    }
+    return rv;
+  }
+
+  return Success;
+}
+
+Result
+BackCert::InitExtensions()
+{
+  if (extensionsInitialized) {
+    return Success;
+  }
+
+  static const uint8_t CSC = der::CONTEXT_SPECIFIC | der::CONSTRUCTED;
+
+  Reader extensionsReader(extensions);
+  Result rv = der::OptionalExtensions(
+         extensionsReader, CSC | 3,
          [this](Reader& extnID, const Input& extnValue, bool critical,
                 /*out*/ bool& understood) {
            return RememberExtension(extnID, extnValue, critical, understood);
@@ -166,59 +268,70 @@ BackCert::Init()
     return Result::ERROR_UNKNOWN_CRITICAL_EXTENSION;
   }
 
-  return der::End(tbsCertificate);
+  extensionsInitialized = true;
+  return Success;
 }
 
+namespace {
+
+// The extensions that BackCert::RememberExtension understands.
+enum class KnownExtension
+{
+  Unknown,
+  KeyUsage,
+  SubjectAltName,
+  BasicConstraints,
+  NameConstraints,
+  CertificatePolicies,
+  PolicyConstraints,
+  ExtKeyUsage,
+  InhibitAnyPolicy,
+  AuthorityInfoAccess,
+  OCSPNocheck,
+  NetscapeCertificateType,
+};
+
+template <KnownExtension Value, uint32_t... Arcs>
+using KnownExtensionOID =
+  der::OIDMatcherEntry<KnownExtension, Value, der::EncodedOID<Arcs...>>;
+
+// Unknown extensions, which include ones in nearly every certificate such as
+// authorityKeyIdentifier, subjectKeyIdentifier, and SCT lists, are identified
+// as such without any byte-by-byte comparison, because their keys differ from
+// those of the known extensions.
+typedef der::OIDMatcher<KnownExtension, KnownExtension::Unknown,
+  KnownExtensionOID<KnownExtension::KeyUsage, 2, 5, 29, 15>,
+  KnownExtensionOID<KnownExtension::SubjectAltName, 2, 5, 29, 17>,
+  KnownExtensionOID<KnownExtension::BasicConstraints, 2, 5, 29, 19>,
+  KnownExtensionOID<KnownExtension::NameConstraints, 2, 5, 29, 30>,
+  KnownExtensionOID<KnownExtension::CertificatePolicies, 2, 5, 29, 32>,
+  KnownExtensionOID<KnownExtension::PolicyConstraints, 2, 5, 29, 36>,
+  KnownExtensionOID<KnownExtension::ExtKeyUsage, 2, 5, 29, 37>,
+  KnownExtensionOID<KnownExtension::InhibitAnyPolicy, 2, 5, 29, 54>,
+  // id-pe-authorityInfoAccess
+  KnownExtensionOID<KnownExtension::AuthorityInfoAccess,
+                    1, 3, 6, 1, 5, 5, 7, 1, 1>,
+  // id-pkix-ocsp-nocheck
+  KnownExtensionOID<KnownExtension::OCSPNocheck,
+                    1, 3, 6, 1, 5, 5, 7, 48, 1, 5>,
+  // Netscape-certificate-type
+  KnownExtensionOID<KnownExtension::NetscapeCertificateType,
+                    2, 16, 840, 1, 113730, 1, 1>
+> KnownExtensionMatcher;
+
+} // unnamed namespace
+
 Result
 BackCert::RememberExtension(Reader& extnID, Input extnValue,
                             bool critical, /*out*/ bool& understood)
 {
   understood = false;
 
-  // python DottedOIDToCode.py id-ce-keyUsage 2.5.29.15
-  static const uint8_t id_ce_keyUsage[] = {
-    0x55, 0x1d, 0x0f
-  };
-  // python DottedOIDToCode.py id-ce-subjectAltName 2.5.29.17
-  static const uint8_t id_ce_subjectAltName[] = {
-    0x55, 0x1d, 0x11
-  };
-  // python DottedOIDToCode.py id-ce-basicConstraints 2.5.29.19
-  static const uint8_t id_ce_basicConstraints[] = {
-    0x55, 0x1d, 0x13
-  };
-  // python DottedOIDToCode.py id-ce-nameConstraints 2.5.29.30
-  static const uint8_t id_ce_nameConstraints[] = {
-    0x55, 0x1d, 0x1e
-  };
-  // python DottedOIDToCode.py id-ce-certificatePolicies 2.5.29.32
-  static const uint8_t id_ce_certificatePolicies[] = {
-    0x55, 0x1d, 0x20
-  };
-  // python DottedOIDToCode.py id-ce-policyConstraints 2.5.29.36
-  static const uint8_t id_ce_policyConstraints[] = {
-    0x55, 0x1d, 0x24
-  };
-  // python DottedOIDToCode.py id-ce-extKeyUsage 2.5.29.37
-  static const uint8_t id_ce_extKeyUsage[] = {
-    0x55, 0x1d, 0x25
-  };
-  // python DottedOIDToCode.py id-ce-inhibitAnyPolicy 2.5.29.54
-  static const uint8_t id_ce_inhibitAnyPolicy[] = {
-    0x55, 0x1d, 0x36
-  };
-  // python DottedOIDToCode.py id-pe-authorityInfoAccess 1.3.6.1.5.5.7.1.1
-  static const uint8_t id_pe_authorityInfoAccess[] = {
-    0x2b, 0x06, 0x01, 0x05, 0x05, 0x07, 0x01, 0x01
-  };
-  // python DottedOIDToCode.py id-pkix-ocsp-nocheck 1.3.6.1.5.5.7.48.1.5
-  static const uint8_t id_pkix_ocsp_nocheck[] = {
-    0x2b, 0x06, 0x01, 0x05, 0x05, 0x07, 0x30, 0x01, 0x05
-  };
-  // python DottedOIDToCode.py Netscape-certificate-type 2.16.840.1.113730.1.1
-  static const uint8_t Netscape_certificate_type[] = {
-    0x60, 0x86, 0x48, 0x01, 0x86, 0xf8, 0x42, 0x01, 0x01
-  };
+  Input extnIDInput;
+  Result rv = extnID.SkipToEnd(extnIDInput);
+  if (rv != Success) {
+    return rv;
+  }
 
   Input* out = nullptr;
 
@@ -245,37 +358,57 @@ BackCert::RememberExtension(Reader& extnID, Input extnValue,
   // both authorityKeyIdentifier and subjectKeyIdentifier, and we do not use
   // them for anything, so we totally ignore them here.
 
-  if (extnID.MatchRest(id_ce_keyUsage)) {
-    out = &keyUsage;
-  } else if (extnID.MatchRest(id_ce_subjectAltName)) {
-    out = &subjectAltName;
-  } else if (extnID.MatchRest(id_ce_basicConstraints)) {
-    out = &basicConstraints;
-  } else if (extnID.MatchRest(id_ce_nameConstraints)) {
-    out = &nameConstraints;
-  } else if (extnID.MatchRest(id_ce_certificatePolicies)) {
-    out = &certificatePolicies;
-  } else if (extnID.MatchRest(id_ce_policyConstraints)) {
-    out = &dummyPolicyConstraints;
-  } else if (extnID.MatchRest(id_ce_extKeyUsage)) {
-    out = &extKeyUsage;
-  } else if (extnID.MatchRest(id_ce_inhibitAnyPolicy)) {
-    out = &inhibitAnyPolicy;
-  } else if (extnID.MatchRest(id_pe_authorityInfoAccess)) {
-    out = &authorityInfoAccess;
-  } else if (extnID.MatchRest(id_pkix_ocsp_nocheck) && critical) {
-    // We need to make sure we don't reject delegated OCSP response signing
-    // certificates that contain the id-pkix-ocsp-nocheck extension marked as
-    // critical when validating OCSP responses. Without this, an application
-    // that implements soft-fail OCSP might ignore a valid Revoked or Unknown
-    // response, and an application that implements hard-fail OCSP might fail
-    // to connect to a server given a valid Good response.
-    out = &dummyOCSPNocheck;
-    // We allow this extension to have an empty value.
-    // See http://comments.gmane.org/gmane.ietf.x509/30947
-    emptyValueAllowed = true;
-  } else if (extnID.MatchRest(Netscape_certificate_type) && critical) {
-    out = &criticalNetscapeCertificateType;
+  switch (KnownExtensionMatcher::Match(extnIDInput)) {
+    case KnownExtension::KeyUsage:
+      out = &keyUsage;
+      break;
+    case KnownExtension::SubjectAltName:
+      out = &subjectAltName;
+      break;
+    case KnownExtension::BasicConstraints:
+      out = &basicConstraints;
+      break;
+    case KnownExtension::NameConstraints:
+      out = &nameConstraints;
+      break;
+    case KnownExtension::CertificatePolicies:
+      out = &certificatePolicies;
+      break;
+    case KnownExtension::PolicyConstraints:
+      out = &dummyPolicyConstraints;
+      break;
+    case KnownExtension::ExtKeyUsage:
+      out = &extKeyUsage;
+      break;
+    case KnownExtension::InhibitAnyPolicy:
+      out = &inhibitAnyPolicy;
+      break;
+    case KnownExtension::AuthorityInfoAccess:
+      out = &authorityInfoAccess;
+      break;
+    case KnownExtension::OCSPNocheck:
+      if (critical) {
+        // We need to make sure we don't reject delegated OCSP response
+        // signing certificates that contain the id-pkix-ocsp-nocheck
+        // extension marked as critical when validating OCSP responses.
+        // Without this, an application that implements soft-fail OCSP might
+        // ignore a valid Revoked or Unknown response, and an application
+        // that implements hard-fail OCSP might fail to connect to a server
+        // given a valid Good response.
+        out = &dummyOCSPNocheck;
+        // We allow this extension to have an empty value.
+        // See http://comments.gmane.org/gmane.ietf.x509/30947
+        emptyValueAllowed = true;
+      }
+      break;
+    case KnownExtension::NetscapeCertificateType:
+      if (critical) {
+        out = &criticalNetscapeCertificateType;
+      }
+      break;
+    case KnownExtension::Unknown:
+      break;
+    MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
   }
 
   if (out) {
@@ -294,4 +427,222 @@ BackCert::RememberExtension(Reader& extnID, Input extnValue,
   return Success;
 }
 
+Result
+ReadReceivedCerts(Input data, /*out*/ Input* certs, size_t maxCerts,
+                  /*out*/ size_t& certCount, /*out*/ size_t& consumed)
+{
+  certCount = 0;
+  consumed = 0;
+
+  if (maxCerts > 0 && !certs) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+
+  Reader input(data);
+  while (certCount < maxCerts && !input.AtEnd()) {
+    // Check the tag first so that something that isn't a certificate is
+    // rejected without waiting for all of it to arrive.
+    if (!input.Peek(der::SEQUENCE)) {
+      return Result::ERROR_BAD_DER;
+    }
+    Input remaining;
+    Result rv = remaining.Init(data.UnsafeGetData() + consumed,
+                               data.GetLength() - consumed);
+    if (rv != Success) {
+      return rv;
+    }
+    Input::size_type headerLength = der::TagAndLengthLength(remaining);
+    if (remaining.GetLength() < headerLength) {
+      break;
+    }
+    Reader::Mark mark(input.GetMark());
+    uint8_t tag;
+    uint32_t length;
+    rv = der::ReadTagAndGetLength(input, tag, length);
+    if (rv != Success) {
+      return rv;
+    }
+    if (length > std::numeric_limits<Input::size_type>::max()) {
+      // Longer than any Input, so it could never be received completely.
+      return Result::ERROR_BAD_DER;
+    }
+    if (headerLength + length > remaining.GetLength()) {
+      break;
+    }
+    rv = input.Skip(static_cast<Input::size_type>(length));
+    if (rv != Success) {
+      return rv;
+    }
+    Input& cert(certs[certCount]);
+    rv = input.GetInput(mark, cert);
+    if (rv != Success) {
+      return rv;
+    }
+    // Whether the certificate is an end-entity or a CA doesn't affect
+    // parsing.
+    BackCert backCert(cert, EndEntityOrCA::MustBeEndEntity, nullptr);
+    rv = backCert.Init();
+    if (rv != Success) {
+      return rv;
+    }
+    ++certCount;
+    consumed += cert.GetLength();
+  }
+  return Success;
+}
+
+namespace {
+
+Result
+ExtractSubjectAltNames(Input subjectAltName, const CertFieldColumns& columns,
+                       size_t certIndex)
+{
+  size_t count = 0;
+  Reader input(subjectAltName);
+  Result rv = der::Nested(input, der::SEQUENCE, [&](Reader& generalNames) {
+    do {
+      uint8_t tag;
+      Input name;
+      Result rv = der::ReadTagAndGetValue(generalNames, tag, name);
+      if (rv != Success) {
+        return rv;
+      }
+      if ((tag & 0xC0) != der::CONTEXT_SPECIFIC) {
+        return Result::ERROR_BAD_DER;
+      }
+      if (count < columns.subjectAltNamesPerCert) {
+        size_t j = certIndex * columns.subjectAltNamesPerCert + count;
+        if (columns.subjectAltNames) {
+          rv = columns.subjectAltNames[j].Init(name);
+          if (rv != Success) {
+            return rv;
+          }
+        }
+        if (columns.subjectAltNameTags) {
+          columns.subjectAltNameTags[j] = tag;
+        }
+      }
+      ++count;
+    } while (!generalNames.AtEnd());
+    return Success;
+  });
+  if (rv != Success) {
+    return rv;
+  }
+  rv = der::End(input);
+  if (rv != Success) {
+    return rv;
+  }
+  if (columns.subjectAltNameCounts) {
+    columns.subjectAltNameCounts[certIndex] = count;
+  }
+  return Success;
+}
+
+Result
+ExtractCertFields(Input certDER, const CertFieldColumns& columns, size_t i)
+{
+  BackCert cert(certDER, EndEntityOrCA::MustBeEndEntity, nullptr);
+  Result rv = cert.Init();
+  if (rv != Success) {
+    return rv;
+  }
+
+  if (columns.serialNumbers) {
+    rv = columns.serialNumbers[i].Init(cert.GetSerialNumber());
+    if (rv != Success) {
+      return rv;
+    }
+  }
+  if (columns.issuers) {
+    rv = columns.issuers[i].Init(cert.GetIssuer());
+    if (rv != Success) {
+      return rv;
+    }
+  }
+  if (columns.subjects) {
+    rv = columns.subjects[i].Init(cert.GetSubject());
+    if (rv != Success) {
+      return rv;
+    }
+  }
+
+  if (columns.notBefores || columns.notAfters) {
+    Time notBefore(Time::uninitialized);
+    Time notAfter(Time::uninitialized);
+    rv = ParseValidity(cert.GetValidity(), notBefore, notAfter);
+    if (rv != Success) {
+      return rv;
+    }
+    if (columns.notBefores) {
+      columns.notBefores[i] = notBefore;
+    }
+    if (columns.notAfters) {
+      columns.notAfters[i] = notAfter;
+    }
+  }
+
+  if (columns.publicKeyTypes || columns.publicKeySizesInBits) {
+    PublicKeyType type;
+    unsigned int sizeInBits;
+    rv = GetSubjectPublicKeyTypeAndSize(cert.GetSubjectPublicKeyInfo(), type,
+                                        sizeInBits);
+    if (rv != Success) {
+      return rv;
+    }
+    if (columns.publicKeyTypes) {
+      columns.publicKeyTypes[i] = type;
+    }
+    if (columns.publicKeySizesInBits) {
+      columns.publicKeySizesInBits[i] = sizeInBits;
+    }
+  }
+
+  if (columns.extendedKeyUsages) {
+    uint16_t ekus = 0;
+    const Input* extKeyUsage = cert.GetExtKeyUsage();
+    if (extKeyUsage) {
+      rv = GetExtendedKeyUsages(*extKeyUsage, ekus);
+      if (rv != Success) {
+        return rv;
+      }
+    }
+    columns.extendedKeyUsages[i] = ekus;
+  }
+
+  if (columns.subjectAltNameCounts || columns.subjectAltNames ||
+      columns.subjectAltNameTags) {
+    const Input* subjectAltName = cert.GetSubjectAltName();
+    if (subjectAltName) {
+      rv = ExtractSubjectAltNames(*subjectAltName, columns, i);
+      if (rv != Success) {
+        return rv;
+      }
+    } else if (columns.subjectAltNameCounts) {
+      columns.subjectAltNameCounts[i] = 0;
+    }
+  }
+
+  return Success;
+}
+
+} // unnamed namespace
+
+Result
+ExtractCertFields(const Input* certDERs, size_t certCount,
+                  const CertFieldColumns& columns, unsigned int threadCount)
+{
+  if ((certCount > 0 && (!certDERs || !columns.results)) ||
+      ((columns.subjectAltNames || columns.subjectAltNameTags) &&
+       columns.subjectAltNamesPerCert == 0) ||
+      threadCount == 0 || threadCount > MAX_PARALLEL_THREADS) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+
+  ForEachInParallel(certCount, threadCount, [&](size_t i) {
+    columns.results[i] = ExtractCertFields(certDERs[i], columns, i);
+  });
+  return Success;
+}
+
 } } // namespace mozilla::pkix
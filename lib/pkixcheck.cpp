@@ -125,28 +125,36 @@ CheckSignatureAlgorithm(TrustDomain& trustDomain,
 // 4.1.2.5 Validity
 
 Result
-CheckValidity(Input encodedValidity, Time time,
-              /*optional out*/ Time* notBeforeOut,
-              /*optional out*/ Time* notAfterOut)
+ParseValidity(Input encodedValidity, /*out*/ Time& notBefore,
+              /*out*/ Time& notAfter)
 {
   Reader validity(encodedValidity);
-  Time notBefore(Time::uninitialized);
   if (der::TimeChoice(validity, notBefore) != Success) {
     return Result::ERROR_INVALID_DER_TIME;
   }
-
-  Time notAfter(Time::uninitialized);
   if (der::TimeChoice(validity, notAfter) != Success) {
     return Result::ERROR_INVALID_DER_TIME;
   }
-
   if (der::End(validity) != Success) {
     return Result::ERROR_INVALID_DER_TIME;
   }
-
   if (notBefore > notAfter) {
     return Result::ERROR_INVALID_DER_TIME;
   }
+  return Success;
+}
+
+Result
+CheckValidity(Input encodedValidity, Time time,
+              /*optional out*/ Time* notBeforeOut,
+              /*optional out*/ Time* notAfterOut)
+{
+  Time notBefore(Time::uninitialized);
+  Time notAfter(Time::uninitialized);
+  Result rv = ParseValidity(encodedValidity, notBefore, notAfter);
+  if (rv != Success) {
+    return rv;
+  }
 
   if (time < notBefore) {
     return Result::ERROR_NOT_YET_VALID_CERTIFICATE;
@@ -167,8 +175,42 @@ CheckValidity(Input encodedValidity, Time time,
 
 // 4.1.2.7 Subject Public Key Info
 
+namespace {
+
+enum class SubjectPublicKeyAlgorithm { unknown, rsaEncryption, id_ecPublicKey };
+
+typedef der::OIDMatcher<SubjectPublicKeyAlgorithm,
+                        SubjectPublicKeyAlgorithm::unknown,
+  // RFC 3279 Section 2.3.1
+  der::OIDMatcherEntry<SubjectPublicKeyAlgorithm,
+                       SubjectPublicKeyAlgorithm::rsaEncryption,
+                       der::EncodedOID<1, 2, 840, 113549, 1, 1, 1>>,
+  // RFC 3279 Section 2.3.5 and RFC 5480 Section 2.1.1
+  der::OIDMatcherEntry<SubjectPublicKeyAlgorithm,
+                       SubjectPublicKeyAlgorithm::id_ecPublicKey,
+                       der::EncodedOID<1, 2, 840, 10045, 2, 1>>
+> SubjectPublicKeyAlgorithmMatcher;
+
+enum class SupportedNamedCurve { unknown, secp256r1, secp384r1, secp521r1 };
+
+template <SupportedNamedCurve Value, uint32_t... Arcs>
+using NamedCurveOID =
+  der::OIDMatcherEntry<SupportedNamedCurve, Value, der::EncodedOID<Arcs...>>;
+
+// RFC 5480
+typedef der::OIDMatcher<SupportedNamedCurve, SupportedNamedCurve::unknown,
+  NamedCurveOID<SupportedNamedCurve::secp256r1, 1, 2, 840, 10045, 3, 1, 7>,
+  NamedCurveOID<SupportedNamedCurve::secp384r1, 1, 3, 132, 0, 34>,
+  NamedCurveOID<SupportedNamedCurve::secp521r1, 1, 3, 132, 0, 35>
+> NamedCurveMatcher;
+
+} // unnamed namespace
+
+// KeyChecks is TrustDomain, or anything else with its
+// CheckECDSACurveIsAcceptable and CheckRSAPublicKeyModulusSizeInBits.
+template <typename KeyChecks>
 Result
-CheckSubjectPublicKeyInfo(Reader& input, TrustDomain& trustDomain,
+CheckSubjectPublicKeyInfo(Reader& input, KeyChecks& trustDomain,
                           EndEntityOrCA endEntityOrCA)
 {
   // Here, we validate the syntax and do very basic semantic validation of the
@@ -200,70 +242,45 @@ CheckSubjectPublicKeyInfo(Reader& input, TrustDomain& trustDomain,
 
   Reader subjectPublicKeyReader(subjectPublicKey);
 
-  Reader algorithmOID;
+  Input algorithmOID;
   rv = der::ExpectTagAndGetValue(algorithm, der::OIDTag, algorithmOID);
   if (rv != Success) {
     return rv;
   }
+  SubjectPublicKeyAlgorithm keyAlgorithm =
+    SubjectPublicKeyAlgorithmMatcher::Match(algorithmOID);
 
-  // RFC 3279 Section 2.3.1
-  // python DottedOIDToCode.py rsaEncryption 1.2.840.113549.1.1.1
-  static const uint8_t rsaEncryption[] = {
-    0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x01
-  };
-
-  // RFC 3279 Section 2.3.5 and RFC 5480 Section 2.1.1
-  // python DottedOIDToCode.py id-ecPublicKey 1.2.840.10045.2.1
-  static const uint8_t id_ecPublicKey[] = {
-    0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01
-  };
-
-  if (algorithmOID.MatchRest(id_ecPublicKey)) {
+  if (keyAlgorithm == SubjectPublicKeyAlgorithm::id_ecPublicKey) {
     // An id-ecPublicKey AlgorithmIdentifier has a parameter that identifes
     // the curve being used. Although RFC 5480 specifies multiple forms, we
     // only supported the NamedCurve form, where the curve is identified by an
     // OID.
 
-    Reader namedCurveOIDValue;
+    Input namedCurveOIDValue;
     rv = der::ExpectTagAndGetValue(algorithm, der::OIDTag,
                                    namedCurveOIDValue);
     if (rv != Success) {
       return rv;
     }
 
-    // RFC 5480
-    // python DottedOIDToCode.py secp256r1 1.2.840.10045.3.1.7
-    static const uint8_t secp256r1[] = {
-      0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07
-    };
-
-    // RFC 5480
-    // python DottedOIDToCode.py secp384r1 1.3.132.0.34
-    static const uint8_t secp384r1[] = {
-      0x2b, 0x81, 0x04, 0x00, 0x22
-    };
-
-    // RFC 5480
-    // python DottedOIDToCode.py secp521r1 1.3.132.0.35
-    static const uint8_t secp521r1[] = {
-      0x2b, 0x81, 0x04, 0x00, 0x23
-    };
-
-    // Matching is attempted based on a rough estimate of the commonality of the
-    // elliptic curve, to minimize the number of MatchRest calls.
     NamedCurve curve;
     unsigned int bits;
-    if (namedCurveOIDValue.MatchRest(secp256r1)) {
-      curve = NamedCurve::secp256r1;
-      bits = 256;
-    } else if (namedCurveOIDValue.MatchRest(secp384r1)) {
-      curve = NamedCurve::secp384r1;
-      bits = 384;
-    } else if (namedCurveOIDValue.MatchRest(secp521r1)) {
-      curve = NamedCurve::secp521r1;
-      bits = 521;
-    } else {
-      return Result::ERROR_UNSUPPORTED_ELLIPTIC_CURVE;
+    switch (NamedCurveMatcher::Match(namedCurveOIDValue)) {
+      case SupportedNamedCurve::secp256r1:
+        curve = NamedCurve::secp256r1;
+        bits = 256;
+        break;
+      case SupportedNamedCurve::secp384r1:
+        curve = NamedCurve::secp384r1;
+        bits = 384;
+        break;
+      case SupportedNamedCurve::secp521r1:
+        curve = NamedCurve::secp521r1;
+        bits = 521;
+        break;
+      case SupportedNamedCurve::unknown:
+        return Result::ERROR_UNSUPPORTED_ELLIPTIC_CURVE;
+      MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
     }
 
     rv = trustDomain.CheckECDSACurveIsAcceptable(endEntityOrCA, curve);
@@ -296,7 +313,7 @@ CheckSubjectPublicKeyInfo(Reader& input, TrustDomain& trustDomain,
     // XXX: We defer the mathematical verification of the validity of the point
     // until signature verification. This means that if we never verify a
     // signature, we'll never fully check whether the public key is valid.
-  } else if (algorithmOID.MatchRest(rsaEncryption)) {
+  } else if (keyAlgorithm == SubjectPublicKeyAlgorithm::rsaEncryption) {
     // RFC 3279 Section 2.3.1 says "The parameters field MUST have ASN.1 type
     // NULL for this algorithm identifier."
     rv = der::ExpectTagAndEmptyValue(algorithm, der::NULLTag);
@@ -346,6 +363,70 @@ CheckSubjectPublicKeyInfo(Reader& input, TrustDomain& trustDomain,
   return Success;
 }
 
+Result
+GetSubjectPublicKeyTypeAndSize(Input subjectPublicKeyInfo,
+                               /*out*/ PublicKeyType& type,
+                               /*out*/ unsigned int& sizeInBits)
+{
+  // Records the key instead of checking it.
+  class KeyRecorder final
+  {
+  public:
+    KeyRecorder(PublicKeyType& type, unsigned int& sizeInBits)
+      : type(type)
+      , sizeInBits(sizeInBits)
+    {
+    }
+
+    Result CheckECDSACurveIsAcceptable(EndEntityOrCA, NamedCurve curve)
+    {
+      type = PublicKeyType::EC;
+      switch (curve) {
+        case NamedCurve::secp256r1: sizeInBits = 256; break;
+        case NamedCurve::secp384r1: sizeInBits = 384; break;
+        case NamedCurve::secp521r1: sizeInBits = 521; break;
+        MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
+      }
+      return Success;
+    }
+
+    Result CheckRSAPublicKeyModulusSizeInBits(EndEntityOrCA,
+                                              unsigned int modulusSizeInBits)
+    {
+      type = PublicKeyType::RSA;
+      sizeInBits = modulusSizeInBits;
+      return Success;
+    }
+
+  private:
+    PublicKeyType& type;
+    unsigned int& sizeInBits;
+
+    KeyRecorder(const KeyRecorder&) = delete;
+    void operator=(const KeyRecorder&) = delete;
+  };
+
+  type = PublicKeyType::unsupported;
+  sizeInBits = 0;
+  KeyRecorder keyRecorder(type, sizeInBits);
+
+  Reader spki(subjectPublicKeyInfo);
+  Result rv = der::Nested(spki, der::SEQUENCE, [&](Reader& r) {
+    return CheckSubjectPublicKeyInfo(r, keyRecorder,
+                                     EndEntityOrCA::MustBeEndEntity);
+  });
+  if (rv == Result::ERROR_UNSUPPORTED_KEYALG ||
+      rv == Result::ERROR_UNSUPPORTED_ELLIPTIC_CURVE) {
+    type = PublicKeyType::unsupported;
+    sizeInBits = 0;
+    return Success;
+  }
+  if (rv != Success) {
+    return rv;
+  }
+  return der::End(spki);
+}
+
 // 4.2.1.3. Key Usage (id-ce-keyUsage)
 
 // As explained in the comment in CheckKeyUsage, bit 0 is the most significant
@@ -674,36 +755,56 @@ CheckBasicConstraints(EndEntityOrCA endEntityOrCA,
 
 // 4.2.1.12. Extended Key Usage (id-ce-extKeyUsage)
 
-static Result
+namespace {
+
+enum class KnownEKU
+{
+  unknown,
+  id_kp_serverAuth,
+  id_kp_clientAuth,
+  id_kp_codeSigning,
+  id_kp_emailProtection,
+  id_kp_OCSPSigning,
+  id_Netscape_stepUp,
+};
+
+template <KnownEKU Value, uint32_t... Arcs>
+using KnownEKUOID =
+  der::OIDMatcherEntry<KnownEKU, Value, der::EncodedOID<Arcs...>>;
+
+// id-pkix  OBJECT IDENTIFIER  ::=
+//            { iso(1) identified-organization(3) dod(6) internet(1)
+//                    security(5) mechanisms(5) pkix(7) }
+// id-kp OBJECT IDENTIFIER ::= { id-pkix 3 }
+// id-kp-serverAuth      OBJECT IDENTIFIER ::= { id-kp 1 }
+// id-kp-clientAuth      OBJECT IDENTIFIER ::= { id-kp 2 }
+// id-kp-codeSigning     OBJECT IDENTIFIER ::= { id-kp 3 }
+// id-kp-emailProtection OBJECT IDENTIFIER ::= { id-kp 4 }
+// id-kp-OCSPSigning     OBJECT IDENTIFIER ::= { id-kp 9 }
+//
+// id-Netscape        OBJECT IDENTIFIER ::= { 2 16 840 1 113730 }
+// id-Netscape-policy OBJECT IDENTIFIER ::= { id-Netscape 4 }
+// id-Netscape-stepUp OBJECT IDENTIFIER ::= { id-Netscape-policy 1 }
+typedef der::OIDMatcher<KnownEKU, KnownEKU::unknown,
+  KnownEKUOID<KnownEKU::id_kp_serverAuth, 1, 3, 6, 1, 5, 5, 7, 3, 1>,
+  KnownEKUOID<KnownEKU::id_kp_clientAuth, 1, 3, 6, 1, 5, 5, 7, 3, 2>,
+  KnownEKUOID<KnownEKU::id_kp_codeSigning, 1, 3, 6, 1, 5, 5, 7, 3, 3>,
+  KnownEKUOID<KnownEKU::id_kp_emailProtection, 1, 3, 6, 1, 5, 5, 7, 3, 4>,
+  KnownEKUOID<KnownEKU::id_kp_OCSPSigning, 1, 3, 6, 1, 5, 5, 7, 3, 9>,
+  KnownEKUOID<KnownEKU::id_Netscape_stepUp, 2, 16, 840, 1, 113730, 4, 1>
+> KnownEKUMatcher;
+
+Result
 MatchEKU(Reader& value, KeyPurposeId requiredEKU,
          EndEntityOrCA endEntityOrCA, /*in/out*/ bool& found,
          /*in/out*/ bool& foundOCSPSigning)
 {
-  // See Section 5.9 of "A Layman's Guide to a Subset of ASN.1, BER, and DER"
-  // for a description of ASN.1 DER encoding of OIDs.
-
-  // id-pkix  OBJECT IDENTIFIER  ::=
-  //            { iso(1) identified-organization(3) dod(6) internet(1)
-  //                    security(5) mechanisms(5) pkix(7) }
-  // id-kp OBJECT IDENTIFIER ::= { id-pkix 3 }
-  // id-kp-serverAuth      OBJECT IDENTIFIER ::= { id-kp 1 }
-  // id-kp-clientAuth      OBJECT IDENTIFIER ::= { id-kp 2 }
-  // id-kp-codeSigning     OBJECT IDENTIFIER ::= { id-kp 3 }
-  // id-kp-emailProtection OBJECT IDENTIFIER ::= { id-kp 4 }
-  // id-kp-OCSPSigning     OBJECT IDENTIFIER ::= { id-kp 9 }
-  static const uint8_t server[] = { (40*1)+3, 6, 1, 5, 5, 7, 3, 1 };
-  static const uint8_t client[] = { (40*1)+3, 6, 1, 5, 5, 7, 3, 2 };
-  static const uint8_t code  [] = { (40*1)+3, 6, 1, 5, 5, 7, 3, 3 };
-  static const uint8_t email [] = { (40*1)+3, 6, 1, 5, 5, 7, 3, 4 };
-  static const uint8_t ocsp  [] = { (40*1)+3, 6, 1, 5, 5, 7, 3, 9 };
-
-  // id-Netscape        OBJECT IDENTIFIER ::= { 2 16 840 1 113730 }
-  // id-Netscape-policy OBJECT IDENTIFIER ::= { id-Netscape 4 }
-  // id-Netscape-stepUp OBJECT IDENTIFIER ::= { id-Netscape-policy 1 }
-  static const uint8_t serverStepUp[] =
-    { (40*2)+16, 128+6,72, 1, 128+6,128+120,66, 4, 1 };
-
-  bool match = false;
+  Input oid;
+  Result rv = value.SkipToEnd(oid);
+  if (rv != Success) {
+    return rv;
+  }
+  KnownEKU eku = KnownEKUMatcher::Match(oid);
 
   if (!found) {
     switch (requiredEKU) {
@@ -712,25 +813,25 @@ MatchEKU(Reader& value, KeyPurposeId requiredEKU,
         // Comodo has issued certificates that require this behavior that don't
         // expire until June 2020! TODO(bug 982932): Limit this exception to
         // old certificates.
-        match = value.MatchRest(server) ||
+        found = eku == KnownEKU::id_kp_serverAuth ||
                 (endEntityOrCA == EndEntityOrCA::MustBeCA &&
-                 value.MatchRest(serverStepUp));
+                 eku == KnownEKU::id_Netscape_stepUp);
         break;
 
       case KeyPurposeId::id_kp_clientAuth:
-        match = value.MatchRest(client);
+        found = eku == KnownEKU::id_kp_clientAuth;
         break;
 
       case KeyPurposeId::id_kp_codeSigning:
-        match = value.MatchRest(code);
+        found = eku == KnownEKU::id_kp_codeSigning;
         break;
 
       case KeyPurposeId::id_kp_emailProtection:
-        match = value.MatchRest(email);
+        found = eku == KnownEKU::id_kp_emailProtection;
         break;
 
       case KeyPurposeId::id_kp_OCSPSigning:
-        match = value.MatchRest(ocsp);
+        found = eku == KnownEKU::id_kp_OCSPSigning;
         break;
 
       case KeyPurposeId::anyExtendedKeyUsage:
@@ -739,20 +840,57 @@ MatchEKU(Reader& value, KeyPurposeId requiredEKU,
     }
   }
 
-  if (match) {
-    found = true;
-    if (requiredEKU == KeyPurposeId::id_kp_OCSPSigning) {
-      foundOCSPSigning = true;
-    }
-  } else if (value.MatchRest(ocsp)) {
+  if (eku == KnownEKU::id_kp_OCSPSigning) {
     foundOCSPSigning = true;
   }
 
-  value.SkipToEnd(); // ignore unmatched OIDs.
-
   return Success;
 }
 
+} // unnamed namespace
+
+Result
+GetExtendedKeyUsages(Input encodedExtendedKeyUsage, /*out*/ uint16_t& ekus)
+{
+  ekus = EXTENDED_KEY_USAGE_PRESENT;
+  Reader input(encodedExtendedKeyUsage);
+  Result rv = der::NestedOf(input, der::SEQUENCE, der::OIDTag,
+                            der::EmptyAllowed::No, [&ekus](Reader& r) {
+    Input oid;
+    Result rv = r.SkipToEnd(oid);
+    if (rv != Success) {
+      return rv;
+    }
+    switch (KnownEKUMatcher::Match(oid)) {
+      case KnownEKU::id_kp_serverAuth:
+        ekus |= ExtendedKeyUsageBit(KeyPurposeId::id_kp_serverAuth);
+        break;
+      case KnownEKU::id_kp_clientAuth:
+        ekus |= ExtendedKeyUsageBit(KeyPurposeId::id_kp_clientAuth);
+        break;
+      case KnownEKU::id_kp_codeSigning:
+        ekus |= ExtendedKeyUsageBit(KeyPurposeId::id_kp_codeSigning);
+        break;
+      case KnownEKU::id_kp_emailProtection:
+        ekus |= ExtendedKeyUsageBit(KeyPurposeId::id_kp_emailProtection);
+        break;
+      case KnownEKU::id_kp_OCSPSigning:
+        ekus |= ExtendedKeyUsageBit(KeyPurposeId::id_kp_OCSPSigning);
+        break;
+      case KnownEKU::id_Netscape_stepUp:
+      case KnownEKU::unknown:
+        ekus |= EXTENDED_KEY_USAGE_OTHER;
+        break;
+      MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
+    }
+    return Success;
+  });
+  if (rv != Success) {
+    return rv;
+  }
+  return der::End(input);
+}
+
 Result
 CheckExtendedKeyUsage(EndEntityOrCA endEntityOrCA,
                       const Input* encodedExtendedKeyUsage,
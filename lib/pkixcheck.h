@@ -44,6 +44,29 @@ Result CheckIssuerIndependentProperties(
 Result CheckNameConstraints(Input encodedNameConstraints,
                             const BackCert& firstChild,
                             KeyPurposeId requiredEKUIfPresent);
+Result CheckNameConstraints(const CompiledNameConstraints& nameConstraints,
+                            const BackCert& firstChild,
+                            KeyPurposeId requiredEKUIfPresent);
+
+// Sets type and sizeInBits (the modulus size for RSA, and the curve size for
+// EC) for an SPKI that CheckIssuerIndependentProperties would accept, given a
+// TrustDomain that accepts any curve and modulus size. A key of an
+// unsupported type, or on an unsupported curve, has the type
+// PublicKeyType::unsupported and size 0.
+Result GetSubjectPublicKeyTypeAndSize(Input subjectPublicKeyInfo,
+                                      /*out*/ PublicKeyType& type,
+                                      /*out*/ unsigned int& sizeInBits);
+
+// Sets ekus to EXTENDED_KEY_USAGE_PRESENT, plus ExtendedKeyUsageBit(eku) for
+// each of the KeyPurposeIds in the given EKU extension value and
+// EXTENDED_KEY_USAGE_OTHER if there are any others.
+Result GetExtendedKeyUsages(Input encodedExtendedKeyUsage,
+                            /*out*/ uint16_t& ekus);
+
+// Parses the contents of a Validity SEQUENCE, as CheckValidity does, without
+// checking it against any particular time.
+Result ParseValidity(Input encodedValidity, /*out*/ Time& notBefore,
+                     /*out*/ Time& notAfter);
 
 Result CheckValidity(Input encodedValidity, Time time,
                      /*optional out*/ Time* notBeforeOut = nullptr,
@@ -0,0 +1,380 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pkix/pkix.h"
+
+#include <cstring>
+
+#include "pkixder.h"
+
+namespace mozilla { namespace pkix {
+
+namespace {
+
+const uint8_t BASE64_WHITESPACE = 0x40;
+const uint8_t BASE64_INVALID = 0x80;
+
+// The 6-bit value of each base64 character, BASE64_WHITESPACE for the
+// whitespace that may separate lines, and BASE64_INVALID for everything else,
+// including '=' and the '-' of the END line.
+const uint8_t BASE64_VALUES[256] = {
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x40, 0x40, 0x80,
+  0x80, 0x40, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x40, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x3e, 0x80, 0x80, 0x80, 0x3f,
+  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+  0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12,
+  0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24,
+  0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+  0x31, 0x32, 0x33, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+  0x80, 0x80, 0x80, 0x80,
+};
+
+const uint8_t PEM_BEGIN[] = {
+  '-', '-', '-', '-', '-', 'B', 'E', 'G', 'I', 'N', ' '
+};
+const uint8_t PEM_CERTIFICATE_LABEL[] = {
+  'C', 'E', 'R', 'T', 'I', 'F', 'I', 'C', 'A', 'T', 'E',
+  '-', '-', '-', '-', '-'
+};
+const uint8_t PEM_END_CERTIFICATE[] = {
+  '-', '-', '-', '-', '-', 'E', 'N', 'D', ' ',
+  'C', 'E', 'R', 'T', 'I', 'F', 'I', 'C', 'A', 'T', 'E',
+  '-', '-', '-', '-', '-'
+};
+const uint8_t PEM_END[] = {
+  '-', '-', '-', '-', '-', 'E', 'N', 'D', ' '
+};
+
+template <size_t N>
+bool
+StartsWith(const uint8_t* p, const uint8_t* end, const uint8_t (&prefix)[N])
+{
+  return static_cast<size_t>(end - p) >= N && !std::memcmp(p, prefix, N);
+}
+
+// Returns the first occurrence of text in [p, end), or end.
+template <size_t N>
+const uint8_t*
+Find(const uint8_t* p, const uint8_t* end, const uint8_t (&text)[N])
+{
+  while (static_cast<size_t>(end - p) >= N) {
+    const uint8_t* found = static_cast<const uint8_t*>(
+      std::memchr(p, text[0], static_cast<size_t>(end - p) - (N - 1)));
+    if (!found) {
+      break;
+    }
+    if (!std::memcmp(found, text, N)) {
+      return found;
+    }
+    p = found + 1;
+  }
+  return end;
+}
+
+inline void
+Store24(uint32_t value, /*out*/ uint8_t* out)
+{
+  out[0] = static_cast<uint8_t>(value >> 16);
+  out[1] = static_cast<uint8_t>(value >> 8);
+  out[2] = static_cast<uint8_t>(value);
+}
+
+// Decodes base64 from p until a character that isn't base64 or whitespace,
+// including any padding. Whitespace may appear anywhere, but most PEM lines
+// are 64 (or 76) characters long, so the characters are decoded four at a
+// time, with the lookups combined so that there is one check for invalid
+// characters and whitespace per four characters (or per sixteen, for the
+// middle of a line). A group with whitespace in it is decoded a character at
+// a time. Decoding fails with Result::FATAL_ERROR_NO_MEMORY if out fills up.
+Result
+DecodeBase64(/*in/out*/ const uint8_t*& p, const uint8_t* end,
+             /*out*/ uint8_t* out, const uint8_t* outEnd,
+             /*out*/ size_t& outLength)
+{
+  uint8_t* const outStart = out;
+  uint32_t accumulated = 0;
+  unsigned int accumulatedCount = 0;
+
+  for (;;) {
+    if (accumulatedCount == 0) {
+      while (end - p >= 16 && outEnd - out >= 12) {
+        uint32_t v[16];
+        uint32_t flags = 0;
+        for (size_t i = 0; i < 16; ++i) {
+          v[i] = BASE64_VALUES[p[i]];
+          flags |= v[i];
+        }
+        if (flags & (BASE64_WHITESPACE | BASE64_INVALID)) {
+          break;
+        }
+        for (size_t i = 0; i < 16; i += 4) {
+          Store24((v[i] << 18) | (v[i + 1] << 12) | (v[i + 2] << 6) | v[i + 3],
+                  out);
+          out += 3;
+        }
+        p += 16;
+      }
+      while (end - p >= 4) {
+        uint32_t a = BASE64_VALUES[p[0]];
+        uint32_t b = BASE64_VALUES[p[1]];
+        uint32_t c = BASE64_VALUES[p[2]];
+        uint32_t d = BASE64_VALUES[p[3]];
+        if ((a | b | c | d) & (BASE64_WHITESPACE | BASE64_INVALID)) {
+          break;
+        }
+        if (outEnd - out < 3) {
+          return Result::FATAL_ERROR_NO_MEMORY;
+        }
+        Store24((a << 18) | (b << 12) | (c << 6) | d, out);
+        out += 3;
+        p += 4;
+      }
+    }
+    if (p == end) {
+      break;
+    }
+    uint8_t value = BASE64_VALUES[*p];
+    if (value == BASE64_WHITESPACE) {
+      ++p;
+      continue;
+    }
+    if (value == BASE64_INVALID) {
+      break;
+    }
+    ++p;
+    accumulated = (accumulated << 6) | value;
+    ++accumulatedCount;
+    if (accumulatedCount == 4) {
+      if (outEnd - out < 3) {
+        return Result::FATAL_ERROR_NO_MEMORY;
+      }
+      Store24(accumulated, out);
+      out += 3;
+      accumulated = 0;
+      accumulatedCount = 0;
+    }
+  }
+
+  // The last group may be padded to four characters with "=" or "==".
+  if (accumulatedCount != 0) {
+    if (accumulatedCount == 1) {
+      return Result::ERROR_BAD_DER;
+    }
+    size_t padding = 4 - accumulatedCount;
+    for (size_t i = 0; i < padding; ++i) {
+      while (p != end && BASE64_VALUES[*p] == BASE64_WHITESPACE) {
+        ++p;
+      }
+      if (p == end || *p != '=') {
+        return Result::ERROR_BAD_DER;
+      }
+      ++p;
+    }
+    size_t length = 3 - padding;
+    if (static_cast<size_t>(outEnd - out) < length) {
+      return Result::FATAL_ERROR_NO_MEMORY;
+    }
+    accumulated <<= 6 * padding;
+    out[0] = static_cast<uint8_t>(accumulated >> 16);
+    if (length == 2) {
+      out[1] = static_cast<uint8_t>(accumulated >> 8);
+    }
+    out += length;
+    while (p != end && BASE64_VALUES[*p] == BASE64_WHITESPACE) {
+      ++p;
+    }
+  }
+
+  outLength = static_cast<size_t>(out - outStart);
+  return Success;
+}
+
+} // unnamed namespace
+
+CertCorpusReader::CertCorpusReader(const uint8_t* corpus,
+                                   size_t corpusLength,
+                                   /*out*/ uint8_t* arena,
+                                   size_t arenaLength)
+  : corpus(corpus)
+  , corpusLength(corpusLength)
+  , arena(arena)
+  , arenaLength(arenaLength)
+  , arenaUsed(0)
+  , offset(0)
+  , format(Format::Unknown)
+{
+}
+
+Result
+CertCorpusReader::ReadCerts(/*out*/ Input* certs, size_t maxCerts,
+                            /*out*/ size_t& certCount)
+{
+  certCount = 0;
+  arenaUsed = 0;
+
+  if (format == Format::Unknown) {
+    if (corpusLength == 0) {
+      return Success;
+    }
+    format = corpus[0] == der::SEQUENCE ? Format::DER : Format::PEM;
+  }
+
+  while (certCount < maxCerts) {
+    bool atEnd;
+    Result rv;
+    if (format == Format::DER) {
+      rv = ReadDER(certs[certCount], atEnd);
+    } else {
+      bool arenaFull;
+      rv = ReadPEM(certs[certCount], atEnd, arenaFull);
+      if (rv == Success && arenaFull) {
+        if (certCount == 0) {
+          return Result::FATAL_ERROR_INVALID_ARGS;
+        }
+        break;
+      }
+    }
+    if (rv != Success) {
+      return rv;
+    }
+    if (atEnd) {
+      break;
+    }
+    ++certCount;
+  }
+
+  return Success;
+}
+
+Result
+CertCorpusReader::ReadDER(/*out*/ Input& cert, /*out*/ bool& atEnd)
+{
+  size_t remaining = corpusLength - offset;
+  if (remaining == 0) {
+    atEnd = true;
+    return Success;
+  }
+  atEnd = false;
+
+  // A tag and a length take at most 1 + 1 + 4 bytes.
+  Input header;
+  Result rv = header.Init(corpus + offset, remaining < 6 ? remaining : 6);
+  if (rv != Success) {
+    return rv;
+  }
+  Reader reader(header);
+  Reader::Mark start(reader.GetMark());
+  uint8_t tag;
+  uint32_t length;
+  rv = der::ReadTagAndGetLength(reader, tag, length);
+  if (rv != Success) {
+    return rv;
+  }
+  if (tag != der::SEQUENCE) {
+    return Result::ERROR_BAD_DER;
+  }
+  Input tagAndLength;
+  rv = reader.GetInput(start, tagAndLength);
+  if (rv != Success) {
+    return rv;
+  }
+  if (length > remaining - tagAndLength.GetLength()) {
+    return Result::ERROR_BAD_DER;
+  }
+  size_t certLength = tagAndLength.GetLength() + static_cast<size_t>(length);
+  rv = cert.Init(corpus + offset, certLength);
+  if (rv != Success) {
+    return rv;
+  }
+  offset += certLength;
+  return Success;
+}
+
+Result
+CertCorpusReader::ReadPEM(/*out*/ Input& cert, /*out*/ bool& atEnd,
+                          /*out*/ bool& arenaFull)
+{
+  atEnd = false;
+  arenaFull = false;
+
+  const uint8_t* end = corpus + corpusLength;
+  const uint8_t* p;
+  for (;;) {
+    const uint8_t* begin = Find(corpus + offset, end, PEM_BEGIN);
+    if (begin == end) {
+      offset = corpusLength;
+      atEnd = true;
+      return Success;
+    }
+    offset = static_cast<size_t>(begin - corpus);
+    p = begin + sizeof(PEM_BEGIN);
+    if (StartsWith(p, end, PEM_CERTIFICATE_LABEL)) {
+      p += sizeof(PEM_CERTIFICATE_LABEL);
+      break;
+    }
+    // Skip blocks of other kinds, e.g. keys and CRLs.
+    const uint8_t* blockEnd = Find(p, end, PEM_END);
+    if (blockEnd == end) {
+      return Result::ERROR_BAD_DER;
+    }
+    offset = static_cast<size_t>(blockEnd - corpus) + sizeof(PEM_END);
+  }
+
+  uint8_t* decoded = arena + arenaUsed;
+  size_t decodedLength;
+  Result rv = DecodeBase64(p, end, decoded, arena + arenaLength,
+                           decodedLength);
+  if (rv == Result::FATAL_ERROR_NO_MEMORY) {
+    arenaFull = true;
+    return Success;
+  }
+  if (rv != Success) {
+    return rv;
+  }
+  if (decodedLength == 0 || !StartsWith(p, end, PEM_END_CERTIFICATE)) {
+    return Result::ERROR_BAD_DER;
+  }
+  rv = cert.Init(decoded, decodedLength);
+  if (rv != Success) {
+    return rv;
+  }
+  arenaUsed += decodedLength;
+  offset = static_cast<size_t>(p - corpus) + sizeof(PEM_END_CERTIFICATE);
+  return Success;
+}
+
+} } // namespace mozilla::pkix
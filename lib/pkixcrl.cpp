@@ -0,0 +1,534 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "pkix/pkix.h"
+#include "pkixutil.h"
+
+namespace mozilla { namespace pkix {
+
+namespace {
+
+// CRLs may be much larger than an Input, so the CertificateList, the
+// TBSCertList, and the revokedCertificates are read using LargeReaders. Every
+// other element is read as an Input, with its tag and length, and then parsed
+// as usual.
+Result
+ReadTLV(LargeReader& input, /*out*/ Input& tlv)
+{
+  LargeReader::Mark mark(input.GetMark());
+  uint8_t tag;
+  LargeInput value;
+  Result rv = der::ReadTagAndGetValue(input, tag, value);
+  if (rv != Success) {
+    return rv;
+  }
+  return input.GetInput(mark, tlv);
+}
+
+// The index holds the offsets of the serial numbers' INTEGER TLVs. Serial
+// numbers longer than 127 bytes are rejected so that the length of each
+// serial number is always the byte that follows the tag.
+inline Input::size_type
+SerialNumberLength(const uint8_t* crl, uint32_t offset)
+{
+  return crl[offset + 1];
+}
+
+inline const uint8_t*
+SerialNumberValue(const uint8_t* crl, uint32_t offset)
+{
+  return crl + offset + 2;
+}
+
+// Orders serial numbers by length and then by value. This isn't numeric
+// order for negative serial numbers, but only the consistency of the order
+// matters.
+inline int
+CompareSerialNumbers(const uint8_t* a, size_t aLength,
+                     const uint8_t* b, size_t bLength)
+{
+  if (aLength != bLength) {
+    return aLength < bLength ? -1 : 1;
+  }
+  return std::memcmp(a, b, aLength);
+}
+
+Result
+ExtensionNotUnderstood(Reader& /*extnID*/, Input /*extnValue*/,
+                       bool /*critical*/, /*out*/ bool& understood)
+{
+  understood = false;
+  return Success;
+}
+
+// revokedCertificates     SEQUENCE OF SEQUENCE  {
+//      userCertificate         CertificateSerialNumber,
+//      revocationDate          Time,
+//      crlEntryExtensions      Extensions OPTIONAL
+//                               -- if present, version MUST be v2
+//                           }  OPTIONAL,
+Result
+RevokedCertificate(Reader& entry, bool isV2,
+                   /*out*/ Input& serialNumberTLV)
+{
+  Reader::Mark mark(entry.GetMark());
+  Input serialNumber;
+  Result rv = der::CertificateSerialNumber(entry, serialNumber);
+  if (rv != Success) {
+    return rv;
+  }
+  if (serialNumber.GetLength() > 127) {
+    return Result::ERROR_BAD_DER;
+  }
+  rv = entry.GetInput(mark, serialNumberTLV);
+  if (rv != Success) {
+    return rv;
+  }
+  Time revocationDate(Time::uninitialized);
+  rv = der::TimeChoice(entry, revocationDate);
+  if (rv != Success) {
+    return rv;
+  }
+  if (!entry.AtEnd()) {
+    if (!isV2) {
+      return Result::ERROR_CRL_INVALID;
+    }
+    rv = der::Extensions(entry, der::EmptyAllowed::No,
+                         ExtensionNotUnderstood);
+    if (rv != Success) {
+      return rv;
+    }
+  }
+  return Success;
+}
+
+Result
+DigestTBSCertList(DigestStream& digest, DigestAlgorithm digestAlg,
+                  const uint8_t* tbsCertList, size_t tbsCertListLength)
+{
+  Result rv = digest.Begin(digestAlg);
+  if (rv != Success) {
+    return rv;
+  }
+  while (tbsCertListLength > 0) {
+    size_t chunkLength =
+      std::min<size_t>(tbsCertListLength,
+                       std::numeric_limits<Input::size_type>::max());
+    Input chunk;
+    rv = chunk.Init(tbsCertList, chunkLength);
+    if (rv != Success) {
+      return rv;
+    }
+    rv = digest.Update(chunk);
+    if (rv != Success) {
+      return rv;
+    }
+    tbsCertList += chunkLength;
+    tbsCertListLength -= chunkLength;
+  }
+  return Success;
+}
+
+Result
+VerifyCRLSignature(TrustDomain& trustDomain, DigestStream& digest,
+                   const uint8_t* tbsCertList, size_t tbsCertListLength,
+                   Input signatureAlgorithm, Input signature,
+                   Input issuerSubjectPublicKeyInfo)
+{
+  Reader signatureAlgorithmReader(signatureAlgorithm);
+  der::PublicKeyAlgorithm publicKeyAlg;
+  SignedDigest signedDigest;
+  Result rv = der::SignatureAlgorithmIdentifierValue(
+                signatureAlgorithmReader, publicKeyAlg,
+                signedDigest.digestAlgorithm);
+  if (rv != Success) {
+    return rv;
+  }
+  rv = der::End(signatureAlgorithmReader);
+  if (rv != Success) {
+    return rv;
+  }
+
+  size_t digestLength;
+  switch (signedDigest.digestAlgorithm) {
+    case DigestAlgorithm::sha512: digestLength = 512 / 8; break;
+    case DigestAlgorithm::sha384: digestLength = 384 / 8; break;
+    case DigestAlgorithm::sha256: digestLength = 256 / 8; break;
+    case DigestAlgorithm::sha1: digestLength = 160 / 8; break;
+    MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
+  }
+  uint8_t digestBuf[MAX_DIGEST_SIZE_IN_BYTES];
+  assert(digestLength <= sizeof(digestBuf));
+
+  rv = DigestTBSCertList(digest, signedDigest.digestAlgorithm, tbsCertList,
+                         tbsCertListLength);
+  if (rv != Success) {
+    return rv;
+  }
+  rv = digest.Finish(signedDigest.digestAlgorithm, digestBuf, digestLength);
+  if (rv != Success) {
+    return rv;
+  }
+  rv = signedDigest.digest.Init(digestBuf, digestLength);
+  if (rv != Success) {
+    return rv;
+  }
+  rv = signedDigest.signature.Init(signature);
+  if (rv != Success) {
+    return rv;
+  }
+
+  rv = VerifySignedDigest(trustDomain, publicKeyAlg, signedDigest,
+                          issuerSubjectPublicKeyInfo);
+  if (rv == Result::ERROR_BAD_SIGNATURE) {
+    return Result::ERROR_CRL_BAD_SIGNATURE;
+  }
+  return rv;
+}
+
+// Like the certificate's signature field, the TBSCertList's signature field
+// must identify the same algorithm as the CertificateList's
+// signatureAlgorithm. See CheckSignatureAlgorithm.
+Result
+CheckSignatureAlgorithmsMatch(Input innerSignatureAlgorithm,
+                              Input outerSignatureAlgorithm)
+{
+  der::PublicKeyAlgorithm publicKeyAlgs[2];
+  DigestAlgorithm digestAlgs[2];
+  const Input* algorithms[2] = {
+    &innerSignatureAlgorithm, &outerSignatureAlgorithm
+  };
+  for (size_t i = 0; i < 2; ++i) {
+    Reader algorithm(*algorithms[i]);
+    Result rv = der::Nested(algorithm, der::SEQUENCE, [&](Reader& r) {
+      return der::SignatureAlgorithmIdentifierValue(r, publicKeyAlgs[i],
+                                                    digestAlgs[i]);
+    });
+    if (rv != Success) {
+      return rv;
+    }
+    rv = der::End(algorithm);
+    if (rv != Success) {
+      return rv;
+    }
+  }
+  if (publicKeyAlgs[0] != publicKeyAlgs[1] || digestAlgs[0] != digestAlgs[1]) {
+    return Result::ERROR_SIGNATURE_ALGORITHM_MISMATCH;
+  }
+  return Success;
+}
+
+Result
+MapBadDERToInvalidCRL(Result rv)
+{
+  return (rv == Result::ERROR_BAD_DER) ? Result::ERROR_CRL_INVALID : rv;
+}
+
+} // unnamed namespace
+
+IndexedCRL::IndexedCRL()
+  : crl(nullptr)
+  , index(nullptr)
+  , entryCount(0)
+  , thisUpdate(TimeFromElapsedSecondsAD(0))
+  , nextUpdate(TimeFromElapsedSecondsAD(0))
+{
+}
+
+// CertificateList  ::=  SEQUENCE  {
+//      tbsCertList          TBSCertList,
+//      signatureAlgorithm   AlgorithmIdentifier,
+//      signatureValue       BIT STRING  }
+//
+// TBSCertList  ::=  SEQUENCE  {
+//      version                 Version OPTIONAL,
+//                                   -- if present, MUST be v2
+//      signature               AlgorithmIdentifier,
+//      issuer                  Name,
+//      thisUpdate              Time,
+//      nextUpdate              Time OPTIONAL,
+//      revokedCertificates     SEQUENCE OF SEQUENCE  { ... }  OPTIONAL,
+//      crlExtensions           [0]  EXPLICIT Extensions OPTIONAL
+//                                   -- if present, version MUST be v2
+//                           }
+Result
+IndexedCRL::Init(TrustDomain& trustDomain, DigestStream& tbsCertListDigest,
+                 const uint8_t* crlDER, size_t crlLength, Input issuerSubject,
+                 Input issuerSubjectPublicKeyInfo, Time time,
+                 /*out*/ uint32_t* indexOut, size_t indexCapacity)
+{
+  if (crl) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  if (!crlDER || (!indexOut && indexCapacity > 0)) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  // The index holds 32-bit offsets.
+  if (crlLength > std::numeric_limits<uint32_t>::max()) {
+    return Result::ERROR_CRL_INVALID;
+  }
+
+  LargeInput crlInput;
+  Result rv = crlInput.Init(crlDER, crlLength);
+  if (rv != Success) {
+    return MapBadDERToInvalidCRL(rv);
+  }
+  LargeReader certificateList;
+  rv = der::ExpectTagAndGetValueAtEnd(crlInput, der::SEQUENCE,
+                                      certificateList);
+  if (rv != Success) {
+    return MapBadDERToInvalidCRL(rv);
+  }
+
+  LargeReader::Mark tbsCertListMark(certificateList.GetMark());
+  LargeReader tbsCertList;
+  rv = der::ExpectTagAndGetValue(certificateList, der::SEQUENCE, tbsCertList);
+  if (rv != Success) {
+    return MapBadDERToInvalidCRL(rv);
+  }
+  LargeInput tbsCertListTLV;
+  rv = certificateList.GetInput(tbsCertListMark, tbsCertListTLV);
+  if (rv != Success) {
+    return rv;
+  }
+
+  // Verify the signature before looking at anything else in the TBSCertList.
+  Input signatureAlgorithm;
+  rv = ReadTLV(certificateList, signatureAlgorithm);
+  if (rv != Success) {
+    return MapBadDERToInvalidCRL(rv);
+  }
+  Input signatureTLV;
+  rv = ReadTLV(certificateList, signatureTLV);
+  if (rv != Success) {
+    return MapBadDERToInvalidCRL(rv);
+  }
+  if (!certificateList.AtEnd()) {
+    return Result::ERROR_CRL_INVALID;
+  }
+  Input signatureAlgorithmValue;
+  {
+    Reader signatureAlgorithmReader(signatureAlgorithm);
+    rv = der::ExpectTagAndGetValue(signatureAlgorithmReader, der::SEQUENCE,
+                                   signatureAlgorithmValue);
+    if (rv != Success) {
+      return MapBadDERToInvalidCRL(rv);
+    }
+  }
+  Input signature;
+  {
+    Reader signatureReader(signatureTLV);
+    rv = der::BitStringWithNoUnusedBits(signatureReader, signature);
+    if (rv == Result::ERROR_BAD_DER) {
+      return Result::ERROR_CRL_BAD_SIGNATURE;
+    }
+    if (rv != Success) {
+      return rv;
+    }
+  }
+  // The signature covers the entire encoded TBSCertList, including its tag
+  // and length.
+  rv = VerifyCRLSignature(trustDomain, tbsCertListDigest,
+                          tbsCertListTLV.UnsafeGetData(),
+                          tbsCertListTLV.GetLength(),
+                          signatureAlgorithmValue, signature,
+                          issuerSubjectPublicKeyInfo);
+  if (rv != Success) {
+    return MapBadDERToInvalidCRL(rv);
+  }
+
+  // version
+  bool isV2 = false;
+  if (tbsCertList.Peek(der::INTEGER)) {
+    Input versionTLV;
+    rv = ReadTLV(tbsCertList, versionTLV);
+    if (rv != Success) {
+      return MapBadDERToInvalidCRL(rv);
+    }
+    Reader versionReader(versionTLV);
+    uint8_t version;
+    rv = der::Integer(versionReader, version);
+    if (rv != Success) {
+      return MapBadDERToInvalidCRL(rv);
+    }
+    if (version != static_cast<uint8_t>(der::Version::v2)) {
+      return Result::ERROR_CRL_INVALID;
+    }
+    isV2 = true;
+  }
+
+  // signature
+  Input innerSignatureAlgorithm;
+  rv = ReadTLV(tbsCertList, innerSignatureAlgorithm);
+  if (rv != Success) {
+    return MapBadDERToInvalidCRL(rv);
+  }
+  rv = CheckSignatureAlgorithmsMatch(innerSignatureAlgorithm,
+                                     signatureAlgorithm);
+  if (rv != Success) {
+    return MapBadDERToInvalidCRL(rv);
+  }
+
+  // issuer
+  Input issuerTLV;
+  rv = ReadTLV(tbsCertList, issuerTLV);
+  if (rv != Success) {
+    return MapBadDERToInvalidCRL(rv);
+  }
+  {
+    Reader issuerReader(issuerTLV);
+    Input issuer;
+    rv = der::ExpectTagAndGetTLV(issuerReader, der::SEQUENCE, issuer);
+    if (rv != Success) {
+      return MapBadDERToInvalidCRL(rv);
+    }
+    // Like the matching of OCSP responder names, this is a byte-for-byte
+    // comparison.
+    if (!InputsAreEqual(issuer, issuerSubject)) {
+      return Result::ERROR_CRL_INVALID;
+    }
+  }
+
+  // thisUpdate and nextUpdate
+  Time parsedThisUpdate(Time::uninitialized);
+  Time parsedNextUpdate(Time::uninitialized);
+  Time* const times[2] = { &parsedThisUpdate, &parsedNextUpdate };
+  for (Time* parsedTime : times) {
+    if (!tbsCertList.Peek(der::UTCTime) &&
+        !tbsCertList.Peek(der::GENERALIZED_TIME)) {
+      // RFC 5280 requires nextUpdate even though it is optional in the ASN.1.
+      return Result::ERROR_CRL_INVALID;
+    }
+    Input timeTLV;
+    rv = ReadTLV(tbsCertList, timeTLV);
+    if (rv != Success) {
+      return MapBadDERToInvalidCRL(rv);
+    }
+    Reader timeReader(timeTLV);
+    rv = der::TimeChoice(timeReader, *parsedTime);
+    if (rv != Success) {
+      return MapBadDERToInvalidCRL(rv);
+    }
+  }
+  if (time < parsedThisUpdate) {
+    return Result::ERROR_CRL_NOT_YET_VALID;
+  }
+  if (time > parsedNextUpdate) {
+    return Result::ERROR_CRL_EXPIRED;
+  }
+
+  // revokedCertificates
+  size_t count = 0;
+  if (tbsCertList.Peek(der::SEQUENCE)) {
+    rv = der::NestedOf(tbsCertList, der::SEQUENCE, der::SEQUENCE,
+                       der::EmptyAllowed::No,
+                       [crlDER, isV2, indexOut, indexCapacity,
+                        &count](Reader& r) {
+      Input serialNumberTLV;
+      Result rv = RevokedCertificate(r, isV2, serialNumberTLV);
+      if (rv != Success) {
+        return rv;
+      }
+      if (count == indexCapacity) {
+        return Result::FATAL_ERROR_INVALID_ARGS;
+      }
+      indexOut[count] = static_cast<uint32_t>(
+                          serialNumberTLV.UnsafeGetData() - crlDER);
+      ++count;
+      return Success;
+    });
+    if (rv != Success) {
+      return MapBadDERToInvalidCRL(rv);
+    }
+  }
+
+  // crlExtensions
+  static const uint8_t CRL_EXTENSIONS_TAG =
+    der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 0;
+  if (tbsCertList.Peek(CRL_EXTENSIONS_TAG)) {
+    if (!isV2) {
+      return Result::ERROR_CRL_INVALID;
+    }
+    Input extensionsTLV;
+    rv = ReadTLV(tbsCertList, extensionsTLV);
+    if (rv != Success) {
+      return MapBadDERToInvalidCRL(rv);
+    }
+    Reader extensions(extensionsTLV);
+    rv = der::OptionalExtensions(extensions, CRL_EXTENSIONS_TAG,
+                                 ExtensionNotUnderstood);
+    if (rv != Success) {
+      return MapBadDERToInvalidCRL(rv);
+    }
+  }
+  if (!tbsCertList.AtEnd()) {
+    return Result::ERROR_CRL_INVALID;
+  }
+
+  const uint8_t* crlData = crlDER;
+  std::sort(indexOut, indexOut + count,
+            [crlData](uint32_t a, uint32_t b) {
+    return CompareSerialNumbers(SerialNumberValue(crlData, a),
+                                SerialNumberLength(crlData, a),
+                                SerialNumberValue(crlData, b),
+                                SerialNumberLength(crlData, b)) < 0;
+  });
+
+  crl = crlDER;
+  index = indexOut;
+  entryCount = count;
+  thisUpdate = parsedThisUpdate;
+  nextUpdate = parsedNextUpdate;
+  return Success;
+}
+
+Result
+IndexedCRL::IsRevoked(Input serialNumber, /*out*/ bool& revoked) const
+{
+  if (!crl) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  const uint8_t* crlData = crl;
+  const uint8_t* value = serialNumber.UnsafeGetData();
+  size_t length = serialNumber.GetLength();
+  const uint32_t* found =
+    std::lower_bound(index, index + entryCount, 0u,
+                     [crlData, value, length](uint32_t entry, uint32_t) {
+      return CompareSerialNumbers(SerialNumberValue(crlData, entry),
+                                  SerialNumberLength(crlData, entry),
+                                  value, length) < 0;
+    });
+  revoked = found != index + entryCount &&
+            CompareSerialNumbers(SerialNumberValue(crlData, *found),
+                                 SerialNumberLength(crlData, *found),
+                                 value, length) == 0;
+  return Success;
+}
+
+} } // namespace mozilla::pkix
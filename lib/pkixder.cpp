@@ -24,13 +24,20 @@
 
 #include "pkixder.h"
 
+#include <cstring>
+#include <limits>
+
 #include "pkixutil.h"
 
 namespace mozilla { namespace pkix { namespace der {
 
-// Too complicated to be inline
+namespace {
+
+// Shared by the Reader and LargeReader versions of ReadTagAndGetLength.
+template <typename R>
 Result
-ReadTagAndGetValue(Reader& input, /*out*/ uint8_t& tag, /*out*/ Input& value)
+ReadTagAndGetLengthFrom(R& input, /*out*/ uint8_t& tag,
+                        /*out*/ uint32_t& length)
 {
   Result rv;
 
@@ -42,8 +49,6 @@ ReadTagAndGetValue(Reader& input, /*out*/ uint8_t& tag, /*out*/ Input& value)
     return Result::ERROR_BAD_DER; // high tag number form not allowed
   }
 
-  uint16_t length;
-
   // The short form of length is a single byte with the high order bit set
   // to zero. The long form of length is one byte with the high order bit
   // set, followed by N bytes, where N is encoded in the lowest 7 bits of
@@ -55,31 +60,76 @@ ReadTagAndGetValue(Reader& input, /*out*/ uint8_t& tag, /*out*/ Input& value)
   }
   if (!(length1 & 0x80)) {
     length = length1;
-  } else if (length1 == 0x81) {
-    uint8_t length2;
-    rv = input.Read(length2);
-    if (rv != Success) {
-      return rv;
-    }
-    if (length2 < 128) {
-      // Not shortest possible encoding
-      return Result::ERROR_BAD_DER;
-    }
-    length = length2;
-  } else if (length1 == 0x82) {
-    rv = input.Read(length);
+    return Success;
+  }
+
+  size_t lengthBytes = length1 & 0x7F;
+  if (lengthBytes < 1 || lengthBytes > sizeof(length)) {
+    // Indefinite length (0x80) is not allowed in DER, and we don't support
+    // lengths larger than 2^32 - 1.
+    return Result::ERROR_BAD_DER;
+  }
+  length = 0;
+  for (size_t i = 0; i < lengthBytes; ++i) {
+    uint8_t lengthByte;
+    rv = input.Read(lengthByte);
     if (rv != Success) {
       return rv;
     }
-    if (length < 256) {
+    if (i == 0 && lengthByte == 0) {
       // Not shortest possible encoding
       return Result::ERROR_BAD_DER;
     }
-  } else {
-    // We don't support lengths larger than 2^16 - 1.
+    length = (length << 8) | lengthByte;
+  }
+  if (length < 128) {
+    // Not shortest possible encoding
     return Result::ERROR_BAD_DER;
   }
+  return Success;
+}
 
+} // unnamed namespace
+
+// Too complicated to be inline
+Result
+ReadTagAndGetLength(Reader& input, /*out*/ uint8_t& tag,
+                    /*out*/ uint32_t& length)
+{
+  return ReadTagAndGetLengthFrom(input, tag, length);
+}
+
+Result
+ReadTagAndGetLength(LargeReader& input, /*out*/ uint8_t& tag,
+                    /*out*/ uint32_t& length)
+{
+  return ReadTagAndGetLengthFrom(input, tag, length);
+}
+
+Result
+ReadTagAndGetValue(Reader& input, /*out*/ uint8_t& tag, /*out*/ Input& value)
+{
+  uint32_t length;
+  Result rv = ReadTagAndGetLength(input, tag, length);
+  if (rv != Success) {
+    return rv;
+  }
+  if (length > std::numeric_limits<Input::size_type>::max()) {
+    // We don't support values larger than 2^16 - 1 here.
+    return Result::ERROR_BAD_DER;
+  }
+  return input.Skip(static_cast<Input::size_type>(length), value);
+}
+
+Result
+ReadTagAndGetValue(LargeReader& input, /*out*/ uint8_t& tag,
+                   /*out*/ LargeInput& value)
+{
+  uint32_t length;
+  Result rv = ReadTagAndGetLength(input, tag, length);
+  if (rv != Success) {
+    return rv;
+  }
   return input.Skip(length, value);
 }
 
@@ -95,7 +145,7 @@ OptionalNull(Reader& input)
 namespace {
 
 Result
-AlgorithmIdentifierValue(Reader& input, /*out*/ Reader& algorithmOIDValue)
+AlgorithmIdentifierValue(Reader& input, /*out*/ Input& algorithmOIDValue)
 {
   Result rv = ExpectTagAndGetValue(input, der::OIDTag, algorithmOIDValue);
   if (rv != Success) {
@@ -104,6 +154,74 @@ AlgorithmIdentifierValue(Reader& input, /*out*/ Reader& algorithmOIDValue)
   return OptionalNull(input);
 }
 
+enum class SignatureAlgorithm
+{
+  unknown,
+  ecdsa_with_SHA256,
+  ecdsa_with_SHA384,
+  ecdsa_with_SHA512,
+  sha256WithRSAEncryption,
+  sha384WithRSAEncryption,
+  sha512WithRSAEncryption,
+  sha_1WithRSAEncryption,
+  sha1WithRSASignature,
+  ecdsa_with_SHA1,
+};
+
+template <SignatureAlgorithm Value, uint32_t... Arcs>
+using SignatureAlgorithmOID =
+  OIDMatcherEntry<SignatureAlgorithm, Value, EncodedOID<Arcs...>>;
+
+typedef OIDMatcher<SignatureAlgorithm, SignatureAlgorithm::unknown,
+  // RFC 5758 Section 3.2 (ecdsa-with-SHA224 is intentionally excluded)
+  SignatureAlgorithmOID<SignatureAlgorithm::ecdsa_with_SHA256,
+                        1, 2, 840, 10045, 4, 3, 2>,
+  SignatureAlgorithmOID<SignatureAlgorithm::ecdsa_with_SHA384,
+                        1, 2, 840, 10045, 4, 3, 3>,
+  SignatureAlgorithmOID<SignatureAlgorithm::ecdsa_with_SHA512,
+                        1, 2, 840, 10045, 4, 3, 4>,
+
+  // RFC 4055 Section 5 (sha224WithRSAEncryption is intentionally excluded)
+  SignatureAlgorithmOID<SignatureAlgorithm::sha256WithRSAEncryption,
+                        1, 2, 840, 113549, 1, 1, 11>,
+  SignatureAlgorithmOID<SignatureAlgorithm::sha384WithRSAEncryption,
+                        1, 2, 840, 113549, 1, 1, 12>,
+  SignatureAlgorithmOID<SignatureAlgorithm::sha512WithRSAEncryption,
+                        1, 2, 840, 113549, 1, 1, 13>,
+
+  // RFC 3279 Section 2.2.1
+  SignatureAlgorithmOID<SignatureAlgorithm::sha_1WithRSAEncryption,
+                        1, 2, 840, 113549, 1, 1, 5>,
+
+  // NIST Open Systems Environment (OSE) Implementor's Workshop (OIW)
+  // http://www.oiw.org/agreements/stable/12s-9412.txt (no longer works).
+  // http://www.imc.org/ietf-pkix/old-archive-97/msg01166.html
+  // We need to support this this non-PKIX OID for compatibility.
+  SignatureAlgorithmOID<SignatureAlgorithm::sha1WithRSASignature,
+                        1, 3, 14, 3, 2, 29>,
+
+  // RFC 3279 Section 2.2.3
+  SignatureAlgorithmOID<SignatureAlgorithm::ecdsa_with_SHA1,
+                        1, 2, 840, 10045, 4, 1>
+> SignatureAlgorithmMatcher;
+
+enum class KnownDigestAlgorithm { unknown, sha1, sha256, sha384, sha512 };
+
+template <KnownDigestAlgorithm Value, uint32_t... Arcs>
+using KnownDigestAlgorithmOID =
+  OIDMatcherEntry<KnownDigestAlgorithm, Value, EncodedOID<Arcs...>>;
+
+// RFC 4055 Section 2.1
+typedef OIDMatcher<KnownDigestAlgorithm, KnownDigestAlgorithm::unknown,
+  KnownDigestAlgorithmOID<KnownDigestAlgorithm::sha1, 1, 3, 14, 3, 2, 26>,
+  KnownDigestAlgorithmOID<KnownDigestAlgorithm::sha256,
+                          2, 16, 840, 1, 101, 3, 4, 2, 1>,
+  KnownDigestAlgorithmOID<KnownDigestAlgorithm::sha384,
+                          2, 16, 840, 1, 101, 3, 4, 2, 2>,
+  KnownDigestAlgorithmOID<KnownDigestAlgorithm::sha512,
+                          2, 16, 840, 1, 101, 3, 4, 2, 3>
+> DigestAlgorithmMatcher;
+
 } // unnamed namespace
 
 Result
@@ -118,93 +236,53 @@ SignatureAlgorithmIdentifierValue(Reader& input,
   // RSA must be encoded as NULL; we relax that requirement by allowing the
   // NULL to be omitted, to match all the other signature algorithms we support
   // and for compatibility.
-  Reader algorithmID;
+  Input algorithmID;
   Result rv = AlgorithmIdentifierValue(input, algorithmID);
   if (rv != Success) {
     return rv;
   }
 
-  // RFC 5758 Section 3.2 (ecdsa-with-SHA224 is intentionally excluded)
-  // python DottedOIDToCode.py ecdsa-with-SHA256 1.2.840.10045.4.3.2
-  static const uint8_t ecdsa_with_SHA256[] = {
-    0x2a, 0x86, 0x48, 0xce, 0x3d, 0x04, 0x03, 0x02
-  };
-  // python DottedOIDToCode.py ecdsa-with-SHA384 1.2.840.10045.4.3.3
-  static const uint8_t ecdsa_with_SHA384[] = {
-    0x2a, 0x86, 0x48, 0xce, 0x3d, 0x04, 0x03, 0x03
-  };
-  // python DottedOIDToCode.py ecdsa-with-SHA512 1.2.840.10045.4.3.4
-  static const uint8_t ecdsa_with_SHA512[] = {
-    0x2a, 0x86, 0x48, 0xce, 0x3d, 0x04, 0x03, 0x04
-  };
-
-  // RFC 4055 Section 5 (sha224WithRSAEncryption is intentionally excluded)
-  // python DottedOIDToCode.py sha256WithRSAEncryption 1.2.840.113549.1.1.11
-  static const uint8_t sha256WithRSAEncryption[] = {
-    0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x0b
-  };
-  // python DottedOIDToCode.py sha384WithRSAEncryption 1.2.840.113549.1.1.12
-  static const uint8_t sha384WithRSAEncryption[] = {
-    0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x0c
-  };
-  // python DottedOIDToCode.py sha512WithRSAEncryption 1.2.840.113549.1.1.13
-  static const uint8_t sha512WithRSAEncryption[] = {
-    0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x0d
-  };
-
-  // RFC 3279 Section 2.2.1
-  // python DottedOIDToCode.py sha-1WithRSAEncryption 1.2.840.113549.1.1.5
-  static const uint8_t sha_1WithRSAEncryption[] = {
-    0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x05
-  };
-
-  // NIST Open Systems Environment (OSE) Implementor's Workshop (OIW)
-  // http://www.oiw.org/agreements/stable/12s-9412.txt (no longer works).
-  // http://www.imc.org/ietf-pkix/old-archive-97/msg01166.html
-  // We need to support this this non-PKIX OID for compatibility.
-  // python DottedOIDToCode.py sha1WithRSASignature 1.3.14.3.2.29
-  static const uint8_t sha1WithRSASignature[] = {
-    0x2b, 0x0e, 0x03, 0x02, 0x1d
-  };
-
-  // RFC 3279 Section 2.2.3
-  // python DottedOIDToCode.py ecdsa-with-SHA1 1.2.840.10045.4.1
-  static const uint8_t ecdsa_with_SHA1[] = {
-    0x2a, 0x86, 0x48, 0xce, 0x3d, 0x04, 0x01
-  };
-
-  // Matching is attempted based on a rough estimate of the commonality of the
-  // algorithm, to minimize the number of MatchRest calls.
-  if (algorithmID.MatchRest(sha256WithRSAEncryption)) {
-    publicKeyAlgorithm = PublicKeyAlgorithm::RSA_PKCS1;
-    digestAlgorithm = DigestAlgorithm::sha256;
-  } else if (algorithmID.MatchRest(ecdsa_with_SHA256)) {
-    publicKeyAlgorithm = PublicKeyAlgorithm::ECDSA;
-    digestAlgorithm = DigestAlgorithm::sha256;
-  } else if (algorithmID.MatchRest(sha_1WithRSAEncryption)) {
-    publicKeyAlgorithm = PublicKeyAlgorithm::RSA_PKCS1;
-    digestAlgorithm = DigestAlgorithm::sha1;
-  } else if (algorithmID.MatchRest(ecdsa_with_SHA1)) {
-    publicKeyAlgorithm = PublicKeyAlgorithm::ECDSA;
-    digestAlgorithm = DigestAlgorithm::sha1;
-  } else if (algorithmID.MatchRest(ecdsa_with_SHA384)) {
-    publicKeyAlgorithm = PublicKeyAlgorithm::ECDSA;
-    digestAlgorithm = DigestAlgorithm::sha384;
-  } else if (algorithmID.MatchRest(ecdsa_with_SHA512)) {
-    publicKeyAlgorithm = PublicKeyAlgorithm::ECDSA;
-    digestAlgorithm = DigestAlgorithm::sha512;
-  } else if (algorithmID.MatchRest(sha384WithRSAEncryption)) {
-    publicKeyAlgorithm = PublicKeyAlgorithm::RSA_PKCS1;
-    digestAlgorithm = DigestAlgorithm::sha384;
-  } else if (algorithmID.MatchRest(sha512WithRSAEncryption)) {
-    publicKeyAlgorithm = PublicKeyAlgorithm::RSA_PKCS1;
-    digestAlgorithm = DigestAlgorithm::sha512;
-  } else if (algorithmID.MatchRest(sha1WithRSASignature)) {
-    // XXX(bug 1042479): recognize this old OID for compatibility.
-    publicKeyAlgorithm = PublicKeyAlgorithm::RSA_PKCS1;
-    digestAlgorithm = DigestAlgorithm::sha1;
-  } else {
-    return Result::ERROR_CERT_SIGNATURE_ALGORITHM_DISABLED;
+  switch (SignatureAlgorithmMatcher::Match(algorithmID)) {
+    case SignatureAlgorithm::sha256WithRSAEncryption:
+      publicKeyAlgorithm = PublicKeyAlgorithm::RSA_PKCS1;
+      digestAlgorithm = DigestAlgorithm::sha256;
+      break;
+    case SignatureAlgorithm::ecdsa_with_SHA256:
+      publicKeyAlgorithm = PublicKeyAlgorithm::ECDSA;
+      digestAlgorithm = DigestAlgorithm::sha256;
+      break;
+    case SignatureAlgorithm::sha_1WithRSAEncryption:
+      publicKeyAlgorithm = PublicKeyAlgorithm::RSA_PKCS1;
+      digestAlgorithm = DigestAlgorithm::sha1;
+      break;
+    case SignatureAlgorithm::ecdsa_with_SHA1:
+      publicKeyAlgorithm = PublicKeyAlgorithm::ECDSA;
+      digestAlgorithm = DigestAlgorithm::sha1;
+      break;
+    case SignatureAlgorithm::ecdsa_with_SHA384:
+      publicKeyAlgorithm = PublicKeyAlgorithm::ECDSA;
+      digestAlgorithm = DigestAlgorithm::sha384;
+      break;
+    case SignatureAlgorithm::ecdsa_with_SHA512:
+      publicKeyAlgorithm = PublicKeyAlgorithm::ECDSA;
+      digestAlgorithm = DigestAlgorithm::sha512;
+      break;
+    case SignatureAlgorithm::sha384WithRSAEncryption:
+      publicKeyAlgorithm = PublicKeyAlgorithm::RSA_PKCS1;
+      digestAlgorithm = DigestAlgorithm::sha384;
+      break;
+    case SignatureAlgorithm::sha512WithRSAEncryption:
+      publicKeyAlgorithm = PublicKeyAlgorithm::RSA_PKCS1;
+      digestAlgorithm = DigestAlgorithm::sha512;
+      break;
+    case SignatureAlgorithm::sha1WithRSASignature:
+      // XXX(bug 1042479): recognize this old OID for compatibility.
+      publicKeyAlgorithm = PublicKeyAlgorithm::RSA_PKCS1;
+      digestAlgorithm = DigestAlgorithm::sha1;
+      break;
+    case SignatureAlgorithm::unknown:
+      return Result::ERROR_CERT_SIGNATURE_ALGORITHM_DISABLED;
+    MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
   }
 
   return Success;
@@ -213,44 +291,29 @@ SignatureAlgorithmIdentifierValue(Reader& input,
 Result
 DigestAlgorithmIdentifier(Reader& input, /*out*/ DigestAlgorithm& algorithm)
 {
-  Reader r;
   return der::Nested(input, SEQUENCE, [&algorithm](Reader& r) -> Result {
-    Reader algorithmID;
+    Input algorithmID;
     Result rv = AlgorithmIdentifierValue(r, algorithmID);
     if (rv != Success) {
       return rv;
     }
 
-    // RFC 4055 Section 2.1
-    // python DottedOIDToCode.py id-sha1 1.3.14.3.2.26
-    static const uint8_t id_sha1[] = {
-      0x2b, 0x0e, 0x03, 0x02, 0x1a
-    };
-    // python DottedOIDToCode.py id-sha256 2.16.840.1.101.3.4.2.1
-    static const uint8_t id_sha256[] = {
-      0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01
-    };
-    // python DottedOIDToCode.py id-sha384 2.16.840.1.101.3.4.2.2
-    static const uint8_t id_sha384[] = {
-      0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x02
-    };
-    // python DottedOIDToCode.py id-sha512 2.16.840.1.101.3.4.2.3
-    static const uint8_t id_sha512[] = {
-      0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x03
-    };
-
-    // Matching is attempted based on a rough estimate of the commonality of the
-    // algorithm, to minimize the number of MatchRest calls.
-    if (algorithmID.MatchRest(id_sha1)) {
-      algorithm = DigestAlgorithm::sha1;
-    } else if (algorithmID.MatchRest(id_sha256)) {
-      algorithm = DigestAlgorithm::sha256;
-    } else if (algorithmID.MatchRest(id_sha384)) {
-      algorithm = DigestAlgorithm::sha384;
-    } else if (algorithmID.MatchRest(id_sha512)) {
-      algorithm = DigestAlgorithm::sha512;
-    } else {
-      return Result::ERROR_INVALID_ALGORITHM;
+    switch (DigestAlgorithmMatcher::Match(algorithmID)) {
+      case KnownDigestAlgorithm::sha1:
+        algorithm = DigestAlgorithm::sha1;
+        break;
+      case KnownDigestAlgorithm::sha256:
+        algorithm = DigestAlgorithm::sha256;
+        break;
+      case KnownDigestAlgorithm::sha384:
+        algorithm = DigestAlgorithm::sha384;
+        break;
+      case KnownDigestAlgorithm::sha512:
+        algorithm = DigestAlgorithm::sha512;
+        break;
+      case KnownDigestAlgorithm::unknown:
+        return Result::ERROR_INVALID_ALGORITHM;
+      MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
     }
 
     return Success;
@@ -311,41 +374,85 @@ BitStringWithNoUnusedBits(Reader& input, /*out*/ Input& value)
   return valueWithUnusedBits.SkipToEnd(value);
 }
 
-static inline Result
-ReadDigit(Reader& input, /*out*/ unsigned int& value)
+namespace {
+
+const uint64_t EVERY_BYTE_0x30 = 0x3030303030303030u;
+const uint64_t EVERY_BYTE_0x0F = 0x0f0f0f0f0f0f0f0fu;
+const uint64_t EVERY_BYTE_0xF0 = 0xf0f0f0f0f0f0f0f0u;
+const uint64_t EVERY_BYTE_0x06 = 0x0606060606060606u;
+const uint64_t EVERY_EVEN_BYTE_0xFF = 0x00ff00ff00ff00ffu;
+
+// Byte i of the result is input[i], regardless of the byte order of the
+// platform.
+inline uint64_t
+LoadLittleEndian64(const uint8_t* input)
 {
-  uint8_t b;
-  if (input.Read(b) != Success) {
-    return Result::ERROR_INVALID_DER_TIME;
-  }
-  if (b < '0' || b > '9') {
-    return Result::ERROR_INVALID_DER_TIME;
-  }
-  value = static_cast<unsigned int>(b - static_cast<uint8_t>('0'));
-  return Success;
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || \
+    defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM)
+  uint64_t result;
+  std::memcpy(&result, input, sizeof(result));
+  return result;
+#else
+  return static_cast<uint64_t>(input[0])         |
+         (static_cast<uint64_t>(input[1]) <<  8) |
+         (static_cast<uint64_t>(input[2]) << 16) |
+         (static_cast<uint64_t>(input[3]) << 24) |
+         (static_cast<uint64_t>(input[4]) << 32) |
+         (static_cast<uint64_t>(input[5]) << 40) |
+         (static_cast<uint64_t>(input[6]) << 48) |
+         (static_cast<uint64_t>(input[7]) << 56);
+#endif
 }
 
-static inline Result
-ReadTwoDigits(Reader& input, unsigned int minValue, unsigned int maxValue,
-              /*out*/ unsigned int& value)
+// Every byte is an ASCII digit if and only if its high nibble is 3 and adding
+// 6 to it doesn't carry out of its low nibble. Neither check can carry
+// between bytes.
+inline bool
+AllDigits(uint64_t eightChars)
 {
-  unsigned int hi;
-  Result rv = ReadDigit(input, hi);
-  if (rv != Success) {
-    return rv;
-  }
-  unsigned int lo;
-  rv = ReadDigit(input, lo);
-  if (rv != Success) {
-    return rv;
-  }
-  value = (hi * 10) + lo;
-  if (value < minValue || value > maxValue) {
-    return Result::ERROR_INVALID_DER_TIME;
-  }
-  return Success;
+  return (eightChars & EVERY_BYTE_0xF0) == EVERY_BYTE_0x30 &&
+         ((eightChars + EVERY_BYTE_0x06) & EVERY_BYTE_0xF0) == EVERY_BYTE_0x30;
+}
+
+// Converts eight ASCII digits (as checked by AllDigits) into four two-digit
+// values, each in an even byte of the result.
+inline uint64_t
+TwoDigitValues(uint64_t eightDigits)
+{
+  uint64_t digits = eightDigits & EVERY_BYTE_0x0F;
+  return ((digits * 10u) + (digits >> 8)) & EVERY_EVEN_BYTE_0xFF;
+}
+
+inline unsigned int
+TwoDigitValue(uint64_t twoDigitValues, unsigned int index)
+{
+  return static_cast<unsigned int>((twoDigitValues >> (16u * index)) & 0xffu);
+}
+
+// The same as DaysBeforeYear((century * 100) + yearOfCentury), but without
+// any division, which is the most expensive part of DaysBeforeYear.
+inline unsigned int
+DaysBeforeYear(unsigned int century, unsigned int yearOfCentury)
+{
+  // year - 1 == (century * 100) + (yearOfCentury - 1), where
+  // 0 <= yearOfCentury - 1 < 100, so that (year - 1) / 100 == century and
+  // (year - 1) / 400 == century / 4.
+  if (yearOfCentury == 0) {
+    --century;
+    yearOfCentury = 100;
+  }
+  unsigned int yearsBefore = (century * 100u) + (yearOfCentury - 1u);
+  return (yearsBefore * 365u)
+       + (century * 25u) + ((yearOfCentury - 1u) / 4u) // every 4 years,
+       - century                                       // except every 100,
+       + (century / 4u);                               // except every 400.
 }
 
+const size_t UTC_TIME_LENGTH = 13; // YYMMDDHHMMSSZ
+const size_t GENERALIZED_TIME_LENGTH = 15; // YYYYMMDDHHMMSSZ
+
+} // unnamed namespace
+
 namespace internal {
 
 // We parse GeneralizedTime and UTCTime according to RFC 5280 and we do not
@@ -353,126 +460,97 @@ namespace internal {
 // GeneralizedTime must always be in the format YYYYMMDDHHMMSSZ and UTCTime
 // must always be in the format YYMMDDHHMMSSZ. Timezone formats of the form
 // +HH:MM or -HH:MM or NOT accepted.
+//
+// Since both formats have a fixed length, the value is loaded as two 64-bit
+// words in the GeneralizedTime layout, and all fourteen digits are validated
+// and converted a word at a time instead of one digit at a time.
 Result
 TimeChoice(Reader& tagged, uint8_t expectedTag, /*out*/ Time& time)
 {
-  unsigned int days;
-
-  Reader input;
-  Result rv = ExpectTagAndGetValue(tagged, expectedTag, input);
+  Input value;
+  Result rv = ExpectTagAndGetValue(tagged, expectedTag, value);
   if (rv != Success) {
     return rv;
   }
 
-  unsigned int yearHi;
-  unsigned int yearLo;
+  // date is YYYYMMDD and timeOfDay is HHMMSSZ followed by a zero byte, with
+  // the century of a UTCTime filled in as "00" for now.
+  const uint8_t* chars = value.UnsafeGetData();
+  uint64_t date;
+  uint64_t timeOfDay;
   if (expectedTag == GENERALIZED_TIME) {
-    rv = ReadTwoDigits(input, 0, 99, yearHi);
-    if (rv != Success) {
-      return rv;
-    }
-    rv = ReadTwoDigits(input, 0, 99, yearLo);
-    if (rv != Success) {
-      return rv;
+    if (value.GetLength() != GENERALIZED_TIME_LENGTH) {
+      return Result::ERROR_INVALID_DER_TIME;
     }
+    date = LoadLittleEndian64(chars);
+    timeOfDay = LoadLittleEndian64(chars + 7) >> 8;
   } else if (expectedTag == UTCTime) {
-    rv = ReadTwoDigits(input, 0, 99, yearLo);
-    if (rv != Success) {
-      return rv;
+    if (value.GetLength() != UTC_TIME_LENGTH) {
+      return Result::ERROR_INVALID_DER_TIME;
     }
-    yearHi = yearLo >= 50u ? 19u : 20u;
+    date = (LoadLittleEndian64(chars) << 16) | 0x3030u;
+    timeOfDay = LoadLittleEndian64(chars + 5) >> 8;
   } else {
     return NotReached("invalid tag given to TimeChoice",
                       Result::ERROR_INVALID_DER_TIME);
   }
-  unsigned int year = (yearHi * 100u) + yearLo;
-  if (year < 1970u) {
-    // We don't support dates before January 1, 1970 because that is the epoch.
+
+  if ((timeOfDay >> 48) != 'Z') {
     return Result::ERROR_INVALID_DER_TIME;
   }
-  days = DaysBeforeYear(year);
+  // Replace the Z and the zero byte with digits so that AllDigits is simple.
+  timeOfDay = (timeOfDay & 0x0000ffffffffffffu) | 0x3030000000000000u;
 
-  unsigned int month;
-  rv = ReadTwoDigits(input, 1u, 12u, month);
-  if (rv != Success) {
-    return rv;
-  }
-  unsigned int daysInMonth;
-  static const unsigned int jan = 31u;
-  const unsigned int feb = ((year % 4u == 0u) &&
-                           ((year % 100u != 0u) || (year % 400u == 0u)))
-                         ? 29u
-                         : 28u;
-  static const unsigned int mar = 31u;
-  static const unsigned int apr = 30u;
-  static const unsigned int may = 31u;
-  static const unsigned int jun = 30u;
-  static const unsigned int jul = 31u;
-  static const unsigned int aug = 31u;
-  static const unsigned int sep = 30u;
-  static const unsigned int oct = 31u;
-  static const unsigned int nov = 30u;
-  static const unsigned int dec = 31u;
-  switch (month) {
-    case 1:  daysInMonth = jan; break;
-    case 2:  daysInMonth = feb; days += jan; break;
-    case 3:  daysInMonth = mar; days += jan + feb; break;
-    case 4:  daysInMonth = apr; days += jan + feb + mar; break;
-    case 5:  daysInMonth = may; days += jan + feb + mar + apr; break;
-    case 6:  daysInMonth = jun; days += jan + feb + mar + apr + may; break;
-    case 7:  daysInMonth = jul; days += jan + feb + mar + apr + may + jun;
-             break;
-    case 8:  daysInMonth = aug; days += jan + feb + mar + apr + may + jun +
-                                        jul;
-             break;
-    case 9:  daysInMonth = sep; days += jan + feb + mar + apr + may + jun +
-                                        jul + aug;
-             break;
-    case 10: daysInMonth = oct; days += jan + feb + mar + apr + may + jun +
-                                        jul + aug + sep;
-             break;
-    case 11: daysInMonth = nov; days += jan + feb + mar + apr + may + jun +
-                                        jul + aug + sep + oct;
-             break;
-    case 12: daysInMonth = dec; days += jan + feb + mar + apr + may + jun +
-                                        jul + aug + sep + oct + nov;
-             break;
-    default:
-      return NotReached("month already bounds-checked by ReadTwoDigits",
-                        Result::FATAL_ERROR_INVALID_STATE);
-  }
-
-  unsigned int dayOfMonth;
-  rv = ReadTwoDigits(input, 1u, daysInMonth, dayOfMonth);
-  if (rv != Success) {
-    return rv;
+  if (!AllDigits(date) || !AllDigits(timeOfDay)) {
+    return Result::ERROR_INVALID_DER_TIME;
   }
-  days += dayOfMonth - 1;
+  date = TwoDigitValues(date);
+  timeOfDay = TwoDigitValues(timeOfDay);
 
-  unsigned int hours;
-  rv = ReadTwoDigits(input, 0u, 23u, hours);
-  if (rv != Success) {
-    return rv;
-  }
-  unsigned int minutes;
-  rv = ReadTwoDigits(input, 0u, 59u, minutes);
-  if (rv != Success) {
-    return rv;
-  }
-  unsigned int seconds;
-  rv = ReadTwoDigits(input, 0u, 59u, seconds);
-  if (rv != Success) {
-    return rv;
+  unsigned int yearLo = TwoDigitValue(date, 1);
+  unsigned int yearHi = expectedTag == GENERALIZED_TIME
+                      ? TwoDigitValue(date, 0)
+                      : yearLo >= 50u ? 19u : 20u;
+  unsigned int year = (yearHi * 100u) + yearLo;
+  if (year < 1970u) {
+    // We don't support dates before January 1, 1970 because that is the epoch.
+    return Result::ERROR_INVALID_DER_TIME;
   }
 
-  uint8_t b;
-  if (input.Read(b) != Success) {
+  unsigned int month = TwoDigitValue(date, 2);
+  if (month < 1u || month > 12u) {
     return Result::ERROR_INVALID_DER_TIME;
   }
-  if (b != 'Z') {
+  static const unsigned int DAYS_IN_MONTH[12] = {
+    31u, 28u, 31u, 30u, 31u, 30u, 31u, 31u, 30u, 31u, 30u, 31u
+  };
+  static const unsigned int DAYS_BEFORE_MONTH[12] = {
+    0u, 31u, 59u, 90u, 120u, 151u, 181u, 212u, 243u, 273u, 304u, 334u
+  };
+  // year % 100 == yearLo and year / 100 == yearHi.
+  const bool isLeapYear = (yearLo % 4u == 0u) &&
+                          ((yearLo != 0u) || (yearHi % 4u == 0u));
+  unsigned int daysInMonth = DAYS_IN_MONTH[month - 1u];
+  unsigned int days = DaysBeforeYear(yearHi, yearLo) +
+                      DAYS_BEFORE_MONTH[month - 1u];
+  if (isLeapYear) {
+    if (month == 2u) {
+      daysInMonth += 1u;
+    } else if (month > 2u) {
+      days += 1u;
+    }
+  }
+
+  unsigned int dayOfMonth = TwoDigitValue(date, 3);
+  if (dayOfMonth < 1u || dayOfMonth > daysInMonth) {
     return Result::ERROR_INVALID_DER_TIME;
   }
-  if (End(input) != Success) {
+  days += dayOfMonth - 1;
+
+  unsigned int hours = TwoDigitValue(timeOfDay, 0);
+  unsigned int minutes = TwoDigitValue(timeOfDay, 1);
+  unsigned int seconds = TwoDigitValue(timeOfDay, 2);
+  if (hours > 23u || minutes > 59u || seconds > 59u) {
     return Result::ERROR_INVALID_DER_TIME;
   }
 
@@ -605,4 +683,140 @@ OptionalVersion(Reader& input, /*out*/ Version& version)
   });
 }
 
+Writer::Writer(/*out*/ EncodedLengths& lengths)
+  : measuring(&lengths)
+  , lengths(lengths)
+  , buffer(nullptr)
+  , bufferLength(0)
+  , length(0)
+  , nextNested(0)
+  , depth(0)
+{
+  lengths.count = 0;
+}
+
+Writer::Writer(const EncodedLengths& lengths, /*out*/ uint8_t* buffer,
+               size_t bufferLength)
+  : measuring(nullptr)
+  , lengths(lengths)
+  , buffer(buffer)
+  , bufferLength(bufferLength)
+  , length(0)
+  , nextNested(0)
+  , depth(0)
+{
+}
+
+Result
+Writer::Write(const uint8_t* data, size_t dataLength)
+{
+  if (measuring) {
+    if (dataLength > std::numeric_limits<size_t>::max() - length) {
+      return Result::FATAL_ERROR_INVALID_ARGS;
+    }
+    length += dataLength;
+    return Success;
+  }
+  // The writing pass is given a buffer of exactly the measured length, so
+  // running out of space means that the passes made different calls.
+  if (dataLength > bufferLength - length) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  if (dataLength > 0) {
+    std::memcpy(buffer + length, data, dataLength);
+    length += dataLength;
+  }
+  return Success;
+}
+
+Result
+Writer::WriteTagAndLength(uint8_t tag, size_t valueLength)
+{
+  if (static_cast<uint64_t>(valueLength) > 0xFFFFFFFFu) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  uint8_t header[1 + 1 + 4];
+  size_t headerLength = 0;
+  header[headerLength++] = tag;
+  if (valueLength < 128) {
+    header[headerLength++] = static_cast<uint8_t>(valueLength);
+  } else {
+    uint8_t lengthBytes = valueLength < 0x100u ? 1
+                        : valueLength < 0x10000u ? 2
+                        : valueLength < 0x1000000u ? 3
+                        : 4;
+    header[headerLength++] = 0x80u | lengthBytes;
+    for (uint8_t i = lengthBytes; i > 0; --i) {
+      header[headerLength++] =
+        static_cast<uint8_t>(valueLength >> (8u * (i - 1u)));
+    }
+  }
+  return Write(header, headerLength);
+}
+
+Result
+Writer::BeginNested(uint8_t tag)
+{
+  if (depth == MAX_DEPTH) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  size_t index;
+  if (measuring) {
+    if (measuring->count == EncodedLengths::MAX_NESTED) {
+      return Result::FATAL_ERROR_INVALID_ARGS;
+    }
+    index = measuring->count++;
+    // The length of the length isn't known until the value has been measured,
+    // so only the tag is counted here; EndNested counts the length.
+    Result rv = Write(&tag, 1);
+    if (rv != Success) {
+      return rv;
+    }
+  } else {
+    if (nextNested == lengths.count) {
+      return Result::FATAL_ERROR_INVALID_STATE;
+    }
+    index = nextNested++;
+    Result rv = WriteTagAndLength(tag, lengths.lengths[index]);
+    if (rv != Success) {
+      return rv;
+    }
+  }
+  openStarts[depth] = length;
+  openIndexes[depth] = index;
+  ++depth;
+  return Success;
+}
+
+Result
+Writer::EndNested()
+{
+  if (depth == 0) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  --depth;
+  size_t valueLength = length - openStarts[depth];
+  size_t index = openIndexes[depth];
+  if (!measuring) {
+    if (valueLength != lengths.lengths[index]) {
+      return Result::FATAL_ERROR_INVALID_STATE;
+    }
+    return Success;
+  }
+  if (static_cast<uint64_t>(valueLength) > 0xFFFFFFFFu) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  measuring->lengths[index] = static_cast<uint32_t>(valueLength);
+  size_t lengthLength = valueLength < 0x80u ? 1
+                      : valueLength < 0x100u ? 2
+                      : valueLength < 0x10000u ? 3
+                      : valueLength < 0x1000000u ? 4
+                      : 5;
+  if (lengthLength > std::numeric_limits<size_t>::max() - length) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  length += lengthLength;
+  return Success;
+}
+
 } } } // namespace mozilla::pkix::der
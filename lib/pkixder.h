@@ -37,6 +37,8 @@
 // they are able to do so; otherwise they fail with the input mark in an
 // undefined state.
 
+#include <type_traits>
+
 #include "pkix/Input.h"
 #include "pkix/pkixtypes.h"
 
@@ -78,8 +80,41 @@ enum class EmptyAllowed { No = 0, Yes = 1 };
 
 Result ReadTagAndGetValue(Reader& input, /*out*/ uint8_t& tag,
                           /*out*/ Input& value);
+
+// Reads the tag and length of a TLV, leaving input positioned at the start of
+// the value. Unlike ReadTagAndGetValue, lengths of up to 2^32 - 1 are accepted
+// and the value doesn't need to be available in input, so that structures
+// that are too large for Input can be processed piece by piece.
+Result ReadTagAndGetLength(Reader& input, /*out*/ uint8_t& tag,
+                           /*out*/ uint32_t& length);
 Result End(Reader& input);
 
+// The length of the tag and length at the start of partial, the part of an
+// encoding that has been received so far (e.g. over the network), as given by
+// its first two bytes. Once partial is at least that long, the tag and length
+// can be read with ReadTagAndGetLength, and the TLV has been received
+// completely once the rest of partial is at least as long as the value. If
+// partial is shorter than two bytes, or its first two bytes aren't the start
+// of a valid tag and length, the result is 2, so that ReadTagAndGetLength
+// reports any error once two bytes have been received.
+inline Input::size_type
+TagAndLengthLength(Input partial)
+{
+  Reader input(partial);
+  uint8_t tag;
+  uint8_t length1;
+  if (input.Read(tag) != Success || input.Read(length1) != Success) {
+    return 2;
+  }
+  // See ReadTagAndGetLength for the long form of the length.
+  size_t lengthBytes = length1 & 0x7F;
+  if (!(length1 & 0x80) || lengthBytes < 1 ||
+      lengthBytes > sizeof(uint32_t)) {
+    return 2;
+  }
+  return static_cast<Input::size_type>(2 + lengthBytes);
+}
+
 inline Result
 ExpectTagAndGetValue(Reader& input, uint8_t tag, /*out*/ Input& value)
 {
@@ -257,6 +292,181 @@ ExpectTagAndGetValueAtEnd(Input outer, uint8_t expectedTag,
   return ExpectTagAndGetValueAtEnd(outerReader, expectedTag, inner);
 }
 
+// Large structures
+//
+// These are the equivalents of the above functions for LargeReader. Elements
+// within a large structure that are read into an Input or Reader must fit in
+// one; ERROR_BAD_DER is returned otherwise.
+
+Result ReadTagAndGetValue(LargeReader& input, /*out*/ uint8_t& tag,
+                          /*out*/ LargeInput& value);
+Result ReadTagAndGetLength(LargeReader& input, /*out*/ uint8_t& tag,
+                           /*out*/ uint32_t& length);
+
+inline Result
+End(LargeReader& input)
+{
+  if (!input.AtEnd()) {
+    return Result::ERROR_BAD_DER;
+  }
+
+  return Success;
+}
+
+inline Result
+ExpectTagAndGetValue(LargeReader& input, uint8_t tag,
+                     /*out*/ LargeInput& value)
+{
+  uint8_t actualTag;
+  Result rv = ReadTagAndGetValue(input, actualTag, value);
+  if (rv != Success) {
+    return rv;
+  }
+  if (tag != actualTag) {
+    return Result::ERROR_BAD_DER;
+  }
+  return Success;
+}
+
+inline Result
+ExpectTagAndGetValue(LargeReader& input, uint8_t tag,
+                     /*out*/ LargeReader& value)
+{
+  LargeInput valueInput;
+  Result rv = ExpectTagAndGetValue(input, tag, valueInput);
+  if (rv != Success) {
+    return rv;
+  }
+  return value.Init(valueInput);
+}
+
+inline Result
+ExpectTagAndGetValue(LargeReader& input, uint8_t tag, /*out*/ Input& value)
+{
+  LargeInput valueInput;
+  Result rv = ExpectTagAndGetValue(input, tag, valueInput);
+  if (rv != Success) {
+    return rv;
+  }
+  return valueInput.ToInput(value);
+}
+
+inline Result
+ExpectTagAndGetValue(LargeReader& input, uint8_t tag, /*out*/ Reader& value)
+{
+  Input valueInput;
+  Result rv = ExpectTagAndGetValue(input, tag, valueInput);
+  if (rv != Success) {
+    return rv;
+  }
+  return value.Init(valueInput);
+}
+
+inline Result
+ExpectTagAndSkipValue(LargeReader& input, uint8_t tag)
+{
+  LargeInput ignoredValue;
+  return ExpectTagAndGetValue(input, tag, ignoredValue);
+}
+
+inline Result
+ExpectTagAndGetTLV(LargeReader& input, uint8_t tag, /*out*/ LargeInput& tlv)
+{
+  LargeReader::Mark mark(input.GetMark());
+  Result rv = ExpectTagAndSkipValue(input, tag);
+  if (rv != Success) {
+    return rv;
+  }
+  return input.GetInput(mark, tlv);
+}
+
+inline Result
+ExpectTagAndGetTLV(LargeReader& input, uint8_t tag, /*out*/ Input& tlv)
+{
+  LargeReader::Mark mark(input.GetMark());
+  Result rv = ExpectTagAndSkipValue(input, tag);
+  if (rv != Success) {
+    return rv;
+  }
+  return input.GetInput(mark, tlv);
+}
+
+// The decoder is given a LargeReader.
+template <typename Decoder>
+inline Result
+Nested(LargeReader& input, uint8_t tag, Decoder decoder)
+{
+  LargeReader nested;
+  Result rv = ExpectTagAndGetValue(input, tag, nested);
+  if (rv != Success) {
+    return rv;
+  }
+  rv = decoder(nested);
+  if (rv != Success) {
+    return rv;
+  }
+  return End(nested);
+}
+
+// Unlike Nested, the decoder is given a Reader for each element, since the
+// elements of large lists (the entries of a CRL, the certificates in a
+// bundle, the SingleResponses of an OCSP response) are small.
+template <typename Decoder>
+inline Result
+NestedOf(LargeReader& input, uint8_t outerTag, uint8_t innerTag,
+         EmptyAllowed mayBeEmpty, Decoder decoder)
+{
+  LargeReader inner;
+  Result rv = ExpectTagAndGetValue(input, outerTag, inner);
+  if (rv != Success) {
+    return rv;
+  }
+
+  if (inner.AtEnd()) {
+    if (mayBeEmpty != EmptyAllowed::Yes) {
+      return Result::ERROR_BAD_DER;
+    }
+    return Success;
+  }
+
+  do {
+    Reader element;
+    rv = ExpectTagAndGetValue(inner, innerTag, element);
+    if (rv != Success) {
+      return rv;
+    }
+    rv = decoder(element);
+    if (rv != Success) {
+      return rv;
+    }
+    rv = End(element);
+    if (rv != Success) {
+      return rv;
+    }
+  } while (!inner.AtEnd());
+
+  return Success;
+}
+
+inline Result
+ExpectTagAndGetValueAtEnd(LargeReader& outer, uint8_t expectedTag,
+                          /*out*/ LargeReader& inner)
+{
+  Result rv = der::ExpectTagAndGetValue(outer, expectedTag, inner);
+  if (rv != Success) {
+    return rv;
+  }
+  return der::End(outer);
+}
+
+inline Result
+ExpectTagAndGetValueAtEnd(LargeInput outer, uint8_t expectedTag,
+                          /*out*/ LargeReader& inner)
+{
+  LargeReader outerReader(outer);
+  return ExpectTagAndGetValueAtEnd(outerReader, expectedTag, inner);
+}
+
 // Universal types
 
 namespace internal {
@@ -435,6 +645,363 @@ OID(Reader& input, const uint8_t (&expectedOid)[Len])
   return Success;
 }
 
+// Object identifiers known at compile time
+//
+// EncodedOID<arc1, arc2, ...> is the DER encoding of the value (without the
+// tag and length) of the OBJECT IDENTIFIER with the given arcs, computed at
+// compile time. Its static member bytes is the encoding:
+//
+//    // id-ce-keyUsage 2.5.29.15
+//    typedef der::EncodedOID<2, 5, 29, 15> id_ce_keyUsage;
+//
+//    if (value.MatchRest(id_ce_keyUsage::bytes)) { /*...*/ }
+//
+// OIDMatcher<Enum, notFound, entries...>::Match identifies an OID value by
+// comparing a small integer key, made of its length and its first and last
+// bytes, with the keys of the entries, which are constants computed at compile
+// time, and then comparing the whole value with the entry that has the same
+// key. The key comparisons are expanded inline, so the compiler can turn them
+// into a switch, and the values of unknown OIDs are rarely compared at all.
+// For example:
+//
+//    enum class Curve { Unknown, secp256r1, secp384r1 };
+//    typedef der::OIDMatcher<Curve, Curve::Unknown,
+//      der::OIDMatcherEntry<Curve, Curve::secp256r1,
+//                           der::EncodedOID<1, 2, 840, 10045, 3, 1, 7>>,
+//      der::OIDMatcherEntry<Curve, Curve::secp384r1,
+//                           der::EncodedOID<1, 3, 132, 0, 34>>
+//    > CurveMatcher;
+//
+//    Curve curve = CurveMatcher::Match(oidValue);
+
+namespace internal {
+
+// The key of an OID value. OIDs that are matched together usually differ in
+// their lengths or their last arcs (e.g. the arcs under id-ce or id-kp), so
+// their keys rarely collide.
+inline constexpr uint32_t
+OIDKey(size_t length, uint8_t first, uint8_t last)
+{
+  return static_cast<uint32_t>(length) |
+         (static_cast<uint32_t>(first) << 16) |
+         (static_cast<uint32_t>(last) << 24);
+}
+
+inline constexpr uint8_t
+LastOIDByte(uint8_t last)
+{
+  return last;
+}
+
+template <typename... Bytes>
+inline constexpr uint8_t
+LastOIDByte(uint8_t, uint8_t second, Bytes... rest)
+{
+  return LastOIDByte(second, rest...);
+}
+
+template <uint8_t First, uint8_t... Rest>
+struct EncodedOIDBytes final
+{
+  static constexpr uint8_t bytes[1 + sizeof...(Rest)] = { First, Rest... };
+  static constexpr uint32_t key =
+    OIDKey(1 + sizeof...(Rest), First, LastOIDByte(First, Rest...));
+};
+
+template <uint8_t First, uint8_t... Rest>
+constexpr uint8_t EncodedOIDBytes<First, Rest...>::bytes[1 + sizeof...(Rest)];
+template <uint8_t First, uint8_t... Rest>
+constexpr uint32_t EncodedOIDBytes<First, Rest...>::key;
+
+template <typename A, typename B> struct ConcatenateOIDBytes;
+
+template <uint8_t... A, uint8_t... B>
+struct ConcatenateOIDBytes<EncodedOIDBytes<A...>, EncodedOIDBytes<B...>>
+{
+  typedef EncodedOIDBytes<A..., B...> type;
+};
+
+// The base-128 encoding of an arc (or the first two arcs combined), with the
+// high bit set in every byte but the last.
+template <uint32_t Arc, uint8_t HighBit = 0, bool LastByte = (Arc < 0x80)>
+struct EncodeOIDArc
+{
+  typedef EncodedOIDBytes<static_cast<uint8_t>(Arc | HighBit)> type;
+};
+
+template <uint32_t Arc, uint8_t HighBit>
+struct EncodeOIDArc<Arc, HighBit, false>
+{
+  typedef typename ConcatenateOIDBytes<
+    typename EncodeOIDArc<(Arc >> 7), 0x80>::type,
+    EncodedOIDBytes<static_cast<uint8_t>((Arc & 0x7f) | HighBit)>
+  >::type type;
+};
+
+template <uint32_t First, uint32_t... Rest>
+struct EncodeOIDArcs
+{
+  typedef typename ConcatenateOIDBytes<
+    typename EncodeOIDArc<First>::type,
+    typename EncodeOIDArcs<Rest...>::type
+  >::type type;
+};
+
+template <uint32_t Last>
+struct EncodeOIDArcs<Last>
+{
+  typedef typename EncodeOIDArc<Last>::type type;
+};
+
+template <uint32_t First, uint32_t Second, uint32_t... Rest>
+struct EncodeOID
+{
+  static_assert(First < 2 ? Second < 40
+                          : First == 2 && Second < 0xffffffffu - 80,
+                "invalid object identifier");
+  typedef typename EncodeOIDArcs<(First * 40) + Second, Rest...>::type type;
+};
+
+// Compares key with the key of each entry in turn. Entries with the same key
+// have the same length. They may share a key, so keep looking after a
+// mismatch.
+template <typename Enum, Enum NotFound, typename... Entries>
+struct MatchOIDEntries
+{
+  static Enum Match(uint32_t, const uint8_t*)
+  {
+    return NotFound;
+  }
+};
+
+template <typename Enum, Enum NotFound, typename Entry, typename... Rest>
+struct MatchOIDEntries<Enum, NotFound, Entry, Rest...>
+{
+  static Enum Match(uint32_t key, const uint8_t* data)
+  {
+    if (key == Entry::oid::key &&
+        !std::memcmp(Entry::oid::bytes, data, sizeof(Entry::oid::bytes))) {
+      return Entry::value;
+    }
+    return MatchOIDEntries<Enum, NotFound, Rest...>::Match(key, data);
+  }
+};
+
+// Two OIDs are the same if and only if their EncodedOIDBytes types are.
+template <typename OIDType, typename... Entries>
+struct OIDIsIn
+{
+  static constexpr bool value = false;
+};
+
+template <typename OIDType, typename Entry, typename... Rest>
+struct OIDIsIn<OIDType, Entry, Rest...>
+{
+  static constexpr bool value =
+    std::is_same<OIDType, typename Entry::oid>::value ||
+    OIDIsIn<OIDType, Rest...>::value;
+};
+
+template <typename... Entries>
+struct OIDsAreDistinct
+{
+  static constexpr bool value = true;
+};
+
+template <typename Entry, typename... Rest>
+struct OIDsAreDistinct<Entry, Rest...>
+{
+  static constexpr bool value =
+    !OIDIsIn<typename Entry::oid, Rest...>::value &&
+    OIDsAreDistinct<Rest...>::value;
+};
+
+} // namespace internal
+
+template <uint32_t... Arcs>
+using EncodedOID = typename internal::EncodeOID<Arcs...>::type;
+
+template <typename Enum, Enum Value, typename OIDType>
+struct OIDMatcherEntry final
+{
+  static constexpr Enum value = Value;
+  typedef OIDType oid;
+};
+
+template <typename Enum, Enum NotFound, typename... Entries>
+struct OIDMatcher final
+{
+  static_assert(sizeof...(Entries) > 0, "OIDMatcher needs entries");
+  static_assert(internal::OIDsAreDistinct<Entries...>::value,
+                "OIDMatcher entries must have distinct OIDs");
+
+  static Enum Match(Input value)
+  {
+    size_t length = value.GetLength();
+    if (length == 0) {
+      return NotFound;
+    }
+    const uint8_t* data = value.UnsafeGetData();
+    return internal::MatchOIDEntries<Enum, NotFound, Entries...>::Match(
+             internal::OIDKey(length, data[0], data[length - 1]), data);
+  }
+};
+
+// Encoding
+//
+// Writer produces DER without any intermediate buffers by running the same
+// encoding function twice. In the first pass, MeasureEncoding only counts
+// bytes, recording the length of each nested TLV in an EncodedLengths as the
+// TLV is closed. In the second pass, WriteEncoding writes into a buffer of
+// exactly the measured length, taking each TLV's length from the
+// EncodedLengths in the order the TLVs were opened. Consequently, the
+// encoding function must make the same calls in both passes.
+//
+//   EncodedLengths lengths;
+//   size_t length;
+//   rv = MeasureEncoding(lengths, encode, length);
+//   ...
+//   rv = WriteEncoding(lengths, encode, buffer, length);
+//
+// where encode is a function or lambda like:
+//
+//   [&](Writer& output) -> Result {
+//     return Nested(output, SEQUENCE, [&](Writer& sequence) {
+//       return TLV(sequence, OCTET_STRING, value);
+//     });
+//   }
+
+class Writer;
+
+class EncodedLengths final
+{
+public:
+  // The maximum number of TLVs that may be opened with Nested (at any
+  // depth) in a single encoding.
+  static const size_t MAX_NESTED = 64;
+
+  EncodedLengths() : count(0) { }
+
+private:
+  uint32_t lengths[MAX_NESTED];
+  size_t count;
+
+  friend class Writer;
+
+  EncodedLengths(const EncodedLengths&) = delete;
+  void operator=(const EncodedLengths&) = delete;
+};
+
+class Writer final
+{
+public:
+  // Constructs a writer for the measuring pass.
+  explicit Writer(/*out*/ EncodedLengths& lengths);
+
+  // Constructs a writer for the writing pass, which writes at most
+  // bufferLength bytes to buffer.
+  Writer(const EncodedLengths& lengths, /*out*/ uint8_t* buffer,
+         size_t bufferLength);
+
+  Result Write(uint8_t b)
+  {
+    return Write(&b, 1);
+  }
+
+  Result Write(Input input)
+  {
+    return Write(input.UnsafeGetData(), input.GetLength());
+  }
+
+  Result Write(const uint8_t* data, size_t dataLength);
+
+  // Writes a tag and a length, which the caller must follow with exactly
+  // length bytes of value. This is useful when the length of the value is
+  // already known; otherwise, use Nested.
+  Result WriteTagAndLength(uint8_t tag, size_t length);
+
+  // The building blocks of Nested.
+  Result BeginNested(uint8_t tag);
+  Result EndNested();
+
+  // The number of bytes measured or written so far.
+  size_t GetLength() const { return length; }
+
+  // The maximum depth of TLVs opened with Nested.
+  static const size_t MAX_DEPTH = 16;
+
+private:
+  EncodedLengths* const measuring; // nullptr in the writing pass
+  const EncodedLengths& lengths;
+  uint8_t* const buffer;
+  const size_t bufferLength;
+  size_t length;
+  size_t nextNested; // index into lengths in the writing pass
+
+  size_t openStarts[MAX_DEPTH];
+  size_t openIndexes[MAX_DEPTH];
+  size_t depth;
+
+  Writer(const Writer&) = delete;
+  void operator=(const Writer&) = delete;
+};
+
+inline Result
+TLV(Writer& output, uint8_t tag, Input value)
+{
+  Result rv = output.WriteTagAndLength(tag, value.GetLength());
+  if (rv != Success) {
+    return rv;
+  }
+  return output.Write(value);
+}
+
+template <typename Encoder>
+inline Result
+Nested(Writer& output, uint8_t tag, Encoder encode)
+{
+  Result rv = output.BeginNested(tag);
+  if (rv != Success) {
+    return rv;
+  }
+  rv = encode(output);
+  if (rv != Success) {
+    return rv;
+  }
+  return output.EndNested();
+}
+
+template <typename Encoder>
+inline Result
+MeasureEncoding(/*out*/ EncodedLengths& lengths, Encoder encode,
+                /*out*/ size_t& length)
+{
+  Writer output(lengths);
+  Result rv = encode(output);
+  if (rv != Success) {
+    return rv;
+  }
+  length = output.GetLength();
+  return Success;
+}
+
+// length must be the length returned by MeasureEncoding for lengths.
+template <typename Encoder>
+inline Result
+WriteEncoding(const EncodedLengths& lengths, Encoder encode,
+              /*out*/ uint8_t* buffer, size_t length)
+{
+  Writer output(lengths, buffer, length);
+  Result rv = encode(output);
+  if (rv != Success) {
+    return rv;
+  }
+  if (output.GetLength() != length) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  return Success;
+}
+
 // PKI-specific types
 
 inline Result
@@ -465,6 +1032,49 @@ enum class Version { v1 = 0, v2 = 1, v3 = 2, v4 = 3 };
 // encode it.
 Result OptionalVersion(Reader& input, /*out*/ Version& version);
 
+// Extensions ::= SEQUENCE SIZE (1..MAX) OF Extension
+//
+// This parses the extensions of CRL entries, which are not wrapped in an
+// explicit tag; see OptionalExtensions for the tagged form.
+template <typename ExtensionHandler>
+inline Result
+Extensions(Reader& input, EmptyAllowed mayBeEmpty,
+           ExtensionHandler extensionHandler)
+{
+  return NestedOf(input, SEQUENCE, SEQUENCE, mayBeEmpty,
+                  [extensionHandler](Reader& extension) -> Result {
+    // Extension  ::=  SEQUENCE  {
+    //      extnID      OBJECT IDENTIFIER,
+    //      critical    BOOLEAN DEFAULT FALSE,
+    //      extnValue   OCTET STRING
+    //      }
+    Reader extnID;
+    Result rv = ExpectTagAndGetValue(extension, OIDTag, extnID);
+    if (rv != Success) {
+      return rv;
+    }
+    bool critical;
+    rv = OptionalBoolean(extension, critical);
+    if (rv != Success) {
+      return rv;
+    }
+    Input extnValue;
+    rv = ExpectTagAndGetValue(extension, OCTET_STRING, extnValue);
+    if (rv != Success) {
+      return rv;
+    }
+    bool understood = false;
+    rv = extensionHandler(extnID, extnValue, critical, understood);
+    if (rv != Success) {
+      return rv;
+    }
+    if (critical && !understood) {
+      return Result::ERROR_UNKNOWN_CRITICAL_EXTENSION;
+    }
+    return Success;
+  });
+}
+
 template <typename ExtensionHandler>
 inline Result
 OptionalExtensions(Reader& input, uint8_t tag,
@@ -475,43 +1085,10 @@ OptionalExtensions(Reader& input, uint8_t tag,
   }
 
   return Nested(input, tag, [extensionHandler](Reader& tagged) {
-    // Extensions ::= SEQUENCE SIZE (1..MAX) OF Extension
-    //
     // TODO(bug 997994): According to the specification, there should never be
     // an empty sequence of extensions but we've found OCSP responses that have
     // that (see bug 991898).
-    return NestedOf(tagged, SEQUENCE, SEQUENCE, EmptyAllowed::Yes,
-                    [extensionHandler](Reader& extension) -> Result {
-      // Extension  ::=  SEQUENCE  {
-      //      extnID      OBJECT IDENTIFIER,
-      //      critical    BOOLEAN DEFAULT FALSE,
-      //      extnValue   OCTET STRING
-      //      }
-      Reader extnID;
-      Result rv = ExpectTagAndGetValue(extension, OIDTag, extnID);
-      if (rv != Success) {
-        return rv;
-      }
-      bool critical;
-      rv = OptionalBoolean(extension, critical);
-      if (rv != Success) {
-        return rv;
-      }
-      Input extnValue;
-      rv = ExpectTagAndGetValue(extension, OCTET_STRING, extnValue);
-      if (rv != Success) {
-        return rv;
-      }
-      bool understood = false;
-      rv = extensionHandler(extnID, extnValue, critical, understood);
-      if (rv != Success) {
-        return rv;
-      }
-      if (critical && !understood) {
-        return Result::ERROR_UNKNOWN_CRITICAL_EXTENSION;
-      }
-      return Success;
-    });
+    return Extensions(tagged, EmptyAllowed::Yes, extensionHandler);
   });
 }
 
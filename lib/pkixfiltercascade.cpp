@@ -0,0 +1,251 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstring>
+
+#include "pkix/pkix.h"
+#include "pkixutil.h"
+
+namespace mozilla { namespace pkix {
+
+namespace {
+
+// The key is the issuer's SPKI digest followed by the serial number.
+const size_t MAX_KEY_LENGTH =
+  RevocationFilterCascade::ISSUER_SPKI_HASH_LENGTH +
+  RevocationFilterCascade::MAX_SERIAL_NUMBER_LENGTH;
+
+inline uint32_t
+RotateLeft(uint32_t x, int r)
+{
+  return (x << r) | (x >> (32 - r));
+}
+
+// MurmurHash3_x86_32, by Austin Appleby, who placed it in the public domain.
+// The blocks are read little-endian regardless of the platform's byte order
+// so that the results are portable.
+uint32_t
+MurmurHash3(const uint8_t* key, size_t length, uint32_t seed)
+{
+  static const uint32_t c1 = 0xcc9e2d51;
+  static const uint32_t c2 = 0x1b873593;
+
+  uint32_t h = seed;
+  size_t blockCount = length / 4;
+  for (size_t i = 0; i < blockCount; ++i) {
+    const uint8_t* block = key + i * 4;
+    uint32_t k = static_cast<uint32_t>(block[0]) |
+                 (static_cast<uint32_t>(block[1]) << 8) |
+                 (static_cast<uint32_t>(block[2]) << 16) |
+                 (static_cast<uint32_t>(block[3]) << 24);
+    k *= c1;
+    k = RotateLeft(k, 15);
+    k *= c2;
+    h ^= k;
+    h = RotateLeft(h, 13);
+    h = h * 5 + 0xe6546b64;
+  }
+
+  const uint8_t* tail = key + blockCount * 4;
+  size_t tailLength = length & 3;
+  uint32_t k = 0;
+  if (tailLength >= 3) {
+    k ^= static_cast<uint32_t>(tail[2]) << 16;
+  }
+  if (tailLength >= 2) {
+    k ^= static_cast<uint32_t>(tail[1]) << 8;
+  }
+  if (tailLength >= 1) {
+    k ^= tail[0];
+    k *= c1;
+    k = RotateLeft(k, 15);
+    k *= c2;
+    h ^= k;
+  }
+
+  h ^= static_cast<uint32_t>(length);
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+Result
+MakeKey(Input issuerSPKIHash, Input serialNumber,
+        /*out*/ uint8_t (&key)[MAX_KEY_LENGTH], /*out*/ size_t& keyLength)
+{
+  if (issuerSPKIHash.GetLength() !=
+        RevocationFilterCascade::ISSUER_SPKI_HASH_LENGTH) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  if (serialNumber.GetLength() >
+        RevocationFilterCascade::MAX_SERIAL_NUMBER_LENGTH) {
+    return Result::ERROR_BAD_DER;
+  }
+  std::memcpy(key, issuerSPKIHash.UnsafeGetData(),
+              issuerSPKIHash.GetLength());
+  std::memcpy(key + issuerSPKIHash.GetLength(), serialNumber.UnsafeGetData(),
+              serialNumber.GetLength());
+  keyLength = issuerSPKIHash.GetLength() + serialNumber.GetLength();
+  return Success;
+}
+
+inline uint32_t
+BitIndex(uint8_t level, uint8_t hashIndex, uint32_t bitCount,
+         const uint8_t* key, size_t keyLength)
+{
+  uint32_t seed = (static_cast<uint32_t>(level) << 16) | hashIndex;
+  return MurmurHash3(key, keyLength, seed) % bitCount;
+}
+
+} // unnamed namespace
+
+RevocationFilterCascade::RevocationFilterCascade()
+  : levelCount(0)
+{
+}
+
+Result
+RevocationFilterCascade::Init(const uint8_t* data, size_t length)
+{
+  static const uint8_t MAGIC[] = { 'p', 'k', 'f', 'c' };
+  static const uint8_t VERSION = 1;
+
+  if (levelCount != 0) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  if (!data) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+
+  if (length < sizeof(MAGIC) + 2 ||
+      std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0 ||
+      data[sizeof(MAGIC)] != VERSION) {
+    return Result::ERROR_BAD_DER;
+  }
+  size_t count = data[sizeof(MAGIC) + 1];
+  if (count < 1 || count > MAX_LEVELS) {
+    return Result::ERROR_BAD_DER;
+  }
+
+  size_t offset = sizeof(MAGIC) + 2;
+  Level parsed[MAX_LEVELS];
+  for (size_t i = 0; i < count; ++i) {
+    if (length - offset < 5) {
+      return Result::ERROR_BAD_DER;
+    }
+    uint32_t bitCount = (static_cast<uint32_t>(data[offset]) << 24) |
+                        (static_cast<uint32_t>(data[offset + 1]) << 16) |
+                        (static_cast<uint32_t>(data[offset + 2]) << 8) |
+                        static_cast<uint32_t>(data[offset + 3]);
+    uint8_t hashCount = data[offset + 4];
+    offset += 5;
+    if (bitCount == 0 || hashCount < 1 || hashCount > MAX_HASH_COUNT) {
+      return Result::ERROR_BAD_DER;
+    }
+    size_t byteCount = (static_cast<size_t>(bitCount) + 7) / 8;
+    if (length - offset < byteCount) {
+      return Result::ERROR_BAD_DER;
+    }
+    if (bitCount % 8 != 0 &&
+        (data[offset + byteCount - 1] >> (bitCount % 8)) != 0) {
+      return Result::ERROR_BAD_DER;
+    }
+    parsed[i].bits = data + offset;
+    parsed[i].bitCount = bitCount;
+    parsed[i].hashCount = hashCount;
+    offset += byteCount;
+  }
+  if (offset != length) {
+    return Result::ERROR_BAD_DER;
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    levels[i] = parsed[i];
+  }
+  levelCount = count;
+  return Success;
+}
+
+Result
+RevocationFilterCascade::CheckRevocation(Input issuerSPKIHash,
+                                         Input serialNumber) const
+{
+  if (levelCount == 0) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+
+  uint8_t key[MAX_KEY_LENGTH];
+  size_t keyLength;
+  Result rv = MakeKey(issuerSPKIHash, serialNumber, key, keyLength);
+  if (rv != Success) {
+    return rv;
+  }
+
+  // Level 0 is built from the revoked certificates, level 1 from the
+  // non-revoked ones, and so on. A certificate that isn't in some level is in
+  // the set the previous level was built from, and a certificate that is in
+  // every level is in the set the last level was built from. Either way, it
+  // is revoked exactly when the number of levels that contain it is odd.
+  size_t level = 0;
+  for (; level < levelCount; ++level) {
+    const Level& filter = levels[level];
+    bool found = true;
+    for (uint8_t i = 0; i < filter.hashCount; ++i) {
+      uint32_t bit = BitIndex(static_cast<uint8_t>(level), i, filter.bitCount,
+                              key, keyLength);
+      if (!((filter.bits[bit / 8] >> (bit % 8)) & 1)) {
+        found = false;
+        break;
+      }
+    }
+    if (!found) {
+      break;
+    }
+  }
+  return (level % 2 == 1) ? Result::ERROR_REVOKED_CERTIFICATE : Success;
+}
+
+/*static*/ Result
+RevocationFilterCascade::Hash(uint8_t level, uint8_t hashIndex,
+                              uint32_t bitCount, Input issuerSPKIHash,
+                              Input serialNumber, /*out*/ uint32_t& bitIndex)
+{
+  if (bitCount == 0) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  uint8_t key[MAX_KEY_LENGTH];
+  size_t keyLength;
+  Result rv = MakeKey(issuerSPKIHash, serialNumber, key, keyLength);
+  if (rv != Success) {
+    return rv;
+  }
+  bitIndex = BitIndex(level, hashIndex, bitCount, key, keyLength);
+  return Success;
+}
+
+} } // namespace mozilla::pkix
@@ -34,6 +34,16 @@
 // constraints, the reference identifier is the entire encoded name constraint
 // extension value.
 
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MOZILLA_PKIX_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "pkix/pkix.h"
 #include "pkixcheck.h"
 #include "pkixutil.h"
 
@@ -126,11 +136,13 @@ enum class MatchResult
 Result SearchNames(const Input* subjectAltName, Input subject,
                    GeneralNameType referenceIDType,
                    Input referenceID,
+                   const CompiledNameConstraints* nameConstraints,
                    FallBackToSearchWithinSubject fallBackToCommonName,
                    /*out*/ MatchResult& match);
 Result SearchWithinRDN(Reader& rdn,
                        GeneralNameType referenceIDType,
                        Input referenceID,
+                       const CompiledNameConstraints* nameConstraints,
                        FallBackToSearchWithinSubject fallBackToEmailAddress,
                        FallBackToSearchWithinSubject fallBackToCommonName,
                        /*in/out*/ MatchResult& match);
@@ -139,6 +151,7 @@ Result MatchAVA(Input type,
                 Input presentedID,
                 GeneralNameType referenceIDType,
                 Input referenceID,
+                const CompiledNameConstraints* nameConstraints,
                 FallBackToSearchWithinSubject fallBackToEmailAddress,
                 FallBackToSearchWithinSubject fallBackToCommonName,
                 /*in/out*/ MatchResult& match);
@@ -146,20 +159,26 @@ Result ReadAVA(Reader& rdn,
                /*out*/ Input& type,
                /*out*/ uint8_t& valueTag,
                /*out*/ Input& value);
-void MatchSubjectPresentedIDWithReferenceID(GeneralNameType presentedIDType,
-                                            Input presentedID,
-                                            GeneralNameType referenceIDType,
-                                            Input referenceID,
-                                            /*in/out*/ MatchResult& match);
-
-Result MatchPresentedIDWithReferenceID(GeneralNameType presentedIDType,
-                                       Input presentedID,
-                                       GeneralNameType referenceIDType,
-                                       Input referenceID,
-                                       /*in/out*/ MatchResult& matchResult);
-Result CheckPresentedIDConformsToConstraints(GeneralNameType referenceIDType,
-                                             Input presentedID,
-                                             Input nameConstraints);
+void MatchSubjectPresentedIDWithReferenceID(
+       GeneralNameType presentedIDType,
+       Input presentedID,
+       GeneralNameType referenceIDType,
+       Input referenceID,
+       const CompiledNameConstraints* nameConstraints,
+       /*in/out*/ MatchResult& match);
+
+Result MatchPresentedIDWithReferenceID(
+         GeneralNameType presentedIDType,
+         Input presentedID,
+         GeneralNameType referenceIDType,
+         Input referenceID,
+         const CompiledNameConstraints* nameConstraints,
+         /*in/out*/ MatchResult& matchResult);
+Result CheckPresentedIDConformsToConstraints(
+         GeneralNameType referenceIDType,
+         Input presentedID,
+         Input encodedNameConstraints,
+         /*optional*/ const CompiledNameConstraints* nameConstraints);
 
 uint8_t LocaleInsensitveToLower(uint8_t a);
 bool StartsWithIDNALabel(Input id);
@@ -180,8 +199,13 @@ enum class AllowWildcards { No = 0, Yes = 1 };
 // ".example.com").
 enum class AllowDotlessSubdomainMatches { No = 0, Yes = 1 };
 
+const size_t MAX_DNS_ID_LENGTH = 253;
+
 bool IsValidDNSID(Input hostname, IDRole idRole,
                   AllowWildcards allowWildcards);
+bool IsValidDNSID(Input hostname, IDRole idRole,
+                  AllowWildcards allowWildcards,
+                  /*optional out*/ uint8_t* lowercaseHostname);
 
 Result MatchPresentedDNSIDWithReferenceDNSID(
          Input presentedDNSID,
@@ -195,6 +219,8 @@ Result MatchPresentedRFC822NameWithReferenceRFC822Name(
          Input presentedRFC822Name, IDRole referenceRFC822NameRole,
          Input referenceRFC822Name, /*out*/ bool& matches);
 
+bool IsValidRFC822Name(Input input);
+
 } // unnamed namespace
 
 bool IsValidReferenceDNSID(Input hostname);
@@ -240,19 +266,27 @@ CheckCertHostname(Input endEntityCertDER, Input hostname)
   // IPv4 and IPv6 addresses are represented using the same type of GeneralName
   // (iPAddress); they are differentiated by the lengths of the values.
   MatchResult match;
-  uint8_t ipv6[16];
-  uint8_t ipv4[4];
-  if (IsValidReferenceDNSID(hostname)) {
-    rv = SearchNames(subjectAltName, subject, GeneralNameType::dNSName,
-                     hostname, FallBackToSearchWithinSubject::Yes, match);
-  } else if (ParseIPv6Address(hostname, ipv6)) {
-    rv = SearchNames(subjectAltName, subject, GeneralNameType::iPAddress,
-                     Input(ipv6), FallBackToSearchWithinSubject::No, match);
-  } else if (ParseIPv4Address(hostname, ipv4)) {
-    rv = SearchNames(subjectAltName, subject, GeneralNameType::iPAddress,
-                     Input(ipv4), FallBackToSearchWithinSubject::Yes, match);
-  } else {
-    return Result::ERROR_BAD_CERT_DOMAIN;
+  uint8_t ipAddress[16];
+  Input referenceID;
+  switch (ClassifyReferenceID(hostname, ipAddress, referenceID)) {
+    case ReferenceIDType::DNSID:
+      rv = SearchNames(subjectAltName, subject, GeneralNameType::dNSName,
+                       referenceID, nullptr,
+                       FallBackToSearchWithinSubject::Yes, match);
+      break;
+    case ReferenceIDType::IPv6Address:
+      rv = SearchNames(subjectAltName, subject, GeneralNameType::iPAddress,
+                       referenceID, nullptr,
+                       FallBackToSearchWithinSubject::No, match);
+      break;
+    case ReferenceIDType::IPv4Address:
+      rv = SearchNames(subjectAltName, subject, GeneralNameType::iPAddress,
+                       referenceID, nullptr,
+                       FallBackToSearchWithinSubject::Yes, match);
+      break;
+    case ReferenceIDType::Invalid:
+      return Result::ERROR_BAD_CERT_DOMAIN;
+    MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
   }
   if (rv != Success) {
     return rv;
@@ -267,9 +301,208 @@ CheckCertHostname(Input endEntityCertDER, Input hostname)
   }
 }
 
-// 4.2.1.10. Name Constraints
+namespace {
+
+// The idTypes value of an emailAddress attribute that isn't an IA5String,
+// which is an error only when emailAddress attributes are checked.
+const uint8_t INVALID_EMAIL_ADDRESS = 0;
+
+// Extracts the identifiers that SearchNames would check against name
+// constraints, in the order in which it would check them. Errors are recorded
+// where SearchNames would return them, instead of being returned, because
+// whether SearchNames reaches them depends on the name constraints.
+void
+ExtractNameConstraintsPresentedIDs(const BackCert& cert,
+                                   /*out*/ NameConstraintsPresentedIDs& ids)
+{
+  ids.state = NameConstraintsPresentedIDs::State::TooMany;
+  ids.idCount = 0;
+  ids.subjectAltNameError = Success;
+  ids.subjectAltNameHasDNSNameOrIPAddress = false;
+  ids.subjectError = Success;
+  ids.commonNameType = 0;
+
+  const Input* subjectAltName(cert.GetSubjectAltName());
+  if (subjectAltName) {
+    Reader altNames;
+    Result rv = der::ExpectTagAndGetValueAtEnd(*subjectAltName, der::SEQUENCE,
+                                               altNames);
+    while (rv == Success && !altNames.AtEnd()) {
+      GeneralNameType presentedIDType;
+      Input presentedID;
+      rv = ReadGeneralName(altNames, presentedIDType, presentedID);
+      if (rv != Success) {
+        break;
+      }
+      if (ids.idCount == NameConstraintsPresentedIDs::MAX_IDS) {
+        return;
+      }
+      rv = ids.ids[ids.idCount].Init(presentedID);
+      if (rv != Success) {
+        return;
+      }
+      ids.idTypes[ids.idCount] = static_cast<uint8_t>(presentedIDType);
+      ++ids.idCount;
+      if (presentedIDType == GeneralNameType::dNSName ||
+          presentedIDType == GeneralNameType::iPAddress) {
+        ids.subjectAltNameHasDNSNameOrIPAddress = true;
+      }
+    }
+    ids.subjectAltNameError = rv;
+  }
+  ids.subjectAltNameIDCount = ids.idCount;
+
+  // python DottedOIDToCode.py id-at-commonName 2.5.4.3
+  static const uint8_t id_at_commonName[] = {
+    0x55, 0x04, 0x03
+  };
+  // python DottedOIDToCode.py id-emailAddress 1.2.840.113549.1.9.1
+  static const uint8_t id_emailAddress[] = {
+    0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x09, 0x01
+  };
+
+  // See MatchAVA for which CN and emailAddress attributes are used.
+  bool tooMany = false;
+  // Input can't be assigned, so the last CN is remembered as a span.
+  const uint8_t* commonNameData = nullptr;
+  Input::size_type commonNameLength = 0;
+  uint8_t commonNameTag = 0;
+  Reader subject(cert.GetSubject());
+  ids.subjectError = der::NestedOf(subject, der::SEQUENCE, der::SET,
+                                   der::EmptyAllowed::Yes, [&](Reader& rdn) {
+    do {
+      Input type;
+      uint8_t valueTag;
+      Input value;
+      Result rv = ReadAVA(rdn, type, valueTag, value);
+      if (rv != Success) {
+        return rv;
+      }
+      if (InputsAreEqual(type, Input(id_at_commonName))) {
+        // Only the most specific CN is used, so only the last one is kept.
+        commonNameData = value.UnsafeGetData();
+        commonNameLength = value.GetLength();
+        commonNameTag = valueTag;
+      } else if (InputsAreEqual(type, Input(id_emailAddress))) {
+        if (ids.idCount == NameConstraintsPresentedIDs::MAX_IDS) {
+          tooMany = true;
+          return Result::FATAL_ERROR_NO_MEMORY;
+        }
+        rv = ids.ids[ids.idCount].Init(value);
+        if (rv != Success) {
+          return rv;
+        }
+        ids.idTypes[ids.idCount] =
+          valueTag == der::IA5String
+            ? static_cast<uint8_t>(GeneralNameType::rfc822Name)
+            : INVALID_EMAIL_ADDRESS;
+        ++ids.idCount;
+      }
+    } while (!rdn.AtEnd());
+    return Success;
+  });
+  if (tooMany) {
+    return;
+  }
+
+  Input commonName;
+  if (commonNameData &&
+      (commonNameTag == der::PrintableString ||
+       commonNameTag == der::UTF8String ||
+       commonNameTag == der::TeletexString) &&
+      commonName.Init(commonNameData, commonNameLength) == Success) {
+    if (IsValidPresentedDNSID(commonName)) {
+      if (ids.commonName.Init(commonName) != Success) {
+        return;
+      }
+      ids.commonNameType = static_cast<uint8_t>(GeneralNameType::dNSName);
+    } else if (ParseIPv4Address(commonName, ids.commonNameIPv4Address)) {
+      if (ids.commonName.Init(ids.commonNameIPv4Address,
+                              sizeof(ids.commonNameIPv4Address)) != Success) {
+        return;
+      }
+      ids.commonNameType = static_cast<uint8_t>(GeneralNameType::iPAddress);
+    }
+  }
+
+  ids.state = NameConstraintsPresentedIDs::State::Extracted;
+}
+
+// Returns the same result as SearchNames followed by the check of its
+// MatchResult in CheckNameConstraints, using the extracted identifiers.
+Result
+CheckExtractedPresentedIDs(const NameConstraintsPresentedIDs& ids,
+                           const BackCert& cert,
+                           Input encodedNameConstraints,
+                           /*optional*/ const CompiledNameConstraints*
+                             nameConstraints,
+                           FallBackToSearchWithinSubject fallBackToCommonName)
+{
+  for (size_t i = 0; i < ids.subjectAltNameIDCount; ++i) {
+    Result rv = CheckPresentedIDConformsToConstraints(
+                  static_cast<GeneralNameType>(ids.idTypes[i]), ids.ids[i],
+                  encodedNameConstraints, nameConstraints);
+    if (rv != Success) {
+      return rv;
+    }
+  }
+  if (ids.subjectAltNameError != Success) {
+    return ids.subjectAltNameError;
+  }
+
+  Result rv = CheckPresentedIDConformsToConstraints(
+                GeneralNameType::directoryName, cert.GetSubject(),
+                encodedNameConstraints, nameConstraints);
+  if (rv != Success) {
+    return rv;
+  }
+
+  bool fallBackToEmailAddress = !cert.GetSubjectAltName();
+  if (ids.subjectAltNameHasDNSNameOrIPAddress) {
+    fallBackToCommonName = FallBackToSearchWithinSubject::No;
+  }
+  if (!fallBackToEmailAddress &&
+      fallBackToCommonName == FallBackToSearchWithinSubject::No) {
+    return Success;
+  }
+
+  if (fallBackToEmailAddress) {
+    for (size_t i = ids.subjectAltNameIDCount; i < ids.idCount; ++i) {
+      if (ids.idTypes[i] == INVALID_EMAIL_ADDRESS) {
+        return Result::ERROR_BAD_DER;
+      }
+      rv = CheckPresentedIDConformsToConstraints(GeneralNameType::rfc822Name,
+                                                 ids.ids[i],
+                                                 encodedNameConstraints,
+                                                 nameConstraints);
+      if (rv != Success) {
+        return rv;
+      }
+    }
+  }
+  if (ids.subjectError != Success) {
+    return ids.subjectError;
+  }
+
+  if (fallBackToCommonName == FallBackToSearchWithinSubject::Yes &&
+      ids.commonNameType != 0) {
+    rv = CheckPresentedIDConformsToConstraints(
+           static_cast<GeneralNameType>(ids.commonNameType), ids.commonName,
+           encodedNameConstraints, nameConstraints);
+    if (rv != Success) {
+      // MatchSubjectPresentedIDWithReferenceID treats any failure to match
+      // the CN-ID as a mismatch.
+      return Result::ERROR_CERT_NOT_IN_NAME_SPACE;
+    }
+  }
+
+  return Success;
+}
+
 Result
 CheckNameConstraints(Input encodedNameConstraints,
+                     /*optional*/ const CompiledNameConstraints*
+                       nameConstraints,
                      const BackCert& firstChild,
                      KeyPurposeId requiredEKUIfPresent)
 {
@@ -280,11 +513,26 @@ CheckNameConstraints(Input encodedNameConstraints,
       ? FallBackToSearchWithinSubject::Yes
       : FallBackToSearchWithinSubject::No;
 
+    NameConstraintsPresentedIDs* ids(child->GetNameConstraintsPresentedIDs());
+    if (ids && ids->state == NameConstraintsPresentedIDs::State::NotExtracted) {
+      ExtractNameConstraintsPresentedIDs(*child, *ids);
+    }
+    if (ids && ids->state == NameConstraintsPresentedIDs::State::Extracted) {
+      Result rv = CheckExtractedPresentedIDs(*ids, *child,
+                                             encodedNameConstraints,
+                                             nameConstraints,
+                                             fallBackToCommonName);
+      if (rv != Success) {
+        return rv;
+      }
+      continue;
+    }
+
     MatchResult match;
     Result rv = SearchNames(child->GetSubjectAltName(), child->GetSubject(),
                             GeneralNameType::nameConstraints,
-                            encodedNameConstraints, fallBackToCommonName,
-                            match);
+                            encodedNameConstraints, nameConstraints,
+                            fallBackToCommonName, match);
     if (rv != Success) {
       return rv;
     }
@@ -300,13 +548,220 @@ CheckNameConstraints(Input encodedNameConstraints,
   return Success;
 }
 
+} // unnamed namespace
+
+// 4.2.1.10. Name Constraints
+Result
+CheckNameConstraints(Input encodedNameConstraints,
+                     const BackCert& firstChild,
+                     KeyPurposeId requiredEKUIfPresent)
+{
+  return CheckNameConstraints(encodedNameConstraints, nullptr, firstChild,
+                              requiredEKUIfPresent);
+}
+
+Result
+CheckNameConstraints(const CompiledNameConstraints& nameConstraints,
+                     const BackCert& firstChild,
+                     KeyPurposeId requiredEKUIfPresent)
+{
+  return CheckNameConstraints(nameConstraints.GetEncoded(), &nameConstraints,
+                              firstChild, requiredEKUIfPresent);
+}
+
+namespace {
+
+// Finds the name for which CheckNameConstraints returned
+// Result::ERROR_CERT_NOT_IN_NAME_SPACE for cert, by checking the names in the
+// order SearchNames does until one of them doesn't pass. Since all of the
+// names before it passed, this is only a matter of which names are checked.
+void
+FindNameConstraintsViolation(const CompiledNameConstraints& nameConstraints,
+                             const BackCert& cert,
+                             FallBackToSearchWithinSubject
+                               fallBackToCommonName,
+                             /*out*/ uint8_t& violatingNameTag,
+                             /*out*/ Input& violatingName)
+{
+  auto violates = [&](GeneralNameType type, Input name) {
+    if (CheckPresentedIDConformsToConstraints(type, name,
+                                              nameConstraints.GetEncoded(),
+                                              &nameConstraints) == Success) {
+      return false;
+    }
+    if (violatingName.Init(name) == Success) {
+      violatingNameTag = static_cast<uint8_t>(type);
+    }
+    return true;
+  };
+
+  const Input* subjectAltName(cert.GetSubjectAltName());
+  if (subjectAltName) {
+    Reader altNames;
+    if (der::ExpectTagAndGetValueAtEnd(*subjectAltName, der::SEQUENCE,
+                                       altNames) != Success) {
+      return;
+    }
+    while (!altNames.AtEnd()) {
+      GeneralNameType presentedIDType;
+      Input presentedID;
+      if (ReadGeneralName(altNames, presentedIDType, presentedID) != Success) {
+        return;
+      }
+      if (violates(presentedIDType, presentedID)) {
+        return;
+      }
+      if (presentedIDType == GeneralNameType::dNSName ||
+          presentedIDType == GeneralNameType::iPAddress) {
+        fallBackToCommonName = FallBackToSearchWithinSubject::No;
+      }
+    }
+  }
+
+  if (violates(GeneralNameType::directoryName, cert.GetSubject())) {
+    return;
+  }
+
+  // python DottedOIDToCode.py id-at-commonName 2.5.4.3
+  static const uint8_t id_at_commonName[] = {
+    0x55, 0x04, 0x03
+  };
+  // python DottedOIDToCode.py id-emailAddress 1.2.840.113549.1.9.1
+  static const uint8_t id_emailAddress[] = {
+    0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x09, 0x01
+  };
+
+  // The emailAddress attributes are checked as they are found, and the most
+  // specific CN (the last one) after all of them, as in SearchNames.
+  const uint8_t* commonNameData = nullptr;
+  Input::size_type commonNameLength = 0;
+  uint8_t commonNameTag = 0;
+  bool found = false;
+  Reader subject(cert.GetSubject());
+  Result rv = der::NestedOf(subject, der::SEQUENCE, der::SET,
+                            der::EmptyAllowed::Yes, [&](Reader& rdn) {
+    do {
+      Input type;
+      uint8_t valueTag;
+      Input value;
+      Result avaRV = ReadAVA(rdn, type, valueTag, value);
+      if (avaRV != Success) {
+        return avaRV;
+      }
+      if (InputsAreEqual(type, Input(id_at_commonName))) {
+        commonNameData = value.UnsafeGetData();
+        commonNameLength = value.GetLength();
+        commonNameTag = valueTag;
+      } else if (!subjectAltName &&
+                 InputsAreEqual(type, Input(id_emailAddress)) &&
+                 violates(GeneralNameType::rfc822Name, value)) {
+        found = true;
+        return Result::ERROR_CERT_NOT_IN_NAME_SPACE;
+      }
+    } while (!rdn.AtEnd());
+    return Success;
+  });
+  if (found || rv != Success ||
+      fallBackToCommonName == FallBackToSearchWithinSubject::No ||
+      !commonNameData) {
+    return;
+  }
+  if (commonNameTag != der::PrintableString &&
+      commonNameTag != der::UTF8String &&
+      commonNameTag != der::TeletexString) {
+    return;
+  }
+
+  Input commonName;
+  if (commonName.Init(commonNameData, commonNameLength) != Success) {
+    return;
+  }
+  GeneralNameType commonNameType;
+  uint8_t ipv4[4];
+  Input commonNameID;
+  if (IsValidPresentedDNSID(commonName)) {
+    commonNameType = GeneralNameType::dNSName;
+    rv = commonNameID.Init(commonName);
+  } else if (ParseIPv4Address(commonName, ipv4)) {
+    commonNameType = GeneralNameType::iPAddress;
+    rv = commonNameID.Init(Input(ipv4));
+  } else {
+    return;
+  }
+  if (rv != Success ||
+      CheckPresentedIDConformsToConstraints(commonNameType, commonNameID,
+                                            nameConstraints.GetEncoded(),
+                                            &nameConstraints) == Success) {
+    return;
+  }
+  if (violatingName.Init(commonName) == Success) {
+    violatingNameTag = static_cast<uint8_t>(commonNameType);
+  }
+}
+
+} // unnamed namespace
+
+Result
+CheckCertNameConstraints(const CompiledNameConstraints& nameConstraints,
+                         Input certDER, EndEntityOrCA endEntityOrCA,
+                         KeyPurposeId requiredEKUIfPresent,
+                         /*optional out*/ uint8_t* violatingNameTag,
+                         /*optional out*/ Input* violatingName)
+{
+  if (violatingNameTag) {
+    *violatingNameTag = 0;
+  }
+  BackCert cert(certDER, endEntityOrCA, nullptr);
+  Result rv = cert.Init();
+  if (rv != Success) {
+    return rv;
+  }
+  rv = CheckNameConstraints(nameConstraints, cert, requiredEKUIfPresent);
+  if (rv == Result::ERROR_CERT_NOT_IN_NAME_SPACE && violatingNameTag &&
+      violatingName) {
+    FallBackToSearchWithinSubject fallBackToCommonName
+      = (endEntityOrCA == EndEntityOrCA::MustBeEndEntity &&
+         requiredEKUIfPresent == KeyPurposeId::id_kp_serverAuth)
+      ? FallBackToSearchWithinSubject::Yes
+      : FallBackToSearchWithinSubject::No;
+    FindNameConstraintsViolation(nameConstraints, cert, fallBackToCommonName,
+                                 *violatingNameTag, *violatingName);
+  }
+  return rv;
+}
+
+Result
+CheckCertsNameConstraints(const CompiledNameConstraints& nameConstraints,
+                          const Input* certDERs, size_t certCount,
+                          EndEntityOrCA endEntityOrCA,
+                          KeyPurposeId requiredEKUIfPresent,
+                          /*out*/ NameConstraintsCheckResult* results,
+                          unsigned int threadCount)
+{
+  if ((certCount > 0 && (!certDERs || !results)) || threadCount == 0 ||
+      threadCount > MAX_PARALLEL_THREADS) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+
+  ForEachInParallel(certCount, threadCount, [&](size_t i) {
+    NameConstraintsCheckResult& result(results[i]);
+    result.result = CheckCertNameConstraints(nameConstraints, certDERs[i],
+                                             endEntityOrCA,
+                                             requiredEKUIfPresent,
+                                             &result.violatingNameTag,
+                                             &result.violatingName);
+  });
+  return Success;
+}
+
 namespace {
 
 // SearchNames is used by CheckCertHostname and CheckNameConstraints.
 //
 // When called during name constraint checking, referenceIDType is
-// GeneralNameType::nameConstraints and referenceID is the entire encoded name
-// constraints extension value.
+// GeneralNameType::nameConstraints, referenceID is the entire encoded name
+// constraints extension value, and nameConstraints, if not null, is its
+// compiled form. Otherwise, nameConstraints is null.
 //
 // The main benefit of using the exact same code paths for both is that we
 // ensure consistency between name validation and name constraint enforcement
@@ -322,6 +777,7 @@ SearchNames(/*optional*/ const Input* subjectAltName,
             Input subject,
             GeneralNameType referenceIDType,
             Input referenceID,
+            /*optional*/ const CompiledNameConstraints* nameConstraints,
             FallBackToSearchWithinSubject fallBackToCommonName,
             /*out*/ MatchResult& match)
 {
@@ -367,7 +823,7 @@ SearchNames(/*optional*/ const Input* subjectAltName,
 
       rv = MatchPresentedIDWithReferenceID(presentedIDType, presentedID,
                                            referenceIDType, referenceID,
-                                           match);
+                                           nameConstraints, match);
       if (rv != Success) {
         return rv;
       }
@@ -384,7 +840,8 @@ SearchNames(/*optional*/ const Input* subjectAltName,
 
   if (referenceIDType == GeneralNameType::nameConstraints) {
     rv = CheckPresentedIDConformsToConstraints(GeneralNameType::directoryName,
-                                               subject, referenceID);
+                                               subject, referenceID,
+                                               nameConstraints);
     if (rv != Success) {
       return rv;
     }
@@ -474,7 +931,7 @@ SearchNames(/*optional*/ const Input* subjectAltName,
   Reader subjectReader(subject);
   return der::NestedOf(subjectReader, der::SEQUENCE, der::SET,
                        der::EmptyAllowed::Yes, [&](Reader& r) {
-    return SearchWithinRDN(r, referenceIDType, referenceID,
+    return SearchWithinRDN(r, referenceIDType, referenceID, nameConstraints,
                           fallBackToEmailAddress, fallBackToCommonName, match);
   });
 }
@@ -489,6 +946,7 @@ Result
 SearchWithinRDN(Reader& rdn,
                 GeneralNameType referenceIDType,
                 Input referenceID,
+                /*optional*/ const CompiledNameConstraints* nameConstraints,
                 FallBackToSearchWithinSubject fallBackToEmailAddress,
                 FallBackToSearchWithinSubject fallBackToCommonName,
                 /*in/out*/ MatchResult& match)
@@ -502,7 +960,8 @@ SearchWithinRDN(Reader& rdn,
       return rv;
     }
     rv = MatchAVA(type, valueTag, value, referenceIDType, referenceID,
-                  fallBackToEmailAddress, fallBackToCommonName, match);
+                  nameConstraints, fallBackToEmailAddress,
+                  fallBackToCommonName, match);
     if (rv != Success) {
       return rv;
     }
@@ -529,6 +988,7 @@ Result
 MatchAVA(Input type, uint8_t valueEncodingTag, Input presentedID,
          GeneralNameType referenceIDType,
          Input referenceID,
+         /*optional*/ const CompiledNameConstraints* nameConstraints,
          FallBackToSearchWithinSubject fallBackToEmailAddress,
          FallBackToSearchWithinSubject fallBackToCommonName,
          /*in/out*/ MatchResult& match)
@@ -590,7 +1050,8 @@ MatchAVA(Input type, uint8_t valueEncodingTag, Input presentedID,
     if (IsValidPresentedDNSID(presentedID)) {
       MatchSubjectPresentedIDWithReferenceID(GeneralNameType::dNSName,
                                              presentedID, referenceIDType,
-                                             referenceID, match);
+                                             referenceID, nameConstraints,
+                                             match);
     } else {
       // We don't match CN-IDs for IPv6 addresses.
       // MatchSubjectPresentedIDWithReferenceID ensures that it won't match an
@@ -600,7 +1061,8 @@ MatchAVA(Input type, uint8_t valueEncodingTag, Input presentedID,
       if (ParseIPv4Address(presentedID, ipv4)) {
         MatchSubjectPresentedIDWithReferenceID(GeneralNameType::iPAddress,
                                                Input(ipv4), referenceIDType,
-                                               referenceID, match);
+                                               referenceID, nameConstraints,
+                                               match);
       }
     }
 
@@ -634,39 +1096,45 @@ MatchAVA(Input type, uint8_t valueEncodingTag, Input presentedID,
     }
     return MatchPresentedIDWithReferenceID(GeneralNameType::rfc822Name,
                                            presentedID, referenceIDType,
-                                           referenceID, match);
+                                           referenceID, nameConstraints,
+                                           match);
   }
 
   return Success;
 }
 
 void
-MatchSubjectPresentedIDWithReferenceID(GeneralNameType presentedIDType,
-                                       Input presentedID,
-                                       GeneralNameType referenceIDType,
-                                       Input referenceID,
-                                       /*in/out*/ MatchResult& match)
+MatchSubjectPresentedIDWithReferenceID(
+  GeneralNameType presentedIDType,
+  Input presentedID,
+  GeneralNameType referenceIDType,
+  Input referenceID,
+  /*optional*/ const CompiledNameConstraints* nameConstraints,
+  /*in/out*/ MatchResult& match)
 {
   Result rv = MatchPresentedIDWithReferenceID(presentedIDType, presentedID,
                                               referenceIDType, referenceID,
-                                              match);
+                                              nameConstraints, match);
   if (rv != Success) {
     match = MatchResult::Mismatch;
   }
 }
 
 Result
-MatchPresentedIDWithReferenceID(GeneralNameType presentedIDType,
-                                Input presentedID,
-                                GeneralNameType referenceIDType,
-                                Input referenceID,
-                                /*out*/ MatchResult& matchResult)
+MatchPresentedIDWithReferenceID(
+  GeneralNameType presentedIDType,
+  Input presentedID,
+  GeneralNameType referenceIDType,
+  Input referenceID,
+  /*optional*/ const CompiledNameConstraints* nameConstraints,
+  /*out*/ MatchResult& matchResult)
 {
   if (referenceIDType == GeneralNameType::nameConstraints) {
     // matchResult is irrelevant when checking name constraints; only the
     // pass/fail result of CheckPresentedIDConformsToConstraints matters.
     return CheckPresentedIDConformsToConstraints(presentedIDType, presentedID,
-                                                 referenceID);
+                                                 referenceID,
+                                                 nameConstraints);
   }
 
   if (presentedIDType != referenceIDType) {
@@ -740,8 +1208,14 @@ Result
 CheckPresentedIDConformsToConstraints(
   GeneralNameType presentedIDType,
   Input presentedID,
-  Input encodedNameConstraints)
+  Input encodedNameConstraints,
+  /*optional*/ const CompiledNameConstraints* compiledNameConstraints)
 {
+  if (compiledNameConstraints) {
+    return compiledNameConstraints->CheckPresentedID(
+             static_cast<uint8_t>(presentedIDType), presentedID);
+  }
+
   // NameConstraints ::= SEQUENCE {
   //      permittedSubtrees       [0]     GeneralSubtrees OPTIONAL,
   //      excludedSubtrees        [1]     GeneralSubtrees OPTIONAL }
@@ -1048,16 +1522,24 @@ MatchPresentedDNSIDWithReferenceDNSID(
   Input referenceDNSID,
   /*out*/ bool& matches)
 {
-  if (!IsValidDNSID(presentedDNSID, IDRole::PresentedID, allowWildcards)) {
+  // Both IDs are converted to lowercase while they are validated, so that
+  // they can be compared with memcmp instead of a byte at a time.
+  uint8_t presented[MAX_DNS_ID_LENGTH];
+  if (!IsValidDNSID(presentedDNSID, IDRole::PresentedID, allowWildcards,
+                    presented)) {
     return Result::ERROR_BAD_DER;
   }
 
-  if (!IsValidDNSID(referenceDNSID, referenceDNSIDRole, AllowWildcards::No)) {
+  uint8_t reference[MAX_DNS_ID_LENGTH];
+  if (!IsValidDNSID(referenceDNSID, referenceDNSIDRole, AllowWildcards::No,
+                    reference)) {
     return Result::ERROR_BAD_DER;
   }
 
-  Reader presented(presentedDNSID);
-  Reader reference(referenceDNSID);
+  size_t presentedLength = presentedDNSID.GetLength();
+  size_t referenceLength = referenceDNSID.GetLength();
+  size_t presentedOffset = 0;
+  size_t referenceOffset = 0;
 
   switch (referenceDNSIDRole)
   {
@@ -1066,8 +1548,8 @@ MatchPresentedDNSIDWithReferenceDNSID(
 
     case IDRole::NameConstraint:
     {
-      if (presentedDNSID.GetLength() > referenceDNSID.GetLength()) {
-        if (referenceDNSID.GetLength() == 0) {
+      if (presentedLength > referenceLength) {
+        if (referenceLength == 0) {
           // An empty constraint matches everything.
           matches = true;
           return Success;
@@ -1095,27 +1577,12 @@ MatchPresentedDNSIDWithReferenceDNSID(
         //     presented ID w/o prefix:      example.com       example.com
         //                reference ID:      example.com       example.com
         //
-        if (reference.Peek('.')) {
-          if (presented.Skip(static_cast<Input::size_type>(
-                               presentedDNSID.GetLength() -
-                                 referenceDNSID.GetLength())) != Success) {
-            return NotReached("skipping subdomain failed",
-                              Result::FATAL_ERROR_LIBRARY_FAILURE);
-          }
+        if (reference[0] == '.') {
+          presentedOffset = presentedLength - referenceLength;
         } else if (allowDotlessSubdomainMatches ==
                    AllowDotlessSubdomainMatches::Yes) {
-          if (presented.Skip(static_cast<Input::size_type>(
-                               presentedDNSID.GetLength() -
-                                 referenceDNSID.GetLength() - 1)) != Success) {
-            return NotReached("skipping subdomains failed",
-                              Result::FATAL_ERROR_LIBRARY_FAILURE);
-          }
-          uint8_t b;
-          if (presented.Read(b) != Success) {
-            return NotReached("reading from presentedDNSID failed",
-                              Result::FATAL_ERROR_LIBRARY_FAILURE);
-          }
-          if (b != '.') {
+          presentedOffset = presentedLength - referenceLength;
+          if (presented[presentedOffset - 1] != '.') {
             matches = false;
             return Success;
           }
@@ -1130,65 +1597,47 @@ MatchPresentedDNSIDWithReferenceDNSID(
   }
 
   // We only allow wildcard labels that consist only of '*'.
-  if (presented.Peek('*')) {
-    if (presented.Skip(1) != Success) {
-      return NotReached("Skipping '*' failed",
-                        Result::FATAL_ERROR_LIBRARY_FAILURE);
-    }
-    do {
-      // This will happen if reference is a single, relative label
-      if (reference.AtEnd()) {
-        matches = false;
-        return Success;
-      }
-      uint8_t referenceByte;
-      if (reference.Read(referenceByte) != Success) {
-        return NotReached("invalid reference ID",
-                          Result::FATAL_ERROR_INVALID_ARGS);
-      }
-    } while (!reference.Peek('.'));
-  }
-
-  for (;;) {
-    uint8_t presentedByte;
-    if (presented.Read(presentedByte) != Success) {
-      matches = false;
-      return Success;
+  if (presentedOffset < presentedLength &&
+      presented[presentedOffset] == '*') {
+    ++presentedOffset;
+    // The wildcard matches the reference ID's first label, which must not be
+    // empty. This will fail if reference is a single, relative label.
+    referenceOffset = 1;
+    while (referenceOffset < referenceLength &&
+           reference[referenceOffset] != '.') {
+      ++referenceOffset;
     }
-    uint8_t referenceByte;
-    if (reference.Read(referenceByte) != Success) {
-      matches = false;
-      return Success;
-    }
-    if (LocaleInsensitveToLower(presentedByte) !=
-        LocaleInsensitveToLower(referenceByte)) {
+    if (referenceOffset >= referenceLength) {
       matches = false;
       return Success;
     }
-    if (presented.AtEnd()) {
-      // Don't allow presented IDs to be absolute.
-      if (presentedByte == '.') {
-        return Result::ERROR_BAD_DER;
-      }
-      break;
-    }
   }
 
+  size_t compareLength = presentedLength - presentedOffset;
+  if (compareLength == 0 ||
+      compareLength > referenceLength - referenceOffset ||
+      memcmp(presented + presentedOffset, reference + referenceOffset,
+             compareLength) != 0) {
+    matches = false;
+    return Success;
+  }
+  // Don't allow presented IDs to be absolute.
+  if (presented[presentedLength - 1] == '.') {
+    return Result::ERROR_BAD_DER;
+  }
+  referenceOffset += compareLength;
+
   // Allow a relative presented DNS ID to match an absolute reference DNS ID,
   // unless we're matching a name constraint.
-  if (!reference.AtEnd()) {
+  if (referenceOffset != referenceLength) {
     if (referenceDNSIDRole != IDRole::NameConstraint) {
-      uint8_t referenceByte;
-      if (reference.Read(referenceByte) != Success) {
-        return NotReached("read failed but not at end",
-                          Result::FATAL_ERROR_LIBRARY_FAILURE);
-      }
-      if (referenceByte != '.') {
+      if (reference[referenceOffset] != '.') {
         matches = false;
         return Success;
       }
+      ++referenceOffset;
     }
-    if (!reference.AtEnd()) {
+    if (referenceOffset != referenceLength) {
       matches = false;
       return Success;
     }
@@ -1864,159 +2313,424 @@ IsValidPresentedDNSID(Input hostname)
   return IsValidDNSID(hostname, IDRole::PresentedID, AllowWildcards::Yes);
 }
 
-namespace {
+// A valid DNS-ID never contains ':' and never ends with a label that is all
+// digits (with or without a trailing dot), a valid IPv6 address always
+// contains ':', and a valid IPv4 address contains only digits and dots. So the
+// longest suffix of hostname that contains only digits and dots, and the byte
+// before it, determine which parser could accept hostname.
+ReferenceIDType
+ClassifyReferenceID(Input hostname, /*out*/ uint8_t (&ipAddress)[16],
+                    /*out*/ Input& referenceID)
+{
+  const uint8_t* data = hostname.UnsafeGetData();
+  size_t i = hostname.GetLength();
+  while (i > 0 && ((data[i - 1] >= '0' && data[i - 1] <= '9') ||
+                   data[i - 1] == '.')) {
+    --i;
+  }
 
-// RFC 5280 Section 4.2.1.6 says that a dNSName "MUST be in the 'preferred name
-// syntax', as specified by Section 3.5 of [RFC1034] and as modified by Section
-// 2.1 of [RFC1123]" except "a dNSName of ' ' MUST NOT be used." Additionally,
-// we allow underscores for compatibility with existing practice.
-bool
-IsValidDNSID(Input hostname, IDRole idRole, AllowWildcards allowWildcards)
+  if (i == 0) {
+    uint8_t (*ipv4)[4] = reinterpret_cast<uint8_t(*)[4]>(&ipAddress[0]);
+    if (!ParseIPv4Address(hostname, *ipv4) ||
+        referenceID.Init(ipAddress, 4) != Success) {
+      return ReferenceIDType::Invalid;
+    }
+    return ReferenceIDType::IPv4Address;
+  }
+
+  if (data[i - 1] != ':') {
+    if (IsValidReferenceDNSID(hostname)) {
+      if (referenceID.Init(hostname) != Success) {
+        return ReferenceIDType::Invalid;
+      }
+      return ReferenceIDType::DNSID;
+    }
+    if (!memchr(data, ':', i - 1)) {
+      return ReferenceIDType::Invalid;
+    }
+  }
+
+  if (!ParseIPv6Address(hostname, ipAddress) ||
+      referenceID.Init(ipAddress, sizeof(ipAddress)) != Success) {
+    return ReferenceIDType::Invalid;
+  }
+  return ReferenceIDType::IPv6Address;
+}
+
+namespace {
+
+// Bit i of each of these masks is set when byte i of a DNS ID is in the
+// corresponding class. Bytes that are letters or underscores are in none of
+// them.
+struct DNSIDCharacterClasses final
 {
-  if (hostname.GetLength() > 253) {
+  static const size_t WORD_COUNT = (MAX_DNS_ID_LENGTH + 63) / 64;
+
+  uint64_t dots[WORD_COUNT];
+  uint64_t hyphens[WORD_COUNT];
+  uint64_t digits[WORD_COUNT];
+};
+
+#ifdef MOZILLA_PKIX_USE_SSE2
+inline __m128i
+IsInRange(__m128i bytes, char min, char max)
+{
+  // Bytes >= 0x80 are negative, so they are never in an ASCII range.
+  return _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(min - 1)),
+                       _mm_cmplt_epi8(bytes, _mm_set1_epi8(max + 1)));
+}
+
+inline uint64_t
+MaskOf(__m128i comparison)
+{
+  return static_cast<uint16_t>(_mm_movemask_epi8(comparison));
+}
+
+// Classifies the sixteen bytes at block, which are the bytes of a DNS ID
+// starting at offset. The masks are accumulated sixteen bits at a time, so a
+// block never straddles two words of them.
+inline bool
+ClassifyDNSIDCharacterBlock(const uint8_t* block, size_t offset,
+                            bool allowLeadingAsterisk,
+                            /*in/out*/ DNSIDCharacterClasses& classes,
+                            /*optional out*/ uint8_t* lowercaseBlock)
+{
+  __m128i bytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block)));
+  __m128i isDot(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('.')));
+  __m128i isHyphen(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('-')));
+  __m128i isDigit(IsInRange(bytes, '0', '9'));
+  // Setting 0x20 maps 'A'-'Z' to 'a'-'z' without mapping any other byte into
+  // that range.
+  __m128i lowercase(_mm_or_si128(bytes, _mm_set1_epi8(0x20)));
+  __m128i isLetter(IsInRange(lowercase, 'a', 'z'));
+  __m128i isValid(
+    _mm_or_si128(_mm_or_si128(isDot, isHyphen),
+                 _mm_or_si128(_mm_or_si128(isDigit, isLetter),
+                              _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_')))));
+  uint64_t invalid = MaskOf(isValid) ^ 0xffffu;
+  if (invalid != 0 &&
+      !(offset == 0 && invalid == 1 && allowLeadingAsterisk &&
+        block[0] == '*')) {
     return false;
   }
+  size_t word = offset / 64;
+  unsigned int shift = offset % 64;
+  classes.dots[word] |= MaskOf(isDot) << shift;
+  classes.hyphens[word] |= MaskOf(isHyphen) << shift;
+  classes.digits[word] |= MaskOf(isDigit) << shift;
+  if (lowercaseBlock) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lowercaseBlock),
+                     _mm_or_si128(_mm_andnot_si128(isLetter, bytes),
+                                  _mm_and_si128(isLetter, lowercase)));
+  }
+  return true;
+}
+#endif
 
-  Reader input(hostname);
+// Classifies every byte of id, returning false if any of them isn't allowed
+// in a DNS ID. A '*' is allowed as the first byte only when
+// allowLeadingAsterisk is true. If lowercaseID isn't null, then id, with
+// letters converted using LocaleInsensitveToLower, is written to it in the
+// same pass. id must not be longer than MAX_DNS_ID_LENGTH.
+bool
+ClassifyDNSIDCharacters(Input id, bool allowLeadingAsterisk,
+                        /*out*/ DNSIDCharacterClasses& classes,
+                        /*optional out*/ uint8_t* lowercaseID)
+{
+  assert(id.GetLength() <= MAX_DNS_ID_LENGTH);
 
-  if (idRole == IDRole::NameConstraint && input.AtEnd()) {
-    return true;
+  const uint8_t* data = id.UnsafeGetData();
+  size_t length = id.GetLength();
+  size_t i = 0;
+
+#ifdef MOZILLA_PKIX_USE_SSE2
+  for (size_t word = 0; word * 64 < length; ++word) {
+    classes.dots[word] = 0;
+    classes.hyphens[word] = 0;
+    classes.digits[word] = 0;
+  }
+  for (; i + 16 <= length; i += 16) {
+    if (!ClassifyDNSIDCharacterBlock(data + i, i, allowLeadingAsterisk,
+                                     classes,
+                                     lowercaseID ? lowercaseID + i : nullptr)) {
+      return false;
+    }
+  }
+  if (i < length) {
+    // The last partial block is padded with letters, which are valid and are
+    // in none of the classes.
+    uint8_t block[16];
+    memset(block, 'a', sizeof(block));
+    memcpy(block, data + i, length - i);
+    uint8_t lowercaseBlock[16];
+    if (!ClassifyDNSIDCharacterBlock(block, i, allowLeadingAsterisk, classes,
+                                     lowercaseID ? lowercaseBlock : nullptr)) {
+      return false;
+    }
+    if (lowercaseID) {
+      memcpy(lowercaseID + i, lowercaseBlock, length - i);
+    }
+  }
+#else
+  // We avoid isdigit, isalpha, and similar things because they are
+  // locale-sensitive. See
+  // http://pubs.opengroup.org/onlinepubs/009695399/functions/isdigit.html.
+  // We allow underscores for compatibility with existing practices. See bug
+  // 1136616.
+  if (length > 0 && allowLeadingAsterisk && data[0] == '*') {
+    if (lowercaseID) {
+      lowercaseID[0] = '*';
+    }
+    i = 1;
   }
+  uint64_t invalid = 0;
+  for (size_t word = 0; word * 64 < length; ++word) {
+    uint64_t dots = 0;
+    uint64_t hyphens = 0;
+    uint64_t digits = 0;
+    size_t wordEnd = std::min(length, (word + 1) * 64);
+    for (; i < wordEnd; ++i) {
+      uint8_t b = data[i];
+      uint64_t bit = uint64_t(1) << (i % 64);
+      switch (b) {
+        case '.':
+          dots |= bit;
+          break;
 
-  size_t dotCount = 0;
-  size_t labelLength = 0;
-  bool labelIsAllNumeric = false;
-  bool labelEndsWithHyphen = false;
+        case '-':
+          hyphens |= bit;
+          break;
 
-  // Only presented IDs are allowed to have wildcard labels. And, like
-  // Chromium, be stricter than RFC 6125 requires by insisting that a
-  // wildcard label consist only of '*'.
-  bool isWildcard = allowWildcards == AllowWildcards::Yes && input.Peek('*');
-  bool isFirstByte = !isWildcard;
-  if (isWildcard) {
-    Result rv = input.Skip(1);
-    if (rv != Success) {
-      assert(false);
-      return false;
+        case '0': case '5':
+        case '1': case '6':
+        case '2': case '7':
+        case '3': case '8':
+        case '4': case '9':
+          digits |= bit;
+          break;
+
+        case 'a': case 'A': case 'n': case 'N':
+        case 'b': case 'B': case 'o': case 'O':
+        case 'c': case 'C': case 'p': case 'P':
+        case 'd': case 'D': case 'q': case 'Q':
+        case 'e': case 'E': case 'r': case 'R':
+        case 'f': case 'F': case 's': case 'S':
+        case 'g': case 'G': case 't': case 'T':
+        case 'h': case 'H': case 'u': case 'U':
+        case 'i': case 'I': case 'v': case 'V':
+        case 'j': case 'J': case 'w': case 'W':
+        case 'k': case 'K': case 'x': case 'X':
+        case 'l': case 'L': case 'y': case 'Y':
+        case 'm': case 'M': case 'z': case 'Z':
+        case '_':
+          break;
+
+        default:
+          invalid |= bit;
+          break;
+      }
+      if (lowercaseID) {
+        lowercaseID[i] = LocaleInsensitveToLower(b);
+      }
     }
+    classes.dots[word] = dots;
+    classes.hyphens[word] = hyphens;
+    classes.digits[word] = digits;
+  }
+  if (invalid != 0) {
+    return false; // Invalid character.
+  }
+#endif
 
-    uint8_t b;
-    rv = input.Read(b);
-    if (rv != Success) {
-      return false;
+  return true;
+}
+
+// Returns the index of the first set bit in [begin, end), or end if there is
+// none.
+size_t
+FindFirstBitSet(const uint64_t (&bits)[DNSIDCharacterClasses::WORD_COUNT],
+                size_t begin, size_t end)
+{
+  for (size_t word = begin / 64; word * 64 < end; ++word) {
+    uint64_t value = bits[word];
+    if (word == begin / 64) {
+      value &= ~uint64_t(0) << (begin % 64);
     }
-    if (b != '.') {
-      return false;
+    if (value != 0) {
+      size_t i = word * 64;
+#if defined(__GNUC__)
+      i += static_cast<size_t>(__builtin_ctzll(value));
+#else
+      while (!(value & 1)) {
+        value >>= 1;
+        ++i;
+      }
+#endif
+      return std::min(i, end);
     }
-    ++dotCount;
   }
+  return end;
+}
 
-  do {
-    static const size_t MAX_LABEL_LENGTH = 63;
+// Returns one more than the index of the last set bit in [0, end), or 0 if
+// there is none.
+size_t
+FindEndOfLastBitSet(const uint64_t (&bits)[DNSIDCharacterClasses::WORD_COUNT],
+                    size_t end)
+{
+  for (size_t word = (end + 63) / 64; word > 0; --word) {
+    uint64_t value = bits[word - 1];
+    if (word * 64 > end) {
+      value &= ~uint64_t(0) >> (word * 64 - end);
+    }
+    if (value != 0) {
+      size_t i = (word - 1) * 64 + 1;
+#if defined(__GNUC__)
+      i += 63 - static_cast<size_t>(__builtin_clzll(value));
+#else
+      while (value >>= 1) {
+        ++i;
+      }
+#endif
+      return i;
+    }
+  }
+  return 0;
+}
 
-    uint8_t b;
-    if (input.Read(b) != Success) {
+bool
+AreAllBitsSet(const uint64_t (&bits)[DNSIDCharacterClasses::WORD_COUNT],
+              size_t begin, size_t end)
+{
+  while (begin < end) {
+    size_t shift = begin % 64;
+    size_t count = std::min(64 - shift, end - begin);
+    uint64_t mask = (count == 64 ? ~uint64_t(0)
+                                 : ((uint64_t(1) << count) - 1)) << shift;
+    if ((bits[begin / 64] & mask) != mask) {
       return false;
     }
-    switch (b) {
-      case '-':
-        if (labelLength == 0) {
-          return false; // Labels must not start with a hyphen.
-        }
-        labelIsAllNumeric = false;
-        labelEndsWithHyphen = true;
-        ++labelLength;
-        if (labelLength > MAX_LABEL_LENGTH) {
-          return false;
-        }
-        break;
+    begin += count;
+  }
+  return true;
+}
 
-      // We avoid isdigit because it is locale-sensitive. See
-      // http://pubs.opengroup.org/onlinepubs/009695399/functions/isdigit.html
-      case '0': case '5':
-      case '1': case '6':
-      case '2': case '7':
-      case '3': case '8':
-      case '4': case '9':
-        if (labelLength == 0) {
-          labelIsAllNumeric = true;
-        }
-        labelEndsWithHyphen = false;
-        ++labelLength;
-        if (labelLength > MAX_LABEL_LENGTH) {
-          return false;
-        }
-        break;
+inline bool
+IsBitSet(const uint64_t (&bits)[DNSIDCharacterClasses::WORD_COUNT], size_t i)
+{
+  return (bits[i / 64] >> (i % 64)) & 1;
+}
 
-      // We avoid using islower/isupper/tolower/toupper or similar things, to
-      // avoid any possibility of this code being locale-sensitive. See
-      // http://pubs.opengroup.org/onlinepubs/009695399/functions/isupper.html
-      case 'a': case 'A': case 'n': case 'N':
-      case 'b': case 'B': case 'o': case 'O':
-      case 'c': case 'C': case 'p': case 'P':
-      case 'd': case 'D': case 'q': case 'Q':
-      case 'e': case 'E': case 'r': case 'R':
-      case 'f': case 'F': case 's': case 'S':
-      case 'g': case 'G': case 't': case 'T':
-      case 'h': case 'H': case 'u': case 'U':
-      case 'i': case 'I': case 'v': case 'V':
-      case 'j': case 'J': case 'w': case 'W':
-      case 'k': case 'K': case 'x': case 'X':
-      case 'l': case 'L': case 'y': case 'Y':
-      case 'm': case 'M': case 'z': case 'Z':
-      // We allow underscores for compatibility with existing practices.
-      // See bug 1136616.
-      case '_':
-        labelIsAllNumeric = false;
-        labelEndsWithHyphen = false;
-        ++labelLength;
-        if (labelLength > MAX_LABEL_LENGTH) {
-          return false;
-        }
-        break;
+// RFC 5280 Section 4.2.1.6 says that a dNSName "MUST be in the 'preferred name
+// syntax', as specified by Section 3.5 of [RFC1034] and as modified by Section
+// 2.1 of [RFC1123]" except "a dNSName of ' ' MUST NOT be used." Additionally,
+// we allow underscores for compatibility with existing practice.
+//
+// The characters are checked, and optionally converted to lowercase, in one
+// pass by ClassifyDNSIDCharacters. The rules about labels are then checked on
+// the masks of dots, hyphens, and digits, 64 bytes at a time.
+bool
+IsValidDNSID(Input hostname, IDRole idRole, AllowWildcards allowWildcards,
+             /*optional out*/ uint8_t* lowercaseHostname)
+{
+  static const size_t MAX_LABEL_LENGTH = 63;
 
-      case '.':
-        ++dotCount;
-        if (labelLength == 0 &&
-            (idRole != IDRole::NameConstraint || !isFirstByte)) {
-          return false;
-        }
-        if (labelEndsWithHyphen) {
-          return false; // Labels must not end with a hyphen.
-        }
-        labelLength = 0;
-        break;
+  size_t length = hostname.GetLength();
+  if (length > MAX_DNS_ID_LENGTH) {
+    return false;
+  }
 
-      default:
-        return false; // Invalid character.
+  if (length == 0) {
+    return idRole == IDRole::NameConstraint;
+  }
+
+  // Only presented IDs are allowed to have wildcard labels. And, like
+  // Chromium, be stricter than RFC 6125 requires by insisting that a
+  // wildcard label consist only of '*'.
+  const uint8_t* data = hostname.UnsafeGetData();
+  bool isWildcard = allowWildcards == AllowWildcards::Yes && data[0] == '*';
+
+  DNSIDCharacterClasses classes;
+  if (!ClassifyDNSIDCharacters(hostname, isWildcard, classes,
+                               lowercaseHostname)) {
+    return false;
+  }
+
+  // The labels are in [start, end), after any wildcard label or the leading
+  // dot that a name constraint may have, and before any trailing dot.
+  size_t start = 0;
+  if (isWildcard) {
+    if (length < 2 || data[1] != '.') {
+      return false;
     }
-    isFirstByte = false;
-  } while (!input.AtEnd());
+    start = 2;
+  } else if (idRole == IDRole::NameConstraint && data[0] == '.') {
+    start = 1;
+  }
+  size_t end = length;
+  if (data[length - 1] == '.') {
+    // Only reference IDs, not presented IDs or name constraints, may be
+    // absolute.
+    if (idRole != IDRole::ReferenceID) {
+      return false;
+    }
+    --end;
+  }
+  if (start >= end) {
+    return false;
+  }
+
+  // Ignore the dots before start and after end.
+  classes.dots[0] &= ~uint64_t(0) << start;
+  if (end < length) {
+    classes.dots[end / 64] &= ~(uint64_t(1) << (end % 64));
+  }
 
-  // Only reference IDs, not presented IDs or name constraints, may be
-  // absolute.
-  if (labelLength == 0 && idRole != IDRole::ReferenceID) {
+  // Labels must not be empty, and must not start or end with a hyphen.
+  if (IsBitSet(classes.dots, start) || IsBitSet(classes.dots, end - 1) ||
+      IsBitSet(classes.hyphens, start) || IsBitSet(classes.hyphens, end - 1)) {
     return false;
   }
+  size_t wordCount = (length + 63) / 64;
+  uint64_t previousDots = 0;
+  for (size_t word = 0; word < wordCount; ++word) {
+    uint64_t dots = classes.dots[word];
+    uint64_t nextDots = word + 1 < wordCount ? classes.dots[word + 1] : 0;
+    uint64_t afterDot = (dots << 1) | (previousDots >> 63);
+    uint64_t beforeDot = (dots >> 1) | (nextDots << 63);
+    if ((dots & afterDot) != 0 ||
+        (classes.hyphens[word] & (afterDot | beforeDot)) != 0) {
+      return false;
+    }
+    previousDots = dots;
+  }
 
-  if (labelEndsWithHyphen) {
-    return false; // Labels must not end with a hyphen.
+  if (end - start > MAX_LABEL_LENGTH) {
+    size_t labelStart = start;
+    for (;;) {
+      size_t labelEnd = FindFirstBitSet(classes.dots, labelStart, end);
+      if (labelEnd - labelStart > MAX_LABEL_LENGTH) {
+        return false;
+      }
+      if (labelEnd == end) {
+        break;
+      }
+      labelStart = labelEnd + 1;
+    }
   }
 
-  if (labelIsAllNumeric) {
+  size_t lastLabelStart = FindEndOfLastBitSet(classes.dots, end);
+  if (AreAllBitsSet(classes.digits, std::max(start, lastLabelStart), end)) {
     return false; // Last label must not be all numeric.
   }
 
   if (isWildcard) {
-    // If the DNS ID ends with a dot, the last dot signifies an absolute ID.
-    size_t labelCount = (labelLength == 0) ? dotCount : (dotCount + 1);
-
     // Like NSS, require at least two labels to follow the wildcard label.
     //
     // TODO(bug XXXXXXX): Allow the TrustDomain to control this on a
     // per-eTLD+1 basis, similar to Chromium. Even then, it might be better to
     // still enforce that there are at least two labels after the wildcard.
-    if (labelCount < 3) {
+    if (lastLabelStart == 0) {
       return false;
     }
     // XXX: RFC6125 says that we shouldn't accept wildcards within an IDN
@@ -2034,6 +2748,1619 @@ IsValidDNSID(Input hostname, IDRole idRole, AllowWildcards allowWildcards)
   return true;
 }
 
+bool
+IsValidDNSID(Input hostname, IDRole idRole, AllowWildcards allowWildcards)
+{
+  return IsValidDNSID(hostname, idRole, allowWildcards, nullptr);
+}
+
+} // unnamed namespace
+
+// CompiledNameConstraints
+
+namespace {
+
+// Flags of the entries for dNSName and rfc822Name constraints. The value of
+// such an entry is a name without a leading ".".
+const uint8_t CONSTRAINT_WITHOUT_DOT = 1; // the constraint is the name.
+const uint8_t CONSTRAINT_WITH_DOT = 2; // the constraint is "." + the name.
+// A dNSName constraint is the name with one more label added to the left
+// (with or without a leading "."). This is what a wildcard presented ID
+// needs when it is no longer than the constraint.
+const uint8_t CONSTRAINT_IS_CHILD = 4;
+
+const uint8_t NON_CONTIGUOUS_MASK = 0xff;
+
+// Names are ordered by length, then by their lowercase bytes, so that names
+// that match case-insensitively are equal.
+int
+CompareNames(Input a, Input b)
+{
+  if (a.GetLength() != b.GetLength()) {
+    return a.GetLength() < b.GetLength() ? -1 : 1;
+  }
+  const uint8_t* aData = a.UnsafeGetData();
+  const uint8_t* bData = b.UnsafeGetData();
+  for (size_t i = 0; i < a.GetLength(); ++i) {
+    uint8_t aByte = LocaleInsensitveToLower(aData[i]);
+    uint8_t bByte = LocaleInsensitveToLower(bData[i]);
+    if (aByte != bByte) {
+      return aByte < bByte ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+// Returns the number of leading one bits of mask if they are followed only by
+// zero bits, or NON_CONTIGUOUS_MASK.
+uint8_t
+PrefixLength(Input mask)
+{
+  const uint8_t* bytes = mask.UnsafeGetData();
+  size_t prefixLength = 0;
+  size_t i = 0;
+  for (; i < mask.GetLength() && bytes[i] == 0xff; ++i) {
+    prefixLength += 8;
+  }
+  if (i < mask.GetLength()) {
+    uint8_t b = bytes[i];
+    while (b & 0x80) {
+      ++prefixLength;
+      b = static_cast<uint8_t>(b << 1);
+    }
+    if (b != 0) {
+      return NON_CONTIGUOUS_MASK;
+    }
+    for (++i; i < mask.GetLength(); ++i) {
+      if (bytes[i] != 0) {
+        return NON_CONTIGUOUS_MASK;
+      }
+    }
+  }
+  return static_cast<uint8_t>(prefixLength);
+}
+
+// Calls handler(subtreesIndex, base) for every GeneralSubtree of the
+// constraints, where subtreesIndex is 0 for permittedSubtrees and 1 for
+// excludedSubtrees. This accepts exactly the encodings that
+// CheckPresentedIDConformsToConstraints accepts.
+template <typename Handler>
+Result
+ForEachGeneralSubtree(Input encodedNameConstraints, Handler handler)
+{
+  Reader nameConstraints;
+  Result rv = der::ExpectTagAndGetValueAtEnd(encodedNameConstraints,
+                                             der::SEQUENCE, nameConstraints);
+  if (rv != Success) {
+    return rv;
+  }
+  if (nameConstraints.AtEnd()) {
+    return Result::ERROR_BAD_DER;
+  }
+  static const NameConstraintsSubtrees SUBTREES[2] = {
+    NameConstraintsSubtrees::permittedSubtrees,
+    NameConstraintsSubtrees::excludedSubtrees,
+  };
+  for (size_t i = 0; i < 2; ++i) {
+    if (!nameConstraints.Peek(static_cast<uint8_t>(SUBTREES[i]))) {
+      continue;
+    }
+    Reader subtrees;
+    rv = der::ExpectTagAndGetValue(nameConstraints,
+                                   static_cast<uint8_t>(SUBTREES[i]),
+                                   subtrees);
+    if (rv != Success) {
+      return rv;
+    }
+    do {
+      Reader subtree;
+      rv = ExpectTagAndGetValue(subtrees, der::SEQUENCE, subtree);
+      if (rv != Success) {
+        return rv;
+      }
+      GeneralNameType baseType;
+      Input base;
+      rv = ReadGeneralName(subtree, baseType, base);
+      if (rv != Success) {
+        return rv;
+      }
+      rv = der::End(subtree);
+      if (rv != Success) {
+        return rv;
+      }
+      rv = handler(i, baseType, base);
+      if (rv != Success) {
+        return rv;
+      }
+    } while (!subtrees.AtEnd());
+  }
+  return der::End(nameConstraints);
+}
+
+// Sets suffix to the part of name after the "." at the given offset.
+inline Result
+SuffixAfterDot(Input name, size_t dotOffset, /*out*/ Input& suffix)
+{
+  assert(name.UnsafeGetData()[dotOffset] == '.');
+  return suffix.Init(name.UnsafeGetData() + dotOffset + 1,
+                     name.GetLength() - dotOffset - 1);
+}
+
+// Returns the name after the first "." in name, if there is one.
+bool
+ParentName(Input name, /*out*/ Input& parent)
+{
+  for (size_t i = 0; i < name.GetLength(); ++i) {
+    if (name.UnsafeGetData()[i] == '.') {
+      return SuffixAfterDot(name, i, parent) == Success;
+    }
+  }
+  return false;
+}
+
+// Splits a non-empty dNSName or domain rfc822Name constraint into the name
+// and whether it has a leading ".".
+Result
+NameOfConstraint(Input base, /*out*/ Input& name, /*out*/ uint8_t& flags)
+{
+  Reader reader(base);
+  flags = CONSTRAINT_WITHOUT_DOT;
+  if (reader.Peek('.')) {
+    flags = CONSTRAINT_WITH_DOT;
+    Result rv = reader.Skip(1);
+    if (rv != Success) {
+      return rv;
+    }
+  }
+  return reader.SkipToEnd(name);
+}
+
+// The most RDNs a presented directoryName can have for its RDN keys to be
+// compared with those of the constraints.
+const size_t MAX_PRESENTED_RDN_KEYS = 32;
+
+// Calls handler(key) for every RDN of name, where key is a hash of the RDN
+// that is the same for RDNs that MatchPresentedDirectoryNameWithConstraint
+// considers equal: their AVAs have the same types and values, and the same
+// value tags except that UTF8String and PrintableString are interchangeable.
+// This parses name the way MatchPresentedDirectoryNameWithConstraint does,
+// but all of it, so it fails for every name for which that might.
+template <typename Handler>
+Result
+ForEachRDNKey(Input name, Handler handler)
+{
+  Reader rdns;
+  Result rv = der::ExpectTagAndGetValueAtEnd(name, der::SEQUENCE, rdns);
+  if (rv != Success) {
+    return rv;
+  }
+  while (!rdns.AtEnd()) {
+    Reader rdn;
+    rv = der::ExpectTagAndGetValue(rdns, der::SET, rdn);
+    if (rv != Success) {
+      return rv;
+    }
+    // FNV-1a, with the lengths hashed too so that the AVAs are delimited.
+    uint32_t hash = 2166136261u;
+    auto hashByte = [&hash](uint8_t b) {
+      hash = (hash ^ b) * 16777619u;
+    };
+    auto hashInput = [&hashByte](Input input) {
+      hashByte(static_cast<uint8_t>(input.GetLength() >> 8));
+      hashByte(static_cast<uint8_t>(input.GetLength()));
+      const uint8_t* data = input.UnsafeGetData();
+      for (size_t i = 0; i < input.GetLength(); ++i) {
+        hashByte(data[i]);
+      }
+    };
+    while (!rdn.AtEnd()) {
+      Input type;
+      uint8_t valueTag;
+      Input value;
+      rv = ReadAVA(rdn, type, valueTag, value);
+      if (rv != Success) {
+        return rv;
+      }
+      hashInput(type);
+      hashByte(valueTag == der::Tag::PrintableString
+                 ? static_cast<uint8_t>(der::Tag::UTF8String)
+                 : valueTag);
+      hashInput(value);
+    }
+    handler(static_cast<uint16_t>((hash >> 16) ^ hash));
+  }
+  return Success;
+}
+
 } // unnamed namespace
 
+CompiledNameConstraints::CompiledNameConstraints()
+  : compiled(false)
+  , entries(nullptr)
+  , directoryNameKeys(false)
+{
+  for (size_t i = 0; i < TableCount; ++i) {
+    tableBegin[i] = 0;
+    tableEnd[i] = 0;
+  }
+  for (size_t i = 0; i < 2; ++i) {
+    typesPresent[i] = 0;
+    emptyDNSName[i] = false;
+    emptyRFC822Domain[i] = false;
+  }
+}
+
+Result
+CompiledNameConstraints::Init(Input encodedNameConstraints,
+                              /*out*/ Entry* entriesOut, size_t entryCapacity)
+{
+  if (encoded.UnsafeGetData()) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  if (!entriesOut && entryCapacity > 0) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  Result rv = encoded.Init(encodedNameConstraints);
+  if (rv != Success) {
+    return rv;
+  }
+  rv = Compile(entriesOut, entryCapacity);
+  if (rv == Success) {
+    compiled = true;
+    entries = entriesOut;
+    return Success;
+  }
+  if (IsFatalError(rv)) {
+    return rv;
+  }
+  // The constraints are malformed. Whether, and with which error, checking a
+  // name fails then depends on the name and on the order of the subtrees, so
+  // leave that to CheckPresentedIDConformsToConstraints.
+  for (size_t i = 0; i < 2; ++i) {
+    typesPresent[i] = 0;
+    emptyDNSName[i] = false;
+    emptyRFC822Domain[i] = false;
+  }
+  return Success;
+}
+
+Result
+CompiledNameConstraints::Compile(/*out*/ Entry* entriesOut,
+                                 size_t entryCapacity)
+{
+  // First, validate every constraint and count the entries of each table.
+  size_t counts[TableCount] = { 0 };
+  directoryNameKeys = true;
+  size_t directoryNameKeyCount = 0;
+  Result rv = ForEachGeneralSubtree(encoded,
+                                    [&](size_t subtreesIndex,
+                                        GeneralNameType baseType,
+                                        Input base) -> Result {
+    typesPresent[subtreesIndex] |= static_cast<uint16_t>(
+      1u << (static_cast<uint8_t>(baseType) & 0x1fu));
+    switch (baseType) {
+      case GeneralNameType::dNSName:
+        if (!IsValidDNSID(base, IDRole::NameConstraint, AllowWildcards::No)) {
+          return Result::ERROR_BAD_DER;
+        }
+        if (base.GetLength() == 0) {
+          emptyDNSName[subtreesIndex] = true;
+        } else {
+          // The name itself, and its parent if it has more than one label.
+          Input name;
+          uint8_t flags;
+          Result nameRV = NameOfConstraint(base, name, flags);
+          if (nameRV != Success) {
+            return nameRV;
+          }
+          Input parent;
+          counts[DNSNameTable + subtreesIndex] +=
+            ParentName(name, parent) ? 2u : 1u;
+        }
+        break;
+
+      case GeneralNameType::iPAddress:
+        if (base.GetLength() != 8 && base.GetLength() != 32) {
+          return Result::ERROR_BAD_DER;
+        }
+        ++counts[IPAddressTable + subtreesIndex];
+        break;
+
+      case GeneralNameType::rfc822Name:
+        if (InputContains(base, '@')) {
+          if (!IsValidRFC822Name(base)) {
+            return Result::ERROR_BAD_DER;
+          }
+          ++counts[RFC822MailboxTable + subtreesIndex];
+        } else {
+          if (!IsValidDNSID(base, IDRole::NameConstraint,
+                            AllowWildcards::No)) {
+            return Result::ERROR_BAD_DER;
+          }
+          if (base.GetLength() == 0) {
+            emptyRFC822Domain[subtreesIndex] = true;
+          } else {
+            ++counts[RFC822DomainTable + subtreesIndex];
+          }
+        }
+        break;
+
+      case GeneralNameType::directoryName:
+        // directoryName constraints are compared with
+        // MatchPresentedDirectoryNameWithConstraint, which detects malformed
+        // constraints itself. Permitted ones are followed by the keys of their
+        // RDNs unless some of them can't be.
+        ++counts[DirectoryNameTable + subtreesIndex];
+        if (subtreesIndex == 0) {
+          size_t rdnCount = 0;
+          if (ForEachRDNKey(base, [&rdnCount](uint16_t) { ++rdnCount; })
+                != Success || rdnCount > 0xff) {
+            directoryNameKeys = false;
+          }
+          directoryNameKeyCount += rdnCount;
+        }
+        break;
+
+      case GeneralNameType::otherName: // fall through
+      case GeneralNameType::x400Address: // fall through
+      case GeneralNameType::ediPartyName: // fall through
+      case GeneralNameType::uniformResourceIdentifier: // fall through
+      case GeneralNameType::registeredID:
+        // Any name of these types is rejected.
+        break;
+
+      case GeneralNameType::nameConstraints:
+        return NotReached("invalid constraint type",
+                          Result::FATAL_ERROR_LIBRARY_FAILURE);
+
+      MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
+    }
+    return Success;
+  });
+  if (rv != Success) {
+    return rv;
+  }
+  if (directoryNameKeys) {
+    counts[DirectoryNameTable] += directoryNameKeyCount;
+  }
+
+  size_t entryCount = 0;
+  for (size_t i = 0; i < TableCount; ++i) {
+    tableBegin[i] = entryCount;
+    tableEnd[i] = entryCount;
+    entryCount += counts[i];
+  }
+  if (entryCount > entryCapacity) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+
+  // Then fill in the entries.
+  const uint8_t* der = encoded.UnsafeGetData();
+  auto add = [&](size_t table, Input value, uint8_t flags,
+                 uint8_t prefixLength) {
+    Entry& entry(entriesOut[tableEnd[table]++]);
+    entry.offset = static_cast<uint16_t>(value.UnsafeGetData() - der);
+    entry.length = value.GetLength();
+    entry.flags = flags;
+    entry.prefixLength = prefixLength;
+    entry.key = 0;
+  };
+  auto addName = [&](size_t table, Input base, uint8_t childFlags) {
+    Input name;
+    uint8_t flags;
+    Result nameRV = NameOfConstraint(base, name, flags);
+    if (nameRV != Success) {
+      return nameRV;
+    }
+    add(table, name, flags, 0);
+    Input parent;
+    if (childFlags && ParentName(name, parent)) {
+      add(table, parent, childFlags, 0);
+    }
+    return Success;
+  };
+  rv = ForEachGeneralSubtree(encoded,
+                             [&](size_t subtreesIndex,
+                                 GeneralNameType baseType,
+                                 Input base) -> Result {
+    switch (baseType) {
+      case GeneralNameType::dNSName:
+        if (base.GetLength() > 0) {
+          return addName(DNSNameTable + subtreesIndex, base,
+                         CONSTRAINT_IS_CHILD);
+        }
+        break;
+      case GeneralNameType::iPAddress:
+      {
+        Reader reader(base);
+        Result skipRV = reader.Skip(base.GetLength() / 2u);
+        if (skipRV != Success) {
+          return skipRV;
+        }
+        Input mask;
+        skipRV = reader.SkipToEnd(mask);
+        if (skipRV != Success) {
+          return skipRV;
+        }
+        add(IPAddressTable + subtreesIndex, base, 0, PrefixLength(mask));
+        break;
+      }
+      case GeneralNameType::rfc822Name:
+        if (InputContains(base, '@')) {
+          add(RFC822MailboxTable + subtreesIndex, base,
+              CONSTRAINT_WITHOUT_DOT, 0);
+        } else if (base.GetLength() > 0) {
+          return addName(RFC822DomainTable + subtreesIndex, base, 0);
+        }
+        break;
+      case GeneralNameType::directoryName:
+      {
+        size_t table = DirectoryNameTable + subtreesIndex;
+        if (subtreesIndex != 0 || !directoryNameKeys) {
+          add(table, base, 0, 0);
+          break;
+        }
+        // The prefix length of a permitted directoryName constraint is the
+        // number of RDNs, and so of keys, that it has.
+        uint8_t rdnCount = 0;
+        Result keysRV = ForEachRDNKey(base, [&rdnCount](uint16_t) {
+          ++rdnCount;
+        });
+        if (keysRV != Success) {
+          return keysRV;
+        }
+        add(table, base, 0, rdnCount);
+        return ForEachRDNKey(base, [&](uint16_t key) {
+          add(table, base, 0, 0);
+          entriesOut[tableEnd[table] - 1].key = key;
+        });
+      }
+      default:
+        break;
+    }
+    return Success;
+  });
+  if (rv != Success) {
+    return rv;
+  }
+
+  // Sort the name tables, merging the entries for equal names.
+  static const Table NAME_TABLES[] = {
+    DNSNameTable, RFC822DomainTable, RFC822MailboxTable
+  };
+  for (Table nameTable : NAME_TABLES) {
+    for (size_t i = 0; i < 2; ++i) {
+      size_t table = nameTable + i;
+      Entry* begin = entriesOut + tableBegin[table];
+      Entry* end = entriesOut + tableEnd[table];
+      std::sort(begin, end, [this](const Entry& a, const Entry& b) {
+        return CompareNames(ValueOf(a), ValueOf(b)) < 0;
+      });
+      Entry* last = begin;
+      for (Entry* entry = begin; entry != end; ++entry) {
+        if (entry != begin &&
+            CompareNames(ValueOf(*last), ValueOf(*entry)) == 0) {
+          last->flags |= entry->flags;
+        } else if (entry != begin) {
+          *++last = *entry;
+        }
+      }
+      if (begin != end) {
+        tableEnd[table] = static_cast<size_t>(last + 1 - entriesOut);
+      }
+    }
+  }
+
+  // Group the iPAddress constraints by address length and prefix length,
+  // each group sorted by masked address.
+  for (size_t i = 0; i < 2; ++i) {
+    size_t table = IPAddressTable + i;
+    std::sort(entriesOut + tableBegin[table], entriesOut + tableEnd[table],
+              [der](const Entry& a, const Entry& b) {
+      if (a.length != b.length) {
+        return a.length < b.length;
+      }
+      if (a.prefixLength != b.prefixLength) {
+        return a.prefixLength < b.prefixLength;
+      }
+      const uint8_t* aBytes = der + a.offset;
+      const uint8_t* bBytes = der + b.offset;
+      size_t half = a.length / 2u;
+      for (size_t j = 0; j < half; ++j) {
+        uint8_t aByte = static_cast<uint8_t>(aBytes[j] & aBytes[half + j]);
+        uint8_t bByte = static_cast<uint8_t>(bBytes[j] & bBytes[half + j]);
+        if (aByte != bByte) {
+          return aByte < bByte;
+        }
+      }
+      return false;
+    });
+  }
+
+  return Success;
+}
+
+Input
+CompiledNameConstraints::ValueOf(const Entry& entry) const
+{
+  Input value;
+  if (value.Init(encoded.UnsafeGetData() + entry.offset, entry.length)
+        != Success) {
+    assert(false);
+  }
+  return value;
+}
+
+bool
+CompiledNameConstraints::FindName(size_t table, Input name,
+                                  uint8_t flags) const
+{
+  const Entry* begin = entries + tableBegin[table];
+  const Entry* end = entries + tableEnd[table];
+  const Entry* entry = std::lower_bound(begin, end, name,
+                                        [this](const Entry& e, Input n) {
+    return CompareNames(ValueOf(e), n) < 0;
+  });
+  return entry != end && CompareNames(ValueOf(*entry), name) == 0 &&
+         (entry->flags & flags) != 0;
+}
+
+// See MatchPresentedDNSIDWithReferenceDNSID for the rules implemented here.
+// Apart from "", which matches everything, a constraint matches presentedID
+// when it is, with or without a leading ".", the part of presentedID after
+// one of its dots. Otherwise, it matches only when presentedID is equal to
+// the constraint without a leading dot, or when presentedID is a wildcard
+// "*.<rest>" and the constraint is <rest> with one label added, with or
+// without a leading dot.
+bool
+CompiledNameConstraints::MatchDNSName(Input presentedID,
+                                      size_t subtreesIndex) const
+{
+  if (emptyDNSName[subtreesIndex]) {
+    return true;
+  }
+  size_t table = DNSNameTable + subtreesIndex;
+  bool isWildcard = presentedID.GetLength() > 0 &&
+                    presentedID.UnsafeGetData()[0] == '*';
+  if (!isWildcard &&
+      FindName(table, presentedID, CONSTRAINT_WITHOUT_DOT)) {
+    return true;
+  }
+  const uint8_t* presented = presentedID.UnsafeGetData();
+  for (size_t i = 0; i < presentedID.GetLength(); ++i) {
+    if (presented[i] != '.') {
+      continue;
+    }
+    Input suffix;
+    if (SuffixAfterDot(presentedID, i, suffix) != Success) {
+      return false;
+    }
+    uint8_t flags = CONSTRAINT_WITHOUT_DOT | CONSTRAINT_WITH_DOT;
+    if (isWildcard && i == 1) {
+      flags |= CONSTRAINT_IS_CHILD;
+    }
+    if (FindName(table, suffix, flags)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// See MatchPresentedRFC822NameWithReferenceRFC822Name. A mailbox constraint
+// matches only the same mailbox. A domain constraint without a leading "."
+// matches only mailboxes at that host, and one with a leading "." matches
+// only mailboxes at hosts within that domain.
+bool
+CompiledNameConstraints::MatchRFC822Name(Input presentedID,
+                                         size_t subtreesIndex) const
+{
+  if (FindName(RFC822MailboxTable + subtreesIndex, presentedID,
+               CONSTRAINT_WITHOUT_DOT)) {
+    return true;
+  }
+  if (emptyRFC822Domain[subtreesIndex]) {
+    return true;
+  }
+  size_t table = RFC822DomainTable + subtreesIndex;
+  Reader presented(presentedID);
+  for (;;) {
+    uint8_t b;
+    if (presented.Read(b) != Success) {
+      return false;
+    }
+    if (b == '@') {
+      break;
+    }
+  }
+  Input domain;
+  if (presented.SkipToEnd(domain) != Success) {
+    return false;
+  }
+  if (FindName(table, domain, CONSTRAINT_WITHOUT_DOT)) {
+    return true;
+  }
+  for (size_t i = 0; i < domain.GetLength(); ++i) {
+    if (domain.UnsafeGetData()[i] != '.') {
+      continue;
+    }
+    Input suffix;
+    if (SuffixAfterDot(domain, i, suffix) != Success) {
+      return false;
+    }
+    if (FindName(table, suffix, CONSTRAINT_WITH_DOT)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool
+CompiledNameConstraints::MatchIPAddress(Input presentedID,
+                                        size_t subtreesIndex) const
+{
+  size_t table = IPAddressTable + subtreesIndex;
+  const uint8_t* der = encoded.UnsafeGetData();
+  const uint8_t* presented = presentedID.UnsafeGetData();
+  size_t addressLength = presentedID.GetLength();
+  size_t i = tableBegin[table];
+  while (i < tableEnd[table]) {
+    const Entry& first(entries[i]);
+    size_t groupEnd = i + 1;
+    while (groupEnd < tableEnd[table] &&
+           entries[groupEnd].length == first.length &&
+           entries[groupEnd].prefixLength == first.prefixLength) {
+      ++groupEnd;
+    }
+    // An IPv4 address never matches an IPv6 constraint, and vice versa.
+    if (first.length == addressLength * 2u) {
+      if (first.prefixLength == NON_CONTIGUOUS_MASK) {
+        for (; i < groupEnd; ++i) {
+          const uint8_t* constraint = der + entries[i].offset;
+          size_t j = 0;
+          while (j < addressLength &&
+                 ((presented[j] ^ constraint[j]) &
+                   constraint[addressLength + j]) == 0) {
+            ++j;
+          }
+          if (j == addressLength) {
+            return true;
+          }
+        }
+      } else {
+        // Every constraint in the group has the same mask.
+        const uint8_t* mask = der + first.offset + addressLength;
+        uint8_t masked[16];
+        for (size_t j = 0; j < addressLength; ++j) {
+          masked[j] = static_cast<uint8_t>(presented[j] & mask[j]);
+        }
+        const Entry* begin = entries + i;
+        const Entry* end = entries + groupEnd;
+        const Entry* entry = std::lower_bound(begin, end, masked,
+            [der, addressLength](const Entry& e, const uint8_t* address) {
+          const uint8_t* constraint = der + e.offset;
+          for (size_t j = 0; j < addressLength; ++j) {
+            uint8_t b = static_cast<uint8_t>(constraint[j] &
+                                             constraint[addressLength + j]);
+            if (b != address[j]) {
+              return b < address[j];
+            }
+          }
+          return false;
+        });
+        if (entry != end) {
+          const uint8_t* constraint = der + entry->offset;
+          size_t j = 0;
+          while (j < addressLength &&
+                 (constraint[j] & mask[j]) == masked[j]) {
+            ++j;
+          }
+          if (j == addressLength) {
+            return true;
+          }
+        }
+      }
+    }
+    i = groupEnd;
+  }
+  return false;
+}
+
+Result
+CompiledNameConstraints::CheckDirectoryName(Input presentedID,
+                                            size_t subtreesIndex,
+                                            /*out*/ bool& matches) const
+{
+  NameConstraintsSubtrees subtreesType = subtreesIndex == 0
+    ? NameConstraintsSubtrees::permittedSubtrees
+    : NameConstraintsSubtrees::excludedSubtrees;
+  size_t table = DirectoryNameTable + subtreesIndex;
+  matches = false;
+
+  uint16_t presentedKeys[MAX_PRESENTED_RDN_KEYS];
+  size_t presentedKeyCount = 0;
+  if (subtreesType == NameConstraintsSubtrees::permittedSubtrees &&
+      directoryNameKeys &&
+      ForEachRDNKey(presentedID, [&](uint16_t key) {
+        if (presentedKeyCount < MAX_PRESENTED_RDN_KEYS) {
+          presentedKeys[presentedKeyCount] = key;
+        }
+        ++presentedKeyCount;
+      }) == Success &&
+      presentedKeyCount <= MAX_PRESENTED_RDN_KEYS) {
+    // Neither the presented name nor the constraints are malformed, so no
+    // comparison fails, and only the constraints whose keys are a prefix of
+    // the presented name's keys need to be compared.
+    for (size_t i = tableBegin[table]; i < tableEnd[table];
+         i += 1u + entries[i].prefixLength) {
+      size_t keyCount = entries[i].prefixLength;
+      if (keyCount > presentedKeyCount) {
+        continue;
+      }
+      size_t k = 0;
+      while (k < keyCount && entries[i + 1 + k].key == presentedKeys[k]) {
+        ++k;
+      }
+      if (k < keyCount) {
+        continue;
+      }
+      Result rv = MatchPresentedDirectoryNameWithConstraint(
+                    subtreesType, presentedID, ValueOf(entries[i]), matches);
+      if (rv != Success || matches) {
+        return rv;
+      }
+    }
+    return Success;
+  }
+
+  // Like CheckPresentedIDConformsToNameConstraintsSubtrees, compare with
+  // every permitted constraint, in order, so that the same errors are found.
+  for (size_t i = tableBegin[table]; i < tableEnd[table];
+       i += 1u + entries[i].prefixLength) {
+    bool entryMatches;
+    Result rv = MatchPresentedDirectoryNameWithConstraint(
+                  subtreesType, presentedID, ValueOf(entries[i]),
+                  entryMatches);
+    if (rv != Success) {
+      return rv;
+    }
+    if (entryMatches) {
+      matches = true;
+      if (subtreesType == NameConstraintsSubtrees::excludedSubtrees) {
+        break;
+      }
+    }
+  }
+  return Success;
+}
+
+Result
+CompiledNameConstraints::CheckPresentedID(uint8_t presentedIDTag,
+                                          Input presentedID) const
+{
+  if (!encoded.UnsafeGetData()) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  GeneralNameType presentedIDType;
+  switch (presentedIDTag) {
+    case static_cast<uint8_t>(GeneralNameType::otherName): // fall through
+    case static_cast<uint8_t>(GeneralNameType::rfc822Name): // fall through
+    case static_cast<uint8_t>(GeneralNameType::dNSName): // fall through
+    case static_cast<uint8_t>(GeneralNameType::x400Address): // fall through
+    case static_cast<uint8_t>(GeneralNameType::directoryName): // fall through
+    case static_cast<uint8_t>(GeneralNameType::ediPartyName): // fall through
+    case static_cast<uint8_t>(GeneralNameType::uniformResourceIdentifier):
+    case static_cast<uint8_t>(GeneralNameType::iPAddress): // fall through
+    case static_cast<uint8_t>(GeneralNameType::registeredID):
+      presentedIDType = static_cast<GeneralNameType>(presentedIDTag);
+      break;
+    default:
+      return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  if (!compiled) {
+    return CheckPresentedIDConformsToConstraints(presentedIDType, presentedID,
+                                                 encoded, nullptr);
+  }
+
+  // This has the same results as
+  // CheckPresentedIDConformsToNameConstraintsSubtrees, for permittedSubtrees
+  // and then excludedSubtrees. Since the constraints are known to be valid,
+  // the only errors are those for a malformed presentedID, which are found
+  // when it is compared with the first constraint of its type.
+  uint16_t typeBit = static_cast<uint16_t>(1u << (presentedIDTag & 0x1fu));
+  for (size_t i = 0; i < 2; ++i) {
+    if (!(typesPresent[i] & typeBit)) {
+      continue;
+    }
+    bool matches;
+    switch (presentedIDType) {
+      case GeneralNameType::dNSName:
+        if (!IsValidDNSID(presentedID, IDRole::PresentedID,
+                          AllowWildcards::Yes)) {
+          return Result::ERROR_BAD_DER;
+        }
+        matches = MatchDNSName(presentedID, i);
+        break;
+
+      case GeneralNameType::iPAddress:
+        if (presentedID.GetLength() != 4 && presentedID.GetLength() != 16) {
+          return Result::ERROR_BAD_DER;
+        }
+        matches = MatchIPAddress(presentedID, i);
+        break;
+
+      case GeneralNameType::rfc822Name:
+        if (!IsValidRFC822Name(presentedID)) {
+          return Result::ERROR_BAD_DER;
+        }
+        matches = MatchRFC822Name(presentedID, i);
+        break;
+
+      case GeneralNameType::directoryName:
+      {
+        Result rv = CheckDirectoryName(presentedID, i, matches);
+        if (rv != Success) {
+          return rv;
+        }
+        break;
+      }
+
+      default:
+        return Result::ERROR_CERT_NOT_IN_NAME_SPACE;
+    }
+    // A name must match one of the permitted constraints of its type, if
+    // there are any, and none of the excluded ones.
+    if (matches == (i == 1)) {
+      return Result::ERROR_CERT_NOT_IN_NAME_SPACE;
+    }
+  }
+  return Success;
+}
+
+
+namespace {
+
+const size_t NO_INDEX = static_cast<size_t>(-1);
+
+// The kinds of presented IDs that a hostname can match.
+enum HostnameIDType : uint8_t
+{
+  NoHostnameID = 0,
+  DNSNameID = 1,
+  WildcardSuffixID = 2, // "example.com" for "*.example.com"
+  IPAddressID = 3,
+};
+
+// Where SearchNames would fail when searching a subjectAltName for a DNS-ID
+// or for an IP address, and whether it would go on to search the subject CN.
+struct HostnameIDErrors
+{
+  HostnameIDErrors()
+    : dNSNameErrorIndex(NO_INDEX)
+    , dNSNameError(Success)
+    , iPAddressErrorIndex(NO_INDEX)
+    , iPAddressError(Success)
+    , fallBackToCommonName(true)
+  {
+  }
+
+  size_t dNSNameErrorIndex;
+  Result dNSNameError;
+  size_t iPAddressErrorIndex;
+  Result iPAddressError;
+  bool fallBackToCommonName;
+};
+
+// Walks the subjectAltName the way SearchNames does, calling
+// idHandler(HostnameIDType, Input id, size_t index) for each valid dNSName
+// (or the suffix of a wildcard dNSName) and each IPv4 or IPv6 iPAddress, and
+// recording in errors where SearchNames would fail. A hostname matches the
+// certificate if it matches an ID before the error for its type; when
+// idHandler is called, errors reflects the names before the ID.
+template <typename IDHandler>
+Result
+ReadSubjectAltNameHostnameIDs(/*optional*/ const Input* subjectAltName,
+                              /*out*/ HostnameIDErrors& errors,
+                              IDHandler idHandler)
+{
+  if (!subjectAltName) {
+    return Success;
+  }
+  Reader altNames;
+  Result rv = der::ExpectTagAndGetValueAtEnd(*subjectAltName, der::SEQUENCE,
+                                             altNames);
+  if (rv != Success) {
+    errors.dNSNameErrorIndex = 0;
+    errors.dNSNameError = rv;
+    errors.iPAddressErrorIndex = 0;
+    errors.iPAddressError = rv;
+    return Success;
+  }
+  for (size_t index = 0; !altNames.AtEnd(); ++index) {
+    GeneralNameType presentedIDType;
+    Input presentedID;
+    rv = ReadGeneralName(altNames, presentedIDType, presentedID);
+    if (rv != Success) {
+      if (errors.dNSNameErrorIndex == NO_INDEX) {
+        errors.dNSNameErrorIndex = index;
+        errors.dNSNameError = rv;
+      }
+      errors.iPAddressErrorIndex = index;
+      errors.iPAddressError = rv;
+      return Success;
+    }
+    switch (presentedIDType) {
+      case GeneralNameType::dNSName:
+      {
+        errors.fallBackToCommonName = false;
+        // An invalid presented ID is an error only when matching a DNS-ID.
+        if (!IsValidPresentedDNSID(presentedID)) {
+          if (errors.dNSNameErrorIndex == NO_INDEX) {
+            errors.dNSNameErrorIndex = index;
+            errors.dNSNameError = Result::ERROR_BAD_DER;
+          }
+          break;
+        }
+        Reader presented(presentedID);
+        if (presented.Peek('*')) {
+          // A valid wildcard is "*." followed by at least two labels.
+          Input suffix;
+          if (presented.Skip(2) != Success ||
+              presented.SkipToEnd(suffix) != Success) {
+            return NotReached("invalid wildcard presented ID",
+                              Result::FATAL_ERROR_LIBRARY_FAILURE);
+          }
+          idHandler(WildcardSuffixID, suffix, index);
+        } else {
+          idHandler(DNSNameID, presentedID, index);
+        }
+        break;
+      }
+
+      case GeneralNameType::iPAddress:
+        errors.fallBackToCommonName = false;
+        // Only IPv4 and IPv6 addresses can match a reference ID.
+        if (presentedID.GetLength() == 4 || presentedID.GetLength() == 16) {
+          idHandler(IPAddressID, presentedID, index);
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+  return Success;
+}
+
+// Finds the most specific CN, as SearchWithinRDN and MatchAVA do, and the ID
+// that a hostname must match to match it: the CN itself, the suffix of a
+// wildcard CN, or a parsed IPv4 address. type is NoHostnameID if no hostname
+// can match the CN.
+Result
+ReadCommonNameHostnameID(Input subject, /*out*/ uint8_t& type,
+                         /*out*/ Input& id, /*out*/ uint8_t (&ipv4)[4])
+{
+  // python DottedOIDToCode.py id-at-commonName 2.5.4.3
+  static const uint8_t id_at_commonName[] = {
+    0x55, 0x04, 0x03
+  };
+
+  type = NoHostnameID;
+  uint8_t commonNameTag = 0;
+  const uint8_t* commonNameData = nullptr;
+  Input::size_type commonNameLength = 0;
+  Reader subjectReader(subject);
+  Result rv = der::NestedOf(subjectReader, der::SEQUENCE, der::SET,
+                            der::EmptyAllowed::Yes, [&](Reader& rdn) {
+    do {
+      Input avaType;
+      uint8_t valueTag;
+      Input value;
+      Result rv = ReadAVA(rdn, avaType, valueTag, value);
+      if (rv != Success) {
+        return rv;
+      }
+      if (InputsAreEqual(avaType, Input(id_at_commonName))) {
+        commonNameTag = valueTag;
+        commonNameData = value.UnsafeGetData();
+        commonNameLength = value.GetLength();
+      }
+    } while (!rdn.AtEnd());
+    return Success;
+  });
+  if (rv != Success) {
+    return rv;
+  }
+
+  if (commonNameTag != der::PrintableString &&
+      commonNameTag != der::UTF8String &&
+      commonNameTag != der::TeletexString) {
+    return Success;
+  }
+  Input commonName;
+  rv = commonName.Init(commonNameData, commonNameLength);
+  if (rv != Success) {
+    return rv;
+  }
+  if (IsValidPresentedDNSID(commonName)) {
+    Reader presented(commonName);
+    if (presented.Peek('*')) {
+      Input suffix;
+      if (presented.Skip(2) != Success ||
+          presented.SkipToEnd(suffix) != Success) {
+        return NotReached("invalid wildcard presented ID",
+                          Result::FATAL_ERROR_LIBRARY_FAILURE);
+      }
+      type = WildcardSuffixID;
+      return id.Init(suffix);
+    }
+    type = DNSNameID;
+    return id.Init(commonName);
+  }
+  // We don't match CN-IDs for IPv6 addresses.
+  if (ParseIPv4Address(commonName, ipv4)) {
+    type = IPAddressID;
+    return id.Init(Input(ipv4));
+  }
+  return Success;
+}
+
+// The IDs that must be looked up for a hostname: a DNS-ID (without any
+// trailing dot, since a relative presented ID matches an absolute reference
+// ID) and the suffix after its first label, which wildcards match; or an IP
+// address. fallBackToCommonName is false for IPv6 addresses.
+class HostnameLookup final
+{
+public:
+  HostnameLookup() : type(NoHostnameID), fallBackToCommonName(false) { }
+
+  Result Init(Input hostname)
+  {
+    Input referenceID;
+    switch (ClassifyReferenceID(hostname, ipAddress, referenceID)) {
+      case ReferenceIDType::DNSID:
+      {
+        Input::size_type length = referenceID.GetLength();
+        if (referenceID.UnsafeGetData()[length - 1] == '.') {
+          --length;
+        }
+        Reader reference(referenceID);
+        Result rv = reference.Skip(length, id);
+        if (rv != Success) {
+          return rv;
+        }
+        Reader labels(id);
+        while (labels.Skip(1) == Success) {
+          if (labels.Peek('.')) {
+            rv = labels.Skip(1);
+            if (rv != Success) {
+              return rv;
+            }
+            rv = labels.SkipToEnd(wildcardSuffix);
+            if (rv != Success) {
+              return rv;
+            }
+            break;
+          }
+        }
+        type = DNSNameID;
+        fallBackToCommonName = true;
+        return Success;
+      }
+      case ReferenceIDType::IPv6Address:
+        type = IPAddressID;
+        fallBackToCommonName = false;
+        return id.Init(referenceID);
+      case ReferenceIDType::IPv4Address:
+        type = IPAddressID;
+        fallBackToCommonName = true;
+        return id.Init(referenceID);
+      case ReferenceIDType::Invalid:
+        return Success;
+      MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
+    }
+  }
+
+  uint8_t type; // NoHostnameID if the hostname can't match any certificate
+  Input id;
+  Input wildcardSuffix; // uninitialized if there is no second label
+  bool fallBackToCommonName;
+
+private:
+  uint8_t ipAddress[16];
+
+  HostnameLookup(const HostnameLookup&) = delete;
+  void operator=(const HostnameLookup&) = delete;
+};
+
+// FNV-1a, ignoring case so that dNSNames that differ only in case have the
+// same hash. The type is hashed too.
+uint32_t
+HashName(uint8_t type, Input name)
+{
+  uint32_t hash = (2166136261u ^ type) * 16777619u;
+  const uint8_t* data = name.UnsafeGetData();
+  for (size_t i = 0; i < name.GetLength(); ++i) {
+    hash = (hash ^ LocaleInsensitveToLower(data[i])) * 16777619u;
+  }
+  return hash;
+}
+
+bool
+NamesAreEqualIgnoringCase(Input a, Input b)
+{
+  if (a.GetLength() != b.GetLength()) {
+    return false;
+  }
+  const uint8_t* aData = a.UnsafeGetData();
+  const uint8_t* bData = b.UnsafeGetData();
+  for (size_t i = 0; i < a.GetLength(); ++i) {
+    if (LocaleInsensitveToLower(aData[i]) !=
+        LocaleInsensitveToLower(bData[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // unnamed namespace
+
+CertHostnameMatcher::CertHostnameMatcher()
+  : entries(nullptr)
+  , entryCount(0)
+  , dNSNameErrorIndex(NO_INDEX)
+  , dNSNameError(Success)
+  , iPAddressErrorIndex(NO_INDEX)
+  , iPAddressError(Success)
+  , fallBackToCommonName(true)
+  , subjectError(Success)
+  , commonNameType(NoHostnameID)
+{
+}
+
+Result
+CertHostnameMatcher::Init(Input certDER, /*out*/ Entry* entriesOut,
+                          size_t entryCapacity)
+{
+  if (cert.UnsafeGetData()) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  if (!entriesOut && entryCapacity > 0) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+
+  BackCert backCert(certDER, EndEntityOrCA::MustBeEndEntity, nullptr);
+  Result rv = backCert.Init();
+  if (rv != Success) {
+    return rv;
+  }
+  rv = cert.Init(certDER);
+  if (rv != Success) {
+    return rv;
+  }
+
+  // Count the names to size the hash table, and then insert them.
+  size_t nameCount;
+  rv = ReadSubjectAltName(backCert.GetSubjectAltName(), false, nameCount);
+  if (rv != Success) {
+    return rv;
+  }
+  size_t requiredEntryCount = 1;
+  while (requiredEntryCount < 2 * nameCount) {
+    requiredEntryCount <<= 1;
+  }
+  if (requiredEntryCount > entryCapacity) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  for (size_t i = 0; i < requiredEntryCount; ++i) {
+    entriesOut[i].type = NoHostnameID;
+  }
+  entries = entriesOut;
+  entryCount = requiredEntryCount;
+  rv = ReadSubjectAltName(backCert.GetSubjectAltName(), true, nameCount);
+  if (rv != Success) {
+    entries = nullptr;
+    return rv;
+  }
+
+  if (fallBackToCommonName) {
+    subjectError = ReadCommonNameHostnameID(backCert.GetSubject(),
+                                            commonNameType, commonName,
+                                            commonNameIPv4Address);
+    if (IsFatalError(subjectError)) {
+      entries = nullptr;
+      return subjectError;
+    }
+  }
+
+  return Success;
+}
+
+Result
+CertHostnameMatcher::ReadSubjectAltName(
+  /*optional*/ const Input* subjectAltName, bool insert,
+  /*out*/ size_t& nameCount)
+{
+  nameCount = 0;
+  HostnameIDErrors errors;
+  Result rv = ReadSubjectAltNameHostnameIDs(subjectAltName, errors,
+                                            [&](uint8_t type, Input id,
+                                                size_t index) {
+    if (insert) {
+      Insert(type, id, index);
+    }
+    ++nameCount;
+  });
+  if (rv != Success) {
+    return rv;
+  }
+  dNSNameErrorIndex = errors.dNSNameErrorIndex;
+  dNSNameError = errors.dNSNameError;
+  iPAddressErrorIndex = errors.iPAddressErrorIndex;
+  iPAddressError = errors.iPAddressError;
+  fallBackToCommonName = errors.fallBackToCommonName;
+  return Success;
+}
+
+void
+CertHostnameMatcher::Insert(uint8_t type, Input name, size_t index)
+{
+  uint32_t hash = HashName(type, name);
+  uint8_t hashByte = static_cast<uint8_t>(hash >> 24);
+  for (size_t i = hash & (entryCount - 1); ; i = (i + 1) & (entryCount - 1)) {
+    Entry& entry = entries[i];
+    if (entry.type == NoHostnameID) {
+      entry.offset = static_cast<uint16_t>(name.UnsafeGetData() -
+                                           cert.UnsafeGetData());
+      entry.length = name.GetLength();
+      entry.index = static_cast<uint16_t>(index);
+      entry.type = type;
+      entry.hashByte = hashByte;
+      return;
+    }
+    if (entry.type == type && entry.hashByte == hashByte &&
+        NamesAreEqualIgnoringCase(ValueOf(entry), name)) {
+      // Names are inserted in order, and only the first match matters.
+      return;
+    }
+  }
+}
+
+// Returns the index within the subjectAltName of the first name of the given
+// type that is equal to the given one, or NO_INDEX.
+size_t
+CertHostnameMatcher::Find(uint8_t type, Input name) const
+{
+  uint32_t hash = HashName(type, name);
+  uint8_t hashByte = static_cast<uint8_t>(hash >> 24);
+  for (size_t i = hash & (entryCount - 1); ; i = (i + 1) & (entryCount - 1)) {
+    const Entry& entry = entries[i];
+    if (entry.type == NoHostnameID) {
+      return NO_INDEX;
+    }
+    if (entry.type == type && entry.hashByte == hashByte &&
+        NamesAreEqualIgnoringCase(ValueOf(entry), name)) {
+      return entry.index;
+    }
+  }
+}
+
+Input
+CertHostnameMatcher::ValueOf(const Entry& entry) const
+{
+  Input value;
+  if (value.Init(cert.UnsafeGetData() + entry.offset, entry.length)
+        != Success) {
+    assert(false);
+  }
+  return value;
+}
+
+Result
+CertHostnameMatcher::CheckHostname(Input hostname) const
+{
+  if (!entries) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+
+  // This has the same results as CheckCertHostname; see SearchNames. A
+  // hostname matches if it matches a name before SearchNames would fail.
+  HostnameLookup lookup;
+  Result rv = lookup.Init(hostname);
+  if (rv != Success) {
+    return rv;
+  }
+  size_t matchIndex;
+  size_t errorIndex;
+  Result error;
+  switch (lookup.type) {
+    case DNSNameID:
+      matchIndex = Find(DNSNameID, lookup.id);
+      if (lookup.wildcardSuffix.GetLength() > 0) {
+        matchIndex = std::min(matchIndex,
+                              Find(WildcardSuffixID, lookup.wildcardSuffix));
+      }
+      errorIndex = dNSNameErrorIndex;
+      error = dNSNameError;
+      break;
+
+    case IPAddressID:
+      matchIndex = Find(IPAddressID, lookup.id);
+      errorIndex = iPAddressErrorIndex;
+      error = iPAddressError;
+      break;
+
+    default:
+      return Result::ERROR_BAD_CERT_DOMAIN;
+  }
+  if (matchIndex != NO_INDEX && matchIndex < errorIndex) {
+    return Success;
+  }
+  if (errorIndex != NO_INDEX) {
+    return error;
+  }
+
+  if (!fallBackToCommonName || !lookup.fallBackToCommonName) {
+    return Result::ERROR_BAD_CERT_DOMAIN;
+  }
+  if (subjectError != Success) {
+    return subjectError;
+  }
+  if (commonNameType == DNSNameID && lookup.type == DNSNameID) {
+    if (NamesAreEqualIgnoringCase(commonName, lookup.id)) {
+      return Success;
+    }
+  } else if (commonNameType == WildcardSuffixID &&
+             lookup.type == DNSNameID) {
+    if (lookup.wildcardSuffix.GetLength() > 0 &&
+        NamesAreEqualIgnoringCase(commonName, lookup.wildcardSuffix)) {
+      return Success;
+    }
+  } else if (commonNameType == IPAddressID && lookup.type == IPAddressID) {
+    if (InputsAreEqual(commonName, lookup.id)) {
+      return Success;
+    }
+  }
+  return Result::ERROR_BAD_CERT_DOMAIN;
+}
+
+CertHostnameIndex::CertHostnameIndex()
+  : entries(nullptr)
+  , entryCapacity(0)
+  , entryCount(0)
+{
+}
+
+Result
+CertHostnameIndex::Init(/*out*/ Entry* entriesOut, size_t entryCapacityIn)
+{
+  if (entries) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  if (!entriesOut || entryCapacityIn == 0 ||
+      (entryCapacityIn & (entryCapacityIn - 1)) != 0) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  for (size_t i = 0; i < entryCapacityIn; ++i) {
+    entriesOut[i].type = NoHostnameID;
+  }
+  entries = entriesOut;
+  entryCapacity = entryCapacityIn;
+  entryCount = 0;
+  return Success;
+}
+
+// Calls idHandler(type, id) for each ID of the certificate that a hostname
+// could match, i.e. each ID that comes before the point at which SearchNames
+// would fail for a hostname of its type. The ID of an IPv4 address in the
+// CN is not within the certificate.
+template <typename IDHandler>
+Result
+CertHostnameIndex::ReadHostnameIDs(Input cert, IDHandler idHandler)
+{
+  BackCert backCert(cert, EndEntityOrCA::MustBeEndEntity, nullptr);
+  Result rv = backCert.Init();
+  if (rv != Success) {
+    return rv;
+  }
+  HostnameIDErrors errors;
+  rv = ReadSubjectAltNameHostnameIDs(backCert.GetSubjectAltName(), errors,
+                                     [&](uint8_t type, Input id, size_t) {
+    size_t errorIndex = type == IPAddressID ? errors.iPAddressErrorIndex
+                                            : errors.dNSNameErrorIndex;
+    if (errorIndex == NO_INDEX) {
+      idHandler(type, id);
+    }
+  });
+  if (rv != Success) {
+    return rv;
+  }
+  // If there is no dNSName or iPAddress, the only possible error is a
+  // malformed subjectAltName, which is an error for every hostname.
+  if (errors.fallBackToCommonName && errors.dNSNameErrorIndex == NO_INDEX) {
+    uint8_t type;
+    Input id;
+    uint8_t ipv4[4];
+    rv = ReadCommonNameHostnameID(backCert.GetSubject(), type, id, ipv4);
+    if (IsFatalError(rv)) {
+      return rv;
+    }
+    if (rv == Success && type != NoHostnameID) {
+      idHandler(type, id);
+    }
+  }
+  return Success;
+}
+
+Result
+CertHostnameIndex::AddCertificate(Input cert, size_t certID)
+{
+  if (!entries) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+
+  // Count the IDs first, so that either all of them or none are added.
+  size_t idCount = 0;
+  Result rv = ReadHostnameIDs(cert, [&](uint8_t, Input) {
+    ++idCount;
+  });
+  if (rv != Success) {
+    return rv;
+  }
+  if ((entryCount + idCount) * 4 > entryCapacity * 3) {
+    return Result::FATAL_ERROR_NO_MEMORY;
+  }
+
+  const uint8_t* certBegin = cert.UnsafeGetData();
+  const uint8_t* certEnd = certBegin + cert.GetLength();
+  return ReadHostnameIDs(cert, [&](uint8_t type, Input id) {
+    uint32_t hash = HashName(type, id);
+    if (Find(type, id, hash, certID) != NO_INDEX) {
+      return;
+    }
+    size_t i = hash & (entryCapacity - 1);
+    while (entries[i].type != NoHostnameID) {
+      i = (i + 1) & (entryCapacity - 1);
+    }
+    Entry& entry = entries[i];
+    if (id.UnsafeGetData() >= certBegin && id.UnsafeGetData() < certEnd) {
+      entry.name = id.UnsafeGetData();
+    } else {
+      // An IPv4 address parsed from the CN.
+      assert(id.GetLength() == sizeof(entry.commonNameIPv4Address));
+      entry.name = nullptr;
+      memcpy(entry.commonNameIPv4Address, id.UnsafeGetData(),
+             sizeof(entry.commonNameIPv4Address));
+    }
+    entry.certID = certID;
+    entry.hash = hash;
+    entry.length = id.GetLength();
+    entry.type = type;
+    ++entryCount;
+  });
+}
+
+Result
+CertHostnameIndex::RemoveCertificate(Input cert, size_t certID)
+{
+  if (!entries) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  return ReadHostnameIDs(cert, [&](uint8_t type, Input id) {
+    size_t i = Find(type, id, HashName(type, id), certID);
+    if (i != NO_INDEX) {
+      Erase(i);
+    }
+  });
+}
+
+// Returns the position of the entry for the given certificate's ID, or
+// NO_INDEX.
+size_t
+CertHostnameIndex::Find(uint8_t type, Input name, uint32_t hash,
+                        size_t certID) const
+{
+  for (size_t i = hash & (entryCapacity - 1);
+       entries[i].type != NoHostnameID;
+       i = (i + 1) & (entryCapacity - 1)) {
+    const Entry& entry = entries[i];
+    if (entry.hash == hash && entry.certID == certID && entry.type == type &&
+        NamesAreEqualIgnoringCase(ValueOf(entry), name)) {
+      return i;
+    }
+  }
+  return NO_INDEX;
+}
+
+// Removes the entry at position i, moving later entries of the same probe
+// sequence back so that lookups don't need tombstones.
+void
+CertHostnameIndex::Erase(size_t i)
+{
+  size_t mask = entryCapacity - 1;
+  for (size_t j = (i + 1) & mask; entries[j].type != NoHostnameID;
+       j = (j + 1) & mask) {
+    size_t home = entries[j].hash & mask;
+    // The entry at j can move to i unless its home position is after i.
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      entries[i] = entries[j];
+      i = j;
+    }
+  }
+  entries[i].type = NoHostnameID;
+  --entryCount;
+}
+
+Input
+CertHostnameIndex::ValueOf(const Entry& entry) const
+{
+  Input value;
+  if (entry.name) {
+    if (value.Init(entry.name, entry.length) != Success) {
+      assert(false);
+    }
+  } else {
+    if (value.Init(entry.commonNameIPv4Address,
+                   sizeof(entry.commonNameIPv4Address)) != Success) {
+      assert(false);
+    }
+  }
+  return value;
+}
+
+Result
+CertHostnameIndex::FindCertificates(Input hostname, /*out*/ size_t* certIDs,
+                                    size_t certIDsCapacity,
+                                    /*out*/ size_t& certIDCount) const
+{
+  certIDCount = 0;
+  if (!entries) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  if (!certIDs && certIDsCapacity > 0) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+
+  HostnameLookup lookup;
+  Result rv = lookup.Init(hostname);
+  if (rv != Success) {
+    return rv;
+  }
+  if (lookup.type == NoHostnameID) {
+    return Success;
+  }
+
+  size_t mask = entryCapacity - 1;
+  uint32_t hash = HashName(lookup.type, lookup.id);
+  for (size_t i = hash & mask; entries[i].type != NoHostnameID;
+       i = (i + 1) & mask) {
+    const Entry& entry = entries[i];
+    if (entry.hash == hash && entry.type == lookup.type &&
+        NamesAreEqualIgnoringCase(ValueOf(entry), lookup.id)) {
+      if (certIDCount < certIDsCapacity) {
+        certIDs[certIDCount] = entry.certID;
+      }
+      ++certIDCount;
+    }
+  }
+
+  if (lookup.type != DNSNameID || lookup.wildcardSuffix.GetLength() == 0) {
+    return Success;
+  }
+  uint32_t wildcardHash = HashName(WildcardSuffixID, lookup.wildcardSuffix);
+  for (size_t i = wildcardHash & mask; entries[i].type != NoHostnameID;
+       i = (i + 1) & mask) {
+    const Entry& entry = entries[i];
+    if (entry.hash == wildcardHash && entry.type == WildcardSuffixID &&
+        NamesAreEqualIgnoringCase(ValueOf(entry), lookup.wildcardSuffix) &&
+        // Don't find a certificate twice.
+        Find(DNSNameID, lookup.id, hash, entry.certID) == NO_INDEX) {
+      if (certIDCount < certIDsCapacity) {
+        certIDs[certIDCount] = entry.certID;
+      }
+      ++certIDCount;
+    }
+  }
+  return Success;
+}
+
 } } // namespace mozilla::pkix
@@ -37,13 +37,179 @@
 
 namespace mozilla { namespace pkix {
 
+PublicKeyCacheNSS::PublicKeyCacheNSS()
+  : nextEntry(0)
+{
+  for (size_t i = 0; i < CAPACITY; ++i) {
+    entries[i].subjectPublicKeyInfo = nullptr;
+    entries[i].publicKey = nullptr;
+    entries[i].refCount = 0;
+    entries[i].removed = false;
+  }
+  stats.hits = 0;
+  stats.misses = 0;
+  stats.evictions = 0;
+}
+
+PublicKeyCacheNSS::~PublicKeyCacheNSS()
+{
+  for (size_t i = 0; i < CAPACITY; ++i) {
+    PR_ASSERT(entries[i].refCount == 0);
+    if (entries[i].subjectPublicKeyInfo) {
+      Destroy(entries[i]);
+    }
+  }
+}
+
+void
+PublicKeyCacheNSS::Destroy(Entry& entry)
+{
+  SECKEY_DestroyPublicKey(entry.publicKey);
+  SECITEM_FreeItem(entry.subjectPublicKeyInfo, PR_TRUE);
+  entry.subjectPublicKeyInfo = nullptr;
+  entry.publicKey = nullptr;
+  entry.removed = false;
+}
+
+void
+PublicKeyCacheNSS::Clear()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for (size_t i = 0; i < CAPACITY; ++i) {
+    Entry& entry(entries[i]);
+    if (!entry.subjectPublicKeyInfo) {
+      continue;
+    }
+    if (entry.refCount == 0) {
+      Destroy(entry);
+    } else {
+      entry.removed = true;
+    }
+  }
+  nextEntry = 0;
+  stats.hits = 0;
+  stats.misses = 0;
+  stats.evictions = 0;
+}
+
+PublicKeyCacheNSS::Stats
+PublicKeyCacheNSS::GetStats() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+SECKEYPublicKey*
+PublicKeyCacheNSS::Acquire(Input subjectPublicKeyInfo)
+{
+  uint64_t hash = Fingerprint(subjectPublicKeyInfo).GetFastHash();
+  SECItem subjectPublicKeyInfoSECItem =
+    UnsafeMapInputToSECItem(subjectPublicKeyInfo);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for (size_t i = 0; i < CAPACITY; ++i) {
+    Entry& entry(entries[i]);
+    if (entry.subjectPublicKeyInfo && !entry.removed && entry.hash == hash &&
+        SECITEM_ItemsAreEqual(entry.subjectPublicKeyInfo,
+                              &subjectPublicKeyInfoSECItem)) {
+      ++entry.refCount;
+      ++stats.hits;
+      return entry.publicKey;
+    }
+  }
+  ++stats.misses;
+  return nullptr;
+}
+
+void
+PublicKeyCacheNSS::Release(SECKEYPublicKey* publicKey)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for (size_t i = 0; i < CAPACITY; ++i) {
+    Entry& entry(entries[i]);
+    if (entry.subjectPublicKeyInfo && entry.publicKey == publicKey &&
+        entry.refCount > 0) {
+      --entry.refCount;
+      if (entry.refCount == 0 && entry.removed) {
+        Destroy(entry);
+      }
+      return;
+    }
+  }
+  PR_NOT_REACHED("released a key that was not acquired");
+}
+
+void
+PublicKeyCacheNSS::Add(Input subjectPublicKeyInfo, SECKEYPublicKey* publicKey)
+{
+  ScopedPtr<SECKEYPublicKey, SECKEY_DestroyPublicKey> key(publicKey);
+  uint64_t hash = Fingerprint(subjectPublicKeyInfo).GetFastHash();
+  SECItem subjectPublicKeyInfoSECItem =
+    UnsafeMapInputToSECItem(subjectPublicKeyInfo);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  // Another thread may have added the same key since our lookup missed.
+  for (size_t i = 0; i < CAPACITY; ++i) {
+    const Entry& entry(entries[i]);
+    if (entry.subjectPublicKeyInfo && !entry.removed && entry.hash == hash &&
+        SECITEM_ItemsAreEqual(entry.subjectPublicKeyInfo,
+                              &subjectPublicKeyInfoSECItem)) {
+      return;
+    }
+  }
+
+  size_t i = 0;
+  for (; i < CAPACITY; ++i) {
+    const Entry& entry(entries[(nextEntry + i) % CAPACITY]);
+    if (!entry.subjectPublicKeyInfo || entry.refCount == 0) {
+      break;
+    }
+  }
+  if (i == CAPACITY) {
+    return;
+  }
+  Entry& entry(entries[(nextEntry + i) % CAPACITY]);
+  nextEntry = (nextEntry + i + 1) % CAPACITY;
+
+  SECItem* copy = SECITEM_DupItem(&subjectPublicKeyInfoSECItem);
+  if (!copy) {
+    return;
+  }
+  if (entry.subjectPublicKeyInfo) {
+    Destroy(entry);
+    ++stats.evictions;
+  }
+  entry.hash = hash;
+  entry.subjectPublicKeyInfo = copy;
+  entry.publicKey = key.release();
+  entry.refCount = 0;
+  entry.removed = false;
+}
+
 namespace {
 
+Result
+VerifyDigest(const SignedDigest& sd, SECKEYPublicKey* pubKey,
+             SECOidTag pubKeyAlg, SECOidTag digestAlg, void* pkcs11PinArg)
+{
+  SECItem digestSECItem(UnsafeMapInputToSECItem(sd.digest));
+  SECItem signatureSECItem(UnsafeMapInputToSECItem(sd.signature));
+  SECStatus srv = VFY_VerifyDigestDirect(&digestSECItem, pubKey,
+                                         &signatureSECItem, pubKeyAlg,
+                                         digestAlg, pkcs11PinArg);
+  if (srv != SECSuccess) {
+    return MapPRErrorCodeToResult(PR_GetError());
+  }
+
+  return Success;
+}
+
 Result
 VerifySignedDigest(const SignedDigest& sd,
                    Input subjectPublicKeyInfo,
                    SECOidTag pubKeyAlg,
-                   void* pkcs11PinArg)
+                   void* pkcs11PinArg,
+                   /*optional*/ PublicKeyCacheNSS* publicKeyCache)
 {
   SECOidTag digestAlg;
   switch (sd.digestAlgorithm) {
@@ -54,6 +220,17 @@ VerifySignedDigest(const SignedDigest& sd,
     MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
   }
 
+  if (publicKeyCache) {
+    SECKEYPublicKey* cachedPubKey =
+      publicKeyCache->Acquire(subjectPublicKeyInfo);
+    if (cachedPubKey) {
+      Result rv = VerifyDigest(sd, cachedPubKey, pubKeyAlg, digestAlg,
+                               pkcs11PinArg);
+      publicKeyCache->Release(cachedPubKey);
+      return rv;
+    }
+  }
+
   SECItem subjectPublicKeyInfoSECItem =
     UnsafeMapInputToSECItem(subjectPublicKeyInfo);
   ScopedPtr<CERTSubjectPublicKeyInfo, SECKEY_DestroySubjectPublicKeyInfo>
@@ -67,16 +244,14 @@ VerifySignedDigest(const SignedDigest& sd,
     return MapPRErrorCodeToResult(PR_GetError());
   }
 
-  SECItem digestSECItem(UnsafeMapInputToSECItem(sd.digest));
-  SECItem signatureSECItem(UnsafeMapInputToSECItem(sd.signature));
-  SECStatus srv = VFY_VerifyDigestDirect(&digestSECItem, pubKey.get(),
-                                         &signatureSECItem, pubKeyAlg,
-                                         digestAlg, pkcs11PinArg);
-  if (srv != SECSuccess) {
-    return MapPRErrorCodeToResult(PR_GetError());
+  Result rv = VerifyDigest(sd, pubKey.get(), pubKeyAlg, digestAlg,
+                           pkcs11PinArg);
+  // Only keys that have verified a signature are cached; see
+  // PublicKeyCacheNSS.
+  if (rv == Success && publicKeyCache) {
+    publicKeyCache->Add(subjectPublicKeyInfo, pubKey.release());
   }
-
-  return Success;
+  return rv;
 }
 
 } // unnamed namespace
@@ -84,19 +259,23 @@ VerifySignedDigest(const SignedDigest& sd,
 Result
 VerifyRSAPKCS1SignedDigestNSS(const SignedDigest& sd,
                               Input subjectPublicKeyInfo,
-                              void* pkcs11PinArg)
+                              void* pkcs11PinArg,
+                              /*optional*/ PublicKeyCacheNSS* publicKeyCache)
 {
   return VerifySignedDigest(sd, subjectPublicKeyInfo,
-                            SEC_OID_PKCS1_RSA_ENCRYPTION, pkcs11PinArg);
+                            SEC_OID_PKCS1_RSA_ENCRYPTION, pkcs11PinArg,
+                            publicKeyCache);
 }
 
 Result
 VerifyECDSASignedDigestNSS(const SignedDigest& sd,
                            Input subjectPublicKeyInfo,
-                           void* pkcs11PinArg)
+                           void* pkcs11PinArg,
+                           /*optional*/ PublicKeyCacheNSS* publicKeyCache)
 {
   return VerifySignedDigest(sd, subjectPublicKeyInfo,
-                            SEC_OID_ANSIX962_EC_PUBLIC_KEY, pkcs11PinArg);
+                            SEC_OID_ANSIX962_EC_PUBLIC_KEY, pkcs11PinArg,
+                            publicKeyCache);
 }
 
 Result
@@ -133,6 +312,132 @@ DigestBufNSS(Input item,
   return Success;
 }
 
+// The order of the contexts in DigestStreamNSS::contexts.
+static const SECOidTag DIGEST_STREAM_ALGORITHMS[] = {
+  SEC_OID_SHA1,
+  SEC_OID_SHA256,
+  SEC_OID_SHA384,
+  SEC_OID_SHA512,
+};
+
+DigestStreamNSS::DigestStreamNSS()
+{
+  static_assert(PR_ARRAY_SIZE(DIGEST_STREAM_ALGORITHMS) ==
+                  DIGEST_ALGORITHM_COUNT,
+                "DIGEST_STREAM_ALGORITHMS doesn't match contexts");
+  for (size_t i = 0; i < DIGEST_ALGORITHM_COUNT; ++i) {
+    contexts[i] = nullptr;
+  }
+}
+
+DigestStreamNSS::~DigestStreamNSS()
+{
+  DestroyContexts();
+}
+
+void
+DigestStreamNSS::DestroyContexts()
+{
+  for (size_t i = 0; i < DIGEST_ALGORITHM_COUNT; ++i) {
+    if (contexts[i]) {
+      PK11_DestroyContext(contexts[i], PR_TRUE);
+      contexts[i] = nullptr;
+    }
+  }
+}
+
+static size_t
+DigestStreamContextIndex(DigestAlgorithm digestAlg, /*out*/ size_t& bits)
+{
+  switch (digestAlg) {
+    case DigestAlgorithm::sha1: bits = 160; return 0;
+    case DigestAlgorithm::sha256: bits = 256; return 1;
+    case DigestAlgorithm::sha384: bits = 384; return 2;
+    case DigestAlgorithm::sha512: bits = 512; return 3;
+    MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
+  }
+}
+
+Result
+DigestStreamNSS::BeginContext(size_t i)
+{
+  contexts[i] = PK11_CreateDigestContext(DIGEST_STREAM_ALGORITHMS[i]);
+  if (!contexts[i]) {
+    return MapPRErrorCodeToResult(PR_GetError());
+  }
+  if (PK11_DigestBegin(contexts[i]) != SECSuccess) {
+    return MapPRErrorCodeToResult(PR_GetError());
+  }
+  return Success;
+}
+
+Result
+DigestStreamNSS::Begin()
+{
+  DestroyContexts();
+  for (size_t i = 0; i < DIGEST_ALGORITHM_COUNT; ++i) {
+    Result rv = BeginContext(i);
+    if (rv != Success) {
+      return rv;
+    }
+  }
+  return Success;
+}
+
+Result
+DigestStreamNSS::Begin(DigestAlgorithm digestAlg)
+{
+  DestroyContexts();
+  size_t bits;
+  return BeginContext(DigestStreamContextIndex(digestAlg, bits));
+}
+
+Result
+DigestStreamNSS::Update(Input data)
+{
+  bool begun = false;
+  for (size_t i = 0; i < DIGEST_ALGORITHM_COUNT; ++i) {
+    if (!contexts[i]) {
+      continue;
+    }
+    begun = true;
+    if (PK11_DigestOp(contexts[i], data.UnsafeGetData(), data.GetLength())
+          != SECSuccess) {
+      return MapPRErrorCodeToResult(PR_GetError());
+    }
+  }
+  if (!begun) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  return Success;
+}
+
+Result
+DigestStreamNSS::Finish(DigestAlgorithm digestAlg,
+                        /*out*/ uint8_t* digestBuf,
+                        size_t digestBufLen)
+{
+  size_t bits;
+  size_t i = DigestStreamContextIndex(digestAlg, bits);
+  if (digestBufLen != bits / 8) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  if (!contexts[i]) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  unsigned int outLen;
+  SECStatus srv = PK11_DigestFinal(contexts[i], digestBuf, &outLen,
+                                   static_cast<unsigned int>(digestBufLen));
+  DestroyContexts();
+  if (srv != SECSuccess) {
+    return MapPRErrorCodeToResult(PR_GetError());
+  }
+  if (outLen != digestBufLen) {
+    return Result::FATAL_ERROR_LIBRARY_FAILURE;
+  }
+  return Success;
+}
+
 Result
 MapPRErrorCodeToResult(PRErrorCode error)
 {
@@ -202,6 +507,9 @@ RegisterErrorTable()
       "verified." },
     { "MOZILLA_PKIX_ERROR_VALIDITY_TOO_LONG",
       "The server presented a certificate that is valid for too long." },
+    { "MOZILLA_PKIX_ERROR_OCSP_RESPONSE_FIELD_TOO_LONG",
+      "The OCSP response has a responder ID or signature that is too long to "
+      "be verified incrementally." },
   };
   // Note that these error strings are not localizable.
   // When these strings change, update the localization information too.
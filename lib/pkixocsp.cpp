@@ -22,6 +22,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cstring>
 #include <limits>
 
 #include "pkix/pkix.h"
@@ -48,7 +50,8 @@ class Context final
 public:
   Context(TrustDomain& trustDomain, const CertID& certID, Time time,
           uint16_t maxLifetimeInDays, /*optional out*/ Time* thisUpdate,
-          /*optional out*/ Time* validThrough)
+          /*optional out*/ Time* validThrough,
+          /*optional*/ OCSPSignerCache* signerCache)
     : trustDomain(trustDomain)
     , certID(certID)
     , time(time)
@@ -56,8 +59,11 @@ public:
     , certStatus(CertStatus::Unknown)
     , thisUpdate(thisUpdate)
     , validThrough(validThrough)
+    , signerCache(signerCache)
     , expired(false)
     , matchFound(false)
+    , signerNotAfter(TimeFromElapsedSecondsAD(
+                       std::numeric_limits<uint64_t>::max()))
   {
     if (thisUpdate) {
       *thisUpdate = TimeFromElapsedSecondsAD(0);
@@ -74,6 +80,7 @@ public:
   CertStatus certStatus;
   Time* thisUpdate;
   Time* validThrough;
+  OCSPSignerCache* signerCache;
   bool expired;
 
   // Keep track of whether the OCSP response contains the status of the
@@ -82,18 +89,37 @@ public:
   // indicate a server failure in those cases.
   bool matchFound;
 
+  // The end of the validity period of the delegated signing certificate, if
+  // the response was signed by one; otherwise, the latest possible time.
+  Time signerNotAfter;
+
   Context(const Context&) = delete;
   void operator=(const Context&) = delete;
 };
 
+static inline Result
+MapBadSignatureToOCSPBadSignature(Result rv)
+{
+  if (rv == Result::ERROR_BAD_SIGNATURE) {
+    return Result::ERROR_OCSP_BAD_SIGNATURE;
+  }
+  return rv;
+}
+
 // Verify that potentialSigner is a valid delegated OCSP response signing cert
 // according to RFC 6960 section 4.2.2.2.
+//
+// If signedResponseData is given, its signature is verified with
+// potentialSigner's key together with potentialSigner's own signature, and
+// responseSignatureResult is set to the result of that verification.
 static Result
 CheckOCSPResponseSignerCert(TrustDomain& trustDomain,
                             BackCert& potentialSigner,
                             Input issuerSubject,
                             Input issuerSubjectPublicKeyInfo,
-                            Time time)
+                            Time time,
+        /*optional*/ const der::SignedDataWithSignature* signedResponseData,
+                            /*out*/ Result& responseSignatureResult)
 {
   Result rv;
 
@@ -141,8 +167,31 @@ CheckOCSPResponseSignerCert(TrustDomain& trustDomain,
 
   // TODO(bug 926260): check name constraints
 
-  rv = VerifySignedData(trustDomain, potentialSigner.GetSignedData(),
-                        issuerSubjectPublicKeyInfo);
+  if (!signedResponseData) {
+    rv = VerifySignedData(trustDomain, potentialSigner.GetSignedData(),
+                          issuerSubjectPublicKeyInfo);
+  } else {
+    // Neither signature depends on the other, so the TrustDomain may verify
+    // them as a batch.
+    const der::SignedDataWithSignature* signedDatas[] = {
+      &potentialSigner.GetSignedData(),
+      signedResponseData,
+    };
+    const Input signerSubjectPublicKeyInfos[] = {
+      issuerSubjectPublicKeyInfo,
+      potentialSigner.GetSubjectPublicKeyInfo(),
+    };
+    Result results[] = {
+      Result::FATAL_ERROR_LIBRARY_FAILURE,
+      Result::FATAL_ERROR_LIBRARY_FAILURE,
+    };
+    rv = VerifySignedDatas(trustDomain, signedDatas,
+                           signerSubjectPublicKeyInfos, 2, results);
+    if (rv == Success) {
+      rv = results[0];
+      responseSignatureResult = MapBadSignatureToOCSPBadSignature(results[1]);
+    }
+  }
 
   // TODO: check for revocation of the OCSP responder certificate unless no-check
   // or the caller forcing no-check. To properly support the no-check policy, we'd
@@ -217,11 +266,97 @@ VerifyOCSPSignedData(TrustDomain& trustDomain,
                      const der::SignedDataWithSignature& signedResponseData,
                      Input spki)
 {
-  Result rv = VerifySignedData(trustDomain, signedResponseData, spki);
-  if (rv == Result::ERROR_BAD_SIGNATURE) {
-    rv = Result::ERROR_OCSP_BAD_SIGNATURE;
+  return MapBadSignatureToOCSPBadSignature(
+           VerifySignedData(trustDomain, signedResponseData, spki));
+}
+
+// Determine whether signerDER, a certificate embedded in the response, is a
+// valid delegated OCSP response signer identified by responderID. If so,
+// found will be true and signerSubjectPublicKeyInfo will be the key that the
+// response must be signed with. Errors that make the response invalid are
+// returned; other problems with the signer just result in found being false.
+//
+// If signedResponseData is given and the signer is found, the response's
+// signature is verified too and responseSignatureResult is set to the result.
+// When the signer isn't in the cache, that is done together with verifying
+// the signer's signature (see CheckOCSPResponseSignerCert).
+static Result
+MatchDelegatedSigner(Context& context, ResponderIDType responderIDType,
+                     Input responderID, Input signerDER,
+        /*optional*/ const der::SignedDataWithSignature* signedResponseData,
+                     /*out*/ bool& found,
+                     /*out*/ Input& signerSubjectPublicKeyInfoOut,
+                     /*out*/ Result& responseSignatureResult)
+{
+  found = false;
+
+  BackCert cert(signerDER, EndEntityOrCA::MustBeEndEntity, nullptr);
+  Result rv = cert.Init();
+  if (rv != Success) {
+    return rv;
   }
-  return rv;
+
+  bool match;
+  rv = MatchResponderID(context.trustDomain, responderIDType, responderID,
+                        cert.GetSubject(), cert.GetSubjectPublicKeyInfo(),
+                        match);
+  if (rv != Success) {
+    if (IsFatalError(rv)) {
+      return rv;
+    }
+    return Success;
+  }
+  if (!match) {
+    return Success;
+  }
+
+  // If this signer was already validated for this issuer then we can avoid
+  // verifying its signature again. The key is only computed for the signer
+  // that matches the responder ID; if it can't be computed, the signer is
+  // just verified without the cache.
+  OCSPSignerCache::Key key;
+  bool useCache = context.signerCache &&
+                  key.Init(context.trustDomain, signerDER,
+                           context.certID) == Success;
+  if (useCache &&
+      context.signerCache->Find(key, signerDER, context.time)) {
+    // This is the only part of CheckOCSPResponseSignerCert that depends
+    // on more than the signer and the issuer's public key.
+    if (!InputsAreEqual(cert.GetIssuer(), context.certID.issuer)) {
+      return Success;
+    }
+    if (signedResponseData) {
+      responseSignatureResult =
+        VerifyOCSPSignedData(context.trustDomain, *signedResponseData,
+                             cert.GetSubjectPublicKeyInfo());
+    }
+  } else {
+    rv = CheckOCSPResponseSignerCert(context.trustDomain, cert,
+                                     context.certID.issuer,
+                                     context.certID.issuerSubjectPublicKeyInfo,
+                                     context.time, signedResponseData,
+                                     responseSignatureResult);
+    if (rv != Success) {
+      if (IsFatalError(rv)) {
+        return rv;
+      }
+      return Success;
+    }
+  }
+
+  Time notBefore(Time::uninitialized);
+  Time notAfter(Time::uninitialized);
+  rv = CheckValidity(cert.GetValidity(), context.time, &notBefore, &notAfter);
+  if (rv != Success) {
+    return NotReached("signer validity was already checked", rv);
+  }
+  if (useCache) {
+    context.signerCache->Add(key, signerDER, notBefore, notAfter);
+  }
+  context.signerNotAfter = notAfter;
+
+  found = true;
+  return signerSubjectPublicKeyInfoOut.Init(cert.GetSubjectPublicKeyInfo());
 }
 
 // RFC 6960 section 4.2.2.2: The OCSP responder must either be the issuer of
@@ -250,35 +385,18 @@ VerifySignature(Context& context, ResponderIDType responderIDType,
 
   size_t numCerts = certs.GetLength();
   for (size_t i = 0; i < numCerts; ++i) {
-    BackCert cert(*certs.GetDER(i), EndEntityOrCA::MustBeEndEntity, nullptr);
-    rv = cert.Init();
+    bool found;
+    Input signerSubjectPublicKeyInfo;
+    Result responseSignatureResult = Result::FATAL_ERROR_LIBRARY_FAILURE;
+    rv = MatchDelegatedSigner(context, responderIDType, responderID,
+                              *certs.GetDER(i), &signedResponseData, found,
+                              signerSubjectPublicKeyInfo,
+                              responseSignatureResult);
     if (rv != Success) {
       return rv;
     }
-    rv = MatchResponderID(context.trustDomain, responderIDType, responderID,
-                          cert.GetSubject(), cert.GetSubjectPublicKeyInfo(),
-                          match);
-    if (rv != Success) {
-      if (IsFatalError(rv)) {
-        return rv;
-      }
-      continue;
-    }
-
-    if (match) {
-      rv = CheckOCSPResponseSignerCert(context.trustDomain, cert,
-                                       context.certID.issuer,
-                                       context.certID.issuerSubjectPublicKeyInfo,
-                                       context.time);
-      if (rv != Success) {
-        if (IsFatalError(rv)) {
-          return rv;
-        }
-        continue;
-      }
-
-      return VerifyOCSPSignedData(context.trustDomain, signedResponseData,
-                                  cert.GetSubjectPublicKeyInfo());
+    if (found) {
+      return responseSignatureResult;
     }
   }
 
@@ -300,13 +418,18 @@ VerifyEncodedOCSPResponse(TrustDomain& trustDomain, const struct CertID& certID,
                           Input encodedResponse,
                           /*out*/ bool& expired,
                           /*optional out*/ Time* thisUpdate,
-                          /*optional out*/ Time* validThrough)
+                          /*optional out*/ Time* validThrough,
+                          /*optional*/ OCSPSignerCache* signerCache,
+                          /*optional out*/ Time* signerNotAfter)
 {
   // Always initialize this to something reasonable.
   expired = false;
 
   Context context(trustDomain, certID, time, maxOCSPLifetimeInDays,
-                  thisUpdate, validThrough);
+                  thisUpdate, validThrough, signerCache);
+  if (signerNotAfter) {
+    *signerNotAfter = context.signerNotAfter;
+  }
 
   Reader input(encodedResponse);
   Result rv = der::Nested(input, der::SEQUENCE, [&context](Reader& r) {
@@ -324,6 +447,9 @@ VerifyEncodedOCSPResponse(TrustDomain& trustDomain, const struct CertID& certID,
   }
 
   expired = context.expired;
+  if (signerNotAfter) {
+    *signerNotAfter = context.signerNotAfter;
+  }
 
   switch (context.certStatus) {
     case CertStatus::Good:
@@ -765,7 +891,7 @@ MatchKeyHash(TrustDomain& trustDomain, Input keyHash,
   if (keyHash.GetLength() != SHA1_DIGEST_LENGTH)  {
     return Result::ERROR_OCSP_MALFORMED_RESPONSE;
   }
-  static uint8_t hashBuf[SHA1_DIGEST_LENGTH];
+  uint8_t hashBuf[SHA1_DIGEST_LENGTH];
   Result rv = KeyHash(trustDomain, subjectPublicKeyInfo, hashBuf,
                       sizeof hashBuf);
   if (rv != Success) {
@@ -826,6 +952,1069 @@ ExtensionNotUnderstood(Reader& /*extnID*/, Input /*extnValue*/,
   return Success;
 }
 
+StreamingOCSPResponse::StreamingOCSPResponse(
+    TrustDomain& trustDomain, const struct CertID& certID, Time time,
+    uint16_t maxLifetimeInDays, DigestStream& tbsResponseDataDigest,
+    /*optional*/ OCSPSignerCache* signerCache)
+  : trustDomain(trustDomain)
+  , certID(certID)
+  , time(time)
+  , maxLifetimeInDays(maxLifetimeInDays)
+  , tbsResponseDataDigest(tbsResponseDataDigest)
+  , signerCache(signerCache)
+  , state(State::OCSPResponse)
+  , position(0)
+  , responseEnd(0)
+  , tbsResponseDataStart(0)
+  , tbsResponseDataEnd(0)
+  , responsesEnd(0)
+  , certCount(0)
+  , responderIDType(0)
+  , responderIDLength(0)
+  , signatureAlgorithmResult(Result::FATAL_ERROR_INVALID_STATE)
+  , publicKeyAlgorithm(0)
+  , digestAlgorithm(DigestAlgorithm::sha1)
+  , digestLength(0)
+  , signatureLength(0)
+  , signatureVerificationDone(false)
+  , signatureVerificationResult(Result::FATAL_ERROR_INVALID_STATE)
+  , tbsResponseDataResult(Success)
+  , certStatus(static_cast<uint8_t>(CertStatus::Unknown))
+  , expired(false)
+  , matchFound(false)
+  , thisUpdate(TimeFromElapsedSecondsAD(0))
+  , validThrough(TimeFromElapsedSecondsAD(0))
+{
+}
+
+Result
+StreamingOCSPResponse::Update(Input data, /*out*/ size_t& consumed)
+{
+  consumed = 0;
+
+  if (state == State::Failed) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+
+  while (state != State::Done) {
+    Input remaining;
+    Result rv = remaining.Init(data.UnsafeGetData() + consumed,
+                               data.GetLength() - consumed);
+    if (rv != Success) {
+      return rv;
+    }
+
+    Input::size_type stepLength = 0;
+    bool needMoreData = false;
+    rv = Step(remaining, stepLength, needMoreData);
+    if (rv != Success) {
+      state = State::Failed;
+      return MapBadDERToMalformedOCSPResponse(rv);
+    }
+    if (needMoreData) {
+      break;
+    }
+
+    // Feed the part of this step that is within the ResponseData to the
+    // digest, since the signature covers the entire encoded ResponseData.
+    uint64_t stepEnd = position + stepLength;
+    if (stepLength > 0 &&
+        stepEnd > tbsResponseDataStart && position < tbsResponseDataEnd) {
+      uint64_t digestStart = std::max(position, tbsResponseDataStart);
+      uint64_t digestEnd = std::min(stepEnd, tbsResponseDataEnd);
+      Input toDigest;
+      rv = toDigest.Init(remaining.UnsafeGetData() + (digestStart - position),
+                         static_cast<size_t>(digestEnd - digestStart));
+      if (rv != Success) {
+        return rv;
+      }
+      rv = tbsResponseDataDigest.Update(toDigest);
+      if (rv != Success) {
+        state = State::Failed;
+        return rv;
+      }
+    }
+
+    position = stepEnd;
+    consumed += stepLength;
+  }
+
+  return Success;
+}
+
+// Reads the tag and length of the element at the current position, which
+// must end at or before limit, with input, which is at the start of
+// remaining.
+Result
+StreamingOCSPResponse::ReadHeader(Input remaining, Reader& input,
+                                  uint64_t limit, /*out*/ uint8_t& tag,
+                                  /*out*/ uint64_t& end,
+                                  /*out*/ bool& needMoreData)
+{
+  needMoreData = false;
+
+  if (position >= limit) {
+    return Result::ERROR_BAD_DER; // missing element
+  }
+
+  Input::size_type headerLength = der::TagAndLengthLength(remaining);
+  if (remaining.GetLength() < headerLength) {
+    needMoreData = true;
+    return Success;
+  }
+  uint32_t length;
+  Result rv = der::ReadTagAndGetLength(input, tag, length);
+  if (rv != Success) {
+    return rv;
+  }
+
+  end = position + headerLength + length;
+  if (end > limit) {
+    return Result::ERROR_BAD_DER;
+  }
+  return Success;
+}
+
+// Reads the entire element at the current position, which must end at or
+// before limit, including its tag and length, with input, which is at the
+// start of remaining.
+Result
+StreamingOCSPResponse::ReadTLV(Input remaining, Reader& input, uint64_t limit,
+                               /*out*/ Input& tlv, /*out*/ bool& needMoreData)
+{
+  Reader::Mark mark(input.GetMark());
+  uint8_t tag;
+  uint64_t end;
+  Result rv = ReadHeader(remaining, input, limit, tag, end, needMoreData);
+  if (rv != Success || needMoreData) {
+    return rv;
+  }
+  if (end - position > std::numeric_limits<Input::size_type>::max()) {
+    // Only the outer structures of the response may be larger than Input
+    // supports.
+    return Result::ERROR_BAD_DER;
+  }
+  Input ignored;
+  rv = input.GetInput(mark, ignored);
+  if (rv != Success) {
+    return rv;
+  }
+  Input::size_type valueLength =
+    static_cast<Input::size_type>(end - position - ignored.GetLength());
+  if (remaining.GetLength() - ignored.GetLength() < valueLength) {
+    needMoreData = true;
+    return Success;
+  }
+  rv = input.Skip(valueLength);
+  if (rv != Success) {
+    return rv;
+  }
+  return input.GetInput(mark, tlv);
+}
+
+// Errors in the ResponseData following the ResponderID are only reported if
+// the signature turns out to be valid, like VerifyEncodedOCSPResponse does.
+// The rest of the ResponseData is skipped (but still digested).
+Result
+StreamingOCSPResponse::DeferTBSResponseDataError(Result rv)
+{
+  if (IsFatalError(rv)) {
+    return rv;
+  }
+  tbsResponseDataResult = rv;
+  state = State::SkipTBSResponseData;
+  return Success;
+}
+
+Result
+StreamingOCSPResponse::Step(Input remaining,
+                            /*out*/ Input::size_type& stepLength,
+                            /*out*/ bool& needMoreData)
+{
+  stepLength = 0;
+  needMoreData = false;
+
+  Reader input(remaining);
+  Reader::Mark mark(input.GetMark());
+  uint8_t tag;
+  uint64_t end;
+  Input tlv;
+  Result rv;
+
+  switch (state) {
+    // OCSPResponse ::= SEQUENCE {
+    //       responseStatus         OCSPResponseStatus,
+    //       responseBytes          [0] EXPLICIT ResponseBytes OPTIONAL }
+    case State::OCSPResponse:
+      rv = ReadHeader(remaining, input, std::numeric_limits<uint64_t>::max(),
+                      tag, responseEnd, needMoreData);
+      if (rv != Success || needMoreData) {
+        return rv;
+      }
+      if (tag != der::SEQUENCE) {
+        return Result::ERROR_BAD_DER;
+      }
+      state = State::ResponseStatus;
+      break;
+
+    case State::ResponseStatus:
+    {
+      rv = ReadTLV(remaining, input, responseEnd, tlv, needMoreData);
+      if (rv != Success || needMoreData) {
+        return rv;
+      }
+      Reader responseStatusReader(tlv);
+      uint8_t responseStatus;
+      rv = der::Enumerated(responseStatusReader, responseStatus);
+      if (rv != Success) {
+        return rv;
+      }
+      switch (responseStatus) {
+        case 0: break; // successful
+        case 1: return Result::ERROR_OCSP_MALFORMED_REQUEST;
+        case 2: return Result::ERROR_OCSP_SERVER_ERROR;
+        case 3: return Result::ERROR_OCSP_TRY_SERVER_LATER;
+        case 5: return Result::ERROR_OCSP_REQUEST_NEEDS_SIG;
+        case 6: return Result::ERROR_OCSP_UNAUTHORIZED_REQUEST;
+        default: return Result::ERROR_OCSP_UNKNOWN_RESPONSE_STATUS;
+      }
+      state = State::ResponseBytesExplicit;
+      break;
+    }
+
+    // The [0] EXPLICIT wrapper, the ResponseBytes, its response OCTET STRING,
+    // and the BasicOCSPResponse must all end where the OCSPResponse ends.
+    case State::ResponseBytesExplicit:
+    case State::ResponseBytes:
+    case State::Response:
+    case State::BasicOCSPResponse:
+    {
+      rv = ReadHeader(remaining, input, responseEnd, tag, end, needMoreData);
+      if (rv != Success || needMoreData) {
+        return rv;
+      }
+      uint8_t expectedTag;
+      State nextState;
+      switch (state) {
+        case State::ResponseBytesExplicit:
+          expectedTag = der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 0;
+          nextState = State::ResponseBytes;
+          break;
+        case State::ResponseBytes:
+          expectedTag = der::SEQUENCE;
+          nextState = State::ResponseType;
+          break;
+        case State::Response:
+          expectedTag = der::OCTET_STRING;
+          nextState = State::BasicOCSPResponse;
+          break;
+        case State::BasicOCSPResponse:
+          expectedTag = der::SEQUENCE;
+          nextState = State::TBSResponseData;
+          break;
+        default:
+          return NotReached("unexpected state", Result::FATAL_ERROR_LIBRARY_FAILURE);
+      }
+      if (tag != expectedTag || end != responseEnd) {
+        return Result::ERROR_BAD_DER;
+      }
+      state = nextState;
+      break;
+    }
+
+    // ResponseBytes ::=       SEQUENCE {
+    //     responseType   OBJECT IDENTIFIER,
+    //     response       OCTET STRING }
+    case State::ResponseType:
+    {
+      static const uint8_t id_pkix_ocsp_basic[] = {
+        0x2B, 0x06, 0x01, 0x05, 0x05, 0x07, 0x30, 0x01, 0x01
+      };
+      rv = ReadTLV(remaining, input, responseEnd, tlv, needMoreData);
+      if (rv != Success || needMoreData) {
+        return rv;
+      }
+      Reader responseType(tlv);
+      rv = der::OID(responseType, id_pkix_ocsp_basic);
+      if (rv != Success) {
+        return rv;
+      }
+      state = State::Response;
+      break;
+    }
+
+    // BasicOCSPResponse       ::= SEQUENCE {
+    //    tbsResponseData      ResponseData,
+    //    signatureAlgorithm   AlgorithmIdentifier,
+    //    signature            BIT STRING,
+    //    certs            [0] EXPLICIT SEQUENCE OF Certificate OPTIONAL }
+    case State::TBSResponseData:
+      rv = ReadHeader(remaining, input, responseEnd, tag,
+                      tbsResponseDataEnd, needMoreData);
+      if (rv != Success || needMoreData) {
+        return rv;
+      }
+      if (tag != der::SEQUENCE) {
+        return Result::ERROR_BAD_DER;
+      }
+      rv = tbsResponseDataDigest.Begin();
+      if (rv != Success) {
+        return rv;
+      }
+      tbsResponseDataStart = position;
+      state = State::Version;
+      break;
+
+    // ResponseData ::= SEQUENCE {
+    //    version             [0] EXPLICIT Version DEFAULT v1,
+    //    responderID             ResponderID,
+    //    producedAt              GeneralizedTime,
+    //    responses               SEQUENCE OF SingleResponse,
+    //    responseExtensions  [1] EXPLICIT Extensions OPTIONAL }
+    case State::Version:
+    {
+      static const uint8_t VERSION_TAG =
+        der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 0;
+      if (input.AtEnd()) {
+        needMoreData = true;
+        return Success;
+      }
+      if (input.Peek(VERSION_TAG)) {
+        rv = ReadTLV(remaining, input, tbsResponseDataEnd, tlv,
+                     needMoreData);
+        if (rv != Success || needMoreData) {
+          return rv;
+        }
+        Reader versionReader(tlv);
+        der::Version version;
+        rv = der::OptionalVersion(versionReader, version);
+        if (rv != Success) {
+          return rv;
+        }
+        rv = der::End(versionReader);
+        if (rv != Success) {
+          return rv;
+        }
+        if (version != der::Version::v1) {
+          // TODO: more specific error code for bad version?
+          return Result::ERROR_BAD_DER;
+        }
+      }
+      state = State::ResponderID;
+      break;
+    }
+
+    // ResponderID ::= CHOICE {
+    //    byName              [1] Name,
+    //    byKey               [2] KeyHash }
+    case State::ResponderID:
+    {
+      if (input.AtEnd()) {
+        needMoreData = true;
+        return Success;
+      }
+      ResponderIDType type
+        = input.Peek(static_cast<uint8_t>(ResponderIDType::byName))
+        ? ResponderIDType::byName
+        : ResponderIDType::byKey;
+      rv = ReadTLV(remaining, input, tbsResponseDataEnd, tlv, needMoreData);
+      if (rv != Success || needMoreData) {
+        return rv;
+      }
+      Reader responderIDReader(tlv);
+      Input value;
+      rv = der::ExpectTagAndGetValue(responderIDReader,
+                                     static_cast<uint8_t>(type), value);
+      if (rv != Success) {
+        return rv;
+      }
+      if (value.GetLength() > sizeof(responderID)) {
+        return Result::ERROR_OCSP_RESPONSE_FIELD_TOO_LONG;
+      }
+      std::memcpy(responderID, value.UnsafeGetData(), value.GetLength());
+      responderIDLength = value.GetLength();
+      responderIDType = static_cast<uint8_t>(type);
+      state = State::ProducedAt;
+      break;
+    }
+
+    case State::ProducedAt:
+    {
+      rv = ReadTLV(remaining, input, tbsResponseDataEnd, tlv, needMoreData);
+      if (rv != Success) {
+        return DeferTBSResponseDataError(rv);
+      }
+      if (needMoreData) {
+        return Success;
+      }
+      Reader producedAtReader(tlv);
+      Time producedAt(Time::uninitialized);
+      rv = der::GeneralizedTime(producedAtReader, producedAt);
+      if (rv != Success) {
+        return DeferTBSResponseDataError(rv);
+      }
+      state = State::Responses;
+      break;
+    }
+
+    // We don't accept an empty sequence of responses, like ResponseData.
+    case State::Responses:
+      rv = ReadHeader(remaining, input, tbsResponseDataEnd, tag,
+                      responsesEnd, needMoreData);
+      if (rv != Success) {
+        return DeferTBSResponseDataError(rv);
+      }
+      if (needMoreData) {
+        return Success;
+      }
+      if (tag != der::SEQUENCE) {
+        return DeferTBSResponseDataError(Result::ERROR_BAD_DER);
+      }
+      {
+        Input header;
+        rv = input.GetInput(mark, header);
+        if (rv != Success) {
+          return rv;
+        }
+        if (responsesEnd == position + header.GetLength()) {
+          return DeferTBSResponseDataError(Result::ERROR_BAD_DER);
+        }
+      }
+      state = State::SingleResponse;
+      break;
+
+    case State::SingleResponse:
+      if (position == responsesEnd) {
+        state = State::ResponseExtensions;
+        return Success;
+      }
+      rv = ReadTLV(remaining, input, responsesEnd, tlv, needMoreData);
+      if (rv != Success) {
+        return DeferTBSResponseDataError(rv);
+      }
+      if (needMoreData) {
+        return Success;
+      }
+      rv = ProcessSingleResponse(tlv);
+      if (rv != Success) {
+        return DeferTBSResponseDataError(rv);
+      }
+      break;
+
+    case State::ResponseExtensions:
+    {
+      if (position == tbsResponseDataEnd) {
+        state = State::SignatureAlgorithm;
+        return Success;
+      }
+      rv = ReadTLV(remaining, input, tbsResponseDataEnd, tlv, needMoreData);
+      if (rv != Success) {
+        return DeferTBSResponseDataError(rv);
+      }
+      if (needMoreData) {
+        return Success;
+      }
+      Reader extensions(tlv);
+      rv = der::OptionalExtensions(
+             extensions, der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 1,
+             ExtensionNotUnderstood);
+      if (rv != Success) {
+        return DeferTBSResponseDataError(rv);
+      }
+      rv = der::End(extensions);
+      if (rv != Success) {
+        return DeferTBSResponseDataError(rv);
+      }
+      if (position + tlv.GetLength() != tbsResponseDataEnd) {
+        return DeferTBSResponseDataError(Result::ERROR_BAD_DER);
+      }
+      state = State::SignatureAlgorithm;
+      break;
+    }
+
+    case State::SkipTBSResponseData:
+    {
+      uint64_t toSkip = tbsResponseDataEnd - position;
+      if (toSkip > remaining.GetLength()) {
+        toSkip = remaining.GetLength();
+      }
+      if (toSkip == 0 && position < tbsResponseDataEnd) {
+        needMoreData = true;
+        return Success;
+      }
+      rv = input.Skip(static_cast<Input::size_type>(toSkip));
+      if (rv != Success) {
+        return rv;
+      }
+      if (position + toSkip == tbsResponseDataEnd) {
+        state = State::SignatureAlgorithm;
+      }
+      break;
+    }
+
+    case State::SignatureAlgorithm:
+    {
+      rv = ReadTLV(remaining, input, responseEnd, tlv, needMoreData);
+      if (rv != Success || needMoreData) {
+        return rv;
+      }
+      Reader algorithmReader(tlv);
+      Input algorithm;
+      rv = der::ExpectTagAndGetValue(algorithmReader, der::SEQUENCE,
+                                     algorithm);
+      if (rv != Success) {
+        return rv;
+      }
+      ProcessSignatureAlgorithm(algorithm);
+      state = State::Signature;
+      break;
+    }
+
+    case State::Signature:
+    {
+      rv = ReadTLV(remaining, input, responseEnd, tlv, needMoreData);
+      if (rv != Success || needMoreData) {
+        return rv;
+      }
+      Reader signatureReader(tlv);
+      Input value;
+      rv = der::BitStringWithNoUnusedBits(signatureReader, value);
+      if (rv != Success) {
+        if (rv == Result::ERROR_BAD_DER) {
+          return Result::ERROR_OCSP_BAD_SIGNATURE;
+        }
+        return rv;
+      }
+      if (value.GetLength() > sizeof(signature)) {
+        return Result::ERROR_OCSP_RESPONSE_FIELD_TOO_LONG;
+      }
+      std::memcpy(signature, value.UnsafeGetData(), value.GetLength());
+      signatureLength = value.GetLength();
+
+      // Now that we have the signature, we can check whether the response was
+      // signed by the issuer.
+      ProcessSigner(nullptr);
+      state = State::CertsExplicit;
+      break;
+    }
+
+    case State::CertsExplicit:
+    case State::Certs:
+      if (state == State::CertsExplicit && position == responseEnd) {
+        state = State::Done;
+        return Success;
+      }
+      rv = ReadHeader(remaining, input, responseEnd, tag, end, needMoreData);
+      if (rv != Success || needMoreData) {
+        return rv;
+      }
+      if (end != responseEnd) {
+        return Result::ERROR_BAD_DER;
+      }
+      if (state == State::CertsExplicit) {
+        if (tag != (der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 0)) {
+          return Result::ERROR_BAD_DER;
+        }
+        state = State::Certs;
+      } else {
+        if (tag != der::SEQUENCE) {
+          return Result::ERROR_BAD_DER;
+        }
+        state = State::Certificate;
+      }
+      break;
+
+    case State::Certificate:
+    {
+      if (position == responseEnd) {
+        state = State::Done;
+        return Success;
+      }
+      rv = ReadTLV(remaining, input, responseEnd, tlv, needMoreData);
+      if (rv != Success || needMoreData) {
+        return rv;
+      }
+      Reader certReader(tlv);
+      Input cert;
+      rv = der::ExpectTagAndGetTLV(certReader, der::SEQUENCE, cert);
+      if (rv != Success) {
+        return rv;
+      }
+      // VerifyEncodedOCSPResponse doesn't accept more certificates than fit
+      // in a NonOwningDERArray.
+      ++certCount;
+      if (certCount > NonOwningDERArray::MAX_LENGTH) {
+        return Result::ERROR_BAD_DER; // Too many certs
+      }
+      if (!signatureVerificationDone) {
+        ProcessSigner(&cert);
+      }
+      break;
+    }
+
+    case State::Done:
+    case State::Failed:
+      return NotReached("Step called after the end",
+                        Result::FATAL_ERROR_INVALID_STATE);
+
+    MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
+  }
+
+  Input stepped;
+  rv = input.GetInput(mark, stepped);
+  if (rv != Success) {
+    return rv;
+  }
+  stepLength = stepped.GetLength();
+  return Success;
+}
+
+Result
+StreamingOCSPResponse::ProcessSingleResponse(Input tlv)
+{
+  Time singleThisUpdate(Time::uninitialized);
+  Time singleValidThrough(Time::uninitialized);
+  Context context(trustDomain, certID, time, maxLifetimeInDays,
+                  &singleThisUpdate, &singleValidThrough, signerCache);
+  context.certStatus = static_cast<CertStatus>(certStatus);
+  context.expired = expired;
+
+  Reader input(tlv);
+  Result rv = der::Nested(input, der::SEQUENCE, [&context](Reader& r) {
+    return SingleResponse(r, context);
+  });
+  if (rv != Success) {
+    return rv;
+  }
+  rv = der::End(input);
+  if (rv != Success) {
+    return rv;
+  }
+
+  certStatus = static_cast<uint8_t>(context.certStatus);
+  expired = context.expired;
+  if (context.matchFound) {
+    matchFound = true;
+    thisUpdate = singleThisUpdate;
+    validThrough = singleValidThrough;
+  }
+  return Success;
+}
+
+// Like DigestSignedData, except that the digest has been computed as the
+// ResponseData went by. Errors are remembered in signatureAlgorithmResult
+// because VerifyEncodedOCSPResponse only reports them once it has found the
+// signer.
+void
+StreamingOCSPResponse::ProcessSignatureAlgorithm(Input algorithm)
+{
+  Reader signatureAlg(algorithm);
+  der::PublicKeyAlgorithm publicKeyAlg;
+  signatureAlgorithmResult = der::SignatureAlgorithmIdentifierValue(
+                               signatureAlg, publicKeyAlg, digestAlgorithm);
+  if (signatureAlgorithmResult != Success) {
+    return;
+  }
+  if (!signatureAlg.AtEnd()) {
+    signatureAlgorithmResult = Result::ERROR_BAD_DER;
+    return;
+  }
+  publicKeyAlgorithm = static_cast<uint8_t>(publicKeyAlg);
+
+  switch (digestAlgorithm) {
+    case DigestAlgorithm::sha512: digestLength = 512 / 8; break;
+    case DigestAlgorithm::sha384: digestLength = 384 / 8; break;
+    case DigestAlgorithm::sha256: digestLength = 256 / 8; break;
+    case DigestAlgorithm::sha1: digestLength = 160 / 8; break;
+    MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
+  }
+  assert(digestLength <= sizeof(digest));
+
+  signatureAlgorithmResult = tbsResponseDataDigest.Finish(digestAlgorithm,
+                                                          digest,
+                                                          digestLength);
+}
+
+// Determines whether the response was signed by the issuer (when signerDER is
+// null) or by signerDER and, if so, verifies the signature. This follows
+// VerifySignature.
+void
+StreamingOCSPResponse::ProcessSigner(/*optional*/ const Input* signerDER)
+{
+  Input responderIDInput;
+  Result rv = responderIDInput.Init(responderID, responderIDLength);
+  if (rv != Success) {
+    signatureVerificationDone = true;
+    signatureVerificationResult = rv;
+    return;
+  }
+  ResponderIDType type = static_cast<ResponderIDType>(responderIDType);
+
+  bool found;
+  Input signerSubjectPublicKeyInfo;
+  if (!signerDER) {
+    rv = MatchResponderID(trustDomain, type, responderIDInput, certID.issuer,
+                          certID.issuerSubjectPublicKeyInfo, found);
+    if (rv == Success && found) {
+      rv = signerSubjectPublicKeyInfo.Init(certID.issuerSubjectPublicKeyInfo);
+    }
+  } else {
+    Context context(trustDomain, certID, time, maxLifetimeInDays, nullptr,
+                    nullptr, signerCache);
+    // The response's signature can't be verified until all of the response
+    // has been digested, so it is verified separately below.
+    Result unusedResponseSignatureResult;
+    rv = MatchDelegatedSigner(context, type, responderIDInput, *signerDER,
+                              nullptr, found, signerSubjectPublicKeyInfo,
+                              unusedResponseSignatureResult);
+  }
+  if (rv != Success) {
+    signatureVerificationDone = true;
+    signatureVerificationResult = rv;
+    return;
+  }
+  if (found) {
+    signatureVerificationDone = true;
+    signatureVerificationResult =
+      VerifyResponseSignature(signerSubjectPublicKeyInfo);
+  }
+}
+
+Result
+StreamingOCSPResponse::VerifyResponseSignature(
+  Input signerSubjectPublicKeyInfo)
+{
+  if (signatureAlgorithmResult != Success) {
+    return signatureAlgorithmResult;
+  }
+  SignedDigest signedDigest;
+  signedDigest.digestAlgorithm = digestAlgorithm;
+  Result rv = signedDigest.digest.Init(digest, digestLength);
+  if (rv != Success) {
+    return rv;
+  }
+  rv = signedDigest.signature.Init(signature, signatureLength);
+  if (rv != Success) {
+    return rv;
+  }
+  return MapBadSignatureToOCSPBadSignature(
+           VerifySignedDigest(trustDomain,
+                              static_cast<der::PublicKeyAlgorithm>(
+                                publicKeyAlgorithm),
+                              signedDigest, signerSubjectPublicKeyInfo));
+}
+
+Result
+StreamingOCSPResponse::Finish(/*out*/ bool& expiredOut,
+                              /*optional out*/ Time* thisUpdateOut,
+                              /*optional out*/ Time* validThroughOut)
+{
+  // Always initialize these to something reasonable.
+  expiredOut = false;
+  if (thisUpdateOut) {
+    *thisUpdateOut = TimeFromElapsedSecondsAD(0);
+  }
+  if (validThroughOut) {
+    *validThroughOut = TimeFromElapsedSecondsAD(0);
+  }
+
+  if (state == State::Failed) {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+  if (state != State::Done) {
+    // The response was truncated.
+    return Result::ERROR_OCSP_MALFORMED_RESPONSE;
+  }
+  if (!signatureVerificationDone) {
+    return Result::ERROR_OCSP_INVALID_SIGNING_CERT;
+  }
+  if (signatureVerificationResult != Success) {
+    return MapBadDERToMalformedOCSPResponse(signatureVerificationResult);
+  }
+  if (tbsResponseDataResult != Success) {
+    return MapBadDERToMalformedOCSPResponse(tbsResponseDataResult);
+  }
+  if (!matchFound) {
+    return Result::ERROR_OCSP_RESPONSE_FOR_CERT_MISSING;
+  }
+
+  expiredOut = expired;
+  if (thisUpdateOut) {
+    *thisUpdateOut = thisUpdate;
+  }
+  if (validThroughOut) {
+    *validThroughOut = validThrough;
+  }
+
+  switch (static_cast<CertStatus>(certStatus)) {
+    case CertStatus::Good:
+      if (expired) {
+        return Result::ERROR_OCSP_OLD_RESPONSE;
+      }
+      return Success;
+    case CertStatus::Revoked:
+      return Result::ERROR_REVOKED_CERTIFICATE;
+    case CertStatus::Unknown:
+      return Result::ERROR_OCSP_UNKNOWN_CERT;
+     MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
+  }
+}
+
+OCSPSignerCache::OCSPSignerCache()
+  : nextEntry(0)
+{
+}
+
+void
+OCSPSignerCache::Clear()
+{
+  for (size_t i = 0; i < CAPACITY; ++i) {
+    entries[i].inUse = false;
+  }
+  nextEntry = 0;
+}
+
+// Both caches are keyed by the SHA-256 digest of the issuer's
+// SubjectPublicKeyInfo, which path building has usually already computed.
+static Result
+DigestIssuerSubjectPublicKeyInfo(TrustDomain& trustDomain,
+                                 const struct CertID& certID,
+                                 /*out*/ uint8_t (&digest)[256 / 8])
+{
+  if (!certID.issuerSubjectPublicKeyInfoFingerprint) {
+    return trustDomain.DigestBuf(certID.issuerSubjectPublicKeyInfo,
+                                 DigestAlgorithm::sha256, digest,
+                                 sizeof digest);
+  }
+  Input sha256;
+  Result rv = certID.issuerSubjectPublicKeyInfoFingerprint->GetSHA256(
+                trustDomain, sha256);
+  if (rv != Success) {
+    return rv;
+  }
+  if (sha256.GetLength() != sizeof digest) {
+    return NotReached("wrong SHA-256 digest length",
+                      Result::FATAL_ERROR_LIBRARY_FAILURE);
+  }
+  std::memcpy(digest, sha256.UnsafeGetData(), sizeof digest);
+  return Success;
+}
+
+Result
+OCSPSignerCache::Key::Init(TrustDomain& trustDomain, Input signerDER,
+                           const struct CertID& certID)
+{
+  Result rv = trustDomain.DigestBuf(signerDER, DigestAlgorithm::sha256,
+                                    signerDigest, sizeof signerDigest);
+  if (rv != Success) {
+    return rv;
+  }
+  return DigestIssuerSubjectPublicKeyInfo(trustDomain, certID,
+                                          issuerSubjectPublicKeyInfoDigest);
+}
+
+bool
+OCSPSignerCache::Find(const Key& key, Input signerDER, Time time) const
+{
+  for (size_t i = 0; i < CAPACITY; ++i) {
+    const Entry& entry(entries[i]);
+    if (!entry.inUse ||
+        entry.signerLength != signerDER.GetLength() ||
+        std::memcmp(entry.signerDigest, key.signerDigest,
+                    DIGEST_LENGTH) != 0 ||
+        std::memcmp(entry.issuerSubjectPublicKeyInfoDigest,
+                    key.issuerSubjectPublicKeyInfoDigest,
+                    DIGEST_LENGTH) != 0) {
+      continue;
+    }
+    return time >= entry.notBefore && time <= entry.notAfter;
+  }
+  return false;
+}
+
+void
+OCSPSignerCache::Add(const Key& key, Input signerDER, Time notBefore,
+                     Time notAfter)
+{
+  // Replace the existing entry for this signer, if any, so that a signer
+  // never occupies more than one entry.
+  size_t i = 0;
+  for (; i < CAPACITY; ++i) {
+    if (entries[i].inUse &&
+        !std::memcmp(entries[i].signerDigest, key.signerDigest,
+                     DIGEST_LENGTH) &&
+        !std::memcmp(entries[i].issuerSubjectPublicKeyInfoDigest,
+                     key.issuerSubjectPublicKeyInfoDigest, DIGEST_LENGTH)) {
+      break;
+    }
+  }
+  if (i == CAPACITY) {
+    i = nextEntry;
+    nextEntry = (nextEntry + 1) % CAPACITY;
+  }
+
+  Entry& entry(entries[i]);
+  entry.inUse = true;
+  std::memcpy(entry.signerDigest, key.signerDigest, DIGEST_LENGTH);
+  std::memcpy(entry.issuerSubjectPublicKeyInfoDigest,
+              key.issuerSubjectPublicKeyInfoDigest, DIGEST_LENGTH);
+  entry.signerLength = signerDER.GetLength();
+  entry.notBefore = notBefore;
+  entry.notAfter = notAfter;
+}
+
+StapledOCSPCache::StapledOCSPCache()
+  : nextEntry(0)
+{
+}
+
+void
+StapledOCSPCache::Clear()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for (size_t i = 0; i < CAPACITY; ++i) {
+    entries[i].inUse = false;
+  }
+  nextEntry = 0;
+}
+
+Result
+StapledOCSPCache::Key::Init(TrustDomain& trustDomain,
+                            const struct CertID& certID,
+                            uint16_t maxLifetimeInDays,
+                            Input encodedResponse)
+{
+  this->maxLifetimeInDays = maxLifetimeInDays;
+  const Input fields[DigestCount] = {
+    encodedResponse,
+    certID.issuer,
+    certID.issuerSubjectPublicKeyInfo,
+    certID.serialNumber,
+  };
+  for (size_t i = 0; i < DigestCount; ++i) {
+    Result rv = i == IssuerSubjectPublicKeyInfo
+      ? DigestIssuerSubjectPublicKeyInfo(trustDomain, certID, digests[i])
+      : trustDomain.DigestBuf(fields[i], DigestAlgorithm::sha256, digests[i],
+                              DIGEST_LENGTH);
+    if (rv != Success) {
+      return rv;
+    }
+  }
+  return Success;
+}
+
+bool
+StapledOCSPCache::Find(const Key& key, Time time, /*out*/ Result& result,
+                       /*out*/ Time& thisUpdate,
+                       /*out*/ Time& validThrough) const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for (size_t i = 0; i < CAPACITY; ++i) {
+    const Entry& entry(entries[i]);
+    if (!entry.inUse || entry.maxLifetimeInDays != key.maxLifetimeInDays ||
+        std::memcmp(entry.digests, key.digests, sizeof entry.digests) != 0) {
+      continue;
+    }
+    // Before verificationTime, the response may not have been valid yet.
+    if (time < entry.verificationTime || time > entry.cachedThrough) {
+      return false;
+    }
+    result = entry.result;
+    thisUpdate = entry.thisUpdate;
+    validThrough = entry.validThrough;
+    return true;
+  }
+  return false;
+}
+
+void
+StapledOCSPCache::Add(const Key& key, Time verificationTime, Result result,
+                      Time thisUpdate, Time validThrough, Time signerNotAfter)
+{
+  switch (result) {
+    case Success:
+    case Result::ERROR_REVOKED_CERTIFICATE:
+    case Result::ERROR_OCSP_UNKNOWN_CERT:
+      break;
+    default:
+      return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t i = 0;
+  for (; i < CAPACITY; ++i) {
+    if (entries[i].inUse &&
+        entries[i].maxLifetimeInDays == key.maxLifetimeInDays &&
+        !std::memcmp(entries[i].digests, key.digests,
+                     sizeof entries[i].digests)) {
+      break;
+    }
+  }
+  if (i == CAPACITY) {
+    i = nextEntry;
+    nextEntry = (nextEntry + 1) % CAPACITY;
+  }
+
+  Entry& entry(entries[i]);
+  entry.inUse = true;
+  entry.maxLifetimeInDays = key.maxLifetimeInDays;
+  std::memcpy(entry.digests, key.digests, sizeof entry.digests);
+  entry.result = result;
+  entry.verificationTime = verificationTime;
+  entry.thisUpdate = thisUpdate;
+  entry.validThrough = validThrough;
+  entry.cachedThrough = signerNotAfter < validThrough ? signerNotAfter
+                                                      : validThrough;
+}
+
+Result
+VerifyStapledOCSPResponse(StapledOCSPCache& cache, TrustDomain& trustDomain,
+                          const struct CertID& certID, Time time,
+                          uint16_t maxLifetimeInDays, Input encodedResponse,
+                          /*out*/ bool& expired,
+                          /*optional out*/ Time* thisUpdate,
+                          /*optional out*/ Time* validThrough)
+{
+  StapledOCSPCache::Key key;
+  Result rv = key.Init(trustDomain, certID, maxLifetimeInDays,
+                       encodedResponse);
+  if (rv != Success) {
+    return rv;
+  }
+
+  Time cachedThisUpdate(Time::uninitialized);
+  Time cachedValidThrough(Time::uninitialized);
+  if (cache.Find(key, time, rv, cachedThisUpdate, cachedValidThrough)) {
+    expired = false;
+    if (thisUpdate) {
+      *thisUpdate = cachedThisUpdate;
+    }
+    if (validThrough) {
+      *validThrough = cachedValidThrough;
+    }
+    return rv;
+  }
+
+  Time verifiedThisUpdate(TimeFromElapsedSecondsAD(0));
+  Time verifiedValidThrough(TimeFromElapsedSecondsAD(0));
+  Time signerNotAfter(Time::uninitialized);
+  rv = VerifyEncodedOCSPResponse(trustDomain, certID, time, maxLifetimeInDays,
+                                 encodedResponse, expired,
+                                 &verifiedThisUpdate, &verifiedValidThrough,
+                                 nullptr, &signerNotAfter);
+  if (!expired) {
+    cache.Add(key, time, rv, verifiedThisUpdate, verifiedValidThrough,
+              signerNotAfter);
+  }
+  if (thisUpdate) {
+    *thisUpdate = verifiedThisUpdate;
+  }
+  if (validThrough) {
+    *validThrough = verifiedValidThrough;
+  }
+  return rv;
+}
+
 //   1. The certificate identified in a received response corresponds to
 //      the certificate that was identified in the corresponding request;
 //   2. The signature on the response is valid;
@@ -877,80 +2066,82 @@ CreateEncodedOCSPRequest(TrustDomain& trustDomain, const struct CertID& certID,
   };
   static const uint8_t hashLen = 160 / 8;
 
-  static const unsigned int totalLenWithoutSerialNumberData
-    = 2                             // OCSPRequest
-    + 2                             //   tbsRequest
-    + 2                             //     requestList
-    + 2                             //       Request
-    + 2                             //         reqCert (CertID)
-    + sizeof(hashAlgorithm)         //           hashAlgorithm
-    + 2 + hashLen                   //           issuerNameHash
-    + 2 + hashLen                   //           issuerKeyHash
-    + 2;                            //           serialNumber (header)
+  uint8_t issuerNameHash[hashLen];
+  uint8_t issuerKeyHash[hashLen];
+
+  // OCSPRequest, tbsRequest, requestList (SEQUENCE OF), Request and reqCert
+  // (CertID) are SEQUENCEs that each contain only the next one.
+  static const size_t nestedSequences = 5;
+
+  auto encode = [&](der::Writer& output) -> Result {
+    Result rv;
+    for (size_t i = 0; i < nestedSequences; ++i) {
+      rv = output.BeginNested(der::SEQUENCE);
+      if (rv != Success) {
+        return rv;
+      }
+    }
+    // reqCert.hashAlgorithm
+    rv = output.Write(Input(hashAlgorithm));
+    if (rv != Success) {
+      return rv;
+    }
+    // reqCert.issuerNameHash (OCTET STRING)
+    rv = der::TLV(output, der::OCTET_STRING, Input(issuerNameHash));
+    if (rv != Success) {
+      return rv;
+    }
+    // reqCert.issuerKeyHash (OCTET STRING)
+    rv = der::TLV(output, der::OCTET_STRING, Input(issuerKeyHash));
+    if (rv != Success) {
+      return rv;
+    }
+    // reqCert.serialNumber (INTEGER)
+    rv = der::TLV(output, der::INTEGER, certID.serialNumber);
+    if (rv != Success) {
+      return rv;
+    }
+    for (size_t i = 0; i < nestedSequences; ++i) {
+      rv = output.EndNested();
+      if (rv != Success) {
+        return rv;
+      }
+    }
+    return Success;
+  };
 
   // The only way we could have a request this large is if the serialNumber was
   // ridiculously and unreasonably large. RFC 5280 says "Conforming CAs MUST
   // NOT use serialNumber values longer than 20 octets." With this restriction,
   // we allow for some amount of non-conformance with that requirement while
   // still ensuring we can encode the length values in the ASN.1 TLV structures
-  // in a single byte.
-  static_assert(totalLenWithoutSerialNumberData < OCSP_REQUEST_MAX_LENGTH,
-                "totalLenWithoutSerialNumberData too big");
-  if (certID.serialNumber.GetLength() >
-        OCSP_REQUEST_MAX_LENGTH - totalLenWithoutSerialNumberData) {
-    return Result::ERROR_BAD_DER;
+  // in a single byte. The request is measured before anything is hashed so
+  // that an oversized serial number is rejected first.
+  der::EncodedLengths lengths;
+  Result rv = der::MeasureEncoding(lengths, encode, outLen);
+  if (rv != Success) {
+    return rv;
   }
-
-  outLen = totalLenWithoutSerialNumberData + certID.serialNumber.GetLength();
-
-  uint8_t totalLen = static_cast<uint8_t>(outLen);
-
-  uint8_t* d = out;
-  *d++ = 0x30; *d++ = totalLen - 2u;  // OCSPRequest (SEQUENCE)
-  *d++ = 0x30; *d++ = totalLen - 4u;  //   tbsRequest (SEQUENCE)
-  *d++ = 0x30; *d++ = totalLen - 6u;  //     requestList (SEQUENCE OF)
-  *d++ = 0x30; *d++ = totalLen - 8u;  //       Request (SEQUENCE)
-  *d++ = 0x30; *d++ = totalLen - 10u; //         reqCert (CertID SEQUENCE)
-
-  // reqCert.hashAlgorithm
-  for (size_t i = 0; i < sizeof(hashAlgorithm); ++i) {
-    *d++ = hashAlgorithm[i];
+  if (outLen > OCSP_REQUEST_MAX_LENGTH) {
+    return Result::ERROR_BAD_DER;
   }
 
-  // reqCert.issuerNameHash (OCTET STRING)
-  *d++ = 0x04;
-  *d++ = hashLen;
-  Result rv = trustDomain.DigestBuf(certID.issuer, DigestAlgorithm::sha1, d,
-                                    hashLen);
+  rv = trustDomain.DigestBuf(certID.issuer, DigestAlgorithm::sha1,
+                             issuerNameHash, hashLen);
   if (rv != Success) {
     return rv;
   }
-  d += hashLen;
-
-  // reqCert.issuerKeyHash (OCTET STRING)
-  *d++ = 0x04;
-  *d++ = hashLen;
-  rv = KeyHash(trustDomain, certID.issuerSubjectPublicKeyInfo, d, hashLen);
+  rv = KeyHash(trustDomain, certID.issuerSubjectPublicKeyInfo, issuerKeyHash,
+               hashLen);
   if (rv != Success) {
     return rv;
   }
-  d += hashLen;
 
-  // reqCert.serialNumber (INTEGER)
-  *d++ = 0x02; // INTEGER
-  *d++ = static_cast<uint8_t>(certID.serialNumber.GetLength());
-  Reader serialNumber(certID.serialNumber);
-  do {
-    rv = serialNumber.Read(*d);
-    if (rv != Success) {
-      return rv;
-    }
-    ++d;
-  } while (!serialNumber.AtEnd());
-
-  assert(d == out + totalLen);
+  if (certID.serialNumber.GetLength() == 0) {
+    return Result::ERROR_BAD_DER;
+  }
 
-  return Success;
+  return der::WriteEncoding(lengths, encode, out, outLen);
 }
 
 } } // namespace mozilla::pkix
@@ -25,10 +25,62 @@
 #ifndef mozilla_pkix_pkixutil_h
 #define mozilla_pkix_pkixutil_h
 
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <thread>
+
+#include "pkix/pkix.h"
 #include "pkixder.h"
 
 namespace mozilla { namespace pkix {
 
+// The identifiers in a certificate that name constraints are checked against:
+// the names in its subjectAltName, and the emailAddress and CN-ID attributes
+// of its subject. During path building every constrained issuer checks every
+// certificate below it, and every alternative issuer tried while backtracking
+// does the same, so CheckNameConstraints extracts these once per certificate
+// and keeps them here, in the chain's NameConstraintsPresentedIDsBuffer.
+// Certificates with more than MAX_IDS of them, and certificates whose
+// BackCert has no buffer, are checked without being extracted.
+struct NameConstraintsPresentedIDs final
+{
+  NameConstraintsPresentedIDs()
+    : state(State::NotExtracted)
+  {
+  }
+
+  enum class State : uint8_t { NotExtracted, Extracted, TooMany };
+  static const size_t MAX_IDS = 16;
+
+  State state;
+
+  // ids[0, subjectAltNameIDCount) are the names in the subjectAltName, in
+  // order, with their GeneralName tags in idTypes. subjectAltNameError is the
+  // error, if any, that stopped the subjectAltName from being read further.
+  Input ids[MAX_IDS];
+  uint8_t idTypes[MAX_IDS];
+  size_t subjectAltNameIDCount;
+  Result subjectAltNameError;
+  bool subjectAltNameHasDNSNameOrIPAddress;
+
+  // ids[subjectAltNameIDCount, idCount) are the values of the emailAddress
+  // attributes in the subject, in order. subjectError is the error, if any,
+  // that stopped the subject from being read further.
+  size_t idCount;
+  Result subjectError;
+
+  // The most specific CN in the subject, if it is a valid DNS-ID or IPv4
+  // address, with the GeneralName tag of that form of name. commonNameType
+  // is zero otherwise.
+  uint8_t commonNameType;
+  Input commonName;
+  uint8_t commonNameIPv4Address[4];
+
+  NameConstraintsPresentedIDs(const NameConstraintsPresentedIDs&) = delete;
+  void operator=(const NameConstraintsPresentedIDs&) = delete;
+};
+
 // During path building and verification, we build a linked list of BackCerts
 // from the current cert toward the end-entity certificate. The linked list
 // is used to verify properties that aren't local to the current certificate
@@ -38,20 +90,37 @@ namespace mozilla { namespace pkix {
 // Each BackCert contains pointers to all the given certificate's extensions
 // so that we can parse the extension block once and then process the
 // extensions in an order that may be different than they appear in the cert.
+struct NameConstraintsPresentedIDsBuffer;
+
 class BackCert final
 {
 public:
-  // certDER and childCert must be valid for the lifetime of BackCert.
+  // certDER, childCert, and presentedIDsBuffer must be valid for the lifetime
+  // of BackCert. presentedIDsBuffer is only given for the first certificate
+  // of a chain; the others use their childCert's.
   BackCert(Input certDER, EndEntityOrCA endEntityOrCA,
-           const BackCert* childCert)
-    : der(certDER)
-    , endEntityOrCA(endEntityOrCA)
-    , childCert(childCert)
-  {
-  }
+           const BackCert* childCert,
+           /*optional*/ NameConstraintsPresentedIDsBuffer* presentedIDsBuffer
+             = nullptr);
 
+  // Init parses the whole certificate. It is equivalent to
+  // InitWithoutExtensions followed by InitExtensions, and returns the first
+  // error that they return.
   Result Init();
 
+  // InitWithoutExtensions parses everything except the extensions, which is
+  // enough to compare names and look up the certificate's trust. The
+  // extensions, which are most of the work of parsing a typical certificate,
+  // can then be parsed with InitExtensions only for certificates that are
+  // actually going to be used. The Get* functions for the extensions must not
+  // be called before InitExtensions succeeds.
+  //
+  // When InitWithoutExtensions fails, it returns the same error that Init
+  // would; in particular, if the extensions and something after them are both
+  // invalid, it returns the error for the extensions, like Init.
+  Result InitWithoutExtensions();
+  Result InitExtensions();
+
   const Input GetDER() const { return der; }
   const der::SignedDataWithSignature& GetSignedData() const {
     return signedData;
@@ -103,6 +172,28 @@ public:
     return MaybeInput(subjectAltName);
   }
 
+  // The fast hashes (see Fingerprint::GetFastHash) of the subject and the
+  // SubjectPublicKeyInfo, computed together when first used. They must not be
+  // used before InitWithoutExtensions succeeds.
+  uint64_t GetSubjectFastHash() const
+  {
+    ComputeFastHashes();
+    return subjectFastHash;
+  }
+  uint64_t GetSubjectPublicKeyInfoFastHash() const
+  {
+    ComputeFastHashes();
+    return subjectPublicKeyInfoFastHash;
+  }
+
+  // Filled in by CheckNameConstraints the first time the certificate is
+  // checked against name constraints. nullptr if the chain has no
+  // NameConstraintsPresentedIDsBuffer.
+  NameConstraintsPresentedIDs* GetNameConstraintsPresentedIDs() const
+  {
+    return nameConstraintsPresentedIDs;
+  }
+
 private:
   const Input der;
 
@@ -117,8 +208,9 @@ private:
   // *processing* extensions, we distinguish between whether an extension was
   // included or not based on whetehr the GetXXX function for the extension
   // returns nullptr.
-  static inline const Input* MaybeInput(const Input& item)
+  inline const Input* MaybeInput(const Input& item) const
   {
+    assert(extensionsInitialized);
     return item.GetLength() > 0 ? &item : nullptr;
   }
 
@@ -135,6 +227,10 @@ private:
   Input subject;
   Input subjectPublicKeyInfo;
 
+  // The extensions, with their [3] tag, and whether they have been parsed.
+  Input extensions;
+  bool extensionsInitialized;
+
   Input authorityInfoAccess;
   Input basicConstraints;
   Input certificatePolicies;
@@ -145,6 +241,15 @@ private:
   Input subjectAltName;
   Input criticalNetscapeCertificateType;
 
+  void ComputeFastHashes() const;
+  mutable bool fastHashesComputed;
+  mutable uint64_t subjectFastHash;
+  mutable uint64_t subjectPublicKeyInfoFastHash;
+
+  NameConstraintsPresentedIDsBuffer* const presentedIDsBuffer;
+  const size_t chainIndex;
+  NameConstraintsPresentedIDs* const nameConstraintsPresentedIDs;
+
   Result RememberExtension(Reader& extnID, Input extnValue, bool critical,
                            /*out*/ bool& understood);
 
@@ -192,6 +297,51 @@ private:
   void operator=(const NonOwningDERArray&) = delete;
 };
 
+// The NameConstraintsPresentedIDs of the certificates of a chain, indexed by
+// their distance from the first certificate. It is kept outside the BackCerts
+// so that the recursion of path building doesn't carry one per level. The
+// last certificate of a chain is never below another, so it has no entry.
+struct NameConstraintsPresentedIDsBuffer final
+{
+  NameConstraintsPresentedIDsBuffer() { }
+
+  static const size_t MAX_CERTS = NonOwningDERArray::MAX_LENGTH - 1;
+  NameConstraintsPresentedIDs ids[MAX_CERTS];
+
+  NameConstraintsPresentedIDsBuffer(
+    const NameConstraintsPresentedIDsBuffer&) = delete;
+  void operator=(const NameConstraintsPresentedIDsBuffer&) = delete;
+};
+
+inline
+BackCert::BackCert(Input certDER, EndEntityOrCA endEntityOrCA,
+                   const BackCert* childCert,
+                   /*optional*/ NameConstraintsPresentedIDsBuffer*
+                     presentedIDsBuffer)
+  : der(certDER)
+  , endEntityOrCA(endEntityOrCA)
+  , childCert(childCert)
+  , extensionsInitialized(false)
+  , fastHashesComputed(false)
+  , subjectFastHash(0)
+  , subjectPublicKeyInfoFastHash(0)
+  , presentedIDsBuffer(childCert ? childCert->presentedIDsBuffer
+                                 : presentedIDsBuffer)
+  , chainIndex(childCert ? childCert->chainIndex + 1 : 0)
+  , nameConstraintsPresentedIDs(
+      this->presentedIDsBuffer &&
+        chainIndex < NameConstraintsPresentedIDsBuffer::MAX_CERTS
+      ? &this->presentedIDsBuffer->ids[chainIndex]
+      : nullptr)
+{
+  // The entry may hold the identifiers of an alternative to this certificate
+  // that was tried before it. Its Inputs can't be initialized again, so the
+  // whole entry is constructed again.
+  if (nameConstraintsPresentedIDs) {
+    new (nameConstraintsPresentedIDs) NameConstraintsPresentedIDs();
+  }
+}
+
 inline unsigned int
 DaysBeforeYear(unsigned int year)
 {
@@ -220,6 +370,81 @@ Result VerifySignedData(TrustDomain& trustDomain,
                         const der::SignedDataWithSignature& signedData,
                         Input signerSubjectPublicKeyInfo);
 
+static const size_t MAX_SIGNED_DATA_BATCH_SIZE = 4;
+
+// Like VerifySignedData for each of signedDatas[i] and
+// signerSubjectPublicKeyInfos[i], with results[i] set to the result for each,
+// but with all of the signatures given to TrustDomain::VerifySignedDigests
+// together. The signatures must not depend on each other. Fatal errors are
+// returned instead.
+Result VerifySignedDatas(TrustDomain& trustDomain,
+                         const der::SignedDataWithSignature* const* signedDatas,
+                         const Input* signerSubjectPublicKeyInfos,
+                         size_t count,
+                         /*out*/ Result* results);
+
+// The forms that a hostname given to CheckCertHostname can take.
+enum class ReferenceIDType : uint8_t
+{
+  Invalid = 0,
+  DNSID = 1,
+  IPv4Address = 2,
+  IPv6Address = 3,
+};
+
+// Classifies hostname the same way as trying IsValidReferenceDNSID,
+// ParseIPv6Address, and ParseIPv4Address in that order would, but parses it
+// with at most one of them. referenceID is set to hostname for a DNS-ID and to
+// the start of ipAddress, which holds the parsed address, for an IP address;
+// it is left uninitialized when hostname is invalid.
+ReferenceIDType ClassifyReferenceID(Input hostname,
+                                    /*out*/ uint8_t (&ipAddress)[16],
+                                    /*out*/ Input& referenceID);
+
+// Calls fn(i) for each i from 0 to count - 1, dividing the calls among
+// threadCount threads (including the calling one), which must be from 1 to
+// MAX_PARALLEL_THREADS. The threads take the indices in batches, so that they
+// rarely contend for the next one, and no thread is started that would have
+// nothing to do. fn must be safe to call concurrently for different indices.
+//
+// When built without exceptions, a failure to start a thread aborts
+// (std::thread throws std::system_error) instead of being reported; see
+// MAX_PARALLEL_THREADS. With a threadCount of 1, no thread is ever started.
+template <typename F>
+void
+ForEachInParallel(size_t count, unsigned int threadCount, const F& fn)
+{
+  assert(threadCount >= 1 && threadCount <= MAX_PARALLEL_THREADS);
+
+  static const size_t BATCH_SIZE = 64;
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (;;) {
+      size_t begin = next.fetch_add(BATCH_SIZE);
+      if (begin >= count) {
+        return;
+      }
+      size_t end = std::min(count, begin + BATCH_SIZE);
+      for (size_t i = begin; i < end; ++i) {
+        fn(i);
+      }
+    }
+  };
+
+  size_t otherThreadCount = count == 0
+    ? 0
+    : std::min(static_cast<size_t>(threadCount - 1),
+               (count - 1) / BATCH_SIZE);
+  std::thread otherThreads[MAX_PARALLEL_THREADS - 1];
+  for (size_t i = 0; i < otherThreadCount; ++i) {
+    otherThreads[i] = std::thread(work);
+  }
+  work();
+  for (size_t i = 0; i < otherThreadCount; ++i) {
+    otherThreads[i].join();
+  }
+}
+
 // In a switch over an enum, sometimes some compilers are not satisfied that
 // all control flow paths have been considered unless there is a default case.
 // However, in our code, such a default case is almost always unreachable dead
@@ -100,4 +100,94 @@ VerifySignedData(TrustDomain& trustDomain,
                             signerSubjectPublicKeyInfo);
 }
 
+Result
+TrustDomain::VerifySignedDigests(const SignedDigestToVerify* signatures,
+                                 size_t count, /*out*/ Result* results)
+{
+  for (size_t i = 0; i < count; ++i) {
+    const SignedDigestToVerify& signature(signatures[i]);
+    switch (signature.publicKeyType) {
+      case PublicKeyType::EC:
+        results[i] = VerifyECDSASignedDigest(*signature.signedDigest,
+                                             signature.subjectPublicKeyInfo);
+        break;
+      case PublicKeyType::RSA:
+        results[i] = VerifyRSAPKCS1SignedDigest(
+                       *signature.signedDigest, signature.subjectPublicKeyInfo);
+        break;
+      case PublicKeyType::unsupported:
+        results[i] = Result::FATAL_ERROR_INVALID_ARGS;
+        break;
+      MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
+    }
+  }
+  return Success;
+}
+
+Result
+VerifySignedDatas(TrustDomain& trustDomain,
+                  const der::SignedDataWithSignature* const* signedDatas,
+                  const Input* signerSubjectPublicKeyInfos,
+                  size_t count,
+                  /*out*/ Result* results)
+{
+  if (count > MAX_SIGNED_DATA_BATCH_SIZE) {
+    return NotReached("too many signatures in batch",
+                      Result::FATAL_ERROR_INVALID_ARGS);
+  }
+
+  uint8_t digestBufs[MAX_SIGNED_DATA_BATCH_SIZE][MAX_DIGEST_SIZE_IN_BYTES];
+  SignedDigest signedDigests[MAX_SIGNED_DATA_BATCH_SIZE];
+  SignedDigestToVerify toVerify[MAX_SIGNED_DATA_BATCH_SIZE];
+  Result verifyResults[MAX_SIGNED_DATA_BATCH_SIZE];
+  // Signatures whose data can't be digested aren't given to the TrustDomain;
+  // indexes[j] is the index in signedDatas of toVerify[j].
+  size_t indexes[MAX_SIGNED_DATA_BATCH_SIZE];
+  size_t toVerifyCount = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    der::PublicKeyAlgorithm publicKeyAlg;
+    Result rv = DigestSignedData(trustDomain, *signedDatas[i],
+                                 digestBufs[toVerifyCount], publicKeyAlg,
+                                 signedDigests[toVerifyCount]);
+    if (rv != Success) {
+      if (IsFatalError(rv)) {
+        return rv;
+      }
+      results[i] = rv;
+      continue;
+    }
+    SignedDigestToVerify& signature(toVerify[toVerifyCount]);
+    switch (publicKeyAlg) {
+      case der::PublicKeyAlgorithm::ECDSA:
+        signature.publicKeyType = PublicKeyType::EC;
+        break;
+      case der::PublicKeyAlgorithm::RSA_PKCS1:
+        signature.publicKeyType = PublicKeyType::RSA;
+        break;
+      MOZILLA_PKIX_UNREACHABLE_DEFAULT_ENUM
+    }
+    signature.signedDigest = &signedDigests[toVerifyCount];
+    rv = signature.subjectPublicKeyInfo.Init(signerSubjectPublicKeyInfos[i]);
+    if (rv != Success) {
+      return rv;
+    }
+    indexes[toVerifyCount] = i;
+    ++toVerifyCount;
+  }
+
+  if (toVerifyCount == 0) {
+    return Success;
+  }
+  Result rv = trustDomain.VerifySignedDigests(toVerify, toVerifyCount,
+                                              verifyResults);
+  if (rv != Success) {
+    return rv;
+  }
+  for (size_t j = 0; j < toVerifyCount; ++j) {
+    results[indexes[j]] = verifyResults[j];
+  }
+  return Success;
+}
+
 } } // namespace mozilla::pkix
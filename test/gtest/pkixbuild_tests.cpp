@@ -31,11 +31,14 @@
 #endif
 
 #include <map>
+#include <string>
+#include <vector>
 
 #if defined(_MSC_VER) && _MSC_VER < 1900
 #pragma warning(pop)
 #endif
 
+#include "pkixder.h"
 #include "pkixgtest.h"
 
 using namespace mozilla::pkix;
@@ -474,3 +477,270 @@ TEST_P(pkixbuild_IssuerNameCheck, MatchingName)
 
 INSTANTIATE_TEST_CASE_P(pkixbuild_IssuerNameCheck, pkixbuild_IssuerNameCheck,
                         testing::ValuesIn(ISSUER_NAME_CHECK_PARAMS));
+
+// A candidate issuer with invalid extensions is rejected, whether or not its
+// name matches, even though the extensions of a candidate with a mismatched
+// name are only parsed once no issuer has been found.
+TEST_F(pkixbuild_IssuerNameCheck, InvalidExtensions)
+{
+  ByteString basicConstraints(
+    CreateEncodedBasicConstraints(true, nullptr, Critical::Yes));
+  ASSERT_FALSE(ENCODING_FAILED(basicConstraints));
+  // Duplicate extensions are invalid.
+  const ByteString extensions[] = {
+    basicConstraints, basicConstraints, ByteString()
+  };
+
+  for (bool matches : { false, true }) {
+    ScopedTestKeyPair reusedKey(CloneReusedKeyPair());
+    ByteString issuerCertDER(CreateEncodedCertificate(
+                               v3, sha256WithRSAEncryption(),
+                               CreateEncodedSerialNumber(1),
+                               CNToDERName("issuer"), oneDayBeforeNow,
+                               oneDayAfterNow, CNToDERName("issuer"),
+                               *reusedKey, extensions, *reusedKey,
+                               sha256WithRSAEncryption()));
+    ASSERT_FALSE(ENCODING_FAILED(issuerCertDER));
+
+    ByteString subjectCertDER(CreateCert(matches ? "issuer" : "other",
+                                         "end-entity",
+                                         EndEntityOrCA::MustBeEndEntity,
+                                         nullptr));
+    ASSERT_FALSE(ENCODING_FAILED(subjectCertDER));
+    Input subjectCertDERInput;
+    ASSERT_EQ(Success, subjectCertDERInput.Init(subjectCertDER.data(),
+                                                subjectCertDER.length()));
+
+    IssuerNameCheckTrustDomain trustDomain(issuerCertDER, true);
+    ASSERT_EQ(Result::ERROR_EXTENSION_VALUE_INVALID,
+              BuildCertChain(trustDomain, subjectCertDERInput, Now(),
+                             EndEntityOrCA::MustBeEndEntity,
+                             KeyUsage::noParticularKeyUsageRequired,
+                             KeyPurposeId::id_kp_serverAuth,
+                             CertPolicyId::anyPolicy,
+                             nullptr/*stapledOCSPResponse*/));
+  }
+}
+
+// A TrustDomain whose FindIssuer passes every CA certificate it has to the
+// IssuerChecker, without comparing names, with the one real issuer last.
+class UnfilteredTrustDomain final : public DefaultCryptoTrustDomain
+{
+public:
+  explicit UnfilteredTrustDomain(const std::vector<ByteString>& caCerts)
+    : findIssuerCalls(0)
+    , caCerts(caCerts)
+  {
+  }
+
+  unsigned int findIssuerCalls;
+
+private:
+  Result GetCertTrust(EndEntityOrCA endEntityOrCA, const CertPolicyId&, Input,
+                      /*out*/ TrustLevel& trustLevel) override
+  {
+    trustLevel = endEntityOrCA == EndEntityOrCA::MustBeCA
+               ? TrustLevel::TrustAnchor
+               : TrustLevel::InheritsTrust;
+    return Success;
+  }
+
+  Result FindIssuer(Input, IssuerChecker& checker, Time) override
+  {
+    ++findIssuerCalls;
+    for (const ByteString& caCert : caCerts) {
+      Input caCertInput;
+      Result rv = caCertInput.Init(caCert.data(), caCert.length());
+      if (rv != Success) {
+        return rv;
+      }
+      bool keepGoing;
+      rv = checker.Check(caCertInput, nullptr /*additionalNameConstraints*/,
+                         keepGoing);
+      if (rv != Success) {
+        return rv;
+      }
+      if (!keepGoing) {
+        break;
+      }
+    }
+    return Success;
+  }
+
+  Result CheckRevocation(EndEntityOrCA, const CertID&, Time, Duration,
+                         /*optional*/ const Input*, /*optional*/ const Input*)
+                         override
+  {
+    return Success;
+  }
+
+  Result IsChainValid(const DERArray&, Time) override
+  {
+    return Success;
+  }
+
+  const std::vector<ByteString>& caCerts;
+};
+
+class pkixbuild_UnfilteredFindIssuer : public ::testing::Test
+{
+protected:
+  // Creates caCount CA certificates with distinct names, and an end-entity
+  // certificate issued by the last of them, so that all but one of the
+  // candidate issuers that FindIssuer returns must be rejected by name.
+  static void CreateCerts(size_t caCount,
+                          /*out*/ std::vector<ByteString>& caCerts,
+                          /*out*/ ByteString& endEntity)
+  {
+    // Extensions like those of a typical CA certificate.
+    static const uint8_t keyUsageCertSign[] = {
+      0x30, 0x0e, 0x06, 0x03, 0x55, 0x1d, 0x0f, 0x01, 0x01, 0xff,
+      0x04, 0x04, 0x03, 0x02, 0x01, 0x06
+    };
+    ByteString basicConstraints(
+      CreateEncodedBasicConstraints(true, nullptr, Critical::Yes));
+    ASSERT_FALSE(ENCODING_FAILED(basicConstraints));
+    ByteString keyIdentifier(TLV(der::OCTET_STRING, ByteString(20, 0x11)));
+    // python DottedOIDToCode.py --tlv id-ce-subjectKeyIdentifier 2.5.29.14
+    static const uint8_t tlv_id_ce_subjectKeyIdentifier[] = {
+      0x06, 0x03, 0x55, 0x1d, 0x0e
+    };
+    // python DottedOIDToCode.py --tlv id-ce-authorityKeyIdentifier 2.5.29.35
+    static const uint8_t tlv_id_ce_authorityKeyIdentifier[] = {
+      0x06, 0x03, 0x55, 0x1d, 0x23
+    };
+    // python DottedOIDToCode.py --tlv id-ce-cRLDistributionPoints 2.5.29.31
+    static const uint8_t tlv_id_ce_cRLDistributionPoints[] = {
+      0x06, 0x03, 0x55, 0x1d, 0x1f
+    };
+    const ByteString extensions[] = {
+      basicConstraints,
+      ByteString(keyUsageCertSign, sizeof keyUsageCertSign),
+      TLV(der::SEQUENCE,
+          ByteString(tlv_id_ce_subjectKeyIdentifier,
+                     sizeof tlv_id_ce_subjectKeyIdentifier) +
+          TLV(der::OCTET_STRING, keyIdentifier)),
+      TLV(der::SEQUENCE,
+          ByteString(tlv_id_ce_authorityKeyIdentifier,
+                     sizeof tlv_id_ce_authorityKeyIdentifier) +
+          TLV(der::OCTET_STRING, TLV(der::SEQUENCE, keyIdentifier))),
+      TLV(der::SEQUENCE,
+          ByteString(tlv_id_ce_cRLDistributionPoints,
+                     sizeof tlv_id_ce_cRLDistributionPoints) +
+          TLV(der::OCTET_STRING, TLV(der::SEQUENCE, ByteString(40, 0x00)))),
+      ByteString()
+    };
+
+    ScopedTestKeyPair reusedKey(CloneReusedKeyPair());
+    ASSERT_TRUE(reusedKey.get());
+    for (size_t i = 0; i < caCount; ++i) {
+      std::string name("CA " + std::to_string(i));
+      caCerts.push_back(CreateEncodedCertificate(
+                          v3, sha256WithRSAEncryption(),
+                          CreateEncodedSerialNumber(static_cast<long>(i + 1)),
+                          CNToDERName(name.c_str()), oneDayBeforeNow,
+                          oneDayAfterNow, CNToDERName(name.c_str()),
+                          *reusedKey, extensions, *reusedKey,
+                          sha256WithRSAEncryption()));
+      ASSERT_FALSE(ENCODING_FAILED(caCerts.back()));
+    }
+
+    std::string issuerName("CA " + std::to_string(caCount - 1));
+    endEntity = CreateCert(issuerName.c_str(), "end-entity",
+                           EndEntityOrCA::MustBeEndEntity);
+    ASSERT_FALSE(ENCODING_FAILED(endEntity));
+  }
+
+  // A CA certificate whose extensions are invalid (duplicated).
+  static ByteString CreateCAWithInvalidExtensions(const char* name)
+  {
+    ByteString basicConstraints(
+      CreateEncodedBasicConstraints(true, nullptr, Critical::Yes));
+    EXPECT_FALSE(ENCODING_FAILED(basicConstraints));
+    const ByteString extensions[] = {
+      basicConstraints, basicConstraints, ByteString()
+    };
+    ScopedTestKeyPair reusedKey(CloneReusedKeyPair());
+    EXPECT_TRUE(reusedKey.get());
+    ByteString result(CreateEncodedCertificate(
+                        v3, sha256WithRSAEncryption(),
+                        CreateEncodedSerialNumber(127), CNToDERName(name),
+                        oneDayBeforeNow, oneDayAfterNow, CNToDERName(name),
+                        *reusedKey, extensions, *reusedKey,
+                        sha256WithRSAEncryption()));
+    EXPECT_FALSE(ENCODING_FAILED(result));
+    return result;
+  }
+
+  static Result BuildChain(UnfilteredTrustDomain& trustDomain,
+                           const ByteString& endEntity)
+  {
+    Input endEntityInput;
+    Result rv = endEntityInput.Init(endEntity.data(), endEntity.length());
+    if (rv != Success) {
+      return rv;
+    }
+    return BuildCertChain(trustDomain, endEntityInput, Now(),
+                          EndEntityOrCA::MustBeEndEntity,
+                          KeyUsage::noParticularKeyUsageRequired,
+                          KeyPurposeId::id_kp_serverAuth,
+                          CertPolicyId::anyPolicy,
+                          nullptr/*stapledOCSPResponse*/);
+  }
+};
+
+TEST_F(pkixbuild_UnfilteredFindIssuer, BuildCertChain)
+{
+  std::vector<ByteString> caCerts;
+  ByteString endEntity;
+  ASSERT_NO_FATAL_FAILURE(CreateCerts(10, caCerts, endEntity));
+  UnfilteredTrustDomain trustDomain(caCerts);
+  ASSERT_EQ(Success, BuildChain(trustDomain, endEntity));
+}
+
+// The extensions of candidates with mismatched names aren't parsed while
+// looking for the issuer, but they are checked if no issuer is found, so the
+// result is the same as if every candidate had been fully parsed.
+TEST_F(pkixbuild_UnfilteredFindIssuer, MismatchedInvalidExtensions)
+{
+  std::vector<ByteString> caCerts;
+  ByteString endEntity;
+  ASSERT_NO_FATAL_FAILURE(CreateCerts(3, caCerts, endEntity));
+  caCerts.insert(caCerts.begin(), CreateCAWithInvalidExtensions("bad CA"));
+
+  // When the issuer is found, the invalid extensions don't matter and aren't
+  // parsed.
+  {
+    UnfilteredTrustDomain trustDomain(caCerts);
+    ASSERT_EQ(Success, BuildChain(trustDomain, endEntity));
+    ASSERT_EQ(1u, trustDomain.findIssuerCalls);
+  }
+
+  // When it isn't, they are reported as before.
+  caCerts.pop_back();
+  {
+    UnfilteredTrustDomain trustDomain(caCerts);
+    ASSERT_EQ(Result::ERROR_EXTENSION_VALUE_INVALID,
+              BuildChain(trustDomain, endEntity));
+    ASSERT_EQ(2u, trustDomain.findIssuerCalls);
+  }
+
+  // Without the invalid candidate, no issuer is found at all.
+  caCerts.erase(caCerts.begin());
+  {
+    UnfilteredTrustDomain trustDomain(caCerts);
+    ASSERT_EQ(Result::ERROR_UNKNOWN_ISSUER, BuildChain(trustDomain, endEntity));
+  }
+}
+
+TEST_F(pkixbuild_UnfilteredFindIssuer, DISABLED_Benchmark_BuildCertChain)
+{
+  std::vector<ByteString> caCerts;
+  ByteString endEntity;
+  ASSERT_NO_FATAL_FAILURE(CreateCerts(100, caCerts, endEntity));
+  UnfilteredTrustDomain trustDomain(caCerts);
+  Benchmark("BuildCertChain, 100 unfiltered issuers", 200,
+            [&trustDomain, &endEntity]() {
+    ASSERT_EQ(Success, BuildChain(trustDomain, endEntity));
+  });
+}
@@ -0,0 +1,398 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pkix/pkix.h"
+#include "pkixcheck.h"
+#include "pkixgtest.h"
+#include "pkixutil.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+// python DottedOIDToCode.py --tlv unknownOID 1.3.6.1.4.1.13769.666.666.666.1.500.9.3
+static const uint8_t tlv_unknownOID[] = {
+  0x06, 0x12, 0x2b, 0x06, 0x01, 0x04, 0x01, 0xeb, 0x49, 0x85, 0x1a, 0x85, 0x1a,
+  0x85, 0x1a, 0x01, 0x83, 0x74, 0x09, 0x03
+};
+
+template <size_t L>
+inline ByteString
+BytesToByteString(const uint8_t (&bytes)[L])
+{
+  return ByteString(bytes, L);
+}
+
+ByteString
+StringToByteString(const std::string& s)
+{
+  return ByteString(reinterpret_cast<const uint8_t*>(s.data()), s.length());
+}
+
+ByteString
+CreateCert(long serialNumberValue, const char* subjectCN,
+           /*optional*/ const ByteString* subjectAltName,
+           /*optional*/ const ByteString* ekus)
+{
+  ByteString serialNumber(CreateEncodedSerialNumber(serialNumberValue));
+  EXPECT_FALSE(ENCODING_FAILED(serialNumber));
+
+  ByteString extensions[3];
+  size_t extensionCount = 0;
+  if (subjectAltName) {
+    extensions[extensionCount] = CreateEncodedSubjectAltName(*subjectAltName);
+    EXPECT_FALSE(ENCODING_FAILED(extensions[extensionCount]));
+    ++extensionCount;
+  }
+  if (ekus) {
+    Input ekusInput;
+    EXPECT_EQ(Success, ekusInput.Init(ekus->data(), ekus->length()));
+    extensions[extensionCount] =
+      CreateEncodedEKUExtension(ekusInput, Critical::No);
+    EXPECT_FALSE(ENCODING_FAILED(extensions[extensionCount]));
+    ++extensionCount;
+  }
+
+  ScopedTestKeyPair keyPair(CloneReusedKeyPair());
+  return CreateEncodedCertificate(
+                    v3, sha256WithRSAEncryption(), serialNumber,
+                    CNToDERName("issuer"), oneDayBeforeNow, oneDayAfterNow,
+                    CNToDERName(subjectCN), *keyPair, extensions, *keyPair,
+                    sha256WithRSAEncryption());
+}
+
+} // unnamed namespace
+
+class pkixcert_ExtractCertFields : public ::testing::Test
+{
+};
+
+TEST_F(pkixcert_ExtractCertFields, AllColumns)
+{
+  ByteString sans(DNSName("a.example.com") + DNSName("b.example.com") +
+                  RFC822Name("c@example.com"));
+  ByteString ekus(BytesToByteString(tlv_id_kp_serverAuth) +
+                  BytesToByteString(tlv_id_kp_OCSPSigning) +
+                  BytesToByteString(tlv_unknownOID));
+  ByteString certDERs[] = {
+    CreateCert(1, "with extensions", &sans, &ekus),
+    CreateCert(2, "without extensions", nullptr, nullptr),
+    StringToByteString("not a certificate"),
+  };
+  static const size_t CERT_COUNT = MOZILLA_PKIX_ARRAY_LENGTH(certDERs);
+  Input certs[CERT_COUNT];
+  for (size_t i = 0; i < CERT_COUNT; ++i) {
+    ASSERT_FALSE(ENCODING_FAILED(certDERs[i]));
+    ASSERT_EQ(Success, certs[i].Init(certDERs[i].data(),
+                                     certDERs[i].length()));
+  }
+
+  static const size_t SANS_PER_CERT = 2;
+  Result results[CERT_COUNT];
+  Input serialNumbers[CERT_COUNT];
+  Input issuers[CERT_COUNT];
+  Input subjects[CERT_COUNT];
+  Time notBefores[CERT_COUNT] = {
+    Time(Time::uninitialized), Time(Time::uninitialized),
+    Time(Time::uninitialized)
+  };
+  Time notAfters[CERT_COUNT] = {
+    Time(Time::uninitialized), Time(Time::uninitialized),
+    Time(Time::uninitialized)
+  };
+  PublicKeyType publicKeyTypes[CERT_COUNT];
+  unsigned int publicKeySizesInBits[CERT_COUNT];
+  uint16_t extendedKeyUsages[CERT_COUNT];
+  size_t subjectAltNameCounts[CERT_COUNT];
+  Input subjectAltNames[CERT_COUNT * SANS_PER_CERT];
+  uint8_t subjectAltNameTags[CERT_COUNT * SANS_PER_CERT];
+
+  CertFieldColumns columns;
+  columns.results = results;
+  columns.serialNumbers = serialNumbers;
+  columns.issuers = issuers;
+  columns.subjects = subjects;
+  columns.notBefores = notBefores;
+  columns.notAfters = notAfters;
+  columns.publicKeyTypes = publicKeyTypes;
+  columns.publicKeySizesInBits = publicKeySizesInBits;
+  columns.extendedKeyUsages = extendedKeyUsages;
+  columns.subjectAltNameCounts = subjectAltNameCounts;
+  columns.subjectAltNamesPerCert = SANS_PER_CERT;
+  columns.subjectAltNames = subjectAltNames;
+  columns.subjectAltNameTags = subjectAltNameTags;
+  ASSERT_EQ(Success, ExtractCertFields(certs, CERT_COUNT, columns, 1));
+
+  for (size_t i = 0; i < 2; ++i) {
+    ASSERT_EQ(Success, results[i]);
+
+    // The columns refer to the certificates' own bytes.
+    BackCert cert(certs[i], EndEntityOrCA::MustBeEndEntity, nullptr);
+    ASSERT_EQ(Success, cert.Init());
+    ASSERT_EQ(cert.GetSerialNumber().UnsafeGetData(),
+              serialNumbers[i].UnsafeGetData());
+    ASSERT_TRUE(InputsAreEqual(cert.GetSerialNumber(), serialNumbers[i]));
+    ASSERT_TRUE(InputsAreEqual(cert.GetIssuer(), issuers[i]));
+    ASSERT_TRUE(InputsAreEqual(cert.GetSubject(), subjects[i]));
+
+    ASSERT_EQ(TimeFromEpochInSeconds(oneDayBeforeNow), notBefores[i]);
+    ASSERT_EQ(TimeFromEpochInSeconds(oneDayAfterNow), notAfters[i]);
+    ASSERT_EQ(PublicKeyType::RSA, publicKeyTypes[i]);
+    ASSERT_EQ(2048u, publicKeySizesInBits[i]);
+  }
+
+  ASSERT_TRUE(InputEqualsByteString(subjects[0],
+                                    CNToDERName("with extensions")));
+  ASSERT_EQ(EXTENDED_KEY_USAGE_PRESENT | EXTENDED_KEY_USAGE_OTHER |
+              ExtendedKeyUsageBit(KeyPurposeId::id_kp_serverAuth) |
+              ExtendedKeyUsageBit(KeyPurposeId::id_kp_OCSPSigning),
+            extendedKeyUsages[0]);
+  ASSERT_EQ(3u, subjectAltNameCounts[0]);
+  ASSERT_EQ(der::CONTEXT_SPECIFIC | 2, subjectAltNameTags[0]);
+  ASSERT_TRUE(InputEqualsByteString(subjectAltNames[0],
+                                    StringToByteString("a.example.com")));
+  ASSERT_EQ(der::CONTEXT_SPECIFIC | 2, subjectAltNameTags[1]);
+  ASSERT_TRUE(InputEqualsByteString(subjectAltNames[1],
+                                    StringToByteString("b.example.com")));
+
+  ASSERT_TRUE(InputEqualsByteString(subjects[1],
+                                    CNToDERName("without extensions")));
+  ASSERT_EQ(0u, extendedKeyUsages[1]);
+  ASSERT_EQ(0u, subjectAltNameCounts[1]);
+
+  ASSERT_EQ(Result::ERROR_BAD_DER, results[2]);
+}
+
+TEST_F(pkixcert_ExtractCertFields, OnlySomeColumns)
+{
+  ByteString certDER(CreateCert(1, "subject", nullptr, nullptr));
+  ASSERT_FALSE(ENCODING_FAILED(certDER));
+  Input cert;
+  ASSERT_EQ(Success, cert.Init(certDER.data(), certDER.length()));
+
+  Result result = Result::FATAL_ERROR_LIBRARY_FAILURE;
+  Input subject;
+  CertFieldColumns columns;
+  columns.results = &result;
+  columns.subjects = &subject;
+  ASSERT_EQ(Success, ExtractCertFields(&cert, 1, columns, 1));
+  ASSERT_EQ(Success, result);
+  ASSERT_TRUE(InputEqualsByteString(subject, CNToDERName("subject")));
+}
+
+TEST_F(pkixcert_ExtractCertFields, InvalidArgs)
+{
+  ByteString certDER(CreateCert(1, "subject", nullptr, nullptr));
+  ASSERT_FALSE(ENCODING_FAILED(certDER));
+  Input cert;
+  ASSERT_EQ(Success, cert.Init(certDER.data(), certDER.length()));
+
+  Result result;
+  CertFieldColumns columns;
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+            ExtractCertFields(&cert, 1, columns, 1));
+  columns.results = &result;
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+            ExtractCertFields(&cert, 1, columns, 0));
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+            ExtractCertFields(&cert, 1, columns, MAX_PARALLEL_THREADS + 1));
+
+  uint8_t subjectAltNameTag;
+  columns.subjectAltNameTags = &subjectAltNameTag;
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+            ExtractCertFields(&cert, 1, columns, 1));
+
+  ASSERT_EQ(Success, ExtractCertFields(nullptr, 0, CertFieldColumns(), 1));
+}
+
+TEST_F(pkixcert_ExtractCertFields, ManyCertsManyThreads)
+{
+  static const size_t CERT_DER_COUNT = 10;
+  ByteString certDERs[CERT_DER_COUNT];
+  for (size_t i = 0; i < CERT_DER_COUNT; ++i) {
+    std::string host("host" + std::to_string(i) + ".example.com");
+    ByteString sans(DNSName(StringToByteString(host)));
+    certDERs[i] = CreateCert(static_cast<long>(i + 1), "subject", &sans,
+                             nullptr);
+    ASSERT_FALSE(ENCODING_FAILED(certDERs[i]));
+  }
+
+  static const size_t CERT_COUNT = 1000;
+  std::vector<Input> certs(CERT_COUNT);
+  for (size_t i = 0; i < CERT_COUNT; ++i) {
+    const ByteString& certDER(certDERs[i % CERT_DER_COUNT]);
+    ASSERT_EQ(Success, certs[i].Init(certDER.data(), certDER.length()));
+  }
+
+  std::unique_ptr<Result[]> results(new Result[CERT_COUNT]);
+  std::unique_ptr<Input[]> serialNumbers(new Input[CERT_COUNT]);
+  std::unique_ptr<Input[]> subjectAltNames(new Input[CERT_COUNT]);
+  CertFieldColumns columns;
+  columns.results = results.get();
+  columns.serialNumbers = serialNumbers.get();
+  columns.subjectAltNamesPerCert = 1;
+  columns.subjectAltNames = subjectAltNames.get();
+  ASSERT_EQ(Success, ExtractCertFields(certs.data(), CERT_COUNT, columns, 4));
+
+  for (size_t i = 0; i < CERT_COUNT; ++i) {
+    ASSERT_EQ(Success, results[i]);
+    ASSERT_TRUE(InputEqualsByteString(serialNumbers[i],
+      CreateEncodedSerialNumber(static_cast<long>(i % CERT_DER_COUNT + 1))
+        .substr(2)));
+    std::string host("host" + std::to_string(i % CERT_DER_COUNT) +
+                     ".example.com");
+    ASSERT_TRUE(InputEqualsByteString(subjectAltNames[i],
+                                      StringToByteString(host)));
+  }
+}
+
+TEST_F(pkixcert_ExtractCertFields, SubjectPublicKeyTypeAndSize)
+{
+  // SEQUENCE { SEQUENCE { id-ecPublicKey, <curve> },
+  //            BIT STRING { 0x04 <point> } }
+  static const uint8_t tlv_id_ecPublicKey[] = {
+    0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01
+  };
+  static const uint8_t tlv_secp384r1[] = {
+    0x06, 0x05, 0x2b, 0x81, 0x04, 0x00, 0x22
+  };
+  static const uint8_t tlv_secp256k1[] = {
+    0x06, 0x05, 0x2b, 0x81, 0x04, 0x00, 0x0a
+  };
+  ByteString point(1, 0x04);
+  point.append(2 * 48, 0x01);
+  ByteString bitString(1, 0x00);
+  bitString.append(point);
+
+  struct {
+    const uint8_t* curve;
+    size_t curveLength;
+    PublicKeyType expectedType;
+    unsigned int expectedSizeInBits;
+  } testcases[] = {
+    { tlv_secp384r1, sizeof tlv_secp384r1, PublicKeyType::EC, 384 },
+    { tlv_secp256k1, sizeof tlv_secp256k1, PublicKeyType::unsupported, 0 },
+  };
+  for (const auto& testcase : testcases) {
+    ByteString spkiDER(
+      TLV(der::SEQUENCE,
+          TLV(der::SEQUENCE,
+              BytesToByteString(tlv_id_ecPublicKey) +
+              ByteString(testcase.curve, testcase.curveLength)) +
+          TLV(der::BIT_STRING, bitString)));
+    Input spki;
+    ASSERT_EQ(Success, spki.Init(spkiDER.data(), spkiDER.length()));
+    PublicKeyType type;
+    unsigned int sizeInBits;
+    ASSERT_EQ(Success, GetSubjectPublicKeyTypeAndSize(spki, type, sizeInBits));
+    ASSERT_EQ(testcase.expectedType, type);
+    ASSERT_EQ(testcase.expectedSizeInBits, sizeInBits);
+  }
+
+  static const uint8_t notSPKI[] = { 0x30, 0x00 };
+  PublicKeyType type;
+  unsigned int sizeInBits;
+  ASSERT_EQ(Result::ERROR_BAD_DER,
+            GetSubjectPublicKeyTypeAndSize(Input(notSPKI), type, sizeInBits));
+}
+
+TEST_F(pkixcert_ExtractCertFields, DISABLED_Benchmark_ExtractCertFields)
+{
+  std::vector<ByteString> certDERs;
+  ByteString ekus(BytesToByteString(tlv_id_kp_serverAuth));
+  for (long i = 0; i < 100; ++i) {
+    ByteString sans;
+    for (int j = 0; j < 5; ++j) {
+      std::string host("host" + std::to_string(i) + "-" + std::to_string(j) +
+                       ".example.com");
+      sans.append(DNSName(StringToByteString(host)));
+    }
+    certDERs.push_back(CreateCert(i + 1, "www.example.com", &sans, &ekus));
+    ASSERT_FALSE(ENCODING_FAILED(certDERs.back()));
+  }
+  static const size_t CERT_COUNT = 10000;
+  static const size_t SANS_PER_CERT = 4;
+  std::vector<Input> certs(CERT_COUNT);
+  for (size_t i = 0; i < certs.size(); ++i) {
+    const ByteString& certDER(certDERs[i % certDERs.size()]);
+    ASSERT_EQ(Success, certs[i].Init(certDER.data(), certDER.length()));
+  }
+
+  // The baseline: BackCert::Init for each certificate, which doesn't even
+  // decode the validity, key, EKUs or SANs.
+  Benchmark("BackCert::Init, 10000 certificates", 10, [&]() {
+    for (size_t i = 0; i < CERT_COUNT; ++i) {
+      BackCert cert(certs[i], EndEntityOrCA::MustBeEndEntity, nullptr);
+      ASSERT_EQ(Success, cert.Init());
+    }
+  });
+
+  for (unsigned int threadCount : { 1u, 4u }) {
+    std::string name("ExtractCertFields, 10000 certificates, " +
+                     std::to_string(threadCount) + " thread(s)");
+    Benchmark(name.c_str(), 10, [&]() {
+      std::unique_ptr<Result[]> results(new Result[CERT_COUNT]);
+      std::unique_ptr<Input[]> serialNumbers(new Input[CERT_COUNT]);
+      std::unique_ptr<Input[]> issuers(new Input[CERT_COUNT]);
+      std::unique_ptr<Input[]> subjects(new Input[CERT_COUNT]);
+      std::vector<Time> notBefores(CERT_COUNT, TimeFromElapsedSecondsAD(0));
+      std::vector<Time> notAfters(CERT_COUNT, TimeFromElapsedSecondsAD(0));
+      std::unique_ptr<PublicKeyType[]> publicKeyTypes(
+        new PublicKeyType[CERT_COUNT]);
+      std::unique_ptr<unsigned int[]> publicKeySizesInBits(
+        new unsigned int[CERT_COUNT]);
+      std::unique_ptr<uint16_t[]> extendedKeyUsages(new uint16_t[CERT_COUNT]);
+      std::unique_ptr<size_t[]> subjectAltNameCounts(new size_t[CERT_COUNT]);
+      std::unique_ptr<Input[]> subjectAltNames(
+        new Input[CERT_COUNT * SANS_PER_CERT]);
+      std::unique_ptr<uint8_t[]> subjectAltNameTags(
+        new uint8_t[CERT_COUNT * SANS_PER_CERT]);
+
+      CertFieldColumns columns;
+      columns.results = results.get();
+      columns.serialNumbers = serialNumbers.get();
+      columns.issuers = issuers.get();
+      columns.subjects = subjects.get();
+      columns.notBefores = notBefores.data();
+      columns.notAfters = notAfters.data();
+      columns.publicKeyTypes = publicKeyTypes.get();
+      columns.publicKeySizesInBits = publicKeySizesInBits.get();
+      columns.extendedKeyUsages = extendedKeyUsages.get();
+      columns.subjectAltNameCounts = subjectAltNameCounts.get();
+      columns.subjectAltNamesPerCert = SANS_PER_CERT;
+      columns.subjectAltNames = subjectAltNames.get();
+      columns.subjectAltNameTags = subjectAltNameTags.get();
+      ASSERT_EQ(Success, ExtractCertFields(certs.data(), CERT_COUNT, columns,
+                                           threadCount));
+      ASSERT_EQ(Success, results[CERT_COUNT - 1]);
+      ASSERT_EQ(5u, subjectAltNameCounts[CERT_COUNT - 1]);
+    });
+  }
+}
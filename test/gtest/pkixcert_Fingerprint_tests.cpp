@@ -0,0 +1,337 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <map>
+#include <string>
+
+#include "pkix/pkix.h"
+#include "pkixgtest.h"
+#include "pkixutil.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+ByteString
+CreateCert(const char* issuerCN, const char* subjectCN,
+           EndEntityOrCA endEntityOrCA,
+           /*optional modified*/ std::map<ByteString, ByteString>*
+             subjectDERToCertDER = nullptr)
+{
+  static long serialNumberValue = 0;
+  ++serialNumberValue;
+  ByteString serialNumber(CreateEncodedSerialNumber(serialNumberValue));
+  EXPECT_FALSE(ENCODING_FAILED(serialNumber));
+
+  ByteString subjectDER(CNToDERName(subjectCN));
+  ByteString extensions[2];
+  if (endEntityOrCA == EndEntityOrCA::MustBeCA) {
+    extensions[0] =
+      CreateEncodedBasicConstraints(true, nullptr, Critical::Yes);
+    EXPECT_FALSE(ENCODING_FAILED(extensions[0]));
+  }
+
+  ScopedTestKeyPair reusedKey(CloneReusedKeyPair());
+  ByteString certDER(CreateEncodedCertificate(
+                       v3, sha256WithRSAEncryption(), serialNumber,
+                       CNToDERName(issuerCN), oneDayBeforeNow, oneDayAfterNow,
+                       subjectDER, *reusedKey, extensions, *reusedKey,
+                       sha256WithRSAEncryption()));
+  EXPECT_FALSE(ENCODING_FAILED(certDER));
+  if (subjectDERToCertDER) {
+    (*subjectDERToCertDER)[subjectDER] = certDER;
+  }
+  return certDER;
+}
+
+// Counts calls to DigestBuf. CheckRevocation looks up the issuer's key by its
+// SHA-256 digest twice, like a trust domain that consults both a revocation
+// filter and an OCSP response cache keyed by issuer; useFingerprints decides
+// whether it uses the digest from CertID or computes it itself.
+class FingerprintTrustDomain final : public DefaultCryptoTrustDomain
+{
+public:
+  explicit FingerprintTrustDomain(bool useFingerprints)
+    : useFingerprints(useFingerprints)
+    , digestCount(0)
+  {
+  }
+
+  Result GetCertTrust(EndEntityOrCA, const CertPolicyId&, Input candidateCert,
+                      /*out*/ TrustLevel& trustLevel) override
+  {
+    trustLevel = InputEqualsByteString(candidateCert, rootDER)
+               ? TrustLevel::TrustAnchor
+               : TrustLevel::InheritsTrust;
+    return Success;
+  }
+
+  Result FindIssuer(Input encodedIssuerName, IssuerChecker& checker, Time)
+                    override
+  {
+    ByteString certDER(subjectDERToCertDER[InputToByteString(
+                                             encodedIssuerName)]);
+    Input cert;
+    Result rv = cert.Init(certDER.data(), certDER.length());
+    if (rv != Success) {
+      return rv;
+    }
+    bool keepGoing;
+    return checker.Check(cert, nullptr, keepGoing);
+  }
+
+  Result CheckRevocation(EndEntityOrCA, const CertID& certID, Time, Duration,
+                         /*optional*/ const Input*,
+                         /*optional*/ const Input*) override
+  {
+    for (int lookup = 0; lookup < 2; ++lookup) {
+      uint8_t digestBuf[Fingerprint::SHA256_LENGTH];
+      Input digest;
+      Result rv;
+      if (useFingerprints) {
+        EXPECT_TRUE(certID.issuerSubjectPublicKeyInfoFingerprint);
+        rv = certID.issuerSubjectPublicKeyInfoFingerprint->GetSHA256(*this,
+                                                                     digest);
+      } else {
+        rv = DigestBuf(certID.issuerSubjectPublicKeyInfo,
+                       DigestAlgorithm::sha256, digestBuf, sizeof digestBuf);
+        if (rv == Success) {
+          rv = digest.Init(digestBuf, sizeof digestBuf);
+        }
+      }
+      if (rv != Success) {
+        return rv;
+      }
+      if (InputEqualsByteString(digest, revokedIssuerKeyDigest)) {
+        return Result::ERROR_REVOKED_CERTIFICATE;
+      }
+    }
+    return Success;
+  }
+
+  Result IsChainValid(const DERArray&, Time) override
+  {
+    return Success;
+  }
+
+  Result DigestBuf(Input item, DigestAlgorithm digestAlg,
+                   /*out*/ uint8_t* digestBuf, size_t digestBufLen) override
+  {
+    ++digestCount;
+    return TestDigestBuf(item, digestAlg, digestBuf, digestBufLen);
+  }
+
+  const bool useFingerprints;
+  size_t digestCount;
+  ByteString rootDER;
+  ByteString revokedIssuerKeyDigest;
+  std::map<ByteString, ByteString> subjectDERToCertDER;
+};
+
+} // unnamed namespace
+
+class pkixcert_Fingerprint : public ::testing::Test
+{
+protected:
+  // Adds the chain Root <- CA1 <- CA2 <- CA3 to trustDomain and returns an
+  // end-entity certificate issued by CA3.
+  static void CreateChain(FingerprintTrustDomain& trustDomain,
+                          /*out*/ ByteString& eeDER)
+  {
+    static const char* const NAMES[] = { "Root", "CA1", "CA2", "CA3" };
+    static const size_t NAME_COUNT = MOZILLA_PKIX_ARRAY_LENGTH(NAMES);
+
+    for (size_t i = 0; i < NAME_COUNT; ++i) {
+      ByteString certDER(CreateCert(NAMES[i == 0 ? 0 : i - 1], NAMES[i],
+                                    EndEntityOrCA::MustBeCA,
+                                    &trustDomain.subjectDERToCertDER));
+      ASSERT_FALSE(ENCODING_FAILED(certDER));
+      if (i == 0) {
+        trustDomain.rootDER = certDER;
+      }
+    }
+    eeDER = CreateCert(NAMES[NAME_COUNT - 1], "EE",
+                       EndEntityOrCA::MustBeEndEntity);
+    ASSERT_FALSE(ENCODING_FAILED(eeDER));
+  }
+
+  static Result BuildChain(FingerprintTrustDomain& trustDomain, Input ee)
+  {
+    return BuildCertChain(trustDomain, ee, Now(),
+                          EndEntityOrCA::MustBeEndEntity,
+                          KeyUsage::noParticularKeyUsageRequired,
+                          KeyPurposeId::anyExtendedKeyUsage,
+                          CertPolicyId::anyPolicy,
+                          nullptr/*stapledOCSPResponse*/);
+  }
+
+  // One digest for each of the 4 signatures, plus the issuers' key digests
+  // for revocation checking.
+  static size_t ExpectedDigestsPerBuild(bool useFingerprints)
+  {
+    return useFingerprints ? 4u + 4u : 4u + 2u * 4u;
+  }
+};
+
+TEST_F(pkixcert_Fingerprint, FastHash)
+{
+  static const uint8_t DATA[] = {
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 0, 0
+  };
+  static const uint8_t DATA_COPY[] = {
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 0, 0
+  };
+
+  // Every prefix hashes differently, including those that differ only by
+  // trailing zeros, and equal data at different addresses hashes the same.
+  uint64_t hashes[sizeof DATA];
+  for (size_t length = 1; length <= sizeof DATA; ++length) {
+    Input input;
+    ASSERT_EQ(Success, input.Init(DATA, length));
+    Fingerprint fingerprint(input);
+    hashes[length - 1] = fingerprint.GetFastHash();
+    ASSERT_EQ(hashes[length - 1], fingerprint.GetFastHash());
+
+    Input copy;
+    ASSERT_EQ(Success, copy.Init(DATA_COPY, length));
+    Fingerprint copyFingerprint(copy);
+    ASSERT_EQ(hashes[length - 1], copyFingerprint.GetFastHash());
+
+    for (size_t i = 0; i < length - 1; ++i) {
+      ASSERT_NE(hashes[i], hashes[length - 1]);
+    }
+  }
+}
+
+TEST_F(pkixcert_Fingerprint, SHA256ComputedOnce)
+{
+  static const uint8_t DATA[] = { 'a', 'b', 'c' };
+  Input input(DATA);
+  Fingerprint fingerprint(input);
+  FingerprintTrustDomain trustDomain(true);
+
+  Input sha256;
+  ASSERT_EQ(Success, fingerprint.GetSHA256(trustDomain, sha256));
+  ASSERT_EQ(1u, trustDomain.digestCount);
+  uint8_t expected[Fingerprint::SHA256_LENGTH];
+  ASSERT_EQ(Success, TestDigestBuf(input, DigestAlgorithm::sha256, expected,
+                                   sizeof expected));
+  ASSERT_TRUE(InputEqualsByteString(sha256,
+                                    ByteString(expected, sizeof expected)));
+
+  Input sha256Again;
+  ASSERT_EQ(Success, fingerprint.GetSHA256(trustDomain, sha256Again));
+  ASSERT_EQ(1u, trustDomain.digestCount);
+  ASSERT_TRUE(InputsAreEqual(sha256, sha256Again));
+}
+
+TEST_F(pkixcert_Fingerprint, BackCert)
+{
+  ByteString certDER(CreateCert("Issuer", "Subject",
+                                EndEntityOrCA::MustBeEndEntity));
+  Input certInput;
+  ASSERT_EQ(Success, certInput.Init(certDER.data(), certDER.length()));
+  BackCert cert(certInput, EndEntityOrCA::MustBeEndEntity, nullptr);
+  ASSERT_EQ(Success, cert.Init());
+
+  // A Fingerprint copies its Input, so it can be made from a temporary.
+  Fingerprint subjectFingerprint(cert.GetSubject());
+  ASSERT_EQ(subjectFingerprint.GetFastHash(), cert.GetSubjectFastHash());
+  Fingerprint spkiFingerprint(cert.GetSubjectPublicKeyInfo());
+  ASSERT_EQ(spkiFingerprint.GetFastHash(),
+            cert.GetSubjectPublicKeyInfoFastHash());
+}
+
+TEST_F(pkixcert_Fingerprint, StapledOCSPCacheKey)
+{
+  static const uint8_t RESPONSE[] = { 0x30, 0x00 };
+  ByteString issuerDER(CNToDERName("Issuer"));
+  ByteString certDER(CreateCert("Issuer", "Subject",
+                                EndEntityOrCA::MustBeEndEntity));
+  Input certInput;
+  ASSERT_EQ(Success, certInput.Init(certDER.data(), certDER.length()));
+  BackCert cert(certInput, EndEntityOrCA::MustBeEndEntity, nullptr);
+  ASSERT_EQ(Success, cert.Init());
+  Input issuer;
+  ASSERT_EQ(Success, issuer.Init(issuerDER.data(), issuerDER.length()));
+
+  FingerprintTrustDomain trustDomain(true);
+  Fingerprint spkiFingerprint(cert.GetSubjectPublicKeyInfo());
+  CertID certID(issuer, cert.GetSubjectPublicKeyInfo(),
+                cert.GetSerialNumber(), &spkiFingerprint);
+  StapledOCSPCache::Key key;
+  ASSERT_EQ(Success, key.Init(trustDomain, certID, 10, Input(RESPONSE)));
+  ASSERT_EQ(4u, trustDomain.digestCount);
+
+  // The issuer's key is only digested once for both caches.
+  OCSPSignerCache::Key signerKey;
+  ASSERT_EQ(Success, signerKey.Init(trustDomain, certInput, certID));
+  ASSERT_EQ(5u, trustDomain.digestCount);
+  StapledOCSPCache::Key key2;
+  ASSERT_EQ(Success, key2.Init(trustDomain, certID, 10, Input(RESPONSE)));
+  ASSERT_EQ(8u, trustDomain.digestCount);
+}
+
+TEST_F(pkixcert_Fingerprint, BuildCertChainDigestCount)
+{
+  for (bool useFingerprints : { false, true }) {
+    FingerprintTrustDomain trustDomain(useFingerprints);
+    ByteString eeDER;
+    ASSERT_NO_FATAL_FAILURE(CreateChain(trustDomain, eeDER));
+    Input ee;
+    ASSERT_EQ(Success, ee.Init(eeDER.data(), eeDER.length()));
+
+    trustDomain.digestCount = 0;
+    ASSERT_EQ(Success, BuildChain(trustDomain, ee));
+    ASSERT_EQ(ExpectedDigestsPerBuild(useFingerprints),
+              trustDomain.digestCount);
+  }
+}
+
+TEST_F(pkixcert_Fingerprint, DISABLED_Benchmark_BuildCertChainDigestCount)
+{
+  for (bool useFingerprints : { false, true }) {
+    FingerprintTrustDomain trustDomain(useFingerprints);
+    ByteString eeDER;
+    ASSERT_NO_FATAL_FAILURE(CreateChain(trustDomain, eeDER));
+    Input ee;
+    ASSERT_EQ(Success, ee.Init(eeDER.data(), eeDER.length()));
+
+    static const size_t ITERATIONS = 1000;
+    trustDomain.digestCount = 0;
+    std::string name(std::string("BuildCertChain, 5 certificates, ") +
+                     (useFingerprints ? "with" : "without") +
+                     " fingerprints");
+    Benchmark(name.c_str(), ITERATIONS, [&]() {
+      ASSERT_EQ(Success, BuildChain(trustDomain, ee));
+    });
+    size_t digestsPerBuild = trustDomain.digestCount / ITERATIONS;
+    ASSERT_EQ(ExpectedDigestsPerBuild(useFingerprints), digestsPerBuild);
+    std::printf("[ BENCHMARK] %s: %zu DigestBuf calls/BuildCertChain\n",
+                name.c_str(), digestsPerBuild);
+  }
+}
@@ -0,0 +1,197 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <string>
+
+#include "pkix/pkix.h"
+#include "pkixder.h"
+#include "pkixgtest.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+class pkixcert_ReadReceivedCerts : public ::testing::Test
+{
+public:
+  static void SetUpTestCase()
+  {
+    ScopedTestKeyPair key(CloneReusedKeyPair());
+    ASSERT_TRUE(key.get());
+    for (size_t i = 0; i < MOZILLA_PKIX_ARRAY_LENGTH(certs); ++i) {
+      ByteString serialNumber(
+        CreateEncodedSerialNumber(static_cast<long>(i + 1)));
+      ASSERT_FALSE(ENCODING_FAILED(serialNumber));
+      certs[i] = CreateEncodedCertificate(
+                   v3, sha256WithRSAEncryption(), serialNumber,
+                   CNToDERName("Issuer"), oneDayBeforeNow, oneDayAfterNow,
+                   CNToDERName("Subject"), *key, nullptr, *key,
+                   sha256WithRSAEncryption());
+      ASSERT_FALSE(ENCODING_FAILED(certs[i]));
+      chain.append(certs[i]);
+    }
+  }
+
+  static void TearDownTestCase()
+  {
+    for (size_t i = 0; i < MOZILLA_PKIX_ARRAY_LENGTH(certs); ++i) {
+      certs[i].clear();
+    }
+    chain.clear();
+  }
+
+protected:
+  // Passes data to ReadReceivedCerts fragmentLength bytes at a time, the way
+  // it would be received, and checks that the certificates are read as soon
+  // as they are complete.
+  static void ReadInFragments(const ByteString& data, size_t fragmentLength,
+                              /*out*/ ByteString& unconsumed,
+                              /*out*/ size_t& certCount)
+  {
+    certCount = 0;
+    unconsumed.clear();
+    size_t received = 0;
+    while (received < data.length()) {
+      size_t fragment = std::min(fragmentLength, data.length() - received);
+      unconsumed.append(data, received, fragment);
+      received += fragment;
+
+      Input input;
+      ASSERT_EQ(Success, input.Init(unconsumed.data(), unconsumed.length()));
+      Input read[MOZILLA_PKIX_ARRAY_LENGTH(certs)];
+      size_t readCount;
+      size_t consumed;
+      ASSERT_EQ(Success, ReadReceivedCerts(input, read,
+                                           MOZILLA_PKIX_ARRAY_LENGTH(read),
+                                           readCount, consumed));
+      size_t expectedConsumed = 0;
+      for (size_t i = 0; i < readCount; ++i) {
+        ASSERT_LT(certCount, MOZILLA_PKIX_ARRAY_LENGTH(certs));
+        ASSERT_TRUE(InputEqualsByteString(read[i], certs[certCount]));
+        expectedConsumed += certs[certCount].length();
+        ++certCount;
+      }
+      ASSERT_EQ(expectedConsumed, consumed);
+      unconsumed.erase(0, consumed);
+      // A certificate is read as soon as all of it has been received.
+      if (certCount < MOZILLA_PKIX_ARRAY_LENGTH(certs)) {
+        ASSERT_LT(unconsumed.length(), certs[certCount].length());
+      }
+    }
+  }
+
+  static ByteString certs[3];
+  static ByteString chain;
+};
+
+/*static*/ ByteString pkixcert_ReadReceivedCerts::certs[3];
+/*static*/ ByteString pkixcert_ReadReceivedCerts::chain;
+
+TEST_F(pkixcert_ReadReceivedCerts, Empty)
+{
+  Input read[1];
+  size_t readCount = 1;
+  size_t consumed = 1;
+  ASSERT_EQ(Success, ReadReceivedCerts(Input(), read, 1, readCount, consumed));
+  ASSERT_EQ(0u, readCount);
+  ASSERT_EQ(0u, consumed);
+}
+
+TEST_F(pkixcert_ReadReceivedCerts, Fragments)
+{
+  for (size_t fragmentLength : { 1u, 2u, 7u, 100u, 1400u, 65535u }) {
+    ByteString unconsumed;
+    size_t certCount;
+    ASSERT_NO_FATAL_FAILURE(
+      ReadInFragments(chain, fragmentLength, unconsumed, certCount));
+    ASSERT_EQ(MOZILLA_PKIX_ARRAY_LENGTH(certs), certCount);
+    ASSERT_EQ(0u, unconsumed.length());
+  }
+}
+
+TEST_F(pkixcert_ReadReceivedCerts, Truncated)
+{
+  ByteString truncated(chain, 0, chain.length() - 1);
+  ByteString unconsumed;
+  size_t certCount;
+  ASSERT_NO_FATAL_FAILURE(ReadInFragments(truncated, 100, unconsumed,
+                                          certCount));
+  ASSERT_EQ(MOZILLA_PKIX_ARRAY_LENGTH(certs) - 1, certCount);
+  ASSERT_EQ(certs[2].length() - 1, unconsumed.length());
+}
+
+TEST_F(pkixcert_ReadReceivedCerts, MaxCerts)
+{
+  Input input;
+  ASSERT_EQ(Success, input.Init(chain.data(), chain.length()));
+  Input read[2];
+  size_t readCount;
+  size_t consumed;
+  ASSERT_EQ(Success, ReadReceivedCerts(input, read, 2, readCount, consumed));
+  ASSERT_EQ(2u, readCount);
+  ASSERT_EQ(certs[0].length() + certs[1].length(), consumed);
+
+  Input none[1];
+  ASSERT_EQ(Success, ReadReceivedCerts(input, none, 0, readCount, consumed));
+  ASSERT_EQ(0u, readCount);
+  ASSERT_EQ(0u, consumed);
+}
+
+TEST_F(pkixcert_ReadReceivedCerts, Malformed)
+{
+  // A certificate that has been received completely is rejected as soon as it
+  // has arrived, even though the certificate after it is incomplete.
+  ByteString data(certs[0]);
+  data[4] = der::SET; // Replace the TBSCertificate's SEQUENCE tag.
+  data.append(certs[1], 0, 10);
+  Input input;
+  ASSERT_EQ(Success, input.Init(data.data(), data.length()));
+  Input read[2];
+  size_t readCount;
+  size_t consumed;
+  ASSERT_EQ(Result::ERROR_BAD_DER,
+            ReadReceivedCerts(input, read, 2, readCount, consumed));
+
+  // Something that isn't a SEQUENCE is rejected as soon as its tag arrives.
+  static const uint8_t NOT_A_SEQUENCE[] = { 0x31 };
+  Input notASequence[1];
+  ASSERT_EQ(Result::ERROR_BAD_DER,
+            ReadReceivedCerts(Input(NOT_A_SEQUENCE), notASequence, 1,
+                              readCount, consumed));
+}
+
+TEST_F(pkixcert_ReadReceivedCerts, DISABLED_Benchmark_ReadReceivedCerts)
+{
+  for (size_t fragmentLength : { 65535u, 1400u }) {
+    std::string name("ReadReceivedCerts, 3 certificates in " +
+                     std::to_string(fragmentLength) + "-byte fragments");
+    Benchmark(name.c_str(), 10000, [&]() {
+      ByteString unconsumed;
+      size_t certCount;
+      ReadInFragments(chain, fragmentLength, unconsumed, certCount);
+      ASSERT_EQ(MOZILLA_PKIX_ARRAY_LENGTH(certs), certCount);
+    });
+  }
+}
@@ -22,8 +22,11 @@
  * limitations under the License.
  */
 
+#include <vector>
+
 #include "pkixder.h"
 #include "pkixgtest.h"
+#include "pkixutil.h"
 
 using namespace mozilla::pkix;
 using namespace mozilla::pkix::test;
@@ -274,3 +277,283 @@ TEST_F(pkixcert_extension, DuplicateSubjectAltName)
                            CertPolicyId::anyPolicy,
                            nullptr/*stapledOCSPResponse*/));
 }
+
+// The OIDs of the extensions that BackCert understands, in the form of the
+// if/else chain that identified them before it was replaced with a switch.
+// Critical id-pkix-ocsp-nocheck and Netscape-certificate-type extensions are
+// understood, but non-critical ones are ignored.
+static bool
+IsUnderstoodExtension(const ByteString& oid, bool critical)
+{
+  static const uint8_t id_ce_keyUsage[] = { 0x55, 0x1d, 0x0f };
+  static const uint8_t id_ce_subjectAltName[] = { 0x55, 0x1d, 0x11 };
+  static const uint8_t id_ce_basicConstraints[] = { 0x55, 0x1d, 0x13 };
+  static const uint8_t id_ce_nameConstraints[] = { 0x55, 0x1d, 0x1e };
+  static const uint8_t id_ce_certificatePolicies[] = { 0x55, 0x1d, 0x20 };
+  static const uint8_t id_ce_policyConstraints[] = { 0x55, 0x1d, 0x24 };
+  static const uint8_t id_ce_extKeyUsage[] = { 0x55, 0x1d, 0x25 };
+  static const uint8_t id_ce_inhibitAnyPolicy[] = { 0x55, 0x1d, 0x36 };
+  static const uint8_t id_pe_authorityInfoAccess[] = {
+    0x2b, 0x06, 0x01, 0x05, 0x05, 0x07, 0x01, 0x01
+  };
+  static const uint8_t id_pkix_ocsp_nocheck[] = {
+    0x2b, 0x06, 0x01, 0x05, 0x05, 0x07, 0x30, 0x01, 0x05
+  };
+  static const uint8_t Netscape_certificate_type[] = {
+    0x60, 0x86, 0x48, 0x01, 0x86, 0xf8, 0x42, 0x01, 0x01
+  };
+
+  return oid == BytesToByteString(id_ce_keyUsage) ||
+         oid == BytesToByteString(id_ce_subjectAltName) ||
+         oid == BytesToByteString(id_ce_basicConstraints) ||
+         oid == BytesToByteString(id_ce_nameConstraints) ||
+         oid == BytesToByteString(id_ce_certificatePolicies) ||
+         oid == BytesToByteString(id_ce_policyConstraints) ||
+         oid == BytesToByteString(id_ce_extKeyUsage) ||
+         oid == BytesToByteString(id_ce_inhibitAnyPolicy) ||
+         oid == BytesToByteString(id_pe_authorityInfoAccess) ||
+         (critical && oid == BytesToByteString(id_pkix_ocsp_nocheck)) ||
+         (critical && oid == BytesToByteString(Netscape_certificate_type));
+}
+
+static ByteString
+Extension(const ByteString& oid, bool critical, const ByteString& value)
+{
+  return TLV(der::SEQUENCE,
+             TLV(der::OIDTag, oid) +
+             (critical ? Boolean(true) : ByteString()) +
+             TLV(der::OCTET_STRING, value));
+}
+
+// Every certificate in ExtensionOIDs has these, so that a critical
+// Netscape-certificate-type extension is accepted.
+static ByteString
+BasicConstraintsExtension()
+{
+  static const uint8_t id_ce_basicConstraints[] = { 0x55, 0x1d, 0x13 };
+  return Extension(BytesToByteString(id_ce_basicConstraints), true,
+                   TLV(der::SEQUENCE, ByteString()));
+}
+
+static ByteString
+ExtKeyUsageExtension()
+{
+  // python DottedOIDToCode.py --tlv id-kp-serverAuth 1.3.6.1.5.5.7.3.1
+  static const uint8_t tlv_id_kp_serverAuth[] = {
+    0x06, 0x08, 0x2b, 0x06, 0x01, 0x05, 0x05, 0x07, 0x03, 0x01
+  };
+  static const uint8_t id_ce_extKeyUsage[] = { 0x55, 0x1d, 0x25 };
+  return Extension(BytesToByteString(id_ce_extKeyUsage), false,
+                   TLV(der::SEQUENCE,
+                       BytesToByteString(tlv_id_kp_serverAuth)));
+}
+
+// Checks that BackCert identifies every id-ce extension, and every OID that
+// differs from one of the other known OIDs in a single byte or in its length,
+// the same way as the if/else chain in IsUnderstoodExtension does.
+TEST_F(pkixcert_extension, ExtensionOIDs)
+{
+  static const uint8_t LONG_OIDS[][9] = {
+    // id-pe-authorityInfoAccess, with a trailing zero byte.
+    { 0x2b, 0x06, 0x01, 0x05, 0x05, 0x07, 0x01, 0x01, 0x00 },
+    // id-pkix-ocsp-nocheck
+    { 0x2b, 0x06, 0x01, 0x05, 0x05, 0x07, 0x30, 0x01, 0x05 },
+    // Netscape-certificate-type
+    { 0x60, 0x86, 0x48, 0x01, 0x86, 0xf8, 0x42, 0x01, 0x01 },
+  };
+
+  std::vector<ByteString> oids;
+  for (unsigned int lastArc = 0; lastArc <= 0xff; ++lastArc) {
+    const uint8_t id_ce[] = { 0x55, 0x1d, static_cast<uint8_t>(lastArc) };
+    oids.push_back(BytesToByteString(id_ce));
+  }
+  for (const auto& longOID : LONG_OIDS) {
+    ByteString oid(BytesToByteString(longOID));
+    for (size_t length = 1; length <= oid.length(); ++length) {
+      oids.push_back(oid.substr(0, length));
+    }
+    for (size_t i = 0; i < oid.length(); ++i) {
+      ByteString changed(oid);
+      changed[i] ^= 0x01;
+      oids.push_back(changed);
+    }
+  }
+
+  ScopedTestKeyPair key(CloneReusedKeyPair());
+  ASSERT_TRUE(key.get());
+  for (const ByteString& oid : oids) {
+    for (bool critical : { false, true }) {
+      // The value doesn't matter, as long as it isn't empty.
+      const ByteString extensions[] = {
+        BasicConstraintsExtension(),
+        ExtKeyUsageExtension(),
+        Extension(oid, critical, TLV(der::NULLTag, ByteString())),
+        ByteString()
+      };
+      ByteString cert(CreateEncodedCertificate(
+                        v3, sha256WithRSAEncryption(),
+                        CreateEncodedSerialNumber(1), CNToDERName("Issuer"),
+                        oneDayBeforeNow, oneDayAfterNow,
+                        CNToDERName("Subject"), *key, extensions, *key,
+                        sha256WithRSAEncryption()));
+      ASSERT_FALSE(ENCODING_FAILED(cert));
+      Input certInput;
+      ASSERT_EQ(Success, certInput.Init(cert.data(), cert.length()));
+      BackCert backCert(certInput, EndEntityOrCA::MustBeEndEntity, nullptr);
+
+      static const uint8_t id_ce_basicConstraints[] = { 0x55, 0x1d, 0x13 };
+      static const uint8_t id_ce_extKeyUsage[] = { 0x55, 0x1d, 0x25 };
+      Result expectedResult;
+      if (oid == BytesToByteString(id_ce_basicConstraints) ||
+          oid == BytesToByteString(id_ce_extKeyUsage)) {
+        expectedResult = Result::ERROR_EXTENSION_VALUE_INVALID; // duplicate
+      } else if (critical && !IsUnderstoodExtension(oid, critical)) {
+        expectedResult = Result::ERROR_UNKNOWN_CRITICAL_EXTENSION;
+      } else {
+        expectedResult = Success;
+      }
+      ASSERT_EQ(expectedResult, backCert.Init());
+    }
+  }
+}
+
+// Returns a certificate with the extensions typical of a current TLS server
+// certificate, five of which BackCert doesn't understand.
+static ByteString
+CreateTypicalTLSServerCert()
+{
+  static const uint8_t id_ce_subjectKeyIdentifier[] = { 0x55, 0x1d, 0x0e };
+  static const uint8_t id_ce_keyUsage[] = { 0x55, 0x1d, 0x0f };
+  static const uint8_t id_ce_subjectAltName[] = { 0x55, 0x1d, 0x11 };
+  static const uint8_t id_ce_cRLDistributionPoints[] = { 0x55, 0x1d, 0x1f };
+  static const uint8_t id_ce_certificatePolicies[] = { 0x55, 0x1d, 0x20 };
+  static const uint8_t id_ce_authorityKeyIdentifier[] = { 0x55, 0x1d, 0x23 };
+  static const uint8_t id_pe_authorityInfoAccess[] = {
+    0x2b, 0x06, 0x01, 0x05, 0x05, 0x07, 0x01, 0x01
+  };
+  // python DottedOIDToCode.py id-pe-signedCertificateTimestampList 1.3.6.1.4.1.11129.2.4.2
+  static const uint8_t id_pe_signedCertificateTimestampList[] = {
+    0x2b, 0x06, 0x01, 0x04, 0x01, 0xd6, 0x79, 0x02, 0x04, 0x02
+  };
+  // python DottedOIDToCode.py id-pe-tlsfeature 1.3.6.1.5.5.7.1.24
+  static const uint8_t id_pe_tlsfeature[] = {
+    0x2b, 0x06, 0x01, 0x05, 0x05, 0x07, 0x01, 0x18
+  };
+
+  const ByteString value(TLV(der::OCTET_STRING, ByteString(20, 0x11)));
+  const ByteString extensions[] = {
+    Extension(BytesToByteString(id_ce_authorityKeyIdentifier), false, value),
+    Extension(BytesToByteString(id_ce_subjectKeyIdentifier), false, value),
+    Extension(BytesToByteString(id_ce_keyUsage), true, value),
+    ExtKeyUsageExtension(),
+    BasicConstraintsExtension(),
+    Extension(BytesToByteString(id_ce_subjectAltName), false, value),
+    Extension(BytesToByteString(id_ce_certificatePolicies), false, value),
+    Extension(BytesToByteString(id_ce_cRLDistributionPoints), false, value),
+    Extension(BytesToByteString(id_pe_authorityInfoAccess), false, value),
+    Extension(BytesToByteString(id_pe_tlsfeature), false, value),
+    Extension(BytesToByteString(id_pe_signedCertificateTimestampList), false,
+              value),
+    ByteString()
+  };
+  return CreateCertWithExtensions("www.example.com", extensions);
+}
+
+TEST_F(pkixcert_extension, TypicalTLSServerCert)
+{
+  ByteString cert(CreateTypicalTLSServerCert());
+  ASSERT_FALSE(ENCODING_FAILED(cert));
+  Input certInput;
+  ASSERT_EQ(Success, certInput.Init(cert.data(), cert.length()));
+  BackCert backCert(certInput, EndEntityOrCA::MustBeEndEntity, nullptr);
+  ASSERT_EQ(Success, backCert.Init());
+  ASSERT_TRUE(backCert.GetSubjectAltName());
+  ASSERT_TRUE(backCert.GetExtKeyUsage());
+  ASSERT_TRUE(backCert.GetBasicConstraints());
+}
+
+TEST_F(pkixcert_extension, DISABLED_Benchmark_BackCertInit)
+{
+  ByteString cert(CreateTypicalTLSServerCert());
+  ASSERT_FALSE(ENCODING_FAILED(cert));
+  Input certInput;
+  ASSERT_EQ(Success, certInput.Init(cert.data(), cert.length()));
+
+  Benchmark("BackCert::Init", 200000, [&certInput]() {
+    BackCert backCert(certInput, EndEntityOrCA::MustBeEndEntity, nullptr);
+    ASSERT_EQ(Success, backCert.Init());
+    ASSERT_TRUE(backCert.GetSubjectAltName());
+  });
+}
+
+// Returns cert with extra added to the end of its TBSCertificate. The
+// signature is not updated, which doesn't matter to BackCert.
+static ByteString
+AppendToTBSCertificate(const ByteString& cert, const ByteString& extra)
+{
+  Input certInput;
+  EXPECT_EQ(Success, certInput.Init(cert.data(), cert.length()));
+  Reader certificate;
+  EXPECT_EQ(Success, der::ExpectTagAndGetValueAtEnd(certInput, der::SEQUENCE,
+                                                    certificate));
+  Input tbsCertificate;
+  EXPECT_EQ(Success, der::ExpectTagAndGetValue(certificate, der::SEQUENCE,
+                                               tbsCertificate));
+  Input rest;
+  EXPECT_EQ(Success, certificate.SkipToEnd(rest));
+  return TLV(der::SEQUENCE,
+             TLV(der::SEQUENCE, InputToByteString(tbsCertificate) + extra) +
+             InputToByteString(rest));
+}
+
+struct InitWithoutExtensionsTestcase
+{
+  bool duplicateExtension;
+  bool trailingData;
+  Result expectedInitWithoutExtensionsResult;
+  Result expectedInitResult;
+};
+
+static const InitWithoutExtensionsTestcase INIT_WITHOUT_EXTENSIONS_TESTCASES[] =
+{
+  { false, false, Success, Success },
+  { true, false, Success, Result::ERROR_EXTENSION_VALUE_INVALID },
+  { false, true, Result::ERROR_BAD_DER, Result::ERROR_BAD_DER },
+  // The error in the extensions takes precedence, as in Init.
+  { true, true, Result::ERROR_EXTENSION_VALUE_INVALID,
+    Result::ERROR_EXTENSION_VALUE_INVALID },
+};
+
+TEST_F(pkixcert_extension, InitWithoutExtensions)
+{
+  const ByteString extension(ExtKeyUsageExtension());
+  for (const InitWithoutExtensionsTestcase& testcase :
+         INIT_WITHOUT_EXTENSIONS_TESTCASES) {
+    const ByteString extensions[] = {
+      extension,
+      testcase.duplicateExtension ? extension : ByteString(),
+      ByteString()
+    };
+    ByteString cert(CreateCertWithExtensions("InitWithoutExtensions",
+                                             extensions));
+    ASSERT_FALSE(ENCODING_FAILED(cert));
+    if (testcase.trailingData) {
+      cert = AppendToTBSCertificate(cert, TLV(der::NULLTag, ByteString()));
+    }
+    Input certInput;
+    ASSERT_EQ(Success, certInput.Init(cert.data(), cert.length()));
+
+    BackCert backCert(certInput, EndEntityOrCA::MustBeEndEntity, nullptr);
+    ASSERT_EQ(testcase.expectedInitWithoutExtensionsResult,
+              backCert.InitWithoutExtensions());
+    if (testcase.expectedInitWithoutExtensionsResult == Success) {
+      ASSERT_EQ(testcase.expectedInitResult, backCert.InitExtensions());
+    }
+    if (testcase.expectedInitResult == Success) {
+      ASSERT_TRUE(backCert.GetExtKeyUsage());
+    }
+
+    BackCert backCert2(certInput, EndEntityOrCA::MustBeEndEntity, nullptr);
+    ASSERT_EQ(testcase.expectedInitResult, backCert2.Init());
+  }
+}
@@ -0,0 +1,180 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pkixder.h"
+#include "pkixgtest.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace mozilla { namespace pkix {
+
+extern Result CheckExtendedKeyUsage(EndEntityOrCA endEntityOrCA,
+                                    const Input* encodedExtendedKeyUsage,
+                                    KeyPurposeId requiredEKU);
+
+} } // namespace mozilla::pkix
+
+namespace {
+
+class pkixcheck_CheckExtendedKeyUsage : public ::testing::Test { };
+
+// The value of the last arc of each id-kp OID is the same as the
+// corresponding KeyPurposeId.
+ByteString
+KP(KeyPurposeId purpose)
+{
+  static const uint8_t id_kp[] = { 0x2b, 0x06, 0x01, 0x05, 0x05, 0x07, 0x03 };
+  ByteString value(id_kp, sizeof(id_kp));
+  value.push_back(static_cast<uint8_t>(purpose));
+  return TLV(der::OIDTag, value);
+}
+
+ByteString
+NetscapeStepUp()
+{
+  static const uint8_t id_Netscape_stepUp[] = {
+    0x60, 0x86, 0x48, 0x01, 0x86, 0xf8, 0x42, 0x04, 0x01
+  };
+  return TLV(der::OIDTag, ByteString(id_Netscape_stepUp,
+                                     sizeof(id_Netscape_stepUp)));
+}
+
+// id-kp 10, which we don't know about.
+ByteString
+UnknownKP()
+{
+  static const uint8_t unknown[] = {
+    0x2b, 0x06, 0x01, 0x05, 0x05, 0x07, 0x03, 0x0a
+  };
+  return TLV(der::OIDTag, ByteString(unknown, sizeof(unknown)));
+}
+
+Result
+Check(EndEntityOrCA endEntityOrCA, const ByteString& oids,
+      KeyPurposeId requiredEKU)
+{
+  ByteString encoded(TLV(der::SEQUENCE, oids));
+  Input input;
+  Result rv = input.Init(encoded.data(), encoded.length());
+  if (rv != Success) {
+    return rv;
+  }
+  return CheckExtendedKeyUsage(endEntityOrCA, &input, requiredEKU);
+}
+
+const EndEntityOrCA EE = EndEntityOrCA::MustBeEndEntity;
+const EndEntityOrCA CA = EndEntityOrCA::MustBeCA;
+
+TEST_F(pkixcheck_CheckExtendedKeyUsage, Match)
+{
+  ByteString all(KP(KeyPurposeId::id_kp_serverAuth) +
+                 KP(KeyPurposeId::id_kp_clientAuth) +
+                 KP(KeyPurposeId::id_kp_codeSigning) +
+                 KP(KeyPurposeId::id_kp_emailProtection));
+  ASSERT_EQ(Success, Check(EE, all, KeyPurposeId::id_kp_serverAuth));
+  ASSERT_EQ(Success, Check(EE, all, KeyPurposeId::id_kp_clientAuth));
+  ASSERT_EQ(Success, Check(EE, all, KeyPurposeId::id_kp_codeSigning));
+  ASSERT_EQ(Success, Check(EE, all, KeyPurposeId::id_kp_emailProtection));
+  ASSERT_EQ(Success, Check(EE, all, KeyPurposeId::anyExtendedKeyUsage));
+  ASSERT_EQ(Result::ERROR_INADEQUATE_CERT_TYPE,
+            Check(EE, all, KeyPurposeId::id_kp_OCSPSigning));
+
+  ASSERT_EQ(Result::ERROR_INADEQUATE_CERT_TYPE,
+            Check(EE, UnknownKP(), KeyPurposeId::id_kp_serverAuth));
+  ASSERT_EQ(Success,
+            Check(EE, UnknownKP() + KP(KeyPurposeId::id_kp_serverAuth),
+                  KeyPurposeId::id_kp_serverAuth));
+}
+
+TEST_F(pkixcheck_CheckExtendedKeyUsage, NetscapeStepUp)
+{
+  ASSERT_EQ(Success,
+            Check(CA, NetscapeStepUp(), KeyPurposeId::id_kp_serverAuth));
+  ASSERT_EQ(Result::ERROR_INADEQUATE_CERT_TYPE,
+            Check(EE, NetscapeStepUp(), KeyPurposeId::id_kp_serverAuth));
+  ASSERT_EQ(Result::ERROR_INADEQUATE_CERT_TYPE,
+            Check(CA, NetscapeStepUp(), KeyPurposeId::id_kp_clientAuth));
+}
+
+TEST_F(pkixcheck_CheckExtendedKeyUsage, OCSPSigning)
+{
+  ByteString ocsp(KP(KeyPurposeId::id_kp_OCSPSigning));
+  ASSERT_EQ(Success, Check(EE, ocsp, KeyPurposeId::id_kp_OCSPSigning));
+  ASSERT_EQ(Success, Check(CA, ocsp, KeyPurposeId::id_kp_OCSPSigning));
+
+  // An end-entity certificate that asserts id-kp-OCSPSigning is rejected for
+  // anything else, even if it also has the required EKU.
+  ByteString both(KP(KeyPurposeId::id_kp_serverAuth) + ocsp);
+  ASSERT_EQ(Result::ERROR_INADEQUATE_CERT_TYPE,
+            Check(EE, both, KeyPurposeId::id_kp_serverAuth));
+  ASSERT_EQ(Success, Check(CA, both, KeyPurposeId::id_kp_serverAuth));
+  ASSERT_EQ(Result::ERROR_INADEQUATE_CERT_TYPE,
+            Check(EE, ocsp, KeyPurposeId::anyExtendedKeyUsage));
+}
+
+// A typical TLS server certificate's EKU extension, with an unknown EKU
+// added, checked for each of the usages a TLS client might require.
+void
+CheckTypicalTLSServerEKUs(Input input)
+{
+  ASSERT_EQ(Success, CheckExtendedKeyUsage(EE, &input,
+                                           KeyPurposeId::id_kp_serverAuth));
+  ASSERT_EQ(Success, CheckExtendedKeyUsage(EE, &input,
+                                           KeyPurposeId::id_kp_clientAuth));
+  ASSERT_EQ(Result::ERROR_INADEQUATE_CERT_TYPE,
+            CheckExtendedKeyUsage(EE, &input,
+                                  KeyPurposeId::id_kp_codeSigning));
+}
+
+ByteString
+TypicalTLSServerEKUs()
+{
+  return TLV(der::SEQUENCE,
+             KP(KeyPurposeId::id_kp_serverAuth) +
+             KP(KeyPurposeId::id_kp_clientAuth) +
+             UnknownKP());
+}
+
+TEST_F(pkixcheck_CheckExtendedKeyUsage, TypicalTLSServer)
+{
+  ByteString encoded(TypicalTLSServerEKUs());
+  Input input;
+  ASSERT_EQ(Success, input.Init(encoded.data(), encoded.length()));
+  CheckTypicalTLSServerEKUs(input);
+}
+
+TEST_F(pkixcheck_CheckExtendedKeyUsage,
+       DISABLED_Benchmark_CheckExtendedKeyUsage)
+{
+  ByteString encoded(TypicalTLSServerEKUs());
+  Input input;
+  ASSERT_EQ(Success, input.Init(encoded.data(), encoded.length()));
+
+  Benchmark("CheckExtendedKeyUsage", 200000, [&input]() {
+    CheckTypicalTLSServerEKUs(input);
+  });
+}
+
+} // unnamed namespace
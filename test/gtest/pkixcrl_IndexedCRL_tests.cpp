@@ -0,0 +1,495 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include "pkixgtest.h"
+#include "pkix/pkixnss.h"
+#include "pkixder.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+// A DigestStream that only supports digesting with a known algorithm, to
+// check that the TBSCertList isn't digested with every algorithm.
+class KnownAlgorithmDigestStream final : public DigestStream
+{
+public:
+  KnownAlgorithmDigestStream()
+    : begun(false)
+    , beginDigestAlg(DigestAlgorithm::sha1)
+  {
+  }
+
+  Result Begin() override
+  {
+    return Result::FATAL_ERROR_INVALID_STATE;
+  }
+
+  Result Begin(DigestAlgorithm digestAlg) override
+  {
+    begun = true;
+    beginDigestAlg = digestAlg;
+    return digest.Begin(digestAlg);
+  }
+
+  Result Update(Input data) override
+  {
+    return digest.Update(data);
+  }
+
+  Result Finish(DigestAlgorithm digestAlg, /*out*/ uint8_t* digestBuf,
+                size_t digestBufLen) override
+  {
+    return digest.Finish(digestAlg, digestBuf, digestBufLen);
+  }
+
+  bool begun;
+  DigestAlgorithm beginDigestAlg;
+
+private:
+  DigestStreamNSS digest;
+};
+
+} // unnamed namespace
+
+class pkixcrl_IndexedCRL : public ::testing::Test
+{
+public:
+  static void SetUpTestCase()
+  {
+    issuerKeyPair.reset(GenerateKeyPair());
+    if (!issuerKeyPair) {
+      abort();
+    }
+  }
+
+  void SetUp()
+  {
+    issuerNameDER = CNToDERName("CRL Issuer");
+    if (ENCODING_FAILED(issuerNameDER)) {
+      abort();
+    }
+  }
+
+  // Serial numbers that are all the same length, so that they are ordered
+  // numerically in the index.
+  static ByteString SerialNumber(uint32_t value)
+  {
+    ByteString serialNumberValue;
+    serialNumberValue.push_back(0x01);
+    serialNumberValue.push_back(static_cast<uint8_t>(value >> 24));
+    serialNumberValue.push_back(static_cast<uint8_t>(value >> 16));
+    serialNumberValue.push_back(static_cast<uint8_t>(value >> 8));
+    serialNumberValue.push_back(static_cast<uint8_t>(value));
+    return TLV(der::INTEGER, serialNumberValue);
+  }
+
+  ByteString CreateCRL(const ByteString& revokedCertificates,
+                       /*optional*/ const ByteString* extensions = nullptr,
+                       time_t thisUpdate = oneDayBeforeNow,
+                       time_t nextUpdate = oneDayAfterNow,
+                       long version = v2)
+  {
+    ByteString crl(CreateEncodedCRL(version, sha256WithRSAEncryption(),
+                                    issuerNameDER, thisUpdate, nextUpdate,
+                                    revokedCertificates, extensions,
+                                    *issuerKeyPair,
+                                    sha256WithRSAEncryption()));
+    EXPECT_FALSE(ENCODING_FAILED(crl));
+    return crl;
+  }
+
+  Result Init(IndexedCRL& indexedCRL, const ByteString& crl,
+              /*out*/ std::vector<uint32_t>& index,
+              /*optional*/ DigestStream* tbsCertListDigest = nullptr)
+  {
+    index.resize(IndexedCRL::MaxEntryCount(crl.length()));
+    Input issuerSubject;
+    EXPECT_EQ(Success, issuerSubject.Init(issuerNameDER.data(),
+                                          issuerNameDER.length()));
+    Input issuerSPKI;
+    EXPECT_EQ(Success,
+              issuerSPKI.Init(issuerKeyPair->subjectPublicKeyInfo.data(),
+                              issuerKeyPair->subjectPublicKeyInfo.length()));
+    return indexedCRL.Init(trustDomain,
+                           tbsCertListDigest ? *tbsCertListDigest : digest,
+                           crl.data(), crl.length(),
+                           issuerSubject, issuerSPKI, Now(),
+                           index.data(), index.size());
+  }
+
+  static Result IsRevoked(const IndexedCRL& indexedCRL,
+                          const ByteString& serialNumberTLV,
+                          /*out*/ bool& revoked)
+  {
+    // IsRevoked takes the value of the serial number, without the tag and
+    // length.
+    Input serialNumber;
+    EXPECT_EQ(Success, serialNumber.Init(serialNumberTLV.data() + 2,
+                                         serialNumberTLV.length() - 2));
+    return indexedCRL.IsRevoked(serialNumber, revoked);
+  }
+
+  static bool IsRevoked(const IndexedCRL& indexedCRL,
+                        const ByteString& serialNumberTLV)
+  {
+    bool revoked = false;
+    EXPECT_EQ(Success, IsRevoked(indexedCRL, serialNumberTLV, revoked));
+    return revoked;
+  }
+
+  // Multiplying by an odd number permutes the serial numbers so that they
+  // aren't already sorted.
+  static const uint32_t PERMUTATION = 2654435761u;
+
+  // A CRL with entryCount entries, which revokes the even serial numbers
+  // among i * PERMUTATION for i < entryCount.
+  ByteString CreatePermutedCRL(uint32_t entryCount)
+  {
+    ByteString revokedCertificates;
+    ByteString entry(CreateEncodedCRLEntry(SerialNumber(0), oneDayBeforeNow));
+    revokedCertificates.reserve(entry.length() * entryCount);
+    for (uint32_t i = 0; i < entryCount; ++i) {
+      ByteString serialNumber(SerialNumber((i * PERMUTATION) & ~1u));
+      entry.replace(2, serialNumber.length(), serialNumber);
+      revokedCertificates.append(entry);
+    }
+    return CreateCRL(revokedCertificates);
+  }
+
+  static void CheckPermutedSerialNumber(const IndexedCRL& indexedCRL,
+                                        uint32_t i)
+  {
+    uint32_t serialNumber = i * PERMUTATION;
+    uint8_t serialNumberValue[5] = {
+      0x01,
+      static_cast<uint8_t>(serialNumber >> 24),
+      static_cast<uint8_t>(serialNumber >> 16),
+      static_cast<uint8_t>(serialNumber >> 8),
+      static_cast<uint8_t>(serialNumber)
+    };
+    Input serialNumberInput(serialNumberValue);
+    bool revoked;
+    ASSERT_EQ(Success, indexedCRL.IsRevoked(serialNumberInput, revoked));
+    ASSERT_EQ((serialNumber & 1) == 0, revoked);
+  }
+
+  static ScopedTestKeyPair issuerKeyPair;
+  ByteString issuerNameDER;
+  DefaultCryptoTrustDomain trustDomain;
+  DigestStreamNSS digest;
+};
+
+/*static*/ ScopedTestKeyPair pkixcrl_IndexedCRL::issuerKeyPair;
+
+TEST_F(pkixcrl_IndexedCRL, Lookup)
+{
+  ByteString revokedCertificates;
+  // Out of order, to check that the index is sorted.
+  static const uint32_t REVOKED[] = { 9, 3, 7, 1, 5 };
+  for (uint32_t serialNumber : REVOKED) {
+    revokedCertificates.append(CreateEncodedCRLEntry(SerialNumber(serialNumber),
+                                                     oneDayBeforeNow));
+  }
+  // Serial numbers of different lengths.
+  revokedCertificates.append(CreateEncodedCRLEntry(CreateEncodedSerialNumber(2),
+                                                   oneDayBeforeNow));
+  ByteString crl(CreateCRL(revokedCertificates));
+
+  IndexedCRL indexedCRL;
+  std::vector<uint32_t> index;
+  ASSERT_EQ(Success, Init(indexedCRL, crl, index));
+  ASSERT_EQ(6u, indexedCRL.GetEntryCount());
+  ASSERT_EQ(TimeFromEpochInSeconds(static_cast<uint64_t>(oneDayBeforeNow)),
+            indexedCRL.GetThisUpdate());
+  ASSERT_EQ(TimeFromEpochInSeconds(static_cast<uint64_t>(oneDayAfterNow)),
+            indexedCRL.GetNextUpdate());
+
+  for (uint32_t i = 0; i <= 10; ++i) {
+    ASSERT_EQ(i % 2 == 1 && i < 10, IsRevoked(indexedCRL, SerialNumber(i)));
+  }
+  ASSERT_TRUE(IsRevoked(indexedCRL, CreateEncodedSerialNumber(2)));
+  ASSERT_FALSE(IsRevoked(indexedCRL, CreateEncodedSerialNumber(1)));
+  ASSERT_FALSE(IsRevoked(indexedCRL, CreateEncodedSerialNumber(9)));
+}
+
+TEST_F(pkixcrl_IndexedCRL, NotInitialized)
+{
+  IndexedCRL indexedCRL;
+  bool revoked;
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+            IsRevoked(indexedCRL, SerialNumber(1), revoked));
+}
+
+TEST_F(pkixcrl_IndexedCRL, NoRevokedCertificates)
+{
+  ByteString crl(CreateCRL(ByteString()));
+  IndexedCRL indexedCRL;
+  std::vector<uint32_t> index;
+  ASSERT_EQ(Success, Init(indexedCRL, crl, index));
+  ASSERT_EQ(0u, indexedCRL.GetEntryCount());
+  ASSERT_FALSE(IsRevoked(indexedCRL, SerialNumber(1)));
+}
+
+TEST_F(pkixcrl_IndexedCRL, BadSignature)
+{
+  ScopedTestKeyPair otherKeyPair(GenerateKeyPair());
+  ASSERT_TRUE(otherKeyPair.get());
+  ByteString crl(CreateEncodedCRL(v2, sha256WithRSAEncryption(),
+                                  issuerNameDER, oneDayBeforeNow,
+                                  oneDayAfterNow,
+                                  CreateEncodedCRLEntry(SerialNumber(1),
+                                                        oneDayBeforeNow),
+                                  nullptr, *otherKeyPair,
+                                  sha256WithRSAEncryption()));
+  ASSERT_FALSE(ENCODING_FAILED(crl));
+  IndexedCRL indexedCRL;
+  std::vector<uint32_t> index;
+  ASSERT_EQ(Result::ERROR_CRL_BAD_SIGNATURE, Init(indexedCRL, crl, index));
+  // A CRL that failed to initialize must not report certificates as good.
+  bool revoked;
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+            IsRevoked(indexedCRL, SerialNumber(1), revoked));
+}
+
+TEST_F(pkixcrl_IndexedCRL, DigestsWithSignatureAlgorithm)
+{
+  ByteString crl(CreateCRL(CreateEncodedCRLEntry(SerialNumber(1),
+                                                 oneDayBeforeNow)));
+  KnownAlgorithmDigestStream knownAlgorithmDigest;
+  IndexedCRL indexedCRL;
+  std::vector<uint32_t> index;
+  ASSERT_EQ(Success, Init(indexedCRL, crl, index, &knownAlgorithmDigest));
+  ASSERT_TRUE(knownAlgorithmDigest.begun);
+  ASSERT_EQ(DigestAlgorithm::sha256, knownAlgorithmDigest.beginDigestAlg);
+  ASSERT_TRUE(IsRevoked(indexedCRL, SerialNumber(1)));
+}
+
+TEST_F(pkixcrl_IndexedCRL, SignatureAlgorithmMismatch)
+{
+  ByteString crl(CreateEncodedCRL(v2, sha1WithRSAEncryption(),
+                                  issuerNameDER, oneDayBeforeNow,
+                                  oneDayAfterNow, ByteString(), nullptr,
+                                  *issuerKeyPair,
+                                  sha256WithRSAEncryption()));
+  ASSERT_FALSE(ENCODING_FAILED(crl));
+  IndexedCRL indexedCRL;
+  std::vector<uint32_t> index;
+  ASSERT_EQ(Result::ERROR_SIGNATURE_ALGORITHM_MISMATCH,
+            Init(indexedCRL, crl, index));
+}
+
+TEST_F(pkixcrl_IndexedCRL, WrongIssuer)
+{
+  ByteString crl(CreateCRL(ByteString()));
+  issuerNameDER = CNToDERName("Some Other Issuer");
+  IndexedCRL indexedCRL;
+  std::vector<uint32_t> index;
+  ASSERT_EQ(Result::ERROR_CRL_INVALID, Init(indexedCRL, crl, index));
+}
+
+TEST_F(pkixcrl_IndexedCRL, Validity)
+{
+  std::vector<uint32_t> index;
+  {
+    IndexedCRL indexedCRL;
+    ASSERT_EQ(Result::ERROR_CRL_EXPIRED,
+              Init(indexedCRL, CreateCRL(ByteString(), nullptr,
+                                         oneDayBeforeNow - 1,
+                                         oneDayBeforeNow),
+                   index));
+  }
+  {
+    IndexedCRL indexedCRL;
+    ASSERT_EQ(Result::ERROR_CRL_NOT_YET_VALID,
+              Init(indexedCRL, CreateCRL(ByteString(), nullptr,
+                                         oneDayAfterNow,
+                                         oneDayAfterNow + 1),
+                   index));
+  }
+}
+
+// python DottedOIDToCode.py --tlv id-ce-cRLNumber 2.5.29.20
+static const uint8_t tlv_id_ce_cRLNumber[] = {
+  0x06, 0x03, 0x55, 0x1d, 0x14
+};
+
+static ByteString
+CRLNumberExtension(bool critical)
+{
+  ByteString value(tlv_id_ce_cRLNumber, sizeof(tlv_id_ce_cRLNumber));
+  if (critical) {
+    value.append(Boolean(true));
+  }
+  value.append(TLV(der::OCTET_STRING, CreateEncodedSerialNumber(1)));
+  return TLV(der::SEQUENCE, value);
+}
+
+TEST_F(pkixcrl_IndexedCRL, Extensions)
+{
+  std::vector<uint32_t> index;
+  {
+    const ByteString extensions[] = { CRLNumberExtension(false), ByteString() };
+    IndexedCRL indexedCRL;
+    ASSERT_EQ(Success, Init(indexedCRL, CreateCRL(ByteString(), extensions),
+                            index));
+  }
+  {
+    const ByteString extensions[] = { CRLNumberExtension(true), ByteString() };
+    IndexedCRL indexedCRL;
+    ASSERT_EQ(Result::ERROR_UNKNOWN_CRITICAL_EXTENSION,
+              Init(indexedCRL, CreateCRL(ByteString(), extensions), index));
+  }
+  {
+    const ByteString extensions[] = { CRLNumberExtension(false), ByteString() };
+    IndexedCRL indexedCRL;
+    ASSERT_EQ(Success,
+              Init(indexedCRL,
+                   CreateCRL(CreateEncodedCRLEntry(SerialNumber(1),
+                                                   oneDayBeforeNow,
+                                                   extensions)),
+                   index));
+    ASSERT_TRUE(IsRevoked(indexedCRL, SerialNumber(1)));
+  }
+  {
+    const ByteString extensions[] = { CRLNumberExtension(true), ByteString() };
+    IndexedCRL indexedCRL;
+    ASSERT_EQ(Result::ERROR_UNKNOWN_CRITICAL_EXTENSION,
+              Init(indexedCRL,
+                   CreateCRL(CreateEncodedCRLEntry(SerialNumber(1),
+                                                   oneDayBeforeNow,
+                                                   extensions)),
+                   index));
+  }
+}
+
+// Extensions of either kind require a v2 CRL.
+TEST_F(pkixcrl_IndexedCRL, V1)
+{
+  std::vector<uint32_t> index;
+  const ByteString entry(CreateEncodedCRLEntry(SerialNumber(1),
+                                               oneDayBeforeNow));
+  {
+    IndexedCRL indexedCRL;
+    ASSERT_EQ(Success, Init(indexedCRL,
+                            CreateCRL(entry, nullptr, oneDayBeforeNow,
+                                      oneDayAfterNow, v1),
+                            index));
+    ASSERT_TRUE(IsRevoked(indexedCRL, SerialNumber(1)));
+  }
+  const ByteString extensions[] = { CRLNumberExtension(false), ByteString() };
+  {
+    IndexedCRL indexedCRL;
+    ASSERT_EQ(Result::ERROR_CRL_INVALID,
+              Init(indexedCRL,
+                   CreateCRL(entry, extensions, oneDayBeforeNow,
+                             oneDayAfterNow, v1),
+                   index));
+  }
+  {
+    IndexedCRL indexedCRL;
+    ASSERT_EQ(Result::ERROR_CRL_INVALID,
+              Init(indexedCRL,
+                   CreateCRL(CreateEncodedCRLEntry(SerialNumber(1),
+                                                   oneDayBeforeNow,
+                                                   extensions),
+                             nullptr, oneDayBeforeNow, oneDayAfterNow, v1),
+                   index));
+    bool revoked;
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+              IsRevoked(indexedCRL, SerialNumber(1), revoked));
+  }
+}
+
+TEST_F(pkixcrl_IndexedCRL, IndexTooSmall)
+{
+  ByteString revokedCertificates;
+  revokedCertificates.append(CreateEncodedCRLEntry(SerialNumber(1),
+                                                   oneDayBeforeNow));
+  revokedCertificates.append(CreateEncodedCRLEntry(SerialNumber(2),
+                                                   oneDayBeforeNow));
+  ByteString crl(CreateCRL(revokedCertificates));
+  Input issuerSubject;
+  ASSERT_EQ(Success, issuerSubject.Init(issuerNameDER.data(),
+                                        issuerNameDER.length()));
+  Input issuerSPKI;
+  ASSERT_EQ(Success,
+            issuerSPKI.Init(issuerKeyPair->subjectPublicKeyInfo.data(),
+                            issuerKeyPair->subjectPublicKeyInfo.length()));
+  uint32_t index[1];
+  IndexedCRL indexedCRL;
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+            indexedCRL.Init(trustDomain, digest, crl.data(), crl.length(),
+                            issuerSubject, issuerSPKI, Now(), index, 1));
+}
+
+TEST_F(pkixcrl_IndexedCRL, Truncated)
+{
+  ByteString crl(CreateCRL(CreateEncodedCRLEntry(SerialNumber(1),
+                                                 oneDayBeforeNow)));
+  crl.erase(crl.length() - 1);
+  IndexedCRL indexedCRL;
+  std::vector<uint32_t> index;
+  ASSERT_EQ(Result::ERROR_CRL_INVALID, Init(indexedCRL, crl, index));
+}
+
+// A CRL larger than an Input.
+TEST_F(pkixcrl_IndexedCRL, LargerThanInput)
+{
+  static const uint32_t ENTRY_COUNT = 10000;
+  ByteString crl(CreatePermutedCRL(ENTRY_COUNT));
+  ASSERT_GT(crl.length(), 0xffffu);
+
+  IndexedCRL indexedCRL;
+  std::vector<uint32_t> index;
+  ASSERT_EQ(Success, Init(indexedCRL, crl, index));
+  ASSERT_EQ(ENTRY_COUNT, indexedCRL.GetEntryCount());
+  for (uint32_t i = 0; i < ENTRY_COUNT; ++i) {
+    ASSERT_NO_FATAL_FAILURE(CheckPermutedSerialNumber(indexedCRL, i));
+  }
+}
+
+// A CRL with a million entries.
+TEST_F(pkixcrl_IndexedCRL, DISABLED_Benchmark_Lookup)
+{
+  static const uint32_t ENTRY_COUNT = 1000000;
+  ByteString crl(CreatePermutedCRL(ENTRY_COUNT));
+  ASSERT_GT(crl.length(), 20u * 1000u * 1000u);
+
+  IndexedCRL indexedCRL;
+  std::vector<uint32_t> index;
+  Benchmark("IndexedCRL::Init 1M entries", 1, [&]() {
+    ASSERT_EQ(Success, Init(indexedCRL, crl, index));
+  });
+  ASSERT_EQ(ENTRY_COUNT, indexedCRL.GetEntryCount());
+
+  uint32_t i = 0;
+  Benchmark("IndexedCRL::IsRevoked", ENTRY_COUNT, [&]() {
+    CheckPermutedSerialNumber(indexedCRL, i);
+    ++i;
+  });
+}
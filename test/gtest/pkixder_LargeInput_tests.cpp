@@ -0,0 +1,316 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pkixder.h"
+#include "pkixgtest.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::der;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+class pkixder_LargeInput_tests : public ::testing::Test { };
+
+// A SEQUENCE OF SEQUENCE with count elements, each of them containing the
+// INTEGER 1, like a list of CRL entries.
+ByteString
+SequenceOfEntries(size_t count)
+{
+  static const uint8_t ENTRY[] = { 0x30, 0x03, 0x02, 0x01, 0x01 };
+  ByteString value;
+  for (size_t i = 0; i < count; ++i) {
+    value.append(ENTRY, sizeof ENTRY);
+  }
+  return TLV(SEQUENCE, value);
+}
+
+Result
+CountEntries(Reader& r, /*in/out*/ size_t& count)
+{
+  uint8_t value;
+  Result rv = Integer(r, value);
+  if (rv != Success) {
+    return rv;
+  }
+  if (value != 1) {
+    return Result::ERROR_BAD_DER;
+  }
+  ++count;
+  return Success;
+}
+
+} // unnamed namespace
+
+TEST_F(pkixder_LargeInput_tests, InitWithLargeData)
+{
+  ByteString large(100000, 0x00);
+  LargeInput input;
+  ASSERT_EQ(Success, input.Init(large.data(), large.length()));
+  ASSERT_EQ(100000u, input.GetLength());
+
+  Input small;
+  ASSERT_EQ(Result::ERROR_BAD_DER, input.ToInput(small));
+
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+            input.Init(large.data(), large.length()));
+  LargeInput nullInput;
+  ASSERT_EQ(Result::ERROR_BAD_DER, nullInput.Init(nullptr, 0));
+}
+
+TEST_F(pkixder_LargeInput_tests, FromInput)
+{
+  static const uint8_t DATA[] = { 0x01, 0x02, 0x03 };
+  LargeInput input(Input{DATA});
+  ASSERT_EQ(sizeof DATA, input.GetLength());
+  Input small;
+  ASSERT_EQ(Success, input.ToInput(small));
+  ASSERT_TRUE(InputsAreEqual(Input(DATA), small));
+}
+
+TEST_F(pkixder_LargeInput_tests, ReadTagAndGetValue)
+{
+  static const size_t LENGTHS[] = {
+    0, 1, 127, 128, 255, 256, 65535, 65536, 70000, 0x1000000
+  };
+  for (size_t length : LENGTHS) {
+    ByteString value(length, 'x');
+    ByteString tlv(TLV(OCTET_STRING, value));
+    LargeInput tlvInput;
+    ASSERT_EQ(Success, tlvInput.Init(tlv.data(), tlv.length()));
+    LargeReader reader;
+    ASSERT_EQ(Success, reader.Init(tlvInput));
+
+    uint8_t tag;
+    LargeInput valueInput;
+    ASSERT_EQ(Success, ReadTagAndGetValue(reader, tag, valueInput));
+    ASSERT_EQ(OCTET_STRING, tag);
+    ASSERT_EQ(length, valueInput.GetLength());
+    ASSERT_EQ(tlv.data() + tlv.length() - length,
+              valueInput.UnsafeGetData());
+    ASSERT_TRUE(reader.AtEnd());
+
+    // Values that don't fit in an Input can't be read into one.
+    LargeReader reader2(tlvInput);
+    Input smallValue;
+    ASSERT_EQ(length <= 65535 ? Success : Result::ERROR_BAD_DER,
+              ExpectTagAndGetValue(reader2, OCTET_STRING, smallValue));
+  }
+}
+
+TEST_F(pkixder_LargeInput_tests, ReadTagAndGetValueErrors)
+{
+  static const uint8_t NOT_SHORTEST_3[] = { 0x04, 0x83, 0x00, 0xff, 0xff };
+  static const uint8_t NOT_SHORTEST_1[] = { 0x04, 0x81, 0x7f };
+  static const uint8_t FIVE_BYTE_LENGTH[] = {
+    0x04, 0x85, 0x01, 0x00, 0x00, 0x00, 0x00
+  };
+  static const uint8_t INDEFINITE_LENGTH[] = { 0x30, 0x80, 0x00, 0x00 };
+  static const uint8_t TRUNCATED_LENGTH[] = { 0x04, 0x84, 0x01, 0x00 };
+  static const uint8_t TRUNCATED_VALUE[] = { 0x04, 0x83, 0x01, 0x00, 0x00 };
+  static const uint8_t HIGH_TAG_NUMBER[] = { 0x1f, 0x01, 0x00 };
+
+  const LargeInput INPUTS[] = {
+    LargeInput(NOT_SHORTEST_3),
+    LargeInput(NOT_SHORTEST_1),
+    LargeInput(FIVE_BYTE_LENGTH),
+    LargeInput(INDEFINITE_LENGTH),
+    LargeInput(TRUNCATED_LENGTH),
+    LargeInput(TRUNCATED_VALUE),
+    LargeInput(HIGH_TAG_NUMBER),
+  };
+  for (const LargeInput& input : INPUTS) {
+    LargeReader reader(input);
+    uint8_t tag;
+    LargeInput value;
+    ASSERT_EQ(Result::ERROR_BAD_DER, ReadTagAndGetValue(reader, tag, value));
+  }
+}
+
+// For everything that fits in an Input, reading with a LargeReader gives the
+// same results as reading with a Reader.
+TEST_F(pkixder_LargeInput_tests, SameResultsAsReader)
+{
+  uint8_t data[4];
+  for (uint32_t i = 0; i < 0x10000; ++i) {
+    data[0] = static_cast<uint8_t>(i >> 8);
+    data[1] = static_cast<uint8_t>(i);
+    data[2] = 0x01;
+    data[3] = 0x00;
+    for (size_t length = 0; length <= sizeof data; ++length) {
+      Input input;
+      ASSERT_EQ(Success, input.Init(data, length));
+      Reader reader(input);
+      LargeReader largeReader{LargeInput(input)};
+      uint8_t tag;
+      Input value;
+      uint8_t largeTag;
+      LargeInput largeValue;
+      Result rv = ReadTagAndGetValue(reader, tag, value);
+      ASSERT_EQ(rv, ReadTagAndGetValue(largeReader, largeTag, largeValue));
+      if (rv == Success) {
+        ASSERT_EQ(tag, largeTag);
+        ASSERT_EQ(value.UnsafeGetData(), largeValue.UnsafeGetData());
+        ASSERT_EQ(value.GetLength(), largeValue.GetLength());
+        ASSERT_EQ(reader.AtEnd(), largeReader.AtEnd());
+      }
+    }
+  }
+}
+
+TEST_F(pkixder_LargeInput_tests, MarkAndGetInput)
+{
+  ByteString tlv(TLV(SEQUENCE, ByteString(70000, 0x00)));
+  LargeInput input;
+  ASSERT_EQ(Success, input.Init(tlv.data(), tlv.length()));
+  LargeReader reader(input);
+  LargeReader::Mark mark(reader.GetMark());
+  ASSERT_EQ(Success, ExpectTagAndSkipValue(reader, SEQUENCE));
+  LargeInput item;
+  ASSERT_EQ(Success, reader.GetInput(mark, item));
+  ASSERT_EQ(input.UnsafeGetData(), item.UnsafeGetData());
+  ASSERT_EQ(input.GetLength(), item.GetLength());
+  Input smallItem;
+  ASSERT_EQ(Result::ERROR_BAD_DER, reader.GetInput(mark, smallItem));
+}
+
+// Cannot run this test on debug builds because of the NotReached
+#ifdef NDEBUG
+TEST_F(pkixder_LargeInput_tests, MarkAndGetInputDifferentInput)
+{
+  const uint8_t der[] = { 0x11, 0x22, 0x33, 0x44 };
+  LargeReader input((LargeInput(der)));
+
+  LargeReader another;
+  LargeReader::Mark mark = another.GetMark();
+
+  ASSERT_EQ(Success, input.Skip(3));
+
+  LargeInput item;
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS, input.GetInput(mark, item));
+}
+#endif
+
+TEST_F(pkixder_LargeInput_tests, NestedOf)
+{
+  // 30000 elements of 5 bytes each is too large for an Input.
+  static const size_t COUNTS[] = { 1, 1000, 30000 };
+  for (size_t expectedCount : COUNTS) {
+    ByteString der(SequenceOfEntries(expectedCount));
+    LargeInput input;
+    ASSERT_EQ(Success, input.Init(der.data(), der.length()));
+    LargeReader reader(input);
+    size_t count = 0;
+    ASSERT_EQ(Success,
+              NestedOf(reader, SEQUENCE, SEQUENCE, EmptyAllowed::No,
+                       [&count](Reader& r) {
+      return CountEntries(r, count);
+    }));
+    ASSERT_EQ(expectedCount, count);
+    ASSERT_EQ(Success, End(reader));
+  }
+}
+
+TEST_F(pkixder_LargeInput_tests, NestedOfEmpty)
+{
+  static const uint8_t EMPTY[] = { 0x30, 0x00 };
+  LargeReader reader1((LargeInput(EMPTY)));
+  ASSERT_EQ(Result::ERROR_BAD_DER,
+            NestedOf(reader1, SEQUENCE, INTEGER, EmptyAllowed::No,
+                     [](Reader&) { return Success; }));
+  LargeReader reader2((LargeInput(EMPTY)));
+  ASSERT_EQ(Success,
+            NestedOf(reader2, SEQUENCE, INTEGER, EmptyAllowed::Yes,
+                     [](Reader&) { return Success; }));
+}
+
+TEST_F(pkixder_LargeInput_tests, NestedOfLargeElement)
+{
+  ByteString der(TLV(SEQUENCE, TLV(OCTET_STRING, ByteString(65536, 0x00))));
+  LargeInput input;
+  ASSERT_EQ(Success, input.Init(der.data(), der.length()));
+  LargeReader reader(input);
+  ASSERT_EQ(Result::ERROR_BAD_DER,
+            NestedOf(reader, SEQUENCE, OCTET_STRING, EmptyAllowed::No,
+                     [](Reader& r) {
+      r.SkipToEnd();
+      return Success;
+    }));
+}
+
+TEST_F(pkixder_LargeInput_tests, Nested)
+{
+  ByteString der(TLV(SEQUENCE, SequenceOfEntries(30000)));
+  LargeInput input;
+  ASSERT_EQ(Success, input.Init(der.data(), der.length()));
+  LargeReader inner;
+  ASSERT_EQ(Success, ExpectTagAndGetValueAtEnd(input, SEQUENCE, inner));
+  size_t count = 0;
+  ASSERT_EQ(Success, Nested(inner, SEQUENCE, [&count](LargeReader& r) {
+    do {
+      Reader element;
+      Result rv = ExpectTagAndGetValue(r, SEQUENCE, element);
+      if (rv != Success) {
+        return rv;
+      }
+      ++count;
+      element.SkipToEnd();
+    } while (!r.AtEnd());
+    return Success;
+  }));
+  ASSERT_EQ(30000u, count);
+  ASSERT_EQ(Success, End(inner));
+}
+
+// Parses the same small SEQUENCE OF SEQUENCE with a Reader and with a
+// LargeReader. Parsing with a Reader is unchanged by the addition of
+// LargeReader, and parsing with a LargeReader should be about as fast.
+TEST_F(pkixder_LargeInput_tests, DISABLED_Benchmark_SmallInput)
+{
+  ByteString der(SequenceOfEntries(12000));
+  Input input;
+  ASSERT_EQ(Success, input.Init(der.data(), der.length()));
+
+  Benchmark("Reader", 200, [&input]() {
+    Reader reader(input);
+    size_t count = 0;
+    ASSERT_EQ(Success,
+              NestedOf(reader, SEQUENCE, SEQUENCE, EmptyAllowed::No,
+                       [&count](Reader& r) {
+      return CountEntries(r, count);
+    }));
+    ASSERT_EQ(12000u, count);
+  });
+
+  Benchmark("LargeReader", 200, [&input]() {
+    LargeReader reader{LargeInput(input)};
+    size_t count = 0;
+    ASSERT_EQ(Success,
+              NestedOf(reader, SEQUENCE, SEQUENCE, EmptyAllowed::No,
+                       [&count](Reader& r) {
+      return CountEntries(r, count);
+    }));
+    ASSERT_EQ(12000u, count);
+  });
+}
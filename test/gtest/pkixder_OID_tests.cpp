@@ -0,0 +1,122 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pkixder.h"
+#include "pkixgtest.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::der;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+class pkixder_OID_tests : public ::testing::Test { };
+
+template <typename OIDType, size_t N>
+void
+ExpectEncoding(const uint8_t (&expected)[N])
+{
+  static_assert(sizeof(OIDType::bytes) == N, "wrong encoded length");
+  ASSERT_TRUE(InputsAreEqual(Input(expected), Input(OIDType::bytes)));
+}
+
+TEST_F(pkixder_OID_tests, EncodedOID)
+{
+  // Single-byte arcs.
+  static const uint8_t id_ce_keyUsage[] = { 0x55, 0x1d, 0x0f };
+  ExpectEncoding<EncodedOID<2, 5, 29, 15>>(id_ce_keyUsage);
+
+  static const uint8_t anyPolicy[] = { 0x55, 0x1d, 0x20, 0x00 };
+  ExpectEncoding<EncodedOID<2, 5, 29, 32, 0>>(anyPolicy);
+
+  // Two-byte arcs (840, 10045).
+  static const uint8_t ecdsa_with_SHA256[] = {
+    0x2a, 0x86, 0x48, 0xce, 0x3d, 0x04, 0x03, 0x02
+  };
+  ExpectEncoding<EncodedOID<1, 2, 840, 10045, 4, 3, 2>>(ecdsa_with_SHA256);
+
+  // Three-byte arcs (113549, 113730), and a first arc of 2 (2.16).
+  static const uint8_t sha256WithRSAEncryption[] = {
+    0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x0b
+  };
+  ExpectEncoding<EncodedOID<1, 2, 840, 113549, 1, 1, 11>>(
+    sha256WithRSAEncryption);
+  static const uint8_t Netscape_certificate_type[] = {
+    0x60, 0x86, 0x48, 0x01, 0x86, 0xf8, 0x42, 0x01, 0x01
+  };
+  ExpectEncoding<EncodedOID<2, 16, 840, 1, 113730, 1, 1>>(
+    Netscape_certificate_type);
+
+  // Multi-byte arcs with zero low-order groups, and the largest arc.
+  static const uint8_t zeroGroups[] = { 0x2a, 0x81, 0x00, 0x82, 0x80, 0x00 };
+  ExpectEncoding<EncodedOID<1, 2, 128, 32768>>(zeroGroups);
+  static const uint8_t largestArc[] = { 0x2a, 0x8f, 0xff, 0xff, 0xff, 0x7f };
+  ExpectEncoding<EncodedOID<1, 2, 0xffffffffu>>(largestArc);
+
+  // The first two arcs are combined, even when that takes more than one byte.
+  static const uint8_t firstArcsCombined[] = { 0x88, 0x37, 0x01 };
+  ExpectEncoding<EncodedOID<2, 999, 1>>(firstArcsCombined);
+}
+
+enum class Fruit { Unknown, Apple, Banana, Cherry, Durian };
+
+template <Fruit Value, uint32_t... Arcs>
+using FruitOID = OIDMatcherEntry<Fruit, Value, EncodedOID<Arcs...>>;
+
+typedef OIDMatcher<Fruit, Fruit::Unknown,
+  FruitOID<Fruit::Apple, 1, 2, 3>,
+  FruitOID<Fruit::Banana, 1, 2, 3, 4>,
+  FruitOID<Fruit::Cherry, 2, 5, 29, 15>,
+  // The same key (length, first byte, and last byte) as Banana.
+  FruitOID<Fruit::Durian, 1, 2, 5, 4>
+> FruitMatcher;
+
+TEST_F(pkixder_OID_tests, OIDMatcher)
+{
+  static const uint8_t apple[] = { 0x2a, 0x03 };
+  static const uint8_t banana[] = { 0x2a, 0x03, 0x04 };
+  static const uint8_t cherry[] = { 0x55, 0x1d, 0x0f };
+  ASSERT_EQ(Fruit::Apple, FruitMatcher::Match(Input(apple)));
+  ASSERT_EQ(Fruit::Banana, FruitMatcher::Match(Input(banana)));
+  ASSERT_EQ(Fruit::Cherry, FruitMatcher::Match(Input(cherry)));
+  static const uint8_t durian[] = { 0x2a, 0x05, 0x04 };
+  ASSERT_EQ(Fruit::Durian, FruitMatcher::Match(Input(durian)));
+
+  // Prefixes, extensions, and near misses of known OIDs.
+  static const uint8_t prefix[] = { 0x2a };
+  static const uint8_t longer[] = { 0x55, 0x1d, 0x0f, 0x00 };
+  static const uint8_t lastByteDiffers[] = { 0x55, 0x1d, 0x0e };
+  static const uint8_t firstByteDiffers[] = { 0x2b, 0x03 };
+  ASSERT_EQ(Fruit::Unknown, FruitMatcher::Match(Input(prefix)));
+  ASSERT_EQ(Fruit::Unknown, FruitMatcher::Match(Input(longer)));
+  ASSERT_EQ(Fruit::Unknown, FruitMatcher::Match(Input(lastByteDiffers)));
+  ASSERT_EQ(Fruit::Unknown, FruitMatcher::Match(Input(firstByteDiffers)));
+  ASSERT_EQ(Fruit::Unknown, FruitMatcher::Match(Input()));
+
+  // The same key as Banana and Durian, but neither of them.
+  static const uint8_t bananaDurian[] = { 0x2a, 0x04, 0x04 };
+  ASSERT_EQ(Fruit::Unknown, FruitMatcher::Match(Input(bananaDurian)));
+}
+
+} // unnamed namespace
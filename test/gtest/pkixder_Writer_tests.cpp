@@ -0,0 +1,378 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pkixder.h"
+#include "pkixgtest.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::der;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+class pkixder_Writer_tests : public ::testing::Test { };
+
+// Encodes with a measuring pass and then a writing pass, checking that the
+// writing pass produces exactly the measured length.
+template <typename Encoder>
+ByteString
+EncodeTwoPass(Encoder encode)
+{
+  EncodedLengths lengths;
+  size_t length = 0;
+  EXPECT_EQ(Success, MeasureEncoding(lengths, encode, length));
+  ByteString result(length + 1, 0xAA);
+  EXPECT_EQ(Success, WriteEncoding(lengths, encode, &result[0], length));
+  // The byte past the measured length must not have been written.
+  EXPECT_EQ(0xAA, result[length]);
+  result.resize(length);
+  return result;
+}
+
+TEST_F(pkixder_Writer_tests, Empty)
+{
+  EncodedLengths lengths;
+  size_t length = 1;
+  auto encode = [](Writer&) { return Success; };
+  ASSERT_EQ(Success, MeasureEncoding(lengths, encode, length));
+  ASSERT_EQ(0u, length);
+  ASSERT_EQ(Success, WriteEncoding(lengths, encode, nullptr, 0));
+}
+
+TEST_F(pkixder_Writer_tests, Nested)
+{
+  static const uint8_t value[] = { 0x01, 0x02, 0x03 };
+  ByteString encoded(EncodeTwoPass([](Writer& output) {
+    return Nested(output, SEQUENCE, [](Writer& sequence) {
+      Result rv = TLV(sequence, OCTET_STRING, Input(value));
+      if (rv != Success) {
+        return rv;
+      }
+      rv = Nested(sequence, SET, [](Writer&) { return Success; });
+      if (rv != Success) {
+        return rv;
+      }
+      return Nested(sequence, CONTEXT_SPECIFIC | CONSTRUCTED | 0,
+                    [](Writer& tagged) {
+        return tagged.Write(0x05);
+      });
+    });
+  }));
+
+  static const uint8_t expected[] = {
+    0x30, 0x0a,
+      0x04, 0x03, 0x01, 0x02, 0x03,
+      0x31, 0x00,
+      0xa0, 0x01, 0x05,
+  };
+  ASSERT_EQ(ByteString(expected, sizeof(expected)), encoded);
+}
+
+// The lengths at which the encoding of a length gets longer.
+TEST_F(pkixder_Writer_tests, LengthEncodings)
+{
+  static const struct {
+    size_t valueLength;
+    uint8_t header[6];
+    size_t headerLength;
+  } cases[] = {
+    { 0, { 0x04, 0x00 }, 2 },
+    { 127, { 0x04, 0x7f }, 2 },
+    { 128, { 0x04, 0x81, 0x80 }, 3 },
+    { 255, { 0x04, 0x81, 0xff }, 3 },
+    { 256, { 0x04, 0x82, 0x01, 0x00 }, 4 },
+    { 65535, { 0x04, 0x82, 0xff, 0xff }, 4 },
+    { 65536, { 0x04, 0x83, 0x01, 0x00, 0x00 }, 5 },
+  };
+
+  for (const auto& c : cases) {
+    ByteString value(c.valueLength, 0x42);
+    ByteString nested(EncodeTwoPass([&](Writer& output) {
+      return Nested(output, OCTET_STRING, [&](Writer& octetString) {
+        return octetString.Write(value.data(), value.length());
+      });
+    }));
+    ByteString direct(EncodeTwoPass([&](Writer& output) {
+      Result rv = output.WriteTagAndLength(OCTET_STRING, value.length());
+      if (rv != Success) {
+        return rv;
+      }
+      return output.Write(value.data(), value.length());
+    }));
+
+    ByteString expected(c.header, c.headerLength);
+    expected.append(value);
+    ASSERT_EQ(expected, nested);
+    ASSERT_EQ(expected, direct);
+  }
+}
+
+// Nested encodings whose inner lengths push the outer lengths across the
+// boundaries between length encodings.
+TEST_F(pkixder_Writer_tests, NestedLengthsAffectOuterLengths)
+{
+  ByteString value(124, 0x42);
+  ByteString encoded(EncodeTwoPass([&](Writer& output) {
+    return Nested(output, SEQUENCE, [&](Writer& outer) {
+      return Nested(outer, SEQUENCE, [&](Writer& inner) {
+        return TLV(inner, OCTET_STRING, Input());
+      });
+    });
+  }));
+  static const uint8_t expectedSmall[] = { 0x30, 0x04, 0x30, 0x02, 0x04, 0x00 };
+  ASSERT_EQ(ByteString(expectedSmall, sizeof(expectedSmall)), encoded);
+
+  // The inner SEQUENCE has a 126-byte value, so the outer one has a 128-byte
+  // value.
+  encoded = EncodeTwoPass([&](Writer& output) {
+    return Nested(output, SEQUENCE, [&](Writer& outer) {
+      return Nested(outer, SEQUENCE, [&](Writer& inner) {
+        Result rv = inner.WriteTagAndLength(OCTET_STRING, value.length());
+        if (rv != Success) {
+          return rv;
+        }
+        return inner.Write(value.data(), value.length());
+      });
+    });
+  });
+  ASSERT_EQ(2u + 1u + 2u + 2u + value.length(), encoded.length());
+  ASSERT_EQ(0x30, encoded[0]);
+  ASSERT_EQ(0x81, encoded[1]);
+  ASSERT_EQ(0x80, encoded[2]);
+  ASSERT_EQ(0x30, encoded[3]);
+  ASSERT_EQ(0x7e, encoded[4]);
+
+  Input input;
+  ASSERT_EQ(Success, input.Init(encoded.data(), encoded.length()));
+  Reader reader(input);
+  ASSERT_EQ(Success, Nested(reader, SEQUENCE, [](Reader& outer) {
+    return Nested(outer, SEQUENCE, [](Reader& inner) {
+      return ExpectTagAndSkipValue(inner, OCTET_STRING);
+    });
+  }));
+  ASSERT_TRUE(reader.AtEnd());
+}
+
+template <typename Encoder>
+Result
+MeasureOnly(Encoder encode)
+{
+  EncodedLengths lengths;
+  size_t length;
+  return MeasureEncoding(lengths, encode, length);
+}
+
+static Result
+NestDeeply(Writer& output, size_t depth)
+{
+  if (depth == 0) {
+    return Success;
+  }
+  return Nested(output, SEQUENCE, [depth](Writer& nested) {
+    return NestDeeply(nested, depth - 1);
+  });
+}
+
+TEST_F(pkixder_Writer_tests, MaxDepth)
+{
+  ASSERT_EQ(Success, MeasureOnly([](Writer& output) {
+    return NestDeeply(output, Writer::MAX_DEPTH);
+  }));
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS, MeasureOnly([](Writer& output) {
+    return NestDeeply(output, Writer::MAX_DEPTH + 1);
+  }));
+}
+
+TEST_F(pkixder_Writer_tests, MaxNested)
+{
+  auto encodeSequences = [](Writer& output, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      Result rv = Nested(output, SEQUENCE, [](Writer&) { return Success; });
+      if (rv != Success) {
+        return rv;
+      }
+    }
+    return Success;
+  };
+  ASSERT_EQ(Success, MeasureOnly([&](Writer& output) {
+    return encodeSequences(output, EncodedLengths::MAX_NESTED);
+  }));
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS, MeasureOnly([&](Writer& output) {
+    return encodeSequences(output, EncodedLengths::MAX_NESTED + 1);
+  }));
+}
+
+TEST_F(pkixder_Writer_tests, UnbalancedEndNested)
+{
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE, MeasureOnly([](Writer& output) {
+    return output.EndNested();
+  }));
+}
+
+// The writing pass must make the same calls as the measuring pass.
+TEST_F(pkixder_Writer_tests, PassesDiffer)
+{
+  static const uint8_t value[] = { 0x01, 0x02 };
+
+  EncodedLengths lengths;
+  size_t length;
+  ASSERT_EQ(Success, MeasureEncoding(lengths, [](Writer& output) {
+    return Nested(output, SEQUENCE, [](Writer& sequence) {
+      return sequence.Write(0x00);
+    });
+  }, length));
+  ASSERT_EQ(3u, length);
+
+  uint8_t buffer[8];
+
+  // A longer value.
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+            WriteEncoding(lengths, [](Writer& output) {
+              return Nested(output, SEQUENCE, [](Writer& sequence) {
+                return sequence.Write(Input(value));
+              });
+            }, buffer, length));
+
+  // A shorter value.
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+            WriteEncoding(lengths, [](Writer& output) {
+              return Nested(output, SEQUENCE, [](Writer&) {
+                return Success;
+              });
+            }, buffer, length));
+
+  // More nested TLVs.
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+            WriteEncoding(lengths, [](Writer& output) {
+              Result rv = Nested(output, SEQUENCE, [](Writer& sequence) {
+                return sequence.Write(0x00);
+              });
+              if (rv != Success) {
+                return rv;
+              }
+              return Nested(output, SEQUENCE, [](Writer&) {
+                return Success;
+              });
+            }, buffer, length));
+
+  // Fewer bytes overall.
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+            WriteEncoding(lengths, [](Writer&) { return Success; },
+                          buffer, length));
+}
+
+// TLV as it was implemented on ByteString, with concatenation, before
+// test::TLV was ported to Writer.
+ByteString
+ConcatenatedTLV(uint8_t tag, const ByteString& value)
+{
+  ByteString result;
+  result.push_back(tag);
+  if (value.length() < 128) {
+    result.push_back(static_cast<uint8_t>(value.length()));
+  } else {
+    result.push_back(0x81u);
+    result.push_back(static_cast<uint8_t>(value.length()));
+  }
+  result.append(value);
+  return result;
+}
+
+const uint8_t tlv_id_at_commonName[] = {
+  0x06, 0x03, 0x55, 0x04, 0x03
+};
+const uint8_t cn[] = {
+  'I', 'n', 't', 'e', 'r', 'm', 'e', 'd', 'i', 'a', 't', 'e', ' ',
+  'C', 'A'
+};
+
+// Name(RDN(CN(cn))) encoded with ByteString concatenation.
+ByteString
+ConcatenatedName()
+{
+  ByteString ava(tlv_id_at_commonName, sizeof(tlv_id_at_commonName));
+  ava.append(ConcatenatedTLV(UTF8String, ByteString(cn, sizeof(cn))));
+  return ConcatenatedTLV(SEQUENCE,
+                         ConcatenatedTLV(SET,
+                                         ConcatenatedTLV(SEQUENCE, ava)));
+}
+
+// Name(RDN(CN(cn))) encoded with Writer into a fixed-size buffer.
+Result
+WriterName(uint8_t* buffer, size_t bufferLength, /*out*/ size_t& length)
+{
+  auto encode = [&](Writer& output) {
+    return Nested(output, SEQUENCE, [&](Writer& name) {
+      return Nested(name, SET, [&](Writer& rdn) {
+        return Nested(rdn, SEQUENCE, [&](Writer& ava) {
+          Result rv = ava.Write(Input(tlv_id_at_commonName));
+          if (rv != Success) {
+            return rv;
+          }
+          return TLV(ava, UTF8String, Input(cn));
+        });
+      });
+    });
+  };
+  EncodedLengths lengths;
+  Result rv = MeasureEncoding(lengths, encode, length);
+  if (rv != Success) {
+    return rv;
+  }
+  if (length > bufferLength) {
+    return Result::FATAL_ERROR_INVALID_ARGS;
+  }
+  return WriteEncoding(lengths, encode, buffer, length);
+}
+
+TEST_F(pkixder_Writer_tests, EncodeName)
+{
+  const ByteString expected(CNToDERName("Intermediate CA"));
+  ASSERT_EQ(expected, ConcatenatedName());
+
+  uint8_t buffer[64];
+  size_t length;
+  ASSERT_EQ(Success, WriterName(buffer, sizeof(buffer), length));
+  ASSERT_EQ(expected.length(), length);
+  ASSERT_EQ(0, memcmp(expected.data(), buffer, length));
+}
+
+TEST_F(pkixder_Writer_tests, DISABLED_Benchmark_EncodeName)
+{
+  const ByteString expected(CNToDERName("Intermediate CA"));
+
+  Benchmark("EncodeName (ByteString)", 1000000, [&]() {
+    ASSERT_EQ(expected, ConcatenatedName());
+  });
+
+  Benchmark("EncodeName (Writer)", 1000000, [&]() {
+    uint8_t buffer[64];
+    size_t length;
+    ASSERT_EQ(Success, WriterName(buffer, sizeof(buffer), length));
+    ASSERT_EQ(expected.length(), length);
+    ASSERT_EQ(0, memcmp(expected.data(), buffer, length));
+  });
+}
+
+} // namespace
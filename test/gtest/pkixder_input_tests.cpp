@@ -666,6 +666,47 @@ TEST_F(pkixder_input_tests, ExpectTagAndGetValue_Reader_InvalidWrongTag)
             ExpectTagAndGetValue(input, INTEGER, value));
 }
 
+TEST_F(pkixder_input_tests, TagAndLengthLength_PartialInput)
+{
+  // An OCTET STRING with a long-form length, received a byte at a time.
+  uint8_t der[2 + 1 + 200];
+  der[0] = OCTET_STRING;
+  der[1] = 0x81;
+  der[2] = 200;
+  for (size_t i = 0; i < 200; ++i) {
+    der[3 + i] = static_cast<uint8_t>(i);
+  }
+  for (size_t received = 0; received < sizeof der; ++received) {
+    Input buf;
+    ASSERT_EQ(Success, buf.Init(der, received));
+    ASSERT_EQ(received < 2 ? 2u : 3u, TagAndLengthLength(buf));
+  }
+  Input buf(der);
+  ASSERT_EQ(3u, TagAndLengthLength(buf));
+  Reader input(buf);
+  uint8_t tag;
+  uint32_t length;
+  ASSERT_EQ(Success, ReadTagAndGetLength(input, tag, length));
+  ASSERT_EQ(OCTET_STRING, tag);
+  ASSERT_EQ(200u, length);
+
+  static const uint8_t SHORT_FORM[] = { OCTET_STRING, 0x7F };
+  ASSERT_EQ(2u, TagAndLengthLength(Input(SHORT_FORM)));
+  static const uint8_t FOUR_LENGTH_BYTES[] = { OCTET_STRING, 0x84 };
+  ASSERT_EQ(6u, TagAndLengthLength(Input(FOUR_LENGTH_BYTES)));
+
+  // Invalid lengths are reported by ReadTagAndGetLength as soon as the first
+  // two bytes have been received.
+  static const uint8_t INDEFINITE_LENGTH[] = { OCTET_STRING, 0x80 };
+  ASSERT_EQ(2u, TagAndLengthLength(Input(INDEFINITE_LENGTH)));
+  static const uint8_t FIVE_LENGTH_BYTES[] = { OCTET_STRING, 0x85 };
+  ASSERT_EQ(2u, TagAndLengthLength(Input(FIVE_LENGTH_BYTES)));
+  Input fiveLengthBytesBuf(FIVE_LENGTH_BYTES);
+  Reader fiveLengthBytes(fiveLengthBytesBuf);
+  ASSERT_EQ(Result::ERROR_BAD_DER,
+            ReadTagAndGetLength(fiveLengthBytes, tag, length));
+}
+
 TEST_F(pkixder_input_tests, ExpectTagAndGetValue_Input_ValidEmpty)
 {
   Input buf(DER_SEQUENCE_EMPTY);
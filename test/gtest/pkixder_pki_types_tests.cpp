@@ -476,3 +476,38 @@ INSTANTIATE_TEST_CASE_P(
   pkixder_SignatureAlgorithmIdentifier_Invalid,
   pkixder_SignatureAlgorithmIdentifier_Invalid,
   testing::ValuesIn(INVALID_SIGNATURE_ALGORITHM_VALUE_TEST_INFO));
+
+TEST_F(pkixder_pki_types_tests,
+       DISABLED_Benchmark_SignatureAlgorithmIdentifierValue)
+{
+  // Every valid algorithm and every invalid one, in the order of the tables
+  // above, which puts the most common algorithms in the middle.
+  std::vector<Input> inputs;
+  for (const auto& param : VALID_SIGNATURE_ALGORITHM_VALUE_TEST_INFO) {
+    Input input;
+    ASSERT_EQ(Success, input.Init(param.der, param.derLength));
+    inputs.push_back(input);
+  }
+  for (const auto& param : INVALID_SIGNATURE_ALGORITHM_VALUE_TEST_INFO) {
+    Input input;
+    ASSERT_EQ(Success, input.Init(param.der, param.derLength));
+    inputs.push_back(input);
+  }
+
+  const size_t expectedValid =
+    MOZILLA_PKIX_ARRAY_LENGTH(VALID_SIGNATURE_ALGORITHM_VALUE_TEST_INFO);
+  test::Benchmark("SignatureAlgorithmIdentifierValue", 200000,
+                  [&inputs, expectedValid]() {
+    size_t valid = 0;
+    for (Input input : inputs) {
+      Reader reader(input);
+      PublicKeyAlgorithm publicKeyAlg;
+      DigestAlgorithm digestAlg;
+      if (SignatureAlgorithmIdentifierValue(reader, publicKeyAlg,
+                                            digestAlg) == Success) {
+        ++valid;
+      }
+    }
+    ASSERT_EQ(expectedValid, valid);
+  });
+}
@@ -892,6 +892,97 @@ TEST_F(pkixder_universal_types_tests, TimeInvalidFractionalSeconds)
   ExpectBadTime(DER_GENERALIZED_TIME_INVALID_FRACTIONAL_SECONDS);
 }
 
+TEST_F(pkixder_universal_types_tests, TimeInvalidCharInEveryPosition)
+{
+  static const uint8_t DER_GENERALIZED_TIME[] = {
+    0x18,                           // Generalized Time
+    15,                             // Length = 15
+    '2', '0', '1', '2', '0', '6', '3', '0', // YYYYMMDD (2012-06-30)
+    '2', '3', '5', '9', '5', '9', 'Z' // HHMMSSZ (23:59:59Z)
+  };
+  static const size_t VALUE_OFFSET = 2;
+
+  // The characters adjacent to '0' and '9', and ones that differ from digits
+  // only in their high bits or high nibbles.
+  static const uint8_t BAD_CHARS[] = {
+    '/', ':', ' ', 'Z', 0x00, 0x10, 0x39 + 0x10, 0x30 + 0x80, 0x39 + 0x80,
+    0xff, 0x3f
+  };
+
+  for (size_t i = VALUE_OFFSET; i < sizeof(DER_GENERALIZED_TIME); ++i) {
+    for (uint8_t bad : BAD_CHARS) {
+      if (DER_GENERALIZED_TIME[i] == bad) {
+        continue;
+      }
+      uint8_t der[sizeof(DER_GENERALIZED_TIME)];
+      memcpy(der, DER_GENERALIZED_TIME, sizeof(der));
+      der[i] = bad;
+      if (i >= VALUE_OFFSET + 2) {
+        ExpectBadTime(der);
+      } else {
+        // The century isn't part of the equivalent UTCTime.
+        Input input(der);
+        Reader reader(input);
+        Time value(Time::uninitialized);
+        ASSERT_EQ(Result::ERROR_INVALID_DER_TIME,
+                  GeneralizedTime(reader, value));
+      }
+    }
+  }
+
+  // A digit in place of the Z.
+  uint8_t der[sizeof(DER_GENERALIZED_TIME)];
+  memcpy(der, DER_GENERALIZED_TIME, sizeof(der));
+  der[sizeof(der) - 1] = '0';
+  ExpectBadTime(der);
+}
+
+TEST_F(pkixder_universal_types_tests, DISABLED_Benchmark_TimeChoice)
+{
+  static const uint8_t DER_GENERALIZED_TIME[] = {
+    0x18,                           // Generalized Time
+    15,                             // Length = 15
+    '2', '0', '4', '8', '0', '2', '2', '9', // YYYYMMDD (2048-02-29)
+    '2', '3', '5', '9', '5', '9', 'Z' // HHMMSSZ (23:59:59Z)
+  };
+  static const uint8_t DER_UTC_TIME[] = {
+    0x17,                           // UTCTime
+    13,                             // Length = 13
+    '1', '5', '1', '2', '3', '1', // YYMMDD (2015-12-31)
+    '2', '3', '5', '9', '5', '9', 'Z' // HHMMSSZ (23:59:59Z)
+  };
+  static const uint8_t DER_UTC_TIME_BAD_DAY[] = {
+    0x17,                           // UTCTime
+    13,                             // Length = 13
+    '1', '5', '0', '2', '2', '9', // YYMMDD (2015-02-29)
+    '2', '3', '5', '9', '5', '9', 'Z' // HHMMSSZ (23:59:59Z)
+  };
+
+  const Time expectedGeneralizedTime(YMDHMS(2048, 2, 29, 23, 59, 59));
+  const Time expectedUTCTime(YMDHMS(2015, 12, 31, 23, 59, 59));
+
+  Benchmark("TimeChoice", 1000000, [&]() {
+    Time value(Time::uninitialized);
+    {
+      Input input(DER_GENERALIZED_TIME);
+      Reader reader(input);
+      ASSERT_EQ(Success, TimeChoice(reader, value));
+      ASSERT_EQ(expectedGeneralizedTime, value);
+    }
+    {
+      Input input(DER_UTC_TIME);
+      Reader reader(input);
+      ASSERT_EQ(Success, TimeChoice(reader, value));
+      ASSERT_EQ(expectedUTCTime, value);
+    }
+    {
+      Input input(DER_UTC_TIME_BAD_DAY);
+      Reader reader(input);
+      ASSERT_EQ(Result::ERROR_INVALID_DER_TIME, TimeChoice(reader, value));
+    }
+  });
+}
+
 struct IntegerTestParams
 {
   ByteString encoded;
@@ -0,0 +1,303 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "pkixgtest.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+struct CertKey
+{
+  uint8_t issuerSPKIHash[RevocationFilterCascade::ISSUER_SPKI_HASH_LENGTH];
+  uint8_t serialNumber[8];
+
+  Input IssuerSPKIHash() const { return Input(issuerSPKIHash); }
+  Input SerialNumber() const { return Input(serialNumber); }
+};
+
+// Certificates from a few issuers, with serial numbers that are unique
+// across them.
+std::vector<CertKey>
+MakeCertKeys(size_t count, uint64_t firstSerialNumber)
+{
+  std::vector<CertKey> keys(count);
+  for (size_t i = 0; i < count; ++i) {
+    std::memset(keys[i].issuerSPKIHash, static_cast<int>(i % 7),
+                sizeof(keys[i].issuerSPKIHash));
+    uint64_t serialNumber = (firstSerialNumber + i) * 0x9E3779B97F4A7C15ull;
+    for (size_t j = 0; j < sizeof(keys[i].serialNumber); ++j) {
+      keys[i].serialNumber[j] = static_cast<uint8_t>(serialNumber >> (8 * j));
+    }
+  }
+  return keys;
+}
+
+class Filter final
+{
+public:
+  Filter(uint8_t level, size_t elementCount, double falsePositiveRate)
+    : level(level)
+    , hashCount(static_cast<uint8_t>(
+                  std::max(1.0, std::ceil(-std::log2(falsePositiveRate)))))
+    , bitCount(static_cast<uint32_t>(
+                 std::max(8.0, std::ceil(elementCount * hashCount /
+                                         std::log(2.0)))))
+    , bits((bitCount + 7) / 8)
+  {
+  }
+
+  void Add(const CertKey& key)
+  {
+    for (uint8_t i = 0; i < hashCount; ++i) {
+      uint32_t bit = BitIndex(i, key);
+      bits[bit / 8] |= static_cast<uint8_t>(1u << (bit % 8));
+    }
+  }
+
+  bool Contains(const CertKey& key) const
+  {
+    for (uint8_t i = 0; i < hashCount; ++i) {
+      uint32_t bit = BitIndex(i, key);
+      if (!((bits[bit / 8] >> (bit % 8)) & 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void Encode(/*in/out*/ ByteString& encoded) const
+  {
+    encoded.push_back(static_cast<uint8_t>(bitCount >> 24));
+    encoded.push_back(static_cast<uint8_t>(bitCount >> 16));
+    encoded.push_back(static_cast<uint8_t>(bitCount >> 8));
+    encoded.push_back(static_cast<uint8_t>(bitCount));
+    encoded.push_back(hashCount);
+    encoded.append(bits.data(), bits.size());
+  }
+
+private:
+  uint32_t BitIndex(uint8_t hashIndex, const CertKey& key) const
+  {
+    uint32_t bit = 0;
+    EXPECT_EQ(Success,
+              RevocationFilterCascade::Hash(level, hashIndex, bitCount,
+                                            key.IssuerSPKIHash(),
+                                            key.SerialNumber(), bit));
+    return bit;
+  }
+
+  const uint8_t level;
+  const uint8_t hashCount;
+  const uint32_t bitCount;
+  std::vector<uint8_t> bits;
+};
+
+// The same construction as tools/BuildRevocationFilterCascade.py.
+ByteString
+BuildCascade(const std::vector<CertKey>& revoked,
+             const std::vector<CertKey>& notRevoked)
+{
+  static const uint8_t HEADER[] = { 'p', 'k', 'f', 'c', 1 };
+  ByteString levels;
+  uint8_t levelCount = 0;
+  std::vector<CertKey> included(revoked);
+  std::vector<CertKey> excluded(notRevoked);
+  double falsePositiveRate = 1.0 / 64;
+  for (;;) {
+    EXPECT_TRUE(levelCount < RevocationFilterCascade::MAX_LEVELS);
+    Filter filter(levelCount, included.size(), falsePositiveRate);
+    for (const CertKey& key : included) {
+      filter.Add(key);
+    }
+    filter.Encode(levels);
+    ++levelCount;
+
+    std::vector<CertKey> falsePositives;
+    for (const CertKey& key : excluded) {
+      if (filter.Contains(key)) {
+        falsePositives.push_back(key);
+      }
+    }
+    if (falsePositives.empty()) {
+      break;
+    }
+    excluded.swap(included);
+    included.swap(falsePositives);
+    falsePositiveRate = 0.5;
+  }
+
+  ByteString result(HEADER, sizeof(HEADER));
+  result.push_back(levelCount);
+  result.append(levels);
+  return result;
+}
+
+} // unnamed namespace
+
+class pkixfiltercascade_RevocationFilterCascade : public ::testing::Test
+{
+protected:
+  static Result CheckRevocation(const RevocationFilterCascade& cascade,
+                                const CertKey& key)
+  {
+    return cascade.CheckRevocation(key.IssuerSPKIHash(), key.SerialNumber());
+  }
+};
+
+// Built by tools/BuildRevocationFilterCascade.py with the issuer SPKI digest
+// 0x11 * 32, serial numbers 1 through 8 revoked, and serial numbers 9
+// through 255 not revoked.
+static const uint8_t CASCADE_FROM_TOOL[] = {
+  0x70, 0x6b, 0x66, 0x63, 0x01, 0x07, 0x00, 0x00, 0x00, 0x46, 0x06, 0x25,
+  0x9b, 0x5f, 0x56, 0x7c, 0xf3, 0x38, 0x9c, 0x23, 0x00, 0x00, 0x00, 0x0f,
+  0x01, 0xd8, 0x0d, 0x00, 0x00, 0x00, 0x08, 0x01, 0x63, 0x00, 0x00, 0x00,
+  0x0b, 0x01, 0x8f, 0x05, 0x00, 0x00, 0x00, 0x08, 0x01, 0x90, 0x00, 0x00,
+  0x00, 0x08, 0x01, 0x07, 0x00, 0x00, 0x00, 0x08, 0x01, 0x01
+};
+
+TEST_F(pkixfiltercascade_RevocationFilterCascade, CascadeFromTool)
+{
+  RevocationFilterCascade cascade;
+  ASSERT_EQ(Success, cascade.Init(CASCADE_FROM_TOOL,
+                                  sizeof(CASCADE_FROM_TOOL)));
+  uint8_t issuerSPKIHash[RevocationFilterCascade::ISSUER_SPKI_HASH_LENGTH];
+  std::memset(issuerSPKIHash, 0x11, sizeof(issuerSPKIHash));
+  for (unsigned int i = 1; i <= 255; ++i) {
+    uint8_t serialNumber[1] = { static_cast<uint8_t>(i) };
+    ASSERT_EQ(i <= 8 ? Result::ERROR_REVOKED_CERTIFICATE : Success,
+              cascade.CheckRevocation(Input(issuerSPKIHash),
+                                      Input(serialNumber)));
+  }
+}
+
+TEST_F(pkixfiltercascade_RevocationFilterCascade, NoFalsePositives)
+{
+  std::vector<CertKey> revoked(MakeCertKeys(10000, 0));
+  std::vector<CertKey> notRevoked(MakeCertKeys(100000, 10000));
+  ByteString encoded(BuildCascade(revoked, notRevoked));
+
+  RevocationFilterCascade cascade;
+  ASSERT_EQ(Success, cascade.Init(encoded.data(), encoded.length()));
+  for (const CertKey& key : revoked) {
+    ASSERT_EQ(Result::ERROR_REVOKED_CERTIFICATE,
+              CheckRevocation(cascade, key));
+  }
+  for (const CertKey& key : notRevoked) {
+    ASSERT_EQ(Success, CheckRevocation(cascade, key));
+  }
+}
+
+TEST_F(pkixfiltercascade_RevocationFilterCascade, Malformed)
+{
+  ByteString good(CASCADE_FROM_TOOL, sizeof(CASCADE_FROM_TOOL));
+  {
+    RevocationFilterCascade cascade;
+    ByteString bad(good);
+    bad[0] = 'P';
+    ASSERT_EQ(Result::ERROR_BAD_DER, cascade.Init(bad.data(), bad.length()));
+  }
+  {
+    RevocationFilterCascade cascade;
+    ByteString bad(good);
+    bad[4] = 2; // version
+    ASSERT_EQ(Result::ERROR_BAD_DER, cascade.Init(bad.data(), bad.length()));
+  }
+  {
+    RevocationFilterCascade cascade;
+    ByteString bad(good);
+    bad[5] = 0; // levelCount
+    ASSERT_EQ(Result::ERROR_BAD_DER, cascade.Init(bad.data(), bad.length()));
+  }
+  {
+    RevocationFilterCascade cascade;
+    ByteString bad(good);
+    bad[10] = 0; // hashCount of the first level
+    ASSERT_EQ(Result::ERROR_BAD_DER, cascade.Init(bad.data(), bad.length()));
+  }
+  {
+    RevocationFilterCascade cascade;
+    ByteString bad(good, 0, good.length() - 1);
+    ASSERT_EQ(Result::ERROR_BAD_DER, cascade.Init(bad.data(), bad.length()));
+  }
+  {
+    RevocationFilterCascade cascade;
+    ByteString bad(good);
+    bad.push_back(0);
+    ASSERT_EQ(Result::ERROR_BAD_DER, cascade.Init(bad.data(), bad.length()));
+  }
+  {
+    // The first level has 70 bits, so the top two bits of its last byte must
+    // be zero.
+    RevocationFilterCascade cascade;
+    ByteString bad(good);
+    bad[19] |= 0x80;
+    ASSERT_EQ(Result::ERROR_BAD_DER, cascade.Init(bad.data(), bad.length()));
+  }
+  {
+    RevocationFilterCascade cascade;
+    uint8_t issuerSPKIHash[1] = { 0 };
+    uint8_t serialNumber[1] = { 1 };
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+              cascade.CheckRevocation(Input(issuerSPKIHash),
+                                      Input(serialNumber)));
+    ASSERT_EQ(Success, cascade.Init(good.data(), good.length()));
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+              cascade.CheckRevocation(Input(issuerSPKIHash),
+                                      Input(serialNumber)));
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+              cascade.Init(good.data(), good.length()));
+  }
+}
+
+TEST_F(pkixfiltercascade_RevocationFilterCascade,
+       DISABLED_Benchmark_CheckRevocation)
+{
+  std::vector<CertKey> revoked(MakeCertKeys(10000, 0));
+  std::vector<CertKey> notRevoked(MakeCertKeys(1000000, 10000));
+  ByteString encoded(BuildCascade(revoked, notRevoked));
+
+  RevocationFilterCascade cascade;
+  ASSERT_EQ(Success, cascade.Init(encoded.data(), encoded.length()));
+
+  size_t i = 0;
+  Benchmark("RevocationFilterCascade::CheckRevocation", notRevoked.size(),
+            [&]() {
+    ASSERT_EQ(Success, CheckRevocation(cascade, notRevoked[i]));
+    ++i;
+  });
+  i = 0;
+  Benchmark("RevocationFilterCascade::CheckRevocation (revoked)",
+            revoked.size(), [&]() {
+    ASSERT_EQ(Result::ERROR_REVOKED_CERTIFICATE,
+              CheckRevocation(cascade, revoked[i]));
+    ++i;
+  });
+}
@@ -24,6 +24,8 @@
 
 #include "pkixgtest.h"
 
+#include <chrono>
+#include <cstdio>
 #include <ctime>
 
 #include "pkix/Time.h"
@@ -41,4 +43,17 @@ const std::time_t oneDayBeforeNow(time(nullptr) -
 const std::time_t oneDayAfterNow(time(nullptr) +
                                  ONE_DAY_IN_SECONDS_AS_TIME_T);
 
+void
+Benchmark(const char* name, size_t iterations, const std::function<void()>& f)
+{
+  std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+  for (size_t i = 0; i < iterations; ++i) {
+    f();
+  }
+  std::chrono::nanoseconds elapsed(std::chrono::steady_clock::now() - start);
+  std::printf("[ BENCHMARK] %s: %zu iterations, %.1f ns/iteration\n", name,
+              iterations, static_cast<double>(elapsed.count()) /
+                           static_cast<double>(iterations ? iterations : 1));
+}
+
 } } } // namespace mozilla::pkix::test
@@ -24,6 +24,7 @@
 #ifndef mozilla_pkix_pkixgtest_h
 #define mozilla_pkix_pkixgtest_h
 
+#include <functional>
 #include <ostream>
 
 #if defined(__clang__)
@@ -83,6 +84,14 @@ extern const std::time_t now;
 extern const std::time_t oneDayBeforeNow;
 extern const std::time_t oneDayAfterNow;
 
+// Runs f iterations times and reports the average time per iteration. This is
+// used by the tests named DISABLED_Benchmark_*, which are too slow for every
+// run and so only run when --gtest_also_run_disabled_tests is given (e.g.
+// with --gtest_filter=*Benchmark_*). What they check is also checked by
+// normal-sized tests.
+void Benchmark(const char* name, size_t iterations,
+               const std::function<void()>& f);
+
 
 class EverythingFailsByDefaultTrustDomain : public TrustDomain
 {
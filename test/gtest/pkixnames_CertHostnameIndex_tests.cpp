@@ -0,0 +1,367 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pkixder.h"
+#include "pkixgtest.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+// Certificates for the index don't need valid signatures, and signing
+// hundreds of thousands of them would take too long.
+class UnsignedKeyPair final : public TestKeyPair
+{
+public:
+  explicit UnsignedKeyPair(const TestKeyPair& keyPair)
+    : TestKeyPair(keyPair.publicKeyAlg, keyPair.subjectPublicKey)
+  {
+  }
+
+  Result SignData(const ByteString&, const TestSignatureAlgorithm&,
+                  /*out*/ ByteString& signature) const override
+  {
+    signature.assign(256, 0x5a);
+    return Success;
+  }
+
+  TestKeyPair* Clone() const override
+  {
+    return new UnsignedKeyPair(static_cast<const TestKeyPair&>(*this));
+  }
+};
+
+ByteString
+ASCII(const std::string& s)
+{
+  return ByteString(reinterpret_cast<const uint8_t*>(s.data()), s.length());
+}
+
+ByteString
+DNSName(const std::string& name)
+{
+  return mozilla::pkix::test::DNSName(ASCII(name));
+}
+
+class pkixnames_CertHostnameIndex : public ::testing::Test
+{
+public:
+  static void SetUpTestCase()
+  {
+    ScopedTestKeyPair reusedKeyPair(CloneReusedKeyPair());
+    keyPair = new UnsignedKeyPair(*reusedKeyPair);
+  }
+
+  static void TearDownTestCase()
+  {
+    delete keyPair;
+    keyPair = nullptr;
+  }
+
+protected:
+  static ByteString CreateCert(const ByteString& subject,
+                               /*optional*/ const ByteString* sans)
+  {
+    ByteString extensions[2];
+    if (sans) {
+      extensions[0] = CreateEncodedSubjectAltName(*sans);
+      EXPECT_FALSE(ENCODING_FAILED(extensions[0]));
+    }
+    ByteString certDER(CreateEncodedCertificate(
+                         v3, sha256WithRSAEncryption(),
+                         CreateEncodedSerialNumber(1), CNToDERName("issuer"),
+                         oneDayBeforeNow, oneDayAfterNow, subject, *keyPair,
+                         extensions, *keyPair, sha256WithRSAEncryption()));
+    EXPECT_FALSE(ENCODING_FAILED(certDER));
+    return certDER;
+  }
+
+  static Input InputFor(const ByteString& bytes)
+  {
+    Input input;
+    EXPECT_EQ(Success, input.Init(bytes.data(), bytes.length()));
+    return input;
+  }
+
+  static TestKeyPair* keyPair;
+};
+
+/*static*/ TestKeyPair* pkixnames_CertHostnameIndex::keyPair = nullptr;
+
+const char* const HOSTNAMES[] =
+{
+  "example.com",
+  "EXAMPLE.COM.",
+  "www.example.com",
+  "a.www.example.com",
+  "example.org",
+  "foo.example.org",
+  "a.b.example.org",
+  "shared.example",
+  "www.shared.example",
+  "localhost",
+  "other.example",
+  "1.2.3.4",
+  "5.6.7.8",
+  "2001:db8::1",
+  "not a hostname",
+  "",
+};
+
+} // unnamed namespace
+
+TEST_F(pkixnames_CertHostnameIndex, SameResultsAsCheckCertHostname)
+{
+  static const uint8_t ipv4[] = { 1, 2, 3, 4 };
+  static const uint8_t ipv6[] = {
+    0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1
+  };
+  const ByteString invalid(DNSName("invalid..example"));
+  const ByteString malformed(TLV(der::CONTEXT_SPECIFIC | 9, ByteString()));
+  const ByteString rfc822(RFC822Name("user@example.com"));
+  const ByteString sans[] = {
+    DNSName("example.com"),
+    DNSName("Example.COM") + DNSName("www.example.com"),
+    DNSName("*.example.org") + DNSName("example.org"),
+    DNSName("*.example.com") + DNSName("www.example.com"),
+    DNSName("shared.example") + DNSName("*.shared.example"),
+    DNSName("shared.example") + DNSName("shared.example"),
+    IPAddress(ipv4) + IPAddress(ipv6),
+    DNSName("example.com") + invalid + DNSName("*.example.org"),
+    invalid + DNSName("example.com") + IPAddress(ipv4),
+    DNSName("shared.example") + malformed + DNSName("example.com"),
+    malformed + IPAddress(ipv4),
+    rfc822,
+  };
+  const ByteString subjects[] = {
+    Name(RDN(CN("localhost"))),
+    Name(RDN(CN("1.2.3.4"))),
+    Name(RDN(CN("*.shared.example"))),
+    Name(RDN(CN("example.com")) + RDN(CN("Not a hostname"))),
+    Name(RDN(CN("shared.example", der::IA5String))),
+  };
+
+  std::vector<ByteString> certs;
+  for (const ByteString& san : sans) {
+    certs.push_back(CreateCert(Name(RDN(CN("other.example"))), &san));
+  }
+  for (const ByteString& subject : subjects) {
+    certs.push_back(CreateCert(subject, nullptr));
+    certs.push_back(CreateCert(subject, &rfc822));
+  }
+
+  std::vector<CertHostnameIndex::Entry> entries(256);
+  CertHostnameIndex index;
+  ASSERT_EQ(Success, index.Init(entries.data(), entries.size()));
+
+  auto checkAll = [&](const std::vector<bool>& present) {
+    for (const char* hostname : HOSTNAMES) {
+      Input hostnameInput;
+      ASSERT_EQ(Success,
+                hostnameInput.Init(reinterpret_cast<const uint8_t*>(hostname),
+                                   strlen(hostname)));
+      std::vector<size_t> expected;
+      for (size_t i = 0; i < certs.size(); ++i) {
+        if (present[i] &&
+            CheckCertHostname(InputFor(certs[i]), hostnameInput) == Success) {
+          expected.push_back(i);
+        }
+      }
+      static const size_t FOUND_CAPACITY = 64;
+      size_t found[FOUND_CAPACITY];
+      size_t foundCount;
+      ASSERT_EQ(Success, index.FindCertificates(hostnameInput, found,
+                                                FOUND_CAPACITY, foundCount));
+      ASSERT_TRUE(foundCount <= FOUND_CAPACITY);
+      std::vector<size_t> actual(found, found + foundCount);
+      std::sort(actual.begin(), actual.end());
+      ASSERT_EQ(expected, actual) << hostname;
+    }
+  };
+
+  std::vector<bool> present(certs.size(), true);
+  for (size_t i = 0; i < certs.size(); ++i) {
+    ASSERT_EQ(Success, index.AddCertificate(InputFor(certs[i]), i));
+  }
+  checkAll(present);
+
+  // Adding a certificate again changes nothing.
+  size_t entryCount = index.GetEntryCount();
+  ASSERT_EQ(Success, index.AddCertificate(InputFor(certs[1]), 1));
+  ASSERT_EQ(entryCount, index.GetEntryCount());
+
+  // Remove every other certificate, using a copy of it, and then add them
+  // back.
+  for (size_t i = 0; i < certs.size(); i += 2) {
+    ByteString copy(certs[i]);
+    ASSERT_EQ(Success, index.RemoveCertificate(InputFor(copy), i));
+    present[i] = false;
+  }
+  checkAll(present);
+  for (size_t i = 0; i < certs.size(); i += 2) {
+    ASSERT_EQ(Success, index.AddCertificate(InputFor(certs[i]), i));
+    present[i] = true;
+  }
+  checkAll(present);
+  ASSERT_EQ(entryCount, index.GetEntryCount());
+
+  for (size_t i = 0; i < certs.size(); ++i) {
+    ASSERT_EQ(Success, index.RemoveCertificate(InputFor(certs[i]), i));
+  }
+  ASSERT_EQ(0u, index.GetEntryCount());
+}
+
+TEST_F(pkixnames_CertHostnameIndex, FindMoreThanCapacity)
+{
+  std::vector<ByteString> certs;
+  for (size_t i = 0; i < 10; ++i) {
+    const ByteString san(i % 2 == 0 ? DNSName("www.example.com")
+                                    : DNSName("*.example.com"));
+    certs.push_back(CreateCert(Name(RDN(CN("a"))), &san));
+  }
+  std::vector<CertHostnameIndex::Entry> entries(16);
+  CertHostnameIndex index;
+  ASSERT_EQ(Success, index.Init(entries.data(), entries.size()));
+  for (size_t i = 0; i < certs.size(); ++i) {
+    ASSERT_EQ(Success, index.AddCertificate(InputFor(certs[i]), i));
+  }
+
+  static const uint8_t WWW_EXAMPLE_COM[] = {
+    'w', 'w', 'w', '.', 'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm'
+  };
+  size_t found[4];
+  size_t foundCount;
+  ASSERT_EQ(Success, index.FindCertificates(Input(WWW_EXAMPLE_COM), found, 4,
+                                            foundCount));
+  ASSERT_EQ(10u, foundCount);
+  ASSERT_EQ(Success, index.FindCertificates(Input(WWW_EXAMPLE_COM), nullptr,
+                                            0, foundCount));
+  ASSERT_EQ(10u, foundCount);
+}
+
+TEST_F(pkixnames_CertHostnameIndex, Errors)
+{
+  const ByteString sans(DNSName("a.example") + DNSName("b.example") +
+                        DNSName("c.example"));
+  const ByteString certDER(CreateCert(Name(RDN(CN("a"))), &sans));
+  static const uint8_t A_EXAMPLE[] = {
+    'a', '.', 'e', 'x', 'a', 'm', 'p', 'l', 'e'
+  };
+  size_t foundCount;
+
+  std::vector<CertHostnameIndex::Entry> entries(4);
+  CertHostnameIndex index;
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+            index.AddCertificate(InputFor(certDER), 0));
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+            index.FindCertificates(Input(A_EXAMPLE), nullptr, 0,
+                                   foundCount));
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+            index.Init(entries.data(), 3));
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS, index.Init(nullptr, 4));
+  ASSERT_EQ(Success, index.Init(entries.data(), entries.size()));
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+            index.Init(entries.data(), entries.size()));
+
+  // Three entries fit, but not four; a certificate is added completely or not
+  // at all.
+  ASSERT_EQ(Success, index.AddCertificate(InputFor(certDER), 0));
+  ASSERT_EQ(3u, index.GetEntryCount());
+  ASSERT_EQ(Result::FATAL_ERROR_NO_MEMORY,
+            index.AddCertificate(InputFor(certDER), 1));
+  ASSERT_EQ(3u, index.GetEntryCount());
+
+  // Not a certificate.
+  ASSERT_EQ(Result::ERROR_BAD_DER,
+            index.AddCertificate(Input(A_EXAMPLE), 2));
+
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+            index.FindCertificates(Input(A_EXAMPLE), nullptr, 1,
+                                   foundCount));
+  ASSERT_EQ(Success,
+            index.FindCertificates(Input(A_EXAMPLE), nullptr, 0,
+                                   foundCount));
+  ASSERT_EQ(1u, foundCount);
+}
+
+// A frontend choosing among many certificates, each for a few names of a
+// tenant, scaled down from hundreds of thousands of certificates so that the
+// baseline finishes quickly.
+TEST_F(pkixnames_CertHostnameIndex, DISABLED_Benchmark_ManyCertificates)
+{
+  static const size_t CERT_COUNT = 50000;
+  std::vector<ByteString> certs;
+  certs.reserve(CERT_COUNT);
+  for (size_t i = 0; i < CERT_COUNT; ++i) {
+    const std::string tenant("tenant" + std::to_string(i) + ".example");
+    const ByteString sans(DNSName(tenant) + DNSName("www." + tenant) +
+                          DNSName("*.cdn." + tenant));
+    certs.push_back(CreateCert(Name(RDN(CN(tenant.c_str()))), &sans));
+  }
+
+  std::vector<CertHostnameIndex::Entry> entries(1u << 18);
+  CertHostnameIndex index;
+  ASSERT_EQ(Success, index.Init(entries.data(), entries.size()));
+  Benchmark("CertHostnameIndex::AddCertificate", 1, [&]() {
+    for (size_t i = 0; i < certs.size(); ++i) {
+      ASSERT_EQ(Success, index.AddCertificate(InputFor(certs[i]), i));
+    }
+  });
+
+  std::vector<ByteString> hostnames;
+  for (size_t i = 0; i < 1000; ++i) {
+    size_t tenant = (i * 7919) % CERT_COUNT;
+    hostnames.push_back(ASCII((i % 2 == 0 ? "www." : "img.cdn.") +
+                              std::string("tenant") +
+                              std::to_string(tenant) + ".example"));
+  }
+
+  Benchmark("CertHostnameIndex::FindCertificates x 1000", 20, [&]() {
+    for (const ByteString& hostname : hostnames) {
+      size_t found[4];
+      size_t foundCount;
+      ASSERT_EQ(Success, index.FindCertificates(InputFor(hostname), found, 4,
+                                                foundCount));
+      ASSERT_EQ(1u, foundCount);
+    }
+  });
+
+  // The alternative: check each candidate certificate in turn.
+  Benchmark("CheckCertHostname over all certificates x 1", 1, [&]() {
+    size_t foundCount = 0;
+    for (const ByteString& cert : certs) {
+      if (CheckCertHostname(InputFor(cert), InputFor(hostnames[0]))
+            == Success) {
+        ++foundCount;
+      }
+    }
+    ASSERT_EQ(1u, foundCount);
+  });
+}
@@ -0,0 +1,285 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "pkixder.h"
+#include "pkixgtest.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+ByteString
+CreateCert(const ByteString& subject, /*optional*/ const ByteString* sans)
+{
+  ByteString serialNumber(CreateEncodedSerialNumber(1));
+  EXPECT_FALSE(ENCODING_FAILED(serialNumber));
+
+  ByteString extensions[2];
+  if (sans) {
+    extensions[0] = CreateEncodedSubjectAltName(*sans);
+    EXPECT_FALSE(ENCODING_FAILED(extensions[0]));
+  }
+
+  ScopedTestKeyPair keyPair(CloneReusedKeyPair());
+  return CreateEncodedCertificate(
+                    v3, sha256WithRSAEncryption(), serialNumber,
+                    CNToDERName("issuer"), oneDayBeforeNow, oneDayAfterNow,
+                    subject, *keyPair, extensions, *keyPair,
+                    sha256WithRSAEncryption());
+}
+
+ByteString
+DNSName(const std::string& name)
+{
+  return mozilla::pkix::test::DNSName(
+    ByteString(reinterpret_cast<const uint8_t*>(name.data()), name.length()));
+}
+
+const char* const HOSTNAMES[] =
+{
+  "example.com",
+  "EXAMPLE.com",
+  "example.com.",
+  "www.example.com",
+  "a.www.example.com",
+  "foo.example.org",
+  "FOO.Example.ORG.",
+  "example.org",
+  "a.b.example.org",
+  "b.example.net",
+  "x.b.example.net",
+  "x.y.b.example.net",
+  "host7.example",
+  "host77.example",
+  "localhost",
+  "1.2.3.4",
+  "1.2.3.5",
+  "10.0.0.1",
+  "::1",
+  "2001:db8::1",
+  "not a hostname",
+  "",
+  ".",
+  "example..com",
+};
+
+class pkixnames_CertHostnameMatcher : public ::testing::Test
+{
+protected:
+  static void CheckAllHostnamesBothWays(const ByteString& certDER)
+  {
+    ASSERT_FALSE(ENCODING_FAILED(certDER));
+    Input cert;
+    ASSERT_EQ(Success, cert.Init(certDER.data(), certDER.length()));
+
+    std::vector<CertHostnameMatcher::Entry> entries(
+      CertHostnameMatcher::MaxEntryCount(cert));
+    CertHostnameMatcher matcher;
+    ASSERT_EQ(Success, matcher.Init(cert, entries.data(), entries.size()));
+    for (const char* hostname : HOSTNAMES) {
+      Input hostnameInput;
+      ASSERT_EQ(Success,
+                hostnameInput.Init(reinterpret_cast<const uint8_t*>(hostname),
+                                   strlen(hostname)));
+      ASSERT_EQ(CheckCertHostname(cert, hostnameInput),
+                matcher.CheckHostname(hostnameInput))
+        << hostname;
+    }
+  }
+};
+
+} // unnamed namespace
+
+TEST_F(pkixnames_CertHostnameMatcher, SameResultsAsCheckCertHostname)
+{
+  static const uint8_t ipv4[] = { 1, 2, 3, 4 };
+  static const uint8_t ipv6[] = {
+    0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1
+  };
+  static const uint8_t badLength[] = { 1, 2, 3, 4, 5 };
+
+  ByteString names(DNSName("example.com") +
+                   DNSName("WWW.EXAMPLE.COM") +
+                   DNSName("www.example.com") +
+                   DNSName("*.example.org") +
+                   DNSName("*.b.example.net") +
+                   IPAddress(ipv4) +
+                   IPAddress(ipv6) +
+                   IPAddress(badLength) +
+                   RFC822Name("user@example.com"));
+  for (int i = 0; i < 50; ++i) {
+    names.append(DNSName("host" + std::to_string(i) + ".example"));
+  }
+  const ByteString subject(Name(RDN(CN("localhost"))));
+
+  CheckAllHostnamesBothWays(CreateCert(subject, &names));
+
+  // An invalid dNSName is an error for DNS-IDs that aren't matched by an
+  // earlier name.
+  const ByteString invalid(DNSName("invalid..example"));
+  const ByteString withInvalid[] = {
+    invalid + names,
+    names + invalid,
+    DNSName("example.com") + invalid + DNSName("*.example.org"),
+  };
+  for (const ByteString& sans : withInvalid) {
+    CheckAllHostnamesBothWays(CreateCert(subject, &sans));
+  }
+
+  // A malformed GeneralName is an error for every reference ID that isn't
+  // matched by an earlier name.
+  const ByteString malformed(TLV(der::CONTEXT_SPECIFIC | 9, ByteString()));
+  const ByteString withMalformed[] = {
+    malformed + names,
+    DNSName("example.com") + IPAddress(ipv4) + malformed + names,
+  };
+  for (const ByteString& sans : withMalformed) {
+    CheckAllHostnamesBothWays(CreateCert(subject, &sans));
+  }
+}
+
+TEST_F(pkixnames_CertHostnameMatcher, CommonName)
+{
+  static const uint8_t ipv4[] = { 1, 2, 3, 4 };
+
+  // The most specific CN is used only if there is no dNSName or iPAddress.
+  const ByteString subjects[] = {
+    Name(RDN(CN("localhost"))),
+    Name(RDN(CN("example.com")) + RDN(CN("*.example.org"))),
+    Name(RDN(CN("example.com")) + RDN(CN("Not a DNS name"))),
+    Name(RDN(CN("1.2.3.4"))),
+    Name(RDN(CN("1.2.3.4", der::PrintableString))),
+    Name(RDN(CN("example.com", der::IA5String))),
+    Name(ByteString()),
+  };
+  const ByteString rfc822Only(RFC822Name("user@example.com"));
+  const ByteString ipOnly(IPAddress(ipv4));
+  for (const ByteString& subject : subjects) {
+    CheckAllHostnamesBothWays(CreateCert(subject, nullptr));
+    CheckAllHostnamesBothWays(CreateCert(subject, &rfc822Only));
+    CheckAllHostnamesBothWays(CreateCert(subject, &ipOnly));
+  }
+}
+
+TEST_F(pkixnames_CertHostnameMatcher, InitErrors)
+{
+  const ByteString names(DNSName("example.com") + DNSName("example.org"));
+  const ByteString certDER(CreateCert(Name(RDN(CN("a"))), &names));
+  ASSERT_FALSE(ENCODING_FAILED(certDER));
+  Input cert;
+  ASSERT_EQ(Success, cert.Init(certDER.data(), certDER.length()));
+  static const uint8_t EXAMPLE_COM[] = {
+    'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm'
+  };
+
+  std::vector<CertHostnameMatcher::Entry> entries(
+    CertHostnameMatcher::MaxEntryCount(cert));
+  {
+    CertHostnameMatcher matcher;
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+              matcher.CheckHostname(Input(EXAMPLE_COM)));
+    // Two names need a table of four entries.
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+              matcher.Init(cert, entries.data(), 3));
+  }
+  {
+    CertHostnameMatcher matcher;
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+              matcher.Init(cert, nullptr, entries.size()));
+  }
+  {
+    CertHostnameMatcher matcher;
+    ASSERT_EQ(Success, matcher.Init(cert, entries.data(), 4));
+    ASSERT_EQ(Success, matcher.CheckHostname(Input(EXAMPLE_COM)));
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+              matcher.Init(cert, entries.data(), entries.size()));
+  }
+  {
+    // Not a certificate.
+    CertHostnameMatcher matcher;
+    ASSERT_EQ(Result::ERROR_BAD_DER,
+              matcher.Init(Input(EXAMPLE_COM), entries.data(),
+                           entries.size()));
+  }
+}
+
+// A certificate with a hundred names, checked against hundreds of hostnames,
+// as when choosing certificates by SNI or validating a CDN configuration.
+TEST_F(pkixnames_CertHostnameMatcher, DISABLED_Benchmark_HundredsOfHostnames)
+{
+  ByteString names;
+  for (int i = 0; i < 90; ++i) {
+    names.append(DNSName("www.site" + std::to_string(i) + ".example"));
+  }
+  for (int i = 0; i < 10; ++i) {
+    names.append(DNSName("*.cdn" + std::to_string(i) + ".example"));
+  }
+  const ByteString certDER(CreateCert(Name(RDN(CN("www.site0.example"))),
+                                      &names));
+  ASSERT_FALSE(ENCODING_FAILED(certDER));
+  Input cert;
+  ASSERT_EQ(Success, cert.Init(certDER.data(), certDER.length()));
+
+  std::vector<std::string> hostnames;
+  for (int i = 0; i < 300; ++i) {
+    hostnames.push_back(i % 3 == 0
+                          ? "www.site" + std::to_string(i % 120) + ".example"
+                        : i % 3 == 1
+                          ? "a" + std::to_string(i) + ".cdn" +
+                            std::to_string(i % 12) + ".example"
+                          : "unrelated" + std::to_string(i) + ".example");
+  }
+  std::vector<Input> hostnameInputs;
+  std::vector<Result> expected;
+  hostnameInputs.reserve(hostnames.size());
+  for (const std::string& hostname : hostnames) {
+    Input hostnameInput;
+    ASSERT_EQ(Success, hostnameInput.Init(
+                         reinterpret_cast<const uint8_t*>(hostname.data()),
+                         hostname.length()));
+    hostnameInputs.push_back(hostnameInput);
+    expected.push_back(CheckCertHostname(cert, hostnameInput));
+  }
+
+  Benchmark("CheckCertHostname x 300", 20, [&]() {
+    for (size_t i = 0; i < hostnameInputs.size(); ++i) {
+      ASSERT_EQ(expected[i], CheckCertHostname(cert, hostnameInputs[i]));
+    }
+  });
+
+  std::vector<CertHostnameMatcher::Entry> entries(
+    CertHostnameMatcher::MaxEntryCount(cert));
+  Benchmark("CertHostnameMatcher x 300", 20, [&]() {
+    CertHostnameMatcher matcher;
+    ASSERT_EQ(Success, matcher.Init(cert, entries.data(), entries.size()));
+    for (size_t i = 0; i < hostnameInputs.size(); ++i) {
+      ASSERT_EQ(expected[i], matcher.CheckHostname(hostnameInputs[i]));
+    }
+  });
+}
@@ -0,0 +1,367 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pkixder.h"
+#include "pkixgtest.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+ByteString
+ToByteString(const std::string& s)
+{
+  return ByteString(reinterpret_cast<const uint8_t*>(s.data()), s.length());
+}
+
+ByteString
+DNSName(const std::string& name)
+{
+  return mozilla::pkix::test::DNSName(ToByteString(name));
+}
+
+ByteString
+GeneralSubtree(const ByteString& base)
+{
+  return TLV(der::SEQUENCE, base);
+}
+
+ByteString
+CreateCert(const ByteString& subject,
+           /*optional*/ const ByteString* subjectAltName,
+           long serialNumberValue = 1)
+{
+  ByteString serialNumber(CreateEncodedSerialNumber(serialNumberValue));
+  EXPECT_FALSE(ENCODING_FAILED(serialNumber));
+
+  ByteString extensions[2];
+  if (subjectAltName) {
+    extensions[0] = CreateEncodedSubjectAltName(*subjectAltName);
+    EXPECT_FALSE(ENCODING_FAILED(extensions[0]));
+  }
+
+  ScopedTestKeyPair keyPair(CloneReusedKeyPair());
+  return CreateEncodedCertificate(
+                    v3, sha256WithRSAEncryption(), serialNumber,
+                    CNToDERName("issuer"), oneDayBeforeNow, oneDayAfterNow,
+                    subject, *keyPair, extensions, *keyPair,
+                    sha256WithRSAEncryption());
+}
+
+// Permits dNSNames and rfc822Names in example.com and IP addresses in
+// 10.0.0.0/8.
+ByteString
+ExampleNameConstraints()
+{
+  static const uint8_t ipv4Constraint[] = { 10, 0, 0, 0, 255, 0, 0, 0 };
+  return TLV(der::SEQUENCE,
+             TLV(der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 0,
+                 GeneralSubtree(DNSName("example.com")) +
+                 GeneralSubtree(RFC822Name("example.com")) +
+                 GeneralSubtree(IPAddress(ipv4Constraint))));
+}
+
+class pkixnames_CheckCertNameConstraints : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    nameConstraintsDER = ExampleNameConstraints();
+    ASSERT_EQ(Success, nameConstraints.Init(nameConstraintsDER.data(),
+                                            nameConstraintsDER.length()));
+    entries.resize(CompiledNameConstraints::MaxEntryCount(nameConstraints));
+    ASSERT_EQ(Success, compiled.Init(nameConstraints, entries.data(),
+                                     entries.size()));
+  }
+
+  ByteString nameConstraintsDER;
+  Input nameConstraints;
+  std::vector<CompiledNameConstraints::Entry> entries;
+  CompiledNameConstraints compiled;
+};
+
+} // unnamed namespace
+
+TEST_F(pkixnames_CheckCertNameConstraints, ViolatingNames)
+{
+  static const uint8_t ipv4[] = { 10, 1, 2, 3 };
+  static const uint8_t otherIPv4[] = { 192, 168, 1, 1 };
+  ByteString manyNames;
+  for (int i = 0; i < 20; ++i) {
+    manyNames.append(DNSName("host" + std::to_string(i) + ".example.com"));
+  }
+
+  struct Params
+  {
+    ByteString subject;
+    ByteString subjectAltName; // empty for none
+    EndEntityOrCA endEntityOrCA;
+    KeyPurposeId requiredEKUIfPresent;
+    Result expectedResult;
+    uint8_t expectedViolatingNameTag;
+    ByteString expectedViolatingName;
+  };
+  const ByteString notInExample(Name(RDN(CN("www.example.org"))));
+  const ByteString inExample(Name(RDN(CN("www.example.com"))));
+  const Params PARAMS[] = {
+    { notInExample, DNSName("www.example.com") + IPAddress(ipv4),
+      EndEntityOrCA::MustBeEndEntity, KeyPurposeId::id_kp_serverAuth,
+      Success, 0, ByteString() },
+    { inExample, DNSName("www.example.com") + DNSName("www.example.org") +
+                 DNSName("www.example.net"),
+      EndEntityOrCA::MustBeEndEntity, KeyPurposeId::id_kp_serverAuth,
+      Result::ERROR_CERT_NOT_IN_NAME_SPACE, der::CONTEXT_SPECIFIC | 2,
+      ToByteString("www.example.org") },
+    { inExample, DNSName("www.example.com") + IPAddress(otherIPv4),
+      EndEntityOrCA::MustBeEndEntity, KeyPurposeId::id_kp_serverAuth,
+      Result::ERROR_CERT_NOT_IN_NAME_SPACE, der::CONTEXT_SPECIFIC | 7,
+      ByteString(otherIPv4, sizeof(otherIPv4)) },
+    { inExample, RFC822Name("user@example.org"),
+      EndEntityOrCA::MustBeCA, KeyPurposeId::id_kp_serverAuth,
+      Result::ERROR_CERT_NOT_IN_NAME_SPACE, der::CONTEXT_SPECIFIC | 1,
+      ToByteString("user@example.org") },
+    { inExample, manyNames + DNSName("www.example.org"),
+      EndEntityOrCA::MustBeEndEntity, KeyPurposeId::id_kp_serverAuth,
+      Result::ERROR_CERT_NOT_IN_NAME_SPACE, der::CONTEXT_SPECIFIC | 2,
+      ToByteString("www.example.org") },
+
+    // Names in the subject.
+    { notInExample, ByteString(),
+      EndEntityOrCA::MustBeEndEntity, KeyPurposeId::id_kp_serverAuth,
+      Result::ERROR_CERT_NOT_IN_NAME_SPACE, der::CONTEXT_SPECIFIC | 2,
+      ToByteString("www.example.org") },
+    { Name(RDN(CN("192.168.1.1"))), ByteString(),
+      EndEntityOrCA::MustBeEndEntity, KeyPurposeId::id_kp_serverAuth,
+      Result::ERROR_CERT_NOT_IN_NAME_SPACE, der::CONTEXT_SPECIFIC | 7,
+      ToByteString("192.168.1.1") },
+    { Name(RDN(emailAddress("user@example.org")) + RDN(CN("www.example.com"))),
+      ByteString(),
+      EndEntityOrCA::MustBeEndEntity, KeyPurposeId::id_kp_serverAuth,
+      Result::ERROR_CERT_NOT_IN_NAME_SPACE, der::CONTEXT_SPECIFIC | 1,
+      ToByteString("user@example.org") },
+    // The CN is checked when the subjectAltName has no dNSName or iPAddress.
+    { notInExample, RFC822Name("user@example.com"),
+      EndEntityOrCA::MustBeEndEntity, KeyPurposeId::id_kp_serverAuth,
+      Result::ERROR_CERT_NOT_IN_NAME_SPACE, der::CONTEXT_SPECIFIC | 2,
+      ToByteString("www.example.org") },
+    // The CN is only checked for TLS server certificates.
+    { notInExample, ByteString(),
+      EndEntityOrCA::MustBeCA, KeyPurposeId::id_kp_serverAuth,
+      Success, 0, ByteString() },
+    { notInExample, ByteString(),
+      EndEntityOrCA::MustBeEndEntity, KeyPurposeId::id_kp_emailProtection,
+      Success, 0, ByteString() },
+
+    // Errors other than violations don't have a violating name.
+    { inExample, DNSName("www.example.com") + DNSName("invalid..example.com"),
+      EndEntityOrCA::MustBeEndEntity, KeyPurposeId::id_kp_serverAuth,
+      Result::ERROR_BAD_DER, 0, ByteString() },
+  };
+
+  for (const Params& params : PARAMS) {
+    const ByteString certDER(CreateCert(params.subject,
+                                        params.subjectAltName.empty()
+                                          ? nullptr
+                                          : &params.subjectAltName));
+    ASSERT_FALSE(ENCODING_FAILED(certDER));
+    Input cert;
+    ASSERT_EQ(Success, cert.Init(certDER.data(), certDER.length()));
+
+    uint8_t violatingNameTag = 0xff;
+    Input violatingName;
+    ASSERT_EQ(params.expectedResult,
+              CheckCertNameConstraints(compiled, cert, params.endEntityOrCA,
+                                       params.requiredEKUIfPresent,
+                                       &violatingNameTag, &violatingName));
+    ASSERT_EQ(params.expectedViolatingNameTag, violatingNameTag);
+    if (violatingNameTag) {
+      ASSERT_TRUE(InputEqualsByteString(violatingName,
+                                        params.expectedViolatingName));
+    }
+
+    // The violating name is optional.
+    ASSERT_EQ(params.expectedResult,
+              CheckCertNameConstraints(compiled, cert, params.endEntityOrCA,
+                                       params.requiredEKUIfPresent));
+  }
+}
+
+TEST_F(pkixnames_CheckCertNameConstraints, ViolatingSubject)
+{
+  const ByteString permittedSubject(Name(RDN(CN("Example"))));
+  const ByteString nameConstraintsDER(
+    TLV(der::SEQUENCE,
+        TLV(der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 0,
+            GeneralSubtree(DirectoryName(permittedSubject)))));
+  Input nameConstraintsInput;
+  ASSERT_EQ(Success, nameConstraintsInput.Init(nameConstraintsDER.data(),
+                                               nameConstraintsDER.length()));
+  std::vector<CompiledNameConstraints::Entry> subjectEntries(
+    CompiledNameConstraints::MaxEntryCount(nameConstraintsInput));
+  CompiledNameConstraints subjectConstraints;
+  ASSERT_EQ(Success, subjectConstraints.Init(nameConstraintsInput,
+                                             subjectEntries.data(),
+                                             subjectEntries.size()));
+
+  const ByteString subject(Name(RDN(CN("Other"))));
+  const ByteString sans(DNSName("www.example.com"));
+  const ByteString certDER(CreateCert(subject, &sans));
+  ASSERT_FALSE(ENCODING_FAILED(certDER));
+  Input cert;
+  ASSERT_EQ(Success, cert.Init(certDER.data(), certDER.length()));
+  uint8_t violatingNameTag;
+  Input violatingName;
+  ASSERT_EQ(Result::ERROR_CERT_NOT_IN_NAME_SPACE,
+            CheckCertNameConstraints(subjectConstraints, cert,
+                                     EndEntityOrCA::MustBeEndEntity,
+                                     KeyPurposeId::id_kp_serverAuth,
+                                     &violatingNameTag, &violatingName));
+  ASSERT_EQ(der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 4, violatingNameTag);
+  ASSERT_TRUE(InputEqualsByteString(violatingName, subject));
+}
+
+TEST_F(pkixnames_CheckCertNameConstraints, SameResultsInParallel)
+{
+  std::vector<ByteString> certDERs;
+  for (long i = 0; i < 300; ++i) {
+    ByteString sans(DNSName("host" + std::to_string(i) + ".example.com"));
+    if (i % 7 == 0) {
+      sans.append(DNSName("host" + std::to_string(i) + ".example.org"));
+    }
+    if (i % 11 == 0) {
+      sans.append(DNSName("invalid..example.com"));
+    }
+    certDERs.push_back(CreateCert(Name(RDN(CN("www.example.com"))), &sans,
+                                  i % 100 + 1));
+    ASSERT_FALSE(ENCODING_FAILED(certDERs.back()));
+  }
+  static const uint8_t NOT_A_CERT[] = { 0x30, 0x00 };
+  std::vector<Input> certs(certDERs.size() + 1);
+  for (size_t i = 0; i < certDERs.size(); ++i) {
+    ASSERT_EQ(Success, certs[i].Init(certDERs[i].data(),
+                                     certDERs[i].length()));
+  }
+  ASSERT_EQ(Success, certs.back().Init(Input(NOT_A_CERT)));
+
+  for (unsigned int threadCount : { 1u, 2u, 8u }) {
+    std::unique_ptr<NameConstraintsCheckResult[]> results(
+      new NameConstraintsCheckResult[certs.size()]);
+    ASSERT_EQ(Success,
+              CheckCertsNameConstraints(compiled, certs.data(), certs.size(),
+                                        EndEntityOrCA::MustBeEndEntity,
+                                        KeyPurposeId::id_kp_serverAuth,
+                                        results.get(), threadCount));
+    size_t violations = 0;
+    for (size_t i = 0; i < certs.size(); ++i) {
+      uint8_t violatingNameTag;
+      Input violatingName;
+      ASSERT_EQ(CheckCertNameConstraints(compiled, certs[i],
+                                         EndEntityOrCA::MustBeEndEntity,
+                                         KeyPurposeId::id_kp_serverAuth,
+                                         &violatingNameTag, &violatingName),
+                results[i].result);
+      ASSERT_EQ(violatingNameTag, results[i].violatingNameTag);
+      if (violatingNameTag) {
+        ASSERT_TRUE(InputsAreEqual(violatingName, results[i].violatingName));
+        ++violations;
+      }
+    }
+    ASSERT_EQ(Result::ERROR_BAD_DER, results[certs.size() - 1].result);
+    // i % 7 == 0, including i % 77 == 0, since the example.org name comes
+    // before the invalid one.
+    ASSERT_EQ(43u, violations);
+  }
+}
+
+TEST_F(pkixnames_CheckCertNameConstraints, InvalidArgs)
+{
+  NameConstraintsCheckResult results[1];
+  static const uint8_t NOT_A_CERT[] = { 0x30, 0x00 };
+  const Input certs[1] = { Input(NOT_A_CERT) };
+  for (unsigned int threadCount : { 0u, MAX_PARALLEL_THREADS + 1 }) {
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+              CheckCertsNameConstraints(compiled, certs, 1,
+                                        EndEntityOrCA::MustBeEndEntity,
+                                        KeyPurposeId::id_kp_serverAuth,
+                                        results, threadCount));
+  }
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+            CheckCertsNameConstraints(compiled, certs, 1,
+                                      EndEntityOrCA::MustBeEndEntity,
+                                      KeyPurposeId::id_kp_serverAuth,
+                                      nullptr, 1));
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+            CheckCertsNameConstraints(compiled, nullptr, 1,
+                                      EndEntityOrCA::MustBeEndEntity,
+                                      KeyPurposeId::id_kp_serverAuth,
+                                      results, 1));
+  ASSERT_EQ(Success,
+            CheckCertsNameConstraints(compiled, nullptr, 0,
+                                      EndEntityOrCA::MustBeEndEntity,
+                                      KeyPurposeId::id_kp_serverAuth,
+                                      nullptr, 1));
+}
+
+// A compliance pipeline checking everything a name-constrained CA issued.
+TEST_F(pkixnames_CheckCertNameConstraints, DISABLED_Benchmark_Throughput)
+{
+  std::vector<ByteString> certDERs;
+  for (long i = 0; i < 100; ++i) {
+    ByteString sans;
+    for (int j = 0; j < 5; ++j) {
+      sans.append(DNSName("host" + std::to_string(i) + "-" +
+                          std::to_string(j) + ".example.com"));
+    }
+    certDERs.push_back(CreateCert(Name(RDN(CN("www.example.com"))), &sans,
+                                  i + 1));
+    ASSERT_FALSE(ENCODING_FAILED(certDERs.back()));
+  }
+  std::vector<Input> certs(5000);
+  for (size_t i = 0; i < certs.size(); ++i) {
+    const ByteString& certDER(certDERs[i % certDERs.size()]);
+    ASSERT_EQ(Success, certs[i].Init(certDER.data(), certDER.length()));
+  }
+
+  for (unsigned int threadCount : { 1u, 4u }) {
+    std::string name("CheckCertsNameConstraints, 5000 certificates, " +
+                     std::to_string(threadCount) + " thread(s)");
+    Benchmark(name.c_str(), 10, [&]() {
+      std::unique_ptr<NameConstraintsCheckResult[]> results(
+        new NameConstraintsCheckResult[certs.size()]);
+      ASSERT_EQ(Success,
+                CheckCertsNameConstraints(compiled, certs.data(),
+                                          certs.size(),
+                                          EndEntityOrCA::MustBeEndEntity,
+                                          KeyPurposeId::id_kp_serverAuth,
+                                          results.get(), threadCount));
+      ASSERT_EQ(Success, results[certs.size() - 1].result);
+    });
+  }
+}
@@ -0,0 +1,632 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "pkixcheck.h"
+#include "pkixder.h"
+#include "pkixgtest.h"
+#include "pkixutil.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+ByteString
+PermittedSubtrees(const ByteString& generalSubtrees)
+{
+  return TLV(der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 0, generalSubtrees);
+}
+
+ByteString
+ExcludedSubtrees(const ByteString& generalSubtrees)
+{
+  return TLV(der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 1, generalSubtrees);
+}
+
+ByteString
+GeneralSubtree(const ByteString& base)
+{
+  return TLV(der::SEQUENCE, base);
+}
+
+ByteString
+IPAddress(const ByteString& addressAndMask)
+{
+  return TLV(der::CONTEXT_SPECIFIC | 7, addressAndMask);
+}
+
+ByteString
+Bytes(std::initializer_list<uint8_t> bytes)
+{
+  return ByteString(bytes.begin(), bytes.size());
+}
+
+ByteString
+AVA(uint8_t attributeType, const char* value,
+    uint8_t valueTag = der::PrintableString)
+{
+  // id-at OBJECT IDENTIFIER ::= { joint-iso-ccitt(2) ds(5) 4 }
+  const uint8_t tlvType[] = { 0x06, 0x03, 0x55, 0x04, attributeType };
+  return TLV(der::SEQUENCE,
+             ByteString(tlvType, sizeof(tlvType)) +
+             TLV(valueTag,
+                 ByteString(reinterpret_cast<const uint8_t*>(value),
+                            strlen(value))));
+}
+
+// id-at-countryName and id-at-organizationName.
+ByteString
+C(const char* value)
+{
+  return AVA(6, value);
+}
+
+ByteString
+O(const char* value, uint8_t valueTag = der::PrintableString)
+{
+  return AVA(10, value, valueTag);
+}
+
+ByteString
+CreateCert(const ByteString& subject, const ByteString& subjectAltName)
+{
+  ByteString serialNumber(CreateEncodedSerialNumber(1));
+  EXPECT_FALSE(ENCODING_FAILED(serialNumber));
+
+  ByteString extensions[2];
+  extensions[0] = CreateEncodedSubjectAltName(subjectAltName);
+  EXPECT_FALSE(ENCODING_FAILED(extensions[0]));
+
+  ScopedTestKeyPair keyPair(CloneReusedKeyPair());
+  return CreateEncodedCertificate(
+                    v3, sha256WithRSAEncryption(), serialNumber,
+                    CNToDERName("issuer"), oneDayBeforeNow, oneDayAfterNow,
+                    subject, *keyPair, extensions, *keyPair,
+                    sha256WithRSAEncryption());
+}
+
+// DNS constraints, including duplicates and constraints that are suffixes
+// of other constraints, so that the merged table entries are exercised.
+const char* const DNS_CONSTRAINTS[] =
+{
+  "example.com",
+  ".example.org",
+  "a.b.example.net",
+  "EXAMPLE.EDU",
+  "example.com",
+  ".b.example.net",
+  "xn--bcher-kva.example",
+  "corp",
+};
+
+const char* const RFC822_CONSTRAINTS[] =
+{
+  "user@example.com",
+  ".mail.example.com",
+  "example.org",
+  "Admin@Example.NET",
+};
+
+const char* const PRESENTED_DNS_IDS[] =
+{
+  "example.com",
+  "www.example.com",
+  "EXAMPLE.COM",
+  "notexample.com",
+  "example.org",
+  "www.example.org",
+  "WWW.Example.Org",
+  "a.b.example.net",
+  "x.a.b.example.net",
+  "b.example.net",
+  "c.b.example.net",
+  "*.b.example.net",
+  "*.example.com",
+  "*.example.org",
+  "*.www.example.org",
+  "example.edu",
+  "sub.example.edu",
+  "xn--bcher-kva.example",
+  "host.corp",
+  "corp",
+  "com",
+  "host7.example.info",
+  "invalid..example.com",
+  "example.com.",
+  "*",
+  "",
+};
+
+const char* const PRESENTED_RFC822_IDS[] =
+{
+  "user@example.com",
+  "USER@EXAMPLE.COM",
+  "other@example.com",
+  "x@mail.example.com",
+  "x@a.mail.example.com",
+  "x@example.org",
+  "x@sub.example.org",
+  "admin@example.net",
+  "bad@@example.com",
+  "noat",
+};
+
+class pkixnames_CompiledNameConstraints : public ::testing::Test
+{
+public:
+  static void SetUpTestCase()
+  {
+    const ByteString subject(CNToDERName("Example"));
+    for (const char* dnsID : PRESENTED_DNS_IDS) {
+      AddCert(subject, DNSName(BytesFor(dnsID)), dnsID);
+    }
+    for (const char* rfc822ID : PRESENTED_RFC822_IDS) {
+      AddCert(subject, RFC822Name(BytesFor(rfc822ID)), rfc822ID);
+    }
+    const ByteString ipAddresses[] = {
+      Bytes({ 192, 168, 1, 1 }),
+      Bytes({ 192, 169, 0, 1 }),
+      Bytes({ 10, 1, 2, 3 }),
+      Bytes({ 10, 1, 2, 4 }),
+      Bytes({ 11, 0, 0, 1 }),
+      Bytes({ 1, 2, 1, 4 }),
+      Bytes({ 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 }),
+      Bytes({ 0x20, 0x01, 0x0d, 0xb9, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 }),
+      Bytes({ 1, 2, 3, 4, 5 }),
+    };
+    for (const ByteString& ipAddress : ipAddresses) {
+      AddCert(subject, IPAddress(ipAddress), "(IP address)");
+    }
+    AddCert(CNToDERName("Other"), DNSName("www.example.com"),
+            "(subject CN=Other)");
+    AddCert(subject, DirectoryName(CNToDERName("Example")),
+            "(directoryName CN=Example)");
+    AddCert(subject, DirectoryName(CNToDERName("Nope")),
+            "(directoryName CN=Nope)");
+  }
+
+  static void TearDownTestCase()
+  {
+    certs.clear();
+  }
+
+protected:
+  struct TestCert
+  {
+    ByteString der;
+    const char* description;
+  };
+
+  static ByteString BytesFor(const char* s)
+  {
+    return ByteString(reinterpret_cast<const uint8_t*>(s), strlen(s));
+  }
+
+  static void AddCert(const ByteString& subject,
+                      const ByteString& subjectAltName,
+                      const char* description,
+                      std::vector<TestCert>& certsOut = certs)
+  {
+    TestCert cert;
+    cert.der = CreateCert(subject, subjectAltName);
+    ASSERT_FALSE(ENCODING_FAILED(cert.der));
+    cert.description = description;
+    certsOut.push_back(cert);
+  }
+
+  // The DNS, rfc822 and IP constraints, as GeneralSubtrees.
+  static ByteString AllSubtrees()
+  {
+    ByteString subtrees;
+    for (const char* constraint : DNS_CONSTRAINTS) {
+      subtrees.append(GeneralSubtree(DNSName(BytesFor(constraint))));
+    }
+    for (const char* constraint : RFC822_CONSTRAINTS) {
+      subtrees.append(GeneralSubtree(RFC822Name(BytesFor(constraint))));
+    }
+    subtrees.append(GeneralSubtree(IPAddress(
+      Bytes({ 192, 168, 0, 0, 255, 255, 0, 0 }))));
+    subtrees.append(GeneralSubtree(IPAddress(
+      Bytes({ 10, 0, 0, 0, 255, 0, 0, 0 }))));
+    subtrees.append(GeneralSubtree(IPAddress(
+      Bytes({ 10, 1, 2, 3, 255, 255, 255, 255 }))));
+    // A non-contiguous mask.
+    subtrees.append(GeneralSubtree(IPAddress(
+      Bytes({ 1, 0, 1, 0, 255, 0, 255, 0 }))));
+    subtrees.append(GeneralSubtree(IPAddress(
+      Bytes({ 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+              0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }))));
+    return subtrees;
+  }
+
+  // Checks every test certificate against the name constraints both directly
+  // and compiled, returning how many were accepted.
+  static size_t CheckAllCertsBothWays(
+                  const ByteString& nameConstraintsDER,
+                  const std::vector<TestCert>& certsToCheck = certs)
+  {
+    Input nameConstraints;
+    EXPECT_EQ(Success, nameConstraints.Init(nameConstraintsDER.data(),
+                                            nameConstraintsDER.length()));
+    std::vector<CompiledNameConstraints::Entry> entries(
+      CompiledNameConstraints::MaxEntryCount(nameConstraints));
+    CompiledNameConstraints compiled;
+    EXPECT_EQ(Success, compiled.Init(nameConstraints, entries.data(),
+                                     entries.size()));
+    size_t accepted = 0;
+    for (const TestCert& testCert : certsToCheck) {
+      Input certInput;
+      EXPECT_EQ(Success, certInput.Init(testCert.der.data(),
+                                        testCert.der.length()));
+      BackCert cert(certInput, EndEntityOrCA::MustBeEndEntity, nullptr);
+      EXPECT_EQ(Success, cert.Init());
+      Result expected = CheckNameConstraints(nameConstraints, cert,
+                                             KeyPurposeId::id_kp_serverAuth);
+      EXPECT_EQ(expected,
+                CheckNameConstraints(compiled, cert,
+                                     KeyPurposeId::id_kp_serverAuth))
+        << testCert.description;
+      if (expected == Success) {
+        ++accepted;
+      }
+    }
+    return accepted;
+  }
+
+  static std::vector<TestCert> certs;
+};
+
+/*static*/ std::vector<pkixnames_CompiledNameConstraints::TestCert>
+  pkixnames_CompiledNameConstraints::certs;
+
+} // unnamed namespace
+
+TEST_F(pkixnames_CompiledNameConstraints, SameResultsAsUncompiled)
+{
+  const ByteString subtrees(AllSubtrees());
+
+  size_t permitted = CheckAllCertsBothWays(
+    TLV(der::SEQUENCE, PermittedSubtrees(subtrees)));
+  size_t excluded = CheckAllCertsBothWays(
+    TLV(der::SEQUENCE, ExcludedSubtrees(subtrees)));
+  // Every certificate is either malformed, or accepted by exactly one of the
+  // two.
+  ASSERT_TRUE(permitted > 0);
+  ASSERT_TRUE(excluded > 0);
+  ASSERT_TRUE(permitted + excluded <= certs.size());
+
+  CheckAllCertsBothWays(TLV(der::SEQUENCE, PermittedSubtrees(subtrees) +
+                                           ExcludedSubtrees(subtrees)));
+
+  const ByteString example(
+    GeneralSubtree(DirectoryName(CNToDERName("Example"))));
+  const ByteString nope(GeneralSubtree(DirectoryName(CNToDERName("Nope"))));
+  CheckAllCertsBothWays(TLV(der::SEQUENCE,
+                            PermittedSubtrees(subtrees + example)));
+  CheckAllCertsBothWays(TLV(der::SEQUENCE,
+                            PermittedSubtrees(example + subtrees) +
+                            ExcludedSubtrees(nope + subtrees)));
+}
+
+TEST_F(pkixnames_CompiledNameConstraints, SameResultsWhenSplit)
+{
+  // Some constraints of each type are permitted and the others excluded.
+  ByteString permitted;
+  ByteString excluded;
+  bool even = true;
+  for (const char* constraint : DNS_CONSTRAINTS) {
+    (even ? permitted : excluded)
+      .append(GeneralSubtree(DNSName(BytesFor(constraint))));
+    even = !even;
+  }
+  for (const char* constraint : RFC822_CONSTRAINTS) {
+    (even ? permitted : excluded)
+      .append(GeneralSubtree(RFC822Name(BytesFor(constraint))));
+    even = !even;
+  }
+  permitted.append(GeneralSubtree(IPAddress(
+    Bytes({ 10, 0, 0, 0, 255, 0, 0, 0 }))));
+  excluded.append(GeneralSubtree(IPAddress(
+    Bytes({ 10, 1, 0, 0, 255, 255, 0, 0 }))));
+  permitted.append(GeneralSubtree(DirectoryName(CNToDERName("Example"))));
+  excluded.append(GeneralSubtree(DirectoryName(CNToDERName("Nope"))));
+
+  CheckAllCertsBothWays(TLV(der::SEQUENCE, PermittedSubtrees(permitted) +
+                                           ExcludedSubtrees(excluded)));
+}
+
+TEST_F(pkixnames_CompiledNameConstraints, DirectoryNames)
+{
+  const ByteString usGov(RDN(C("US")) + RDN(O("U.S. Government")));
+  const ByteString malformedRDN(TLV(der::SET, Bytes({ 0x05, 0x00 })));
+  const ByteString presented[] = {
+    Name(ByteString()),
+    Name(RDN(C("US"))),
+    Name(usGov),
+    Name(usGov + RDN(OU("DoD"))),
+    Name(usGov + RDN(OU("DoD")) + RDN(OU("PKI")) + RDN(CN("Alice"))),
+    Name(usGov + RDN(OU("DHS")) + RDN(CN("Bob"))),
+    // UTF8String and PrintableString values are interchangeable, but other
+    // string types aren't.
+    Name(RDN(C("US")) + RDN(O("U.S. Government", der::UTF8String)) +
+         RDN(OU("DoD", der::PrintableString))),
+    Name(RDN(C("US")) + RDN(O("U.S. Government", der::IA5String))),
+    // RDNs with several AVAs, in either order.
+    Name(RDN(C("US")) + RDN(O("U.S. Government") + OU("DoD"))),
+    Name(RDN(C("US")) + RDN(OU("DoD") + O("U.S. Government"))),
+    Name(RDN(C("US")) + TLV(der::SET, ByteString())),
+    // Malformed after, and at, the point where the constraints stop
+    // matching.
+    Name(usGov + RDN(OU("DoD")) + malformedRDN),
+    Name(usGov + malformedRDN),
+    Name(RDN(C("UK")) + malformedRDN),
+    TLV(der::SEQUENCE, RDN(C("US")) + Bytes({ 0x31 })),
+  };
+  std::vector<TestCert> directoryNameCerts;
+  for (size_t i = 0; i < MOZILLA_PKIX_ARRAY_LENGTH(presented); ++i) {
+    AddCert(CNToDERName("Example"), DirectoryName(presented[i]),
+            "(directoryName)", directoryNameCerts);
+    AddCert(presented[i], DNSName("example.com"), "(subject)",
+            directoryNameCerts);
+  }
+  // Many RDNs, more than the keys that are compared.
+  ByteString manyRDNs(usGov);
+  for (int i = 0; i < 40; ++i) {
+    manyRDNs.append(RDN(OU("Unit")));
+  }
+  AddCert(CNToDERName("Example"), DirectoryName(Name(manyRDNs)),
+          "(directoryName with many RDNs)", directoryNameCerts);
+
+  const ByteString constraints[] = {
+    GeneralSubtree(DirectoryName(Name(usGov + RDN(OU("DoD"))))),
+    GeneralSubtree(DirectoryName(Name(usGov + RDN(OU("DHS"))))),
+    GeneralSubtree(DirectoryName(Name(usGov))),
+    GeneralSubtree(DirectoryName(Name(RDN(C("US")) +
+                                      RDN(O("U.S. Government") +
+                                          OU("DoD"))))),
+    GeneralSubtree(DirectoryName(Name(RDN(C("US")) +
+                                      TLV(der::SET, ByteString())))),
+    GeneralSubtree(DirectoryName(Name(manyRDNs + RDN(OU("Unit"))))),
+    GeneralSubtree(DirectoryName(Name(ByteString()))),
+  };
+  for (const ByteString& constraint : constraints) {
+    CheckAllCertsBothWays(TLV(der::SEQUENCE, PermittedSubtrees(constraint)),
+                          directoryNameCerts);
+    CheckAllCertsBothWays(TLV(der::SEQUENCE, ExcludedSubtrees(constraint)),
+                          directoryNameCerts);
+  }
+  ByteString allConstraints;
+  for (size_t i = 0; i + 1 < MOZILLA_PKIX_ARRAY_LENGTH(constraints); ++i) {
+    allConstraints.append(constraints[i]);
+  }
+  CheckAllCertsBothWays(TLV(der::SEQUENCE,
+                            PermittedSubtrees(allConstraints)),
+                        directoryNameCerts);
+
+  // A malformed constraint, or one with too many RDNs to have keys, and
+  // constraints of other types.
+  const ByteString withoutKeys[] = {
+    GeneralSubtree(DirectoryName(Name(RDN(C("US")) + malformedRDN))),
+    GeneralSubtree(DirectoryName(TLV(der::SEQUENCE, Bytes({ 0x31 })))),
+    GeneralSubtree(DirectoryName(Name(
+      [&]() {
+        ByteString rdns;
+        for (int i = 0; i < 256; ++i) {
+          rdns.append(RDN(OU("Unit")));
+        }
+        return rdns;
+      }()))),
+  };
+  for (const ByteString& constraint : withoutKeys) {
+    CheckAllCertsBothWays(TLV(der::SEQUENCE,
+                              PermittedSubtrees(allConstraints + constraint +
+                                                AllSubtrees())),
+                          directoryNameCerts);
+    CheckAllCertsBothWays(TLV(der::SEQUENCE,
+                              PermittedSubtrees(constraint + allConstraints)),
+                          directoryNameCerts);
+  }
+}
+
+TEST_F(pkixnames_CompiledNameConstraints, EmptyConstraints)
+{
+  // An empty dNSName or rfc822Name constraint matches every name of its type.
+  const ByteString subtrees(GeneralSubtree(DNSName("")) +
+                            GeneralSubtree(RFC822Name("")));
+  CheckAllCertsBothWays(TLV(der::SEQUENCE, PermittedSubtrees(subtrees)));
+  CheckAllCertsBothWays(TLV(der::SEQUENCE, ExcludedSubtrees(subtrees)));
+}
+
+TEST_F(pkixnames_CompiledNameConstraints, MalformedConstraints)
+{
+  // The errors for these depend on the order in which the constraints are
+  // compared to the names, so they are checked without being compiled, with
+  // the same results.
+  const ByteString malformed[] = {
+    // An invalid dNSName constraint after a valid one.
+    TLV(der::SEQUENCE, PermittedSubtrees(
+      GeneralSubtree(DNSName("example.com")) +
+      GeneralSubtree(DNSName("*.example.com")))),
+    // An IP address constraint of the wrong length.
+    TLV(der::SEQUENCE, ExcludedSubtrees(
+      GeneralSubtree(DNSName("example.org")) +
+      GeneralSubtree(IPAddress(Bytes({ 10, 0, 0, 0, 255 }))))),
+    // Trailing garbage after the subtrees.
+    TLV(der::SEQUENCE, PermittedSubtrees(
+      GeneralSubtree(DNSName("example.com"))) + Bytes({ 0x05, 0x00 })),
+    // No subtrees at all.
+    TLV(der::SEQUENCE, ByteString()),
+  };
+  for (const ByteString& nameConstraintsDER : malformed) {
+    CheckAllCertsBothWays(nameConstraintsDER);
+  }
+}
+
+TEST_F(pkixnames_CompiledNameConstraints, InitErrors)
+{
+  const ByteString nameConstraintsDER(
+    TLV(der::SEQUENCE, PermittedSubtrees(AllSubtrees())));
+  Input nameConstraints;
+  ASSERT_EQ(Success, nameConstraints.Init(nameConstraintsDER.data(),
+                                          nameConstraintsDER.length()));
+  std::vector<CompiledNameConstraints::Entry> entries(
+    CompiledNameConstraints::MaxEntryCount(nameConstraints));
+
+  {
+    CompiledNameConstraints compiled;
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+              compiled.CheckPresentedID(der::CONTEXT_SPECIFIC | 2,
+                                        nameConstraints));
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+              compiled.Init(nameConstraints, entries.data(), 1));
+  }
+  {
+    CompiledNameConstraints compiled;
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+              compiled.Init(nameConstraints, nullptr, entries.size()));
+  }
+  {
+    CompiledNameConstraints compiled;
+    ASSERT_EQ(Success, compiled.Init(nameConstraints, entries.data(),
+                                     entries.size()));
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+              compiled.Init(nameConstraints, entries.data(), entries.size()));
+    // Not a GeneralName tag.
+    ASSERT_EQ(Result::FATAL_ERROR_INVALID_ARGS,
+              compiled.CheckPresentedID(der::SEQUENCE, nameConstraints));
+    static const uint8_t EXAMPLE_COM[] = {
+      'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm'
+    };
+    ASSERT_EQ(Success,
+              compiled.CheckPresentedID(der::CONTEXT_SPECIFIC | 2,
+                                        Input(EXAMPLE_COM)));
+  }
+}
+
+// An enterprise CA with hundreds of permitted subtrees, checked against an
+// end-entity certificate with several names.
+TEST_F(pkixnames_CompiledNameConstraints, DISABLED_Benchmark_HundredsOfSubtrees)
+{
+  ByteString subtrees;
+  for (int i = 0; i < 400; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "host%d.corp.example", i);
+    subtrees.append(GeneralSubtree(DNSName(BytesFor(name))));
+  }
+  for (int i = 0; i < 200; ++i) {
+    subtrees.append(GeneralSubtree(IPAddress(
+      Bytes({ 10, static_cast<uint8_t>(i), 0, 0, 255, 255, 0, 0 }))));
+  }
+  const ByteString nameConstraintsDER(
+    TLV(der::SEQUENCE, PermittedSubtrees(subtrees)));
+  Input nameConstraints;
+  ASSERT_EQ(Success, nameConstraints.Init(nameConstraintsDER.data(),
+                                          nameConstraintsDER.length()));
+
+  ByteString sans;
+  for (int i = 390; i < 400; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "www.host%d.corp.example", i);
+    sans.append(DNSName(BytesFor(name)));
+  }
+  sans.append(IPAddress(Bytes({ 10, 199, 1, 2 })));
+  ByteString certDER(CreateCert(CNToDERName("www.host399.corp.example"),
+                                sans));
+  ASSERT_FALSE(ENCODING_FAILED(certDER));
+  Input certInput;
+  ASSERT_EQ(Success, certInput.Init(certDER.data(), certDER.length()));
+  BackCert cert(certInput, EndEntityOrCA::MustBeEndEntity, nullptr);
+  ASSERT_EQ(Success, cert.Init());
+
+  Benchmark("CheckNameConstraints (encoded)", 200, [&]() {
+    ASSERT_EQ(Success, CheckNameConstraints(nameConstraints, cert,
+                                            KeyPurposeId::id_kp_serverAuth));
+  });
+
+  std::vector<CompiledNameConstraints::Entry> entries(
+    CompiledNameConstraints::MaxEntryCount(nameConstraints));
+  CompiledNameConstraints compiled;
+  ASSERT_EQ(Success, compiled.Init(nameConstraints, entries.data(),
+                                   entries.size()));
+  Benchmark("CheckNameConstraints (compiled)", 200, [&]() {
+    ASSERT_EQ(Success, CheckNameConstraints(compiled, cert,
+                                            KeyPurposeId::id_kp_serverAuth));
+  });
+}
+
+// A government bridge CA that permits the directory names of hundreds of
+// agencies and their offices, checked against a subordinate CA's and an
+// end-entity's subject.
+TEST_F(pkixnames_CompiledNameConstraints,
+       DISABLED_Benchmark_GovernmentDirectoryNames)
+{
+  const ByteString usGov(RDN(C("US")) + RDN(O("U.S. Government")));
+  ByteString subtrees;
+  for (int agency = 0; agency < 100; ++agency) {
+    char agencyName[32];
+    snprintf(agencyName, sizeof(agencyName), "Agency %d", agency);
+    for (int office = 0; office < 3; ++office) {
+      char officeName[32];
+      snprintf(officeName, sizeof(officeName), "Office %d", office);
+      subtrees.append(GeneralSubtree(DirectoryName(
+        Name(usGov + RDN(OU(agencyName)) + RDN(OU(officeName))))));
+    }
+  }
+  const ByteString nameConstraintsDER(
+    TLV(der::SEQUENCE, PermittedSubtrees(subtrees) +
+                       ExcludedSubtrees(GeneralSubtree(DNSName(
+                         BytesFor("example.com"))))));
+  Input nameConstraints;
+  ASSERT_EQ(Success, nameConstraints.Init(nameConstraintsDER.data(),
+                                          nameConstraintsDER.length()));
+
+  ByteString certDER(CreateCert(
+    Name(usGov + RDN(OU("Agency 99")) + RDN(OU("Office 2")) +
+         RDN(OU("People")) + RDN(CN("Jane Doe"))),
+    DirectoryName(Name(usGov + RDN(OU("Agency 98")) + RDN(OU("Office 1"))))));
+  ASSERT_FALSE(ENCODING_FAILED(certDER));
+  Input certInput;
+  ASSERT_EQ(Success, certInput.Init(certDER.data(), certDER.length()));
+  BackCert cert(certInput, EndEntityOrCA::MustBeEndEntity, nullptr);
+  ASSERT_EQ(Success, cert.Init());
+
+  Benchmark("CheckNameConstraints (encoded)", 200, [&]() {
+    ASSERT_EQ(Success, CheckNameConstraints(nameConstraints, cert,
+                                            KeyPurposeId::id_kp_serverAuth));
+  });
+
+  std::vector<CompiledNameConstraints::Entry> entries(
+    CompiledNameConstraints::MaxEntryCount(nameConstraints));
+  CompiledNameConstraints compiled;
+  ASSERT_EQ(Success, compiled.Init(nameConstraints, entries.data(),
+                                   entries.size()));
+  Benchmark("CheckNameConstraints (compiled)", 2000, [&]() {
+    ASSERT_EQ(Success, CheckNameConstraints(compiled, cert,
+                                            KeyPurposeId::id_kp_serverAuth));
+  });
+}
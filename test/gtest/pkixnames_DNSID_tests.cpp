@@ -0,0 +1,381 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+#include <vector>
+
+#include "pkixgtest.h"
+
+namespace mozilla { namespace pkix {
+
+Result MatchPresentedDNSIDWithReferenceDNSID(Input presentedDNSID,
+                                             Input referenceDNSID,
+                                             /*out*/ bool& matches);
+
+bool IsValidReferenceDNSID(Input hostname);
+bool IsValidPresentedDNSID(Input hostname);
+
+} } // namespace mozilla::pkix
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+// The DNS-ID validation and matching are done a block at a time. These are
+// straightforward byte-at-a-time versions of the same rules for reference and
+// presented IDs (see IsValidDNSID and MatchPresentedDNSIDWithReferenceDNSID)
+// that the block-at-a-time versions are compared against.
+
+uint8_t
+ToLower(uint8_t b)
+{
+  return (b >= 'A' && b <= 'Z') ? static_cast<uint8_t>(b - 'A' + 'a') : b;
+}
+
+bool
+ByteAtATimeIsValidDNSID(const std::string& id, bool isPresentedID)
+{
+  if (id.length() > 253 || id.empty()) {
+    return false;
+  }
+  size_t i = 0;
+  size_t dotCount = 0;
+  bool isWildcard = isPresentedID && id[0] == '*';
+  if (isWildcard) {
+    if (id.length() < 3 || id[1] != '.') {
+      return false;
+    }
+    i = 2;
+    dotCount = 1;
+  }
+  size_t labelLength = 0;
+  bool labelIsAllNumeric = false;
+  bool labelEndsWithHyphen = false;
+  for (; i < id.length(); ++i) {
+    char c = id[i];
+    if (c == '.') {
+      ++dotCount;
+      if (labelLength == 0 || labelEndsWithHyphen) {
+        return false;
+      }
+      labelLength = 0;
+      continue;
+    }
+    if (c == '-') {
+      if (labelLength == 0) {
+        return false;
+      }
+      labelIsAllNumeric = false;
+      labelEndsWithHyphen = true;
+    } else if (c >= '0' && c <= '9') {
+      if (labelLength == 0) {
+        labelIsAllNumeric = true;
+      }
+      labelEndsWithHyphen = false;
+    } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+               c == '_') {
+      labelIsAllNumeric = false;
+      labelEndsWithHyphen = false;
+    } else {
+      return false;
+    }
+    if (++labelLength > 63) {
+      return false;
+    }
+  }
+  if ((labelLength == 0 && isPresentedID) || labelEndsWithHyphen ||
+      labelIsAllNumeric) {
+    return false;
+  }
+  if (isWildcard) {
+    size_t labelCount = (labelLength == 0) ? dotCount : (dotCount + 1);
+    if (labelCount < 3 || id.compare(0, 4, "xn--") == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Result
+ByteAtATimeMatch(const std::string& presented, const std::string& reference,
+                 /*out*/ bool& matches)
+{
+  if (!ByteAtATimeIsValidDNSID(presented, true) ||
+      !ByteAtATimeIsValidDNSID(reference, false)) {
+    return Result::ERROR_BAD_DER;
+  }
+  size_t p = 0;
+  size_t r = 0;
+  if (presented[0] == '*') {
+    p = 1;
+    r = reference.find('.');
+    if (r == 0 || r == std::string::npos) {
+      matches = false;
+      return Success;
+    }
+  }
+  for (; p < presented.length(); ++p, ++r) {
+    if (r == reference.length() ||
+        ToLower(static_cast<uint8_t>(presented[p])) !=
+          ToLower(static_cast<uint8_t>(reference[r]))) {
+      matches = false;
+      return Success;
+    }
+  }
+  matches = r == reference.length() ||
+            (r + 1 == reference.length() && reference[r] == '.');
+  return Success;
+}
+
+Input
+ToInput(const std::string& s)
+{
+  Input input;
+  EXPECT_EQ(Success,
+            input.Init(reinterpret_cast<const uint8_t*>(s.data()), s.length()));
+  return input;
+}
+
+// A small deterministic generator so that failures are reproducible.
+class Generator final
+{
+public:
+  explicit Generator(uint32_t seed) : state(seed) { }
+
+  uint32_t Next(uint32_t bound)
+  {
+    state = state * 1103515245u + 12345u;
+    return (state >> 8) % bound;
+  }
+
+  std::string Label(size_t length)
+  {
+    static const char LABEL_CHARS[] = "abcxyzABCXYZ0189_-";
+    std::string label;
+    for (size_t i = 0; i < length; ++i) {
+      label += LABEL_CHARS[Next(sizeof(LABEL_CHARS) - 1)];
+    }
+    return label;
+  }
+
+  // Mostly valid names, with labels of lengths that straddle the block sizes
+  // and the maximum label length.
+  std::string Name()
+  {
+    static const size_t LABEL_LENGTHS[] = {
+      1, 2, 3, 7, 15, 16, 17, 31, 32, 33, 62, 63, 64
+    };
+    std::string name;
+    if (Next(8) == 0) {
+      name = "*.";
+    }
+    size_t labels = 1 + Next(6);
+    for (size_t i = 0; i < labels; ++i) {
+      if (i > 0) {
+        name += '.';
+      }
+      name += Label(Next(4) == 0
+                      ? LABEL_LENGTHS[Next(sizeof(LABEL_LENGTHS) /
+                                           sizeof(LABEL_LENGTHS[0]))]
+                      : 1 + Next(10));
+    }
+    switch (Next(16)) {
+      case 0: name += '.'; break;
+      case 1: name += ".."; break;
+      case 2: name[Next(static_cast<uint32_t>(name.length()))] = '*'; break;
+      case 3: name[Next(static_cast<uint32_t>(name.length()))] = ' '; break;
+      case 4: name[Next(static_cast<uint32_t>(name.length()))] = '\x80';
+              break;
+      case 5: name[Next(static_cast<uint32_t>(name.length()))] = '\0'; break;
+      case 6: name.insert(0, "xn--"); break;
+      default: break;
+    }
+    return name;
+  }
+
+  // A reference ID that is likely to be related to the presented ID.
+  std::string ReferenceFor(const std::string& presented)
+  {
+    std::string reference(presented);
+    if (reference.compare(0, 2, "*.") == 0) {
+      reference.replace(0, 1, Label(1 + Next(3)));
+    }
+    for (char& c : reference) {
+      if (Next(2) == 0) {
+        c = static_cast<char>(
+              (c >= 'a' && c <= 'z') ? c - 'a' + 'A'
+            : (c >= 'A' && c <= 'Z') ? c - 'A' + 'a'
+            : c);
+      }
+    }
+    switch (Next(8)) {
+      case 0: reference += '.'; break;
+      case 1: reference += "x"; break;
+      case 2: reference.erase(reference.length() / 2, 1); break;
+      case 3:
+        if (!reference.empty()) {
+          reference[Next(static_cast<uint32_t>(reference.length()))] ^= 1;
+        }
+        break;
+      default: break;
+    }
+    return reference;
+  }
+
+private:
+  uint32_t state;
+};
+
+class pkixnames_DNSID : public ::testing::Test
+{
+};
+
+} // unnamed namespace
+
+TEST_F(pkixnames_DNSID, SameResultsAsByteAtATime)
+{
+  Generator generator(1);
+  for (int i = 0; i < 50000; ++i) {
+    const std::string presented(generator.Name());
+    const std::string reference(generator.ReferenceFor(presented));
+    if (presented.length() > Input::size_type(-1) ||
+        reference.length() > Input::size_type(-1)) {
+      continue;
+    }
+
+    ASSERT_EQ(ByteAtATimeIsValidDNSID(presented, true),
+              IsValidPresentedDNSID(ToInput(presented)))
+      << presented;
+    ASSERT_EQ(ByteAtATimeIsValidDNSID(presented, false),
+              IsValidReferenceDNSID(ToInput(presented)))
+      << presented;
+    ASSERT_EQ(ByteAtATimeIsValidDNSID(reference, false),
+              IsValidReferenceDNSID(ToInput(reference)))
+      << reference;
+
+    bool expectedMatches = false;
+    Result expectedResult(ByteAtATimeMatch(presented, reference,
+                                           expectedMatches));
+    bool matches = false;
+    ASSERT_EQ(expectedResult,
+              MatchPresentedDNSIDWithReferenceDNSID(ToInput(presented),
+                                                    ToInput(reference),
+                                                    matches))
+      << presented << " " << reference;
+    if (expectedResult == Success) {
+      ASSERT_EQ(expectedMatches, matches) << presented << " " << reference;
+    }
+  }
+}
+
+TEST_F(pkixnames_DNSID, MaximumLengths)
+{
+  // 253 bytes in total, made of labels of the maximum length.
+  const std::string label63(63, 'a');
+  const std::string longest(label63 + '.' + label63 + '.' + label63 + '.' +
+                            std::string(61, 'B'));
+  ASSERT_EQ(253u, longest.length());
+  ASSERT_TRUE(IsValidPresentedDNSID(ToInput(longest)));
+  ASSERT_TRUE(IsValidReferenceDNSID(ToInput(longest)));
+  ASSERT_FALSE(IsValidReferenceDNSID(ToInput(longest + '.')));
+  ASSERT_FALSE(IsValidReferenceDNSID(ToInput(longest + 'b')));
+  ASSERT_FALSE(IsValidReferenceDNSID(ToInput(std::string(64, 'a') + ".com")));
+
+  std::string upper(longest);
+  for (char& c : upper) {
+    c = static_cast<char>((c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c);
+  }
+  bool matches = false;
+  ASSERT_EQ(Success, MatchPresentedDNSIDWithReferenceDNSID(
+                       ToInput(longest), ToInput(upper), matches));
+  ASSERT_TRUE(matches);
+
+  // Differences in each position of the name, including the last byte of
+  // every block.
+  for (size_t i = 0; i < longest.length(); ++i) {
+    if (longest[i] == '.') {
+      continue;
+    }
+    std::string different(longest);
+    different[i] = 'c';
+    ASSERT_EQ(Success, MatchPresentedDNSIDWithReferenceDNSID(
+                         ToInput(longest), ToInput(different), matches));
+    ASSERT_FALSE(matches) << i;
+  }
+}
+
+// A certificate for a hosting provider or CDN, with hundreds of long names
+// that differ only near their ends.
+TEST_F(pkixnames_DNSID, DISABLED_Benchmark_LongSubjectAltNameList)
+{
+  std::vector<std::string> names;
+  ByteString sans;
+  for (int i = 0; i < 400; ++i) {
+    std::string name("customer-" + std::to_string(i) +
+                     ".edge-cache-frontend.eu-west.static-content."
+                     "example-hosting-provider.com");
+    sans.append(DNSName(ByteString(
+                  reinterpret_cast<const uint8_t*>(name.data()),
+                  name.length())));
+    names.push_back(name);
+  }
+  ByteString serialNumber(CreateEncodedSerialNumber(1));
+  ASSERT_FALSE(ENCODING_FAILED(serialNumber));
+  ByteString extensions[2];
+  extensions[0] = CreateEncodedSubjectAltName(sans);
+  ASSERT_FALSE(ENCODING_FAILED(extensions[0]));
+  ScopedTestKeyPair keyPair(CloneReusedKeyPair());
+  const ByteString certDER(CreateEncodedCertificate(
+                             v3, sha256WithRSAEncryption(), serialNumber,
+                             CNToDERName("issuer"), oneDayBeforeNow,
+                             oneDayAfterNow, CNToDERName("subject"), *keyPair,
+                             extensions, *keyPair,
+                             sha256WithRSAEncryption()));
+  ASSERT_FALSE(ENCODING_FAILED(certDER));
+  Input cert;
+  ASSERT_EQ(Success, cert.Init(certDER.data(), certDER.length()));
+
+  // The last name in upper case, and a name that isn't in the list.
+  std::string last(names.back());
+  for (char& c : last) {
+    c = static_cast<char>((c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c);
+  }
+  const std::string missing("customer-400.edge-cache-frontend.eu-west."
+                            "static-content.example-hosting-provider.com");
+  Benchmark("CheckCertHostname, 400 long dNSNames", 200, [&]() {
+    ASSERT_EQ(Success, CheckCertHostname(cert, ToInput(last)));
+    ASSERT_EQ(Result::ERROR_BAD_CERT_DOMAIN,
+              CheckCertHostname(cert, ToInput(missing)));
+  });
+
+  Benchmark("MatchPresentedDNSIDWithReferenceDNSID x 400", 1000, [&]() {
+    for (const std::string& name : names) {
+      bool matches = false;
+      ASSERT_EQ(Success, MatchPresentedDNSIDWithReferenceDNSID(
+                           ToInput(name), ToInput(last), matches));
+      ASSERT_EQ(&name == &names.back(), matches);
+    }
+  });
+}
@@ -0,0 +1,625 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "pkixcheck.h"
+#include "pkixder.h"
+#include "pkixgtest.h"
+#include "pkixutil.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+ByteString
+ToByteString(const std::string& s)
+{
+  return ByteString(reinterpret_cast<const uint8_t*>(s.data()), s.length());
+}
+
+ByteString
+DNSName(const std::string& name)
+{
+  return mozilla::pkix::test::DNSName(ToByteString(name));
+}
+
+ByteString
+RFC822Name(const std::string& name)
+{
+  return mozilla::pkix::test::RFC822Name(ToByteString(name));
+}
+
+ByteString
+URI(const std::string& uri)
+{
+  return TLV(der::CONTEXT_SPECIFIC | 6, ToByteString(uri));
+}
+
+// emailAddress encoded as something other than an IA5String, which is
+// invalid.
+ByteString
+UTF8EmailAddress(const std::string& value)
+{
+  // python DottedOIDToCode.py --tlv id-emailAddress 1.2.840.113549.1.9.1
+  static const uint8_t tlv_id_emailAddress[] = {
+    0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x09, 0x01
+  };
+  return TLV(der::SEQUENCE,
+             ByteString(tlv_id_emailAddress, sizeof(tlv_id_emailAddress)) +
+             TLV(der::UTF8String, ToByteString(value)));
+}
+
+ByteString
+NameConstraints(const ByteString& permitted, const ByteString& excluded)
+{
+  ByteString value;
+  if (!permitted.empty()) {
+    value.append(TLV(der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 0, permitted));
+  }
+  if (!excluded.empty()) {
+    value.append(TLV(der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 1, excluded));
+  }
+  return TLV(der::SEQUENCE, value);
+}
+
+ByteString
+GeneralSubtree(const ByteString& base)
+{
+  return TLV(der::SEQUENCE, base);
+}
+
+ByteString
+CreateCert(const ByteString& issuer, const ByteString& subject,
+           EndEntityOrCA endEntityOrCA,
+           /*optional*/ const ByteString* subjectAltName,
+           /*optional*/ const ByteString* nameConstraints,
+           long serialNumberValue = 1)
+{
+  ByteString serialNumber(CreateEncodedSerialNumber(serialNumberValue));
+  EXPECT_FALSE(ENCODING_FAILED(serialNumber));
+
+  ByteString extensions[4];
+  size_t extensionCount = 0;
+  if (endEntityOrCA == EndEntityOrCA::MustBeCA) {
+    extensions[extensionCount] =
+      CreateEncodedBasicConstraints(true, nullptr, Critical::Yes);
+    EXPECT_FALSE(ENCODING_FAILED(extensions[extensionCount]));
+    ++extensionCount;
+  }
+  if (subjectAltName) {
+    extensions[extensionCount] = CreateEncodedSubjectAltName(*subjectAltName);
+    EXPECT_FALSE(ENCODING_FAILED(extensions[extensionCount]));
+    ++extensionCount;
+  }
+  if (nameConstraints) {
+    // python DottedOIDToCode.py --tlv id-ce-nameConstraints 2.5.29.30
+    static const uint8_t tlv_id_ce_nameConstraints[] = {
+      0x06, 0x03, 0x55, 0x1d, 0x1e
+    };
+    extensions[extensionCount] =
+      TLV(der::SEQUENCE,
+          ByteString(tlv_id_ce_nameConstraints,
+                     sizeof(tlv_id_ce_nameConstraints)) +
+          Boolean(true) + TLV(der::OCTET_STRING, *nameConstraints));
+    ++extensionCount;
+  }
+
+  ScopedTestKeyPair keyPair(CloneReusedKeyPair());
+  return CreateEncodedCertificate(
+                    v3, sha256WithRSAEncryption(), serialNumber, issuer,
+                    oneDayBeforeNow, oneDayAfterNow, subject, *keyPair,
+                    extensions, *keyPair, sha256WithRSAEncryption());
+}
+
+class pkixnames_NameConstraintsPresentedIDs : public ::testing::Test
+{
+};
+
+} // unnamed namespace
+
+// Certificates with more identifiers than NameConstraintsPresentedIDs can
+// hold are checked with SearchNames directly, so padding each subjectAltName
+// with URIs, which none of the constraints here constrain, compares the
+// extracted identifiers with SearchNames.
+TEST_F(pkixnames_NameConstraintsPresentedIDs, SameResultsAsSearchNames)
+{
+  ByteString padding;
+  for (size_t i = 0; i <= NameConstraintsPresentedIDs::MAX_IDS; ++i) {
+    padding.append(URI("https://example.com/" + std::to_string(i)));
+  }
+
+  static const uint8_t ipv4[] = { 10, 1, 2, 3 };
+  static const uint8_t otherIPv4[] = { 192, 168, 1, 1 };
+  const ByteString malformed(TLV(der::CONTEXT_SPECIFIC | 9, ByteString()));
+  const ByteString subjectAltNames[] = {
+    DNSName("www.example.com"),
+    DNSName("www.example.com") + DNSName("www.example.org"),
+    DNSName("*.example.com") + IPAddress(ipv4),
+    IPAddress(otherIPv4),
+    DNSName("invalid..example.com"),
+    RFC822Name("user@example.com") + RFC822Name("user@example.org"),
+    RFC822Name("user@example.com") + malformed + DNSName("www.example.org"),
+    DNSName("www.example.com") + malformed,
+    TLV(der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 4,
+        Name(RDN(CN("www.example.org")))),
+    ByteString(),
+  };
+
+  const ByteString subjects[] = {
+    Name(RDN(CN("www.example.com"))),
+    Name(RDN(CN("www.example.org"))),
+    Name(RDN(CN("www.example.org")) + RDN(CN("www.example.com"))),
+    Name(RDN(CN("www.example.org", der::IA5String))),
+    Name(RDN(CN("10.1.2.3"))),
+    Name(RDN(CN("192.168.1.1"))),
+    Name(RDN(CN("Not a hostname"))),
+    Name(RDN(emailAddress("user@example.com")) + RDN(CN("www.example.com"))),
+    Name(RDN(emailAddress("user@example.org"))),
+    Name(RDN(UTF8EmailAddress("user@example.org")) +
+         RDN(CN("www.example.org"))),
+    Name(RDN(CN("www.example.org")) + TLV(der::SET, ByteString())),
+    Name(ByteString()),
+  };
+
+  static const uint8_t ipv4Constraint[] = { 10, 0, 0, 0, 255, 0, 0, 0 };
+  const ByteString nameConstraints[] = {
+    NameConstraints(GeneralSubtree(DNSName("example.com")), ByteString()),
+    NameConstraints(ByteString(), GeneralSubtree(DNSName("example.org"))),
+    NameConstraints(GeneralSubtree(RFC822Name("example.com")), ByteString()),
+    NameConstraints(ByteString(), GeneralSubtree(RFC822Name("example.org"))),
+    NameConstraints(GeneralSubtree(IPAddress(ipv4Constraint)), ByteString()),
+    NameConstraints(GeneralSubtree(DNSName("example.com")) +
+                      GeneralSubtree(IPAddress(ipv4Constraint)),
+                    GeneralSubtree(DNSName("bad.example.com"))),
+    NameConstraints(GeneralSubtree(
+                      TLV(der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 4,
+                          Name(RDN(CN("www.example.com"))))),
+                    ByteString()),
+    NameConstraints(GeneralSubtree(DNSName("invalid..example")),
+                    ByteString()),
+    TLV(der::SEQUENCE, ByteString()),
+  };
+
+  static const KeyPurposeId EKUS[] = {
+    KeyPurposeId::id_kp_serverAuth,
+    KeyPurposeId::id_kp_emailProtection,
+  };
+
+  for (size_t s = 0; s < MOZILLA_PKIX_ARRAY_LENGTH(subjects); ++s) {
+    for (size_t a = 0; a <= MOZILLA_PKIX_ARRAY_LENGTH(subjectAltNames); ++a) {
+      // The last iteration is for a certificate without a subjectAltName,
+      // which can't be padded, so it is compared with a fresh BackCert for
+      // each check instead.
+      bool hasSubjectAltName = a < MOZILLA_PKIX_ARRAY_LENGTH(subjectAltNames);
+      const ByteString* subjectAltName =
+        hasSubjectAltName ? &subjectAltNames[a] : nullptr;
+      const ByteString paddedSubjectAltName(
+        hasSubjectAltName ? padding + subjectAltNames[a] : ByteString());
+
+      for (EndEntityOrCA endEntityOrCA : { EndEntityOrCA::MustBeEndEntity,
+                                           EndEntityOrCA::MustBeCA }) {
+        const ByteString certDER(CreateCert(CNToDERName("issuer"),
+                                            subjects[s], endEntityOrCA,
+                                            subjectAltName, nullptr));
+        ASSERT_FALSE(ENCODING_FAILED(certDER));
+        const ByteString paddedCertDER(
+          CreateCert(CNToDERName("issuer"), subjects[s], endEntityOrCA,
+                     hasSubjectAltName ? &paddedSubjectAltName : nullptr,
+                     nullptr));
+        ASSERT_FALSE(ENCODING_FAILED(paddedCertDER));
+        Input certInput;
+        ASSERT_EQ(Success, certInput.Init(certDER.data(), certDER.length()));
+        Input paddedCertInput;
+        ASSERT_EQ(Success, paddedCertInput.Init(paddedCertDER.data(),
+                                                paddedCertDER.length()));
+
+        // One BackCert is used for all of the checks, so that all but the
+        // first use the identifiers extracted by the first. A BackCert
+        // without a NameConstraintsPresentedIDsBuffer is checked with
+        // SearchNames.
+        NameConstraintsPresentedIDsBuffer buffer;
+        BackCert cert(certInput, endEntityOrCA, nullptr, &buffer);
+        ASSERT_EQ(Success, cert.Init());
+        BackCert unbufferedCert(certInput, endEntityOrCA, nullptr);
+        ASSERT_EQ(Success, unbufferedCert.Init());
+        ASSERT_FALSE(unbufferedCert.GetNameConstraintsPresentedIDs());
+        NameConstraintsPresentedIDsBuffer paddedBuffer;
+
+        for (const ByteString& nameConstraintsDER : nameConstraints) {
+          Input nameConstraintsInput;
+          ASSERT_EQ(Success,
+                    nameConstraintsInput.Init(nameConstraintsDER.data(),
+                                              nameConstraintsDER.length()));
+          for (KeyPurposeId eku : EKUS) {
+            BackCert paddedCert(paddedCertInput, endEntityOrCA, nullptr,
+                                &paddedBuffer);
+            ASSERT_EQ(Success, paddedCert.Init());
+            Result expected(CheckNameConstraints(nameConstraintsInput,
+                                                 paddedCert, eku));
+            ASSERT_EQ(hasSubjectAltName
+                        ? NameConstraintsPresentedIDs::State::TooMany
+                        : NameConstraintsPresentedIDs::State::Extracted,
+                      paddedCert.GetNameConstraintsPresentedIDs()->state);
+            ASSERT_EQ(expected,
+                      CheckNameConstraints(nameConstraintsInput, cert, eku))
+              << "subject " << s << ", subjectAltName " << a
+              << ", endEntityOrCA " << static_cast<int>(endEntityOrCA);
+            ASSERT_EQ(NameConstraintsPresentedIDs::State::Extracted,
+                      cert.GetNameConstraintsPresentedIDs()->state);
+            ASSERT_EQ(expected,
+                      CheckNameConstraints(nameConstraintsInput,
+                                           unbufferedCert, eku));
+          }
+        }
+      }
+    }
+  }
+}
+
+// A BackCert given the entry of a NameConstraintsPresentedIDsBuffer that was
+// used by another BackCert, as an alternative issuer tried while
+// backtracking is, extracts its own identifiers.
+TEST_F(pkixnames_NameConstraintsPresentedIDs, BufferEntryReused)
+{
+  const ByteString nameConstraintsDER(
+    NameConstraints(GeneralSubtree(DNSName("example.com")), ByteString()));
+  Input nameConstraints;
+  ASSERT_EQ(Success, nameConstraints.Init(nameConstraintsDER.data(),
+                                          nameConstraintsDER.length()));
+
+  NameConstraintsPresentedIDsBuffer buffer;
+  const ByteString permitted(DNSName("www.example.com"));
+  const ByteString permittedDER(CreateCert(CNToDERName("issuer"),
+                                           CNToDERName("permitted"),
+                                           EndEntityOrCA::MustBeEndEntity,
+                                           &permitted, nullptr));
+  ASSERT_FALSE(ENCODING_FAILED(permittedDER));
+  Input permittedInput;
+  ASSERT_EQ(Success, permittedInput.Init(permittedDER.data(),
+                                         permittedDER.length()));
+  {
+    BackCert cert(permittedInput, EndEntityOrCA::MustBeEndEntity, nullptr,
+                  &buffer);
+    ASSERT_EQ(Success, cert.Init());
+    ASSERT_EQ(Success, CheckNameConstraints(nameConstraints, cert,
+                                            KeyPurposeId::id_kp_serverAuth));
+  }
+
+  const ByteString excluded(DNSName("www.example.org"));
+  const ByteString excludedDER(CreateCert(CNToDERName("issuer"),
+                                          CNToDERName("excluded"),
+                                          EndEntityOrCA::MustBeEndEntity,
+                                          &excluded, nullptr));
+  ASSERT_FALSE(ENCODING_FAILED(excludedDER));
+  Input excludedInput;
+  ASSERT_EQ(Success, excludedInput.Init(excludedDER.data(),
+                                        excludedDER.length()));
+  BackCert cert(excludedInput, EndEntityOrCA::MustBeEndEntity, nullptr,
+                &buffer);
+  ASSERT_EQ(Success, cert.Init());
+  ASSERT_EQ(&buffer.ids[0], cert.GetNameConstraintsPresentedIDs());
+  ASSERT_EQ(Result::ERROR_CERT_NOT_IN_NAME_SPACE,
+            CheckNameConstraints(nameConstraints, cert,
+                                 KeyPurposeId::id_kp_serverAuth));
+  ASSERT_EQ(NameConstraintsPresentedIDs::State::Extracted,
+            cert.GetNameConstraintsPresentedIDs()->state);
+}
+
+namespace {
+
+// Builds chains through a hierarchy in which every CA has name constraints
+// and has several alternative certificates. All but one of the alternatives
+// at each level are distrusted, so path building backtracks after checking
+// each of them against the name constraints, as it does when a CA has been
+// cross-certified several times.
+class ConstrainedHierarchyTrustDomain final
+  : public EverythingFailsByDefaultTrustDomain
+{
+public:
+  ConstrainedHierarchyTrustDomain(size_t levels, size_t alternatives)
+  {
+    ByteString issuer(CNToDERName("Root"));
+    root = CreateCert(issuer, issuer, EndEntityOrCA::MustBeCA, nullptr,
+                      nullptr);
+    certsBySubject[issuer].push_back(root);
+
+    static const uint8_t ipv4Constraint[] = { 10, 0, 0, 0, 255, 0, 0, 0 };
+    long serialNumber = 1;
+    for (size_t level = 0; level < levels; ++level) {
+      ByteString subject(CNToDERName(
+                           ("CA" + std::to_string(level)).c_str()));
+      ByteString nameConstraints(
+        NameConstraints(GeneralSubtree(DNSName("example.com")) +
+                          GeneralSubtree(RFC822Name("example.com")) +
+                          GeneralSubtree(IPAddress(ipv4Constraint)),
+                        GeneralSubtree(DNSName("secret.example.com")) +
+                          GeneralSubtree(DNSName(
+                            "level" + std::to_string(level) +
+                            ".example.com"))));
+      for (size_t i = 0; i < alternatives; ++i) {
+        ByteString certDER(CreateCert(issuer, subject,
+                                      EndEntityOrCA::MustBeCA, nullptr,
+                                      &nameConstraints, ++serialNumber));
+        EXPECT_FALSE(ENCODING_FAILED(certDER));
+        if (i + 1 < alternatives) {
+          distrusted.push_back(certDER);
+        }
+        certsBySubject[subject].push_back(certDER);
+      }
+      issuer = subject;
+    }
+
+    ByteString subjectAltName;
+    for (int i = 0; i < 8; ++i) {
+      subjectAltName.append(DNSName("host" + std::to_string(i) +
+                                    ".corp.example.com"));
+    }
+    subjectAltName.append(RFC822Name("admin@example.com"));
+    static const uint8_t ipv4[] = { 10, 1, 2, 3 };
+    subjectAltName.append(IPAddress(ipv4));
+    endEntity = CreateCert(issuer,
+                           Name(RDN(CN("host0.corp.example.com")) +
+                                RDN(emailAddress("admin@example.com"))),
+                           EndEntityOrCA::MustBeEndEntity, &subjectAltName,
+                           nullptr, ++serialNumber);
+    EXPECT_FALSE(ENCODING_FAILED(endEntity));
+  }
+
+  ByteString endEntity;
+
+private:
+  Result GetCertTrust(EndEntityOrCA, const CertPolicyId&, Input candidateCert,
+                      /*out*/ TrustLevel& trustLevel) override
+  {
+    trustLevel = TrustLevel::InheritsTrust;
+    if (InputEqualsByteString(candidateCert, root)) {
+      trustLevel = TrustLevel::TrustAnchor;
+    }
+    for (const ByteString& certDER : distrusted) {
+      if (InputEqualsByteString(candidateCert, certDER)) {
+        trustLevel = TrustLevel::ActivelyDistrusted;
+      }
+    }
+    return Success;
+  }
+
+  Result FindIssuer(Input encodedIssuerName, IssuerChecker& checker, Time)
+                    override
+  {
+    for (const ByteString& certDER :
+           certsBySubject[InputToByteString(encodedIssuerName)]) {
+      Input certInput;
+      Result rv = certInput.Init(certDER.data(), certDER.length());
+      if (rv != Success) {
+        return rv;
+      }
+      bool keepGoing;
+      rv = checker.Check(certInput, nullptr, keepGoing);
+      if (rv != Success) {
+        return rv;
+      }
+      if (!keepGoing) {
+        break;
+      }
+    }
+    return Success;
+  }
+
+  Result CheckRevocation(EndEntityOrCA, const CertID&, Time, Duration,
+                         /*optional*/ const Input*,
+                         /*optional*/ const Input*) override
+  {
+    return Success;
+  }
+
+  Result IsChainValid(const DERArray&, Time) override
+  {
+    return Success;
+  }
+
+  Result DigestBuf(Input item, DigestAlgorithm digestAlg,
+                   /*out*/ uint8_t* digestBuf, size_t digestBufLen) override
+  {
+    return TestDigestBuf(item, digestAlg, digestBuf, digestBufLen);
+  }
+
+  Result CheckSignatureDigestAlgorithm(DigestAlgorithm, EndEntityOrCA)
+                                       override
+  {
+    return Success;
+  }
+
+  Result CheckRSAPublicKeyModulusSizeInBits(EndEntityOrCA, unsigned int)
+                                            override
+  {
+    return Success;
+  }
+
+  // The signatures aren't what is being measured.
+  Result VerifyRSAPKCS1SignedDigest(const SignedDigest&, Input) override
+  {
+    return Success;
+  }
+
+  Result CheckValidityIsAcceptable(Time, Time, EndEntityOrCA, KeyPurposeId)
+                                   override
+  {
+    return Success;
+  }
+
+  ByteString root;
+  std::vector<ByteString> distrusted;
+  std::map<ByteString, std::vector<ByteString>> certsBySubject;
+};
+
+} // unnamed namespace
+
+TEST_F(pkixnames_NameConstraintsPresentedIDs, ConstrainedHierarchy)
+{
+  for (size_t levels = 1; levels <= 3; ++levels) {
+    ConstrainedHierarchyTrustDomain trustDomain(levels, 8);
+    Input endEntity;
+    ASSERT_EQ(Success, endEntity.Init(trustDomain.endEntity.data(),
+                                      trustDomain.endEntity.length()));
+    ASSERT_EQ(Success,
+              BuildCertChain(trustDomain, endEntity, Now(),
+                             EndEntityOrCA::MustBeEndEntity,
+                             KeyUsage::noParticularKeyUsageRequired,
+                             KeyPurposeId::id_kp_serverAuth,
+                             CertPolicyId::anyPolicy, nullptr));
+  }
+}
+
+TEST_F(pkixnames_NameConstraintsPresentedIDs,
+       DISABLED_Benchmark_ConstrainedHierarchy)
+{
+  for (size_t levels = 1; levels <= 3; ++levels) {
+    ConstrainedHierarchyTrustDomain trustDomain(levels, 8);
+    Input endEntity;
+    ASSERT_EQ(Success, endEntity.Init(trustDomain.endEntity.data(),
+                                      trustDomain.endEntity.length()));
+    std::string name("BuildCertChain, " + std::to_string(levels) +
+                     " constrained levels x 8 alternatives");
+    Benchmark(name.c_str(), 1000, [&]() {
+      ASSERT_EQ(Success,
+                BuildCertChain(trustDomain, endEntity, Now(),
+                               EndEntityOrCA::MustBeEndEntity,
+                               KeyUsage::noParticularKeyUsageRequired,
+                               KeyPurposeId::id_kp_serverAuth,
+                               CertPolicyId::anyPolicy, nullptr));
+    });
+  }
+}
+
+namespace {
+
+const size_t LEVELS = 3;
+const size_t ALTERNATIVES = 8;
+
+// certDERs[0] is an end-entity certificate with names of every type and
+// certDERs[i] is the certificate of the CA i levels above it. Each CA has
+// ALTERNATIVES sets of name constraints, as if it had been cross-signed that
+// many times.
+void
+CreateChainWithAlternatives(/*out*/ ByteString (&certDERs)[LEVELS],
+                            /*out*/ std::vector<ByteString>& nameConstraints)
+{
+  ByteString subjectAltName;
+  for (int i = 0; i < 8; ++i) {
+    subjectAltName.append(DNSName("host" + std::to_string(i) +
+                                  ".corp.example.com"));
+  }
+  subjectAltName.append(RFC822Name("admin@example.com"));
+  static const uint8_t ipv4[] = { 10, 1, 2, 3 };
+  subjectAltName.append(IPAddress(ipv4));
+
+  certDERs[0] = CreateCert(CNToDERName("CA0"),
+                           Name(RDN(CN("host0.corp.example.com")) +
+                                RDN(emailAddress("admin@example.com"))),
+                           EndEntityOrCA::MustBeEndEntity, &subjectAltName,
+                           nullptr);
+  ASSERT_FALSE(ENCODING_FAILED(certDERs[0]));
+  for (size_t level = 1; level < LEVELS; ++level) {
+    certDERs[level] =
+      CreateCert(CNToDERName(("CA" + std::to_string(level)).c_str()),
+                 CNToDERName(("CA" + std::to_string(level - 1)).c_str()),
+                 EndEntityOrCA::MustBeCA, nullptr, nullptr);
+    ASSERT_FALSE(ENCODING_FAILED(certDERs[level]));
+  }
+
+  static const uint8_t ipv4Constraint[] = { 10, 0, 0, 0, 255, 0, 0, 0 };
+  for (size_t i = 0; i < LEVELS * ALTERNATIVES; ++i) {
+    nameConstraints.push_back(
+      NameConstraints(GeneralSubtree(DNSName("example.com")) +
+                        GeneralSubtree(RFC822Name("example.com")) +
+                        GeneralSubtree(IPAddress(ipv4Constraint)),
+                      GeneralSubtree(DNSName("secret.example.com")) +
+                        GeneralSubtree(DNSName("alternative" +
+                                               std::to_string(i) +
+                                               ".example.com"))));
+  }
+}
+
+// The name constraints checks that path building does for the chain above,
+// without the rest of path building: each of the alternatives for each CA
+// checks its name constraints against every certificate below it.
+void
+CheckChainNameConstraints(const ByteString (&certDERs)[LEVELS],
+                          const std::vector<ByteString>& nameConstraints)
+{
+  Input certInputs[LEVELS];
+  for (size_t level = 0; level < LEVELS; ++level) {
+    ASSERT_EQ(Success, certInputs[level].Init(certDERs[level].data(),
+                                              certDERs[level].length()));
+  }
+  NameConstraintsPresentedIDsBuffer buffer;
+  BackCert endEntity(certInputs[0], EndEntityOrCA::MustBeEndEntity,
+                     nullptr, &buffer);
+  ASSERT_EQ(Success, endEntity.Init());
+  BackCert ca1(certInputs[1], EndEntityOrCA::MustBeCA, &endEntity);
+  ASSERT_EQ(Success, ca1.Init());
+  BackCert ca2(certInputs[2], EndEntityOrCA::MustBeCA, &ca1);
+  ASSERT_EQ(Success, ca2.Init());
+  const BackCert* firstChildren[LEVELS] = { &endEntity, &ca1, &ca2 };
+
+  for (size_t level = 0; level < LEVELS; ++level) {
+    for (size_t i = 0; i < ALTERNATIVES; ++i) {
+      const ByteString& der(nameConstraints[level * ALTERNATIVES + i]);
+      Input nameConstraintsInput;
+      ASSERT_EQ(Success, nameConstraintsInput.Init(der.data(),
+                                                   der.length()));
+      ASSERT_EQ(Success,
+                CheckNameConstraints(nameConstraintsInput,
+                                     *firstChildren[level],
+                                     KeyPurposeId::id_kp_serverAuth));
+    }
+  }
+}
+
+} // unnamed namespace
+
+TEST_F(pkixnames_NameConstraintsPresentedIDs, ChainNameConstraints)
+{
+  ByteString certDERs[LEVELS];
+  std::vector<ByteString> nameConstraints;
+  ASSERT_NO_FATAL_FAILURE(CreateChainWithAlternatives(certDERs,
+                                                      nameConstraints));
+  CheckChainNameConstraints(certDERs, nameConstraints);
+}
+
+TEST_F(pkixnames_NameConstraintsPresentedIDs,
+       DISABLED_Benchmark_ChainNameConstraints)
+{
+  ByteString certDERs[LEVELS];
+  std::vector<ByteString> nameConstraints;
+  ASSERT_NO_FATAL_FAILURE(CreateChainWithAlternatives(certDERs,
+                                                      nameConstraints));
+  Benchmark("CheckNameConstraints, 3 levels x 8 alternatives", 2000, [&]() {
+    CheckChainNameConstraints(certDERs, nameConstraints);
+  });
+}
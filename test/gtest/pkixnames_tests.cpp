@@ -21,6 +21,8 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <vector>
+
 #include "pkixcheck.h"
 #include "pkixder.h"
 #include "pkixgtest.h"
@@ -1054,6 +1056,148 @@ INSTANTIATE_TEST_CASE_P(pkixnames_ParseIPv6Address,
                         pkixnames_ParseIPv6Address,
                         testing::ValuesIn(IPV6_ADDRESSES));
 
+// ClassifyReferenceID must give the same result as trying each parser in
+// turn, the way CheckCertHostname used to.
+static ReferenceIDType
+ClassifyReferenceIDOneParserAtATime(Input hostname,
+                                    /*out*/ uint8_t (&ipAddress)[16])
+{
+  uint8_t ipv4[4];
+  if (IsValidReferenceDNSID(hostname)) {
+    return ReferenceIDType::DNSID;
+  }
+  if (ParseIPv6Address(hostname, ipAddress)) {
+    return ReferenceIDType::IPv6Address;
+  }
+  if (ParseIPv4Address(hostname, ipv4)) {
+    memcpy(ipAddress, ipv4, sizeof(ipv4));
+    return ReferenceIDType::IPv4Address;
+  }
+  return ReferenceIDType::Invalid;
+}
+
+static void
+CheckClassifyReferenceID(const ByteString& hostname)
+{
+  SCOPED_TRACE(hostname.c_str());
+  Input input;
+  ASSERT_EQ(Success, input.Init(hostname.data(), hostname.length()));
+  uint8_t expectedIPAddress[16];
+  ReferenceIDType expectedType(
+    ClassifyReferenceIDOneParserAtATime(input, expectedIPAddress));
+
+  uint8_t ipAddress[16];
+  Input referenceID;
+  ASSERT_EQ(expectedType, ClassifyReferenceID(input, ipAddress, referenceID));
+  switch (expectedType) {
+    case ReferenceIDType::DNSID:
+      ASSERT_TRUE(InputsAreEqual(input, referenceID));
+      break;
+    case ReferenceIDType::IPv4Address:
+      ASSERT_EQ(4u, referenceID.GetLength());
+      ASSERT_EQ(0, memcmp(expectedIPAddress, referenceID.UnsafeGetData(), 4));
+      break;
+    case ReferenceIDType::IPv6Address:
+      ASSERT_EQ(16u, referenceID.GetLength());
+      ASSERT_EQ(0, memcmp(expectedIPAddress, referenceID.UnsafeGetData(), 16));
+      break;
+    case ReferenceIDType::Invalid:
+      break;
+  }
+}
+
+class pkixnames_ClassifyReferenceID_DNSID
+  : public ::testing::Test
+  , public ::testing::WithParamInterface<InputValidity>
+{
+};
+
+TEST_P(pkixnames_ClassifyReferenceID_DNSID, ClassifyReferenceID)
+{
+  CheckClassifyReferenceID(GetParam().input);
+}
+
+INSTANTIATE_TEST_CASE_P(pkixnames_ClassifyReferenceID_DNSID,
+                        pkixnames_ClassifyReferenceID_DNSID,
+                        testing::ValuesIn(DNSNAMES_VALIDITY));
+INSTANTIATE_TEST_CASE_P(pkixnames_ClassifyReferenceID_DNSID_Turkish_I,
+                        pkixnames_ClassifyReferenceID_DNSID,
+                        testing::ValuesIn(DNSNAMES_VALIDITY_TURKISH_I));
+
+class pkixnames_ClassifyReferenceID_IPv4Address
+  : public ::testing::Test
+  , public ::testing::WithParamInterface<IPAddressParams<4>>
+{
+};
+
+TEST_P(pkixnames_ClassifyReferenceID_IPv4Address, ClassifyReferenceID)
+{
+  CheckClassifyReferenceID(GetParam().input);
+}
+
+INSTANTIATE_TEST_CASE_P(pkixnames_ClassifyReferenceID_IPv4Address,
+                        pkixnames_ClassifyReferenceID_IPv4Address,
+                        testing::ValuesIn(IPV4_ADDRESSES));
+
+class pkixnames_ClassifyReferenceID_IPv6Address
+  : public ::testing::Test
+  , public ::testing::WithParamInterface<IPAddressParams<16>>
+{
+};
+
+TEST_P(pkixnames_ClassifyReferenceID_IPv6Address, ClassifyReferenceID)
+{
+  CheckClassifyReferenceID(GetParam().input);
+}
+
+INSTANTIATE_TEST_CASE_P(pkixnames_ClassifyReferenceID_IPv6Address,
+                        pkixnames_ClassifyReferenceID_IPv6Address,
+                        testing::ValuesIn(IPV6_ADDRESSES));
+
+class pkixnames_ClassifyReferenceID : public ::testing::Test
+{
+};
+
+// Hostnames as seen by a service mesh, where most peers are addressed by IP
+// address.
+TEST_F(pkixnames_ClassifyReferenceID, DISABLED_Benchmark_MostlyIPAddresses)
+{
+  static const char* const HOSTNAMES[] = {
+    "10.0.0.1",
+    "10.12.134.201",
+    "192.168.100.254",
+    "172.16.5.4",
+    "fd00::1",
+    "2001:db8:85a3::8a2e:370:7334",
+    "::ffff:10.1.2.3",
+    "fe80::1ff:fe23:4567:890a",
+    "payments.internal.example.com",
+    "api.example.com",
+  };
+  Input hostnames[MOZILLA_PKIX_ARRAY_LENGTH(HOSTNAMES)];
+  for (size_t i = 0; i < MOZILLA_PKIX_ARRAY_LENGTH(HOSTNAMES); ++i) {
+    ASSERT_EQ(Success,
+              hostnames[i].Init(reinterpret_cast<const uint8_t*>(HOSTNAMES[i]),
+                                strlen(HOSTNAMES[i])));
+  }
+
+  Benchmark("one parser at a time x 10", 100000, [&]() {
+    for (const Input& hostname : hostnames) {
+      uint8_t ipAddress[16];
+      ASSERT_NE(ReferenceIDType::Invalid,
+                ClassifyReferenceIDOneParserAtATime(hostname, ipAddress));
+    }
+  });
+  Benchmark("ClassifyReferenceID x 10", 100000, [&]() {
+    for (const Input& hostname : hostnames) {
+      uint8_t ipAddress[16];
+      Input referenceID;
+      ASSERT_NE(ReferenceIDType::Invalid,
+                ClassifyReferenceID(hostname, ipAddress, referenceID));
+    }
+  });
+}
+
 // This is an arbitrary string that is used to indicate that no SAN extension
 // should be put into the generated certificate. It needs to be different from
 // "" or any other subjectAltName value that we actually want to test, but its
@@ -1553,6 +1697,24 @@ CreateCert(const ByteString& subject, const ByteString& subjectAltName)
                     extensions, *keyPair, sha256WithRSAEncryption());
 }
 
+// Checks the hostname both with CheckCertHostname and with a
+// CertHostnameMatcher, which must have the same result.
+Result
+CheckCertHostnameBothWays(Input certInput, Input hostname)
+{
+  Result rv = CheckCertHostname(certInput, hostname);
+  std::vector<CertHostnameMatcher::Entry> entries(
+    CertHostnameMatcher::MaxEntryCount(certInput));
+  CertHostnameMatcher matcher;
+  Result initResult = matcher.Init(certInput, entries.data(), entries.size());
+  if (initResult != Success) {
+    EXPECT_EQ(rv, initResult);
+  } else {
+    EXPECT_EQ(rv, matcher.CheckHostname(hostname));
+  }
+  return rv;
+}
+
 TEST_P(pkixnames_CheckCertHostname, CheckCertHostname)
 {
   const CheckCertHostnameParams& param(GetParam());
@@ -1566,7 +1728,8 @@ TEST_P(pkixnames_CheckCertHostname, CheckCertHostname)
   ASSERT_EQ(Success, hostnameInput.Init(param.hostname.data(),
                                         param.hostname.length()));
 
-  ASSERT_EQ(param.result, CheckCertHostname(certInput, hostnameInput));
+  ASSERT_EQ(param.result,
+            CheckCertHostnameBothWays(certInput, hostnameInput));
 }
 
 INSTANTIATE_TEST_CASE_P(pkixnames_CheckCertHostname,
@@ -1598,7 +1761,7 @@ TEST_F(pkixnames_CheckCertHostname, SANWithoutSequence)
 
   static const uint8_t a[] = { 'a' };
   ASSERT_EQ(Result::ERROR_EXTENSION_VALUE_INVALID,
-            CheckCertHostname(certInput, Input(a)));
+            CheckCertHostnameBothWays(certInput, Input(a)));
 }
 
 class pkixnames_CheckCertHostname_PresentedMatchesReference
@@ -1624,7 +1787,7 @@ TEST_P(pkixnames_CheckCertHostname_PresentedMatchesReference, CN_NoSAN)
                                         param.referenceDNSID.length()));
 
   ASSERT_EQ(param.expectedMatches ? Success : Result::ERROR_BAD_CERT_DOMAIN,
-            CheckCertHostname(certInput, hostnameInput));
+            CheckCertHostnameBothWays(certInput, hostnameInput));
 }
 
 TEST_P(pkixnames_CheckCertHostname_PresentedMatchesReference,
@@ -1648,7 +1811,8 @@ TEST_P(pkixnames_CheckCertHostname_PresentedMatchesReference,
     = param.expectedResult != Success ? param.expectedResult
     : param.expectedMatches ? Success
     : Result::ERROR_BAD_CERT_DOMAIN;
-  ASSERT_EQ(expectedResult, CheckCertHostname(certInput, hostnameInput));
+  ASSERT_EQ(expectedResult,
+            CheckCertHostnameBothWays(certInput, hostnameInput));
 }
 
 INSTANTIATE_TEST_CASE_P(pkixnames_CheckCertHostname_DNSID_MATCH_PARAMS,
@@ -1677,8 +1841,10 @@ TEST_P(pkixnames_Turkish_I_Comparison, CheckCertHostname_CN_NoSAN)
                         ? Success
                         : Result::ERROR_BAD_CERT_DOMAIN;
 
-  ASSERT_EQ(expectedResult, CheckCertHostname(certInput, UPPERCASE_I));
-  ASSERT_EQ(expectedResult, CheckCertHostname(certInput, LOWERCASE_I));
+  ASSERT_EQ(expectedResult,
+            CheckCertHostnameBothWays(certInput, UPPERCASE_I));
+  ASSERT_EQ(expectedResult,
+            CheckCertHostnameBothWays(certInput, LOWERCASE_I));
 }
 
 TEST_P(pkixnames_Turkish_I_Comparison, CheckCertHostname_SAN)
@@ -1704,8 +1870,10 @@ TEST_P(pkixnames_Turkish_I_Comparison, CheckCertHostname_SAN)
        InputsAreEqual(UPPERCASE_I, input)) ? Success
     : Result::ERROR_BAD_CERT_DOMAIN;
 
-  ASSERT_EQ(expectedResult, CheckCertHostname(certInput, UPPERCASE_I));
-  ASSERT_EQ(expectedResult, CheckCertHostname(certInput, LOWERCASE_I));
+  ASSERT_EQ(expectedResult,
+            CheckCertHostnameBothWays(certInput, UPPERCASE_I));
+  ASSERT_EQ(expectedResult,
+            CheckCertHostnameBothWays(certInput, LOWERCASE_I));
 }
 
 class pkixnames_CheckCertHostname_IPV4_Addresses
@@ -1733,7 +1901,7 @@ TEST_P(pkixnames_CheckCertHostname_IPV4_Addresses,
                                         param.input.length()));
 
   ASSERT_EQ(param.isValid ? Success : Result::ERROR_BAD_CERT_DOMAIN,
-            CheckCertHostname(certInput, hostnameInput));
+            CheckCertHostnameBothWays(certInput, hostnameInput));
 }
 
 TEST_P(pkixnames_CheckCertHostname_IPV4_Addresses,
@@ -1760,7 +1928,8 @@ TEST_P(pkixnames_CheckCertHostname_IPV4_Addresses,
                         ? Success
                         : Result::ERROR_BAD_CERT_DOMAIN;
 
-  ASSERT_EQ(expectedResult, CheckCertHostname(certInput, hostnameInput));
+  ASSERT_EQ(expectedResult,
+            CheckCertHostnameBothWays(certInput, hostnameInput));
 }
 
 INSTANTIATE_TEST_CASE_P(pkixnames_CheckCertHostname_IPV4_ADDRESSES,
@@ -2510,6 +2679,23 @@ class pkixnames_CheckNameConstraints
   : public ::testing::Test
   , public ::testing::WithParamInterface<NameConstraintParams>
 {
+protected:
+  // Checks the name constraints both directly and in compiled form, which
+  // must have the same result.
+  static Result CheckNameConstraintsBothWays(Input nameConstraints,
+                                             const BackCert& cert)
+  {
+    Result rv = CheckNameConstraints(nameConstraints, cert,
+                                     KeyPurposeId::id_kp_serverAuth);
+    std::vector<CompiledNameConstraints::Entry> entries(
+      CompiledNameConstraints::MaxEntryCount(nameConstraints));
+    CompiledNameConstraints compiled;
+    EXPECT_EQ(Success, compiled.Init(nameConstraints, entries.data(),
+                                     entries.size()));
+    EXPECT_EQ(rv, CheckNameConstraints(compiled, cert,
+                                       KeyPurposeId::id_kp_serverAuth));
+    return rv;
+  }
 };
 
 TEST_P(pkixnames_CheckNameConstraints,
@@ -2535,8 +2721,7 @@ TEST_P(pkixnames_CheckNameConstraints,
               nameConstraints.Init(nameConstraintsDER.data(),
                                    nameConstraintsDER.length()));
     ASSERT_EQ(param.expectedPermittedSubtreesResult,
-              CheckNameConstraints(nameConstraints, cert,
-                                   KeyPurposeId::id_kp_serverAuth));
+              CheckNameConstraintsBothWays(nameConstraints, cert));
   }
   {
     ByteString nameConstraintsDER(TLV(der::SEQUENCE,
@@ -2546,8 +2731,7 @@ TEST_P(pkixnames_CheckNameConstraints,
               nameConstraints.Init(nameConstraintsDER.data(),
                                    nameConstraintsDER.length()));
     ASSERT_EQ(param.expectedExcludedSubtreesResult,
-              CheckNameConstraints(nameConstraints, cert,
-                                   KeyPurposeId::id_kp_serverAuth));
+              CheckNameConstraintsBothWays(nameConstraints, cert));
   }
   {
     ByteString nameConstraintsDER(TLV(der::SEQUENCE,
@@ -2561,8 +2745,7 @@ TEST_P(pkixnames_CheckNameConstraints,
                param.expectedExcludedSubtreesResult)
                 ? param.expectedExcludedSubtreesResult
                 : Result::ERROR_CERT_NOT_IN_NAME_SPACE,
-              CheckNameConstraints(nameConstraints, cert,
-                                   KeyPurposeId::id_kp_serverAuth));
+              CheckNameConstraintsBothWays(nameConstraints, cert));
   }
 }
 
@@ -0,0 +1,274 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "keyhi.h"
+#include "pkixgtest.h"
+#include "pkix/pkixnss.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+class pkixnss_PublicKeyCacheNSS : public ::testing::Test
+{
+public:
+  static void SetUpTestCase()
+  {
+    keyPair.reset(CloneReusedKeyPair());
+    if (!keyPair) {
+      abort();
+    }
+    tbs = ByteString(reinterpret_cast<const uint8_t*>("to be signed"));
+    if (keyPair->SignData(tbs, sha256WithRSAEncryption(), signature)
+          != Success) {
+      abort();
+    }
+    Input tbsInput;
+    if (tbsInput.Init(tbs.data(), tbs.length()) != Success ||
+        TestDigestBuf(tbsInput, DigestAlgorithm::sha256, digest,
+                      sizeof digest) != Success) {
+      abort();
+    }
+  }
+
+  static void TearDownTestCase()
+  {
+    keyPair.reset();
+  }
+
+protected:
+  void SetUp() override
+  {
+    ASSERT_EQ(Success, spki.Init(keyPair->subjectPublicKeyInfo.data(),
+                                 keyPair->subjectPublicKeyInfo.length()));
+  }
+
+  Result Verify(const ByteString& signatureToVerify,
+                /*optional*/ PublicKeyCacheNSS* cache)
+  {
+    Input signatureInput;
+    Result rv = signatureInput.Init(signatureToVerify.data(),
+                                    signatureToVerify.length());
+    if (rv != Success) {
+      return rv;
+    }
+    const SignedDigest sd = {
+      Input(digest), DigestAlgorithm::sha256, signatureInput
+    };
+    return VerifyRSAPKCS1SignedDigestNSS(sd, spki, nullptr, cache);
+  }
+
+  // Returns a new copy of the key in spki, for tests that only exercise the
+  // bookkeeping of the cache.
+  SECKEYPublicKey* DecodeKey()
+  {
+    SECItem spkiSECItem = UnsafeMapInputToSECItem(spki);
+    CERTSubjectPublicKeyInfo* decoded =
+      SECKEY_DecodeDERSubjectPublicKeyInfo(&spkiSECItem);
+    if (!decoded) {
+      return nullptr;
+    }
+    SECKEYPublicKey* publicKey = SECKEY_ExtractPublicKey(decoded);
+    SECKEY_DestroySubjectPublicKeyInfo(decoded);
+    return publicKey;
+  }
+
+  static ScopedTestKeyPair keyPair;
+  static ByteString tbs;
+  static ByteString signature;
+  static uint8_t digest[256 / 8];
+
+  Input spki;
+};
+
+/*static*/ ScopedTestKeyPair pkixnss_PublicKeyCacheNSS::keyPair;
+/*static*/ ByteString pkixnss_PublicKeyCacheNSS::tbs;
+/*static*/ ByteString pkixnss_PublicKeyCacheNSS::signature;
+/*static*/ uint8_t pkixnss_PublicKeyCacheNSS::digest[256 / 8];
+
+TEST_F(pkixnss_PublicKeyCacheNSS, VerifyUsesCachedKey)
+{
+  PublicKeyCacheNSS cache;
+  ASSERT_EQ(Success, Verify(signature, &cache));
+  ASSERT_EQ(Success, Verify(signature, &cache));
+  ASSERT_EQ(Success, Verify(signature, &cache));
+
+  PublicKeyCacheNSS::Stats stats(cache.GetStats());
+  ASSERT_EQ(2u, stats.hits);
+  ASSERT_EQ(1u, stats.misses);
+  ASSERT_EQ(0u, stats.evictions);
+}
+
+TEST_F(pkixnss_PublicKeyCacheNSS, BadSignatureWithCachedKey)
+{
+  PublicKeyCacheNSS cache;
+  ASSERT_EQ(Success, Verify(signature, &cache));
+
+  ByteString badSignature(signature);
+  badSignature[badSignature.length() - 1] ^= 1;
+  ASSERT_EQ(Result::ERROR_BAD_SIGNATURE, Verify(badSignature, &cache));
+  ASSERT_EQ(Result::ERROR_BAD_SIGNATURE, Verify(badSignature, nullptr));
+  ASSERT_EQ(1u, cache.GetStats().hits);
+}
+
+TEST_F(pkixnss_PublicKeyCacheNSS, KeyNotCachedAfterBadSignature)
+{
+  PublicKeyCacheNSS cache;
+  ByteString badSignature(signature);
+  badSignature[badSignature.length() - 1] ^= 1;
+  ASSERT_EQ(Result::ERROR_BAD_SIGNATURE, Verify(badSignature, &cache));
+  ASSERT_EQ(Success, Verify(signature, &cache));
+
+  PublicKeyCacheNSS::Stats stats(cache.GetStats());
+  ASSERT_EQ(0u, stats.hits);
+  ASSERT_EQ(2u, stats.misses);
+}
+
+TEST_F(pkixnss_PublicKeyCacheNSS, OldestEntryEvicted)
+{
+  PublicKeyCacheNSS cache;
+  // The cache only compares the bytes it is given, so distinct one-byte
+  // "SubjectPublicKeyInfos" are enough to fill it.
+  uint8_t keys[PublicKeyCacheNSS::CAPACITY + 1];
+  for (size_t i = 0; i < sizeof keys; ++i) {
+    keys[i] = static_cast<uint8_t>(i);
+    Input key;
+    ASSERT_EQ(Success, key.Init(&keys[i], 1));
+    SECKEYPublicKey* publicKey = DecodeKey();
+    ASSERT_TRUE(publicKey);
+    cache.Add(key, publicKey);
+  }
+  ASSERT_EQ(1u, cache.GetStats().evictions);
+
+  Input first;
+  ASSERT_EQ(Success, first.Init(&keys[0], 1));
+  ASSERT_FALSE(cache.Acquire(first));
+  for (size_t i = 1; i < sizeof keys; ++i) {
+    Input key;
+    ASSERT_EQ(Success, key.Init(&keys[i], 1));
+    SECKEYPublicKey* publicKey = cache.Acquire(key);
+    ASSERT_TRUE(publicKey);
+    cache.Release(publicKey);
+  }
+}
+
+TEST_F(pkixnss_PublicKeyCacheNSS, KeyInUseNotEvicted)
+{
+  PublicKeyCacheNSS cache;
+  uint8_t keys[PublicKeyCacheNSS::CAPACITY + 1];
+  keys[0] = 0;
+  Input first;
+  ASSERT_EQ(Success, first.Init(&keys[0], 1));
+  cache.Add(first, DecodeKey());
+  SECKEYPublicKey* held = cache.Acquire(first);
+  ASSERT_TRUE(held);
+
+  for (size_t i = 1; i < sizeof keys; ++i) {
+    keys[i] = static_cast<uint8_t>(i);
+    Input key;
+    ASSERT_EQ(Success, key.Init(&keys[i], 1));
+    cache.Add(key, DecodeKey());
+  }
+  // The second entry was replaced instead of the first.
+  ASSERT_EQ(1u, cache.GetStats().evictions);
+  Input second;
+  ASSERT_EQ(Success, second.Init(&keys[1], 1));
+  ASSERT_FALSE(cache.Acquire(second));
+  SECKEYPublicKey* again = cache.Acquire(first);
+  ASSERT_EQ(held, again);
+  cache.Release(again);
+  cache.Release(held);
+}
+
+TEST_F(pkixnss_PublicKeyCacheNSS, KeyInUseSurvivesClear)
+{
+  PublicKeyCacheNSS cache;
+  ASSERT_EQ(Success, Verify(signature, &cache));
+  SECKEYPublicKey* held = cache.Acquire(spki);
+  ASSERT_TRUE(held);
+
+  cache.Clear();
+  ASSERT_FALSE(cache.Acquire(spki));
+  // The key remains usable until it is released.
+  ASSERT_EQ(2048u, SECKEY_PublicKeyStrengthInBits(held));
+  cache.Release(held);
+
+  ASSERT_EQ(Success, Verify(signature, &cache));
+  ASSERT_EQ(Success, Verify(signature, &cache));
+  ASSERT_EQ(1u, cache.GetStats().hits);
+}
+
+TEST_F(pkixnss_PublicKeyCacheNSS, ConcurrentVerification)
+{
+  PublicKeyCacheNSS cache;
+  static const size_t THREADS = 4;
+  static const size_t VERIFICATIONS_PER_THREAD = 50;
+  std::vector<std::thread> threads;
+  std::vector<Result> results(THREADS, Success);
+  for (size_t t = 0; t < THREADS; ++t) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = 0; i < VERIFICATIONS_PER_THREAD; ++i) {
+        Result rv = Verify(signature, &cache);
+        if (rv != Success) {
+          results[t] = rv;
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (Result rv : results) {
+    ASSERT_EQ(Success, rv);
+  }
+  PublicKeyCacheNSS::Stats stats(cache.GetStats());
+  ASSERT_EQ(THREADS * VERIFICATIONS_PER_THREAD, stats.hits + stats.misses);
+  ASSERT_LE(stats.misses, THREADS);
+}
+
+TEST_F(pkixnss_PublicKeyCacheNSS, DISABLED_Benchmark_VerifyRSAPKCS1SignedDigest)
+{
+  static const size_t ITERATIONS = 2000;
+
+  Benchmark("VerifyRSAPKCS1SignedDigestNSS without cache", ITERATIONS, [&]() {
+    ASSERT_EQ(Success, Verify(signature, nullptr));
+  });
+
+  PublicKeyCacheNSS cache;
+  Benchmark("VerifyRSAPKCS1SignedDigestNSS with cache", ITERATIONS, [&]() {
+    ASSERT_EQ(Success, Verify(signature, &cache));
+  });
+
+  PublicKeyCacheNSS::Stats stats(cache.GetStats());
+  std::printf("[ BENCHMARK] PublicKeyCacheNSS: %llu hits, %llu misses, "
+              "%.1f%% hit rate\n",
+              static_cast<unsigned long long>(stats.hits),
+              static_cast<unsigned long long>(stats.misses),
+              100.0 * stats.hits / (stats.hits + stats.misses));
+  ASSERT_EQ(ITERATIONS - 1, stats.hits);
+}
@@ -61,9 +61,21 @@ protected:
     issuerSPKI = keyPair->subjectPublicKeyInfo;
   }
 
+  static const uint8_t TYPICAL_SERIAL_NUMBER[20];
+  static const size_t TYPICAL_REQUEST_LENGTH =
+    2u + 2u + 2u + 2u + 2u + 11u + 22u + 22u + 22u;
+
   CreateEncodedOCSPRequestTrustDomain trustDomain;
 };
 
+/*static*/ const uint8_t
+  pkixocsp_CreateEncodedOCSPRequest::TYPICAL_SERIAL_NUMBER[20] = {
+    0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0x01, 0x23,
+    0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67
+  };
+/*static*/ const size_t
+  pkixocsp_CreateEncodedOCSPRequest::TYPICAL_REQUEST_LENGTH;
+
 // Test that the large length of the child serial number causes
 // CreateEncodedOCSPRequest to fail.
 TEST_F(pkixocsp_CreateEncodedOCSPRequest, ChildCertLongSerialNumberTest)
@@ -143,3 +155,50 @@ TEST_F(pkixocsp_CreateEncodedOCSPRequest, LongestSupportedSerialNumberTest)
                                      CertID(issuer, spki, serialNumber),
                                      ocspRequest, ocspRequestLength));
 }
+
+// Test that the request for a typical 20-octet serial number has the
+// expected length: the OCSPRequest, TBSRequest, requestList, Request and
+// CertID SEQUENCEs, the hashAlgorithm, the two hashes, and the serial number.
+TEST_F(pkixocsp_CreateEncodedOCSPRequest, TypicalSerialNumberTest)
+{
+  ByteString issuerDER;
+  ByteString issuerSPKI;
+  ASSERT_NO_FATAL_FAILURE(MakeIssuerCertIDComponents("CA", issuerDER,
+                                                     issuerSPKI));
+  Input issuer;
+  ASSERT_EQ(Success, issuer.Init(issuerDER.data(), issuerDER.length()));
+  Input spki;
+  ASSERT_EQ(Success, spki.Init(issuerSPKI.data(), issuerSPKI.length()));
+
+  uint8_t ocspRequest[OCSP_REQUEST_MAX_LENGTH];
+  size_t ocspRequestLength;
+  ASSERT_EQ(Success,
+            CreateEncodedOCSPRequest(trustDomain,
+                                     CertID(issuer, spki,
+                                            Input(TYPICAL_SERIAL_NUMBER)),
+                                     ocspRequest, ocspRequestLength));
+  ASSERT_EQ(TYPICAL_REQUEST_LENGTH, ocspRequestLength);
+}
+
+TEST_F(pkixocsp_CreateEncodedOCSPRequest,
+       DISABLED_Benchmark_CreateEncodedOCSPRequest)
+{
+  ByteString issuerDER;
+  ByteString issuerSPKI;
+  ASSERT_NO_FATAL_FAILURE(MakeIssuerCertIDComponents("CA", issuerDER,
+                                                     issuerSPKI));
+  Input issuer;
+  ASSERT_EQ(Success, issuer.Init(issuerDER.data(), issuerDER.length()));
+  Input spki;
+  ASSERT_EQ(Success, spki.Init(issuerSPKI.data(), issuerSPKI.length()));
+  const CertID certID(issuer, spki, Input(TYPICAL_SERIAL_NUMBER));
+
+  Benchmark("CreateEncodedOCSPRequest", 100000, [&]() {
+    uint8_t ocspRequest[OCSP_REQUEST_MAX_LENGTH];
+    size_t ocspRequestLength;
+    ASSERT_EQ(Success,
+              CreateEncodedOCSPRequest(trustDomain, certID, ocspRequest,
+                                       ocspRequestLength));
+    ASSERT_EQ(TYPICAL_REQUEST_LENGTH, ocspRequestLength);
+  });
+}
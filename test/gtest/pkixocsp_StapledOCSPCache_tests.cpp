@@ -0,0 +1,464 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "pkixgtest.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+const uint16_t END_ENTITY_MAX_LIFETIME_IN_DAYS = 10;
+char const* const rootName = "Test CA 1";
+
+// Counts signature verifications so that tests can tell whether a result
+// came from the cache.
+class StapledOCSPCacheTestTrustDomain final : public DefaultCryptoTrustDomain
+{
+public:
+  StapledOCSPCacheTestTrustDomain()
+    : signatureVerifications(0)
+  {
+  }
+
+  Result GetCertTrust(EndEntityOrCA endEntityOrCA, const CertPolicyId&,
+                      Input, /*out*/ TrustLevel& trustLevel) override
+  {
+    EXPECT_EQ(endEntityOrCA, EndEntityOrCA::MustBeEndEntity);
+    trustLevel = TrustLevel::InheritsTrust;
+    return Success;
+  }
+
+  Result VerifyRSAPKCS1SignedDigest(const SignedDigest& signedDigest,
+                                    Input subjectPublicKeyInfo) override
+  {
+    ++signatureVerifications;
+    return TestVerifyRSAPKCS1SignedDigest(signedDigest, subjectPublicKeyInfo);
+  }
+
+  std::atomic<size_t> signatureVerifications;
+};
+
+} // unnamed namespace
+
+class pkixocsp_StapledOCSPCache : public ::testing::Test
+{
+public:
+  static void SetUpTestCase()
+  {
+    rootKeyPair.reset(GenerateKeyPair());
+    if (!rootKeyPair) {
+      abort();
+    }
+    rootNameDER = CNToDERName(rootName);
+    if (ENCODING_FAILED(rootNameDER)) {
+      abort();
+    }
+  }
+
+  // Returns the CertID of a certificate with the given serial number issued
+  // by the test root. serialNumberDER must outlive the result.
+  static CertID MakeCertID(const ByteString& serialNumberDER)
+  {
+    Input issuer;
+    EXPECT_EQ(Success, issuer.Init(rootNameDER.data(), rootNameDER.length()));
+    Input issuerSPKI;
+    EXPECT_EQ(Success,
+              issuerSPKI.Init(rootKeyPair->subjectPublicKeyInfo.data(),
+                              rootKeyPair->subjectPublicKeyInfo.length()));
+    Input serialNumber;
+    EXPECT_EQ(Success, serialNumber.Init(serialNumberDER.data(),
+                                         serialNumberDER.length()));
+    return CertID(issuer, issuerSPKI, serialNumber);
+  }
+
+  static ByteString CreateResponse(const CertID& certID,
+                                   OCSPResponseContext::CertStatus certStatus,
+                                   time_t thisUpdate = oneDayBeforeNow,
+                                   bool badSignature = false,
+                      /*optional*/ const TestKeyPair* signerKeyPair = nullptr,
+                      /*optional*/ const ByteString* certs = nullptr)
+  {
+    OCSPResponseContext context(certID, thisUpdate);
+    context.signerKeyPair.reset(signerKeyPair ? signerKeyPair->Clone()
+                                              : rootKeyPair->Clone());
+    EXPECT_TRUE(context.signerKeyPair.get());
+    context.badSignature = badSignature;
+    context.certs = certs;
+    context.certStatus = static_cast<uint8_t>(certStatus);
+    if (certStatus == OCSPResponseContext::revoked) {
+      context.revocationTime = thisUpdate;
+    }
+    context.thisUpdate = thisUpdate;
+    context.nextUpdate = thisUpdate + ONE_DAY_IN_SECONDS_AS_TIME_T * 2;
+    ByteString response(CreateEncodedOCSPResponse(context));
+    EXPECT_FALSE(ENCODING_FAILED(response));
+    return response;
+  }
+
+  Result Verify(const CertID& certID, const ByteString& response, Time time,
+                /*out*/ bool& expired,
+                /*optional out*/ Time* validThrough = nullptr,
+                uint16_t maxLifetimeInDays = END_ENTITY_MAX_LIFETIME_IN_DAYS)
+  {
+    Input responseInput;
+    EXPECT_EQ(Success, responseInput.Init(response.data(),
+                                          response.length()));
+    return VerifyStapledOCSPResponse(cache, trustDomain, certID, time,
+                                     maxLifetimeInDays, responseInput,
+                                     expired, nullptr, validThrough);
+  }
+
+  static ScopedTestKeyPair rootKeyPair;
+  static ByteString rootNameDER;
+  StapledOCSPCacheTestTrustDomain trustDomain;
+  StapledOCSPCache cache;
+};
+
+/*static*/ ScopedTestKeyPair pkixocsp_StapledOCSPCache::rootKeyPair;
+/*static*/ ByteString pkixocsp_StapledOCSPCache::rootNameDER;
+
+TEST_F(pkixocsp_StapledOCSPCache, HitSkipsVerification)
+{
+  ByteString serialNumberDER(CreateEncodedSerialNumber(1));
+  CertID certID(MakeCertID(serialNumberDER));
+  ByteString response(CreateResponse(certID, OCSPResponseContext::good));
+
+  bool expired;
+  Time validThrough(Time::uninitialized);
+  ASSERT_EQ(Success, Verify(certID, response, Now(), expired, &validThrough));
+  ASSERT_FALSE(expired);
+  ASSERT_EQ(1u, trustDomain.signatureVerifications);
+
+  Time cachedValidThrough(Time::uninitialized);
+  ASSERT_EQ(Success, Verify(certID, response, Now(), expired,
+                            &cachedValidThrough));
+  ASSERT_FALSE(expired);
+  ASSERT_EQ(validThrough, cachedValidThrough);
+  ASSERT_EQ(1u, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_StapledOCSPCache, RevokedIsCached)
+{
+  ByteString serialNumberDER(CreateEncodedSerialNumber(2));
+  CertID certID(MakeCertID(serialNumberDER));
+  ByteString response(CreateResponse(certID, OCSPResponseContext::revoked));
+
+  bool expired;
+  ASSERT_EQ(Result::ERROR_REVOKED_CERTIFICATE,
+            Verify(certID, response, Now(), expired));
+  ASSERT_EQ(Result::ERROR_REVOKED_CERTIFICATE,
+            Verify(certID, response, Now(), expired));
+  ASSERT_FALSE(expired);
+  ASSERT_EQ(1u, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_StapledOCSPCache, DifferentCertIDMisses)
+{
+  ByteString serialNumberDER(CreateEncodedSerialNumber(3));
+  CertID certID(MakeCertID(serialNumberDER));
+  ByteString response(CreateResponse(certID, OCSPResponseContext::good));
+  bool expired;
+  ASSERT_EQ(Success, Verify(certID, response, Now(), expired));
+
+  // The same staple presented for another certificate must not be accepted
+  // because of the cached result for the first one.
+  ByteString otherSerialNumberDER(CreateEncodedSerialNumber(4));
+  CertID otherCertID(MakeCertID(otherSerialNumberDER));
+  ASSERT_EQ(Result::ERROR_OCSP_RESPONSE_FOR_CERT_MISSING,
+            Verify(otherCertID, response, Now(), expired));
+  ASSERT_EQ(2u, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_StapledOCSPCache, DifferentStapleMisses)
+{
+  ByteString serialNumberDER(CreateEncodedSerialNumber(5));
+  CertID certID(MakeCertID(serialNumberDER));
+  ByteString good(CreateResponse(certID, OCSPResponseContext::good));
+  bool expired;
+  ASSERT_EQ(Success, Verify(certID, good, Now(), expired));
+
+  ByteString revoked(CreateResponse(certID, OCSPResponseContext::revoked));
+  ASSERT_EQ(Result::ERROR_REVOKED_CERTIFICATE,
+            Verify(certID, revoked, Now(), expired));
+  ASSERT_EQ(2u, trustDomain.signatureVerifications);
+
+  // Both results are now cached.
+  ASSERT_EQ(Success, Verify(certID, good, Now(), expired));
+  ASSERT_EQ(Result::ERROR_REVOKED_CERTIFICATE,
+            Verify(certID, revoked, Now(), expired));
+  ASSERT_EQ(2u, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_StapledOCSPCache, DifferentMaxLifetimeMisses)
+{
+  ByteString serialNumberDER(CreateEncodedSerialNumber(101));
+  CertID certID(MakeCertID(serialNumberDER));
+  ByteString response(CreateResponse(certID, OCSPResponseContext::good));
+  bool expired;
+  Time validThrough(Time::uninitialized);
+  ASSERT_EQ(Success, Verify(certID, response, Now(), expired, &validThrough));
+  ASSERT_EQ(1u, trustDomain.signatureVerifications);
+
+  // The response was produced a day ago and is good for two days, but only a
+  // day's lifetime is allowed, so the validThrough cached for the longer
+  // maximum must not be used.
+  Input responseInput;
+  ASSERT_EQ(Success, responseInput.Init(response.data(), response.length()));
+  bool uncachedExpired;
+  Time uncachedValidThrough(Time::uninitialized);
+  Result uncached = VerifyEncodedOCSPResponse(trustDomain, certID, Now(), 1,
+                                              responseInput, uncachedExpired,
+                                              nullptr, &uncachedValidThrough);
+  ASSERT_LT(uncachedValidThrough, validThrough);
+  ASSERT_EQ(2u, trustDomain.signatureVerifications);
+
+  Time shorterValidThrough(Time::uninitialized);
+  ASSERT_EQ(uncached, Verify(certID, response, Now(), expired,
+                             &shorterValidThrough, 1));
+  ASSERT_EQ(uncachedExpired, expired);
+  ASSERT_EQ(uncachedValidThrough, shorterValidThrough);
+  ASSERT_EQ(3u, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_StapledOCSPCache, ExpiredIsVerifiedAgain)
+{
+  ByteString serialNumberDER(CreateEncodedSerialNumber(6));
+  CertID certID(MakeCertID(serialNumberDER));
+  ByteString response(CreateResponse(certID, OCSPResponseContext::good));
+
+  bool expired;
+  Time validThrough(Time::uninitialized);
+  ASSERT_EQ(Success, Verify(certID, response, Now(), expired, &validThrough));
+
+  ASSERT_EQ(Success, Verify(certID, response, validThrough, expired));
+  ASSERT_FALSE(expired);
+  ASSERT_EQ(1u, trustDomain.signatureVerifications);
+
+  Time afterValidThrough(validThrough);
+  ASSERT_EQ(Success, afterValidThrough.AddSeconds(1));
+  ASSERT_EQ(Result::ERROR_OCSP_OLD_RESPONSE,
+            Verify(certID, response, afterValidThrough, expired));
+  ASSERT_TRUE(expired);
+  ASSERT_EQ(2u, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_StapledOCSPCache, EarlierTimeIsVerifiedAgain)
+{
+  // A response verified now would not necessarily have been accepted at an
+  // earlier time (its thisUpdate may have been in the future then), so the
+  // cached result must not be used for earlier times.
+  ByteString serialNumberDER(CreateEncodedSerialNumber(7));
+  CertID certID(MakeCertID(serialNumberDER));
+  ByteString response(CreateResponse(certID, OCSPResponseContext::good, now));
+
+  bool expired;
+  ASSERT_EQ(Success, Verify(certID, response, Now(), expired));
+  ASSERT_EQ(Result::ERROR_OCSP_FUTURE_RESPONSE,
+            Verify(certID, response,
+                   TimeFromEpochInSeconds(static_cast<uint64_t>(
+                     now - 2 * ONE_DAY_IN_SECONDS_AS_TIME_T)), expired));
+  ASSERT_EQ(2u, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_StapledOCSPCache, SignerExpiryIsVerifiedAgain)
+{
+  // The response is signed by a delegated responder whose certificate
+  // expires before the response does, so the cached result must not be used
+  // after the certificate expires.
+  static const Input OCSPSigningEKUDER(tlv_id_kp_OCSPSigning);
+  const ByteString extensions[] = {
+    CreateEncodedEKUExtension(OCSPSigningEKUDER, Critical::No),
+    ByteString()
+  };
+  const time_t signerNotAfter = now + ONE_DAY_IN_SECONDS_AS_TIME_T / 2;
+  ScopedTestKeyPair signerKeyPair(GenerateKeyPair());
+  ASSERT_TRUE(signerKeyPair.get());
+  ByteString signerSerialNumberDER(CreateEncodedSerialNumber(100));
+  ByteString signerDER(CreateEncodedCertificate(
+                         v3, sha256WithRSAEncryption(), signerSerialNumberDER,
+                         rootNameDER, oneDayBeforeNow, signerNotAfter,
+                         CNToDERName("SignerExpiryIsVerifiedAgain"),
+                         *signerKeyPair, extensions, *rootKeyPair,
+                         sha256WithRSAEncryption()));
+  ASSERT_FALSE(ENCODING_FAILED(signerDER));
+  ByteString certs[] = { signerDER, ByteString() };
+
+  ByteString serialNumberDER(CreateEncodedSerialNumber(10));
+  CertID certID(MakeCertID(serialNumberDER));
+  ByteString response(CreateResponse(certID, OCSPResponseContext::good,
+                                     oneDayBeforeNow, false,
+                                     signerKeyPair.get(), certs));
+
+  bool expired;
+  Time validThrough(Time::uninitialized);
+  ASSERT_EQ(Success, Verify(certID, response, Now(), expired, &validThrough));
+  ASSERT_LT(TimeFromEpochInSeconds(static_cast<uint64_t>(signerNotAfter)),
+            validThrough);
+  size_t signatureVerifications = trustDomain.signatureVerifications;
+
+  ASSERT_EQ(Success,
+            Verify(certID, response,
+                   TimeFromEpochInSeconds(static_cast<uint64_t>(
+                     signerNotAfter)), expired));
+  ASSERT_EQ(signatureVerifications, trustDomain.signatureVerifications);
+
+  ASSERT_EQ(Result::ERROR_OCSP_INVALID_SIGNING_CERT,
+            Verify(certID, response,
+                   TimeFromEpochInSeconds(static_cast<uint64_t>(
+                     signerNotAfter + 1)), expired));
+}
+
+TEST_F(pkixocsp_StapledOCSPCache, BadSignatureIsNotCached)
+{
+  ByteString serialNumberDER(CreateEncodedSerialNumber(8));
+  CertID certID(MakeCertID(serialNumberDER));
+  ByteString response(CreateResponse(certID, OCSPResponseContext::good,
+                                     oneDayBeforeNow, true));
+  bool expired;
+  ASSERT_EQ(Result::ERROR_OCSP_BAD_SIGNATURE,
+            Verify(certID, response, Now(), expired));
+  ASSERT_EQ(Result::ERROR_OCSP_BAD_SIGNATURE,
+            Verify(certID, response, Now(), expired));
+  ASSERT_EQ(2u, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_StapledOCSPCache, Clear)
+{
+  ByteString serialNumberDER(CreateEncodedSerialNumber(9));
+  CertID certID(MakeCertID(serialNumberDER));
+  ByteString response(CreateResponse(certID, OCSPResponseContext::good));
+  bool expired;
+  ASSERT_EQ(Success, Verify(certID, response, Now(), expired));
+  cache.Clear();
+  ASSERT_EQ(Success, Verify(certID, response, Now(), expired));
+  ASSERT_EQ(2u, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_StapledOCSPCache, Eviction)
+{
+  static const size_t CERT_COUNT = StapledOCSPCache::CAPACITY + 1;
+  std::vector<ByteString> serialNumbers;
+  std::vector<ByteString> responses;
+  for (size_t i = 0; i < CERT_COUNT; ++i) {
+    serialNumbers.push_back(CreateEncodedSerialNumber(static_cast<long>(i)));
+    responses.push_back(CreateResponse(MakeCertID(serialNumbers[i]),
+                                       OCSPResponseContext::good));
+  }
+  bool expired;
+  for (size_t i = 0; i < CERT_COUNT; ++i) {
+    ASSERT_EQ(Success, Verify(MakeCertID(serialNumbers[i]), responses[i],
+                              Now(), expired));
+  }
+  ASSERT_EQ(CERT_COUNT, trustDomain.signatureVerifications);
+
+  // The first entry was replaced by the last one; all the others remain.
+  for (size_t i = 1; i < CERT_COUNT; ++i) {
+    ASSERT_EQ(Success, Verify(MakeCertID(serialNumbers[i]), responses[i],
+                              Now(), expired));
+  }
+  ASSERT_EQ(CERT_COUNT, trustDomain.signatureVerifications);
+  ASSERT_EQ(Success, Verify(MakeCertID(serialNumbers[0]), responses[0],
+                            Now(), expired));
+  ASSERT_EQ(CERT_COUNT + 1, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_StapledOCSPCache, Concurrency)
+{
+  static const size_t THREAD_COUNT = 8;
+  static const size_t CERT_COUNT = 16;
+  static const size_t ITERATIONS = 200;
+
+  std::vector<ByteString> serialNumbers;
+  std::vector<ByteString> responses;
+  for (size_t i = 0; i < CERT_COUNT; ++i) {
+    serialNumbers.push_back(
+      CreateEncodedSerialNumber(static_cast<long>(i + 10)));
+    responses.push_back(CreateResponse(
+      MakeCertID(serialNumbers[i]),
+      i % 2 ? OCSPResponseContext::revoked : OCSPResponseContext::good));
+  }
+
+  std::atomic<size_t> failures(0);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < THREAD_COUNT; ++t) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = 0; i < ITERATIONS; ++i) {
+        size_t c = (i + t) % CERT_COUNT;
+        Input responseInput;
+        if (responseInput.Init(responses[c].data(), responses[c].length())
+              != Success) {
+          ++failures;
+          continue;
+        }
+        bool expired;
+        Result rv = VerifyStapledOCSPResponse(
+                      cache, trustDomain, MakeCertID(serialNumbers[c]), Now(),
+                      END_ENTITY_MAX_LIFETIME_IN_DAYS, responseInput, expired);
+        if (rv != (c % 2 ? Result::ERROR_REVOKED_CERTIFICATE : Success) ||
+            expired) {
+          ++failures;
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(0u, failures);
+  // Each response is verified at most once per thread (when threads race to
+  // fill the same entry), not once per handshake.
+  ASSERT_TRUE(trustDomain.signatureVerifications <= CERT_COUNT * THREAD_COUNT);
+}
+
+TEST_F(pkixocsp_StapledOCSPCache, DISABLED_Benchmark_Handshakes)
+{
+  ByteString serialNumberDER(CreateEncodedSerialNumber(100));
+  CertID certID(MakeCertID(serialNumberDER));
+  ByteString response(CreateResponse(certID, OCSPResponseContext::good));
+  Input responseInput;
+  ASSERT_EQ(Success, responseInput.Init(response.data(), response.length()));
+
+  static const size_t ITERATIONS = 2000;
+
+  Benchmark("VerifyEncodedOCSPResponse", ITERATIONS, [&]() {
+    bool expired;
+    ASSERT_EQ(Success,
+              VerifyEncodedOCSPResponse(trustDomain, certID, Now(),
+                                        END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                        responseInput, expired));
+  });
+
+  Benchmark("VerifyStapledOCSPResponse", ITERATIONS, [&]() {
+    bool expired;
+    ASSERT_EQ(Success,
+              VerifyStapledOCSPResponse(cache, trustDomain, certID, Now(),
+                                        END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                        responseInput, expired));
+  });
+}
@@ -0,0 +1,470 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This code is made available to you under your choice of the following sets
+ * of licensing terms:
+ */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+/* Copyright 2015 Mozilla Contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pkixgtest.h"
+
+#include "pkix/pkixnss.h"
+
+using namespace mozilla::pkix;
+using namespace mozilla::pkix::test;
+
+namespace {
+
+const uint16_t END_ENTITY_MAX_LIFETIME_IN_DAYS = 10;
+char const* const rootName = "Test CA 1";
+void deleteCertID(CertID* certID) { delete certID; }
+
+class StreamingOCSPTestTrustDomain final : public DefaultCryptoTrustDomain
+{
+  Result GetCertTrust(EndEntityOrCA endEntityOrCA, const CertPolicyId&,
+                      Input, /*out*/ TrustLevel& trustLevel) override
+  {
+    EXPECT_EQ(endEntityOrCA, EndEntityOrCA::MustBeEndEntity);
+    trustLevel = TrustLevel::InheritsTrust;
+    return Success;
+  }
+};
+
+// Signs like keyPair, but pads the signature to signatureLength bytes, since
+// generating an RSA key large enough for such a signature is too slow.
+class LongSignatureKeyPair final : public TestKeyPair
+{
+public:
+  LongSignatureKeyPair(const TestKeyPair& keyPair, size_t signatureLength)
+    : TestKeyPair(keyPair.publicKeyAlg, keyPair.subjectPublicKey)
+    , keyPair(keyPair.Clone())
+    , signatureLength(signatureLength)
+  {
+  }
+
+  Result SignData(const ByteString& tbs,
+                  const TestSignatureAlgorithm& signatureAlgorithm,
+                  /*out*/ ByteString& signature) const override
+  {
+    Result rv = keyPair->SignData(tbs, signatureAlgorithm, signature);
+    if (rv != Success) {
+      return rv;
+    }
+    if (signature.length() < signatureLength) {
+      signature.append(signatureLength - signature.length(), 0);
+    }
+    return Success;
+  }
+
+  TestKeyPair* Clone() const override
+  {
+    return new (std::nothrow) LongSignatureKeyPair(*keyPair, signatureLength);
+  }
+
+private:
+  ScopedTestKeyPair keyPair;
+  const size_t signatureLength;
+};
+
+} // unnamed namespace
+
+class pkixocsp_StreamingOCSPResponse : public ::testing::Test
+{
+public:
+  static void SetUpTestCase()
+  {
+    rootKeyPair.reset(GenerateKeyPair());
+    if (!rootKeyPair) {
+      abort();
+    }
+  }
+
+  void SetUp()
+  {
+    rootNameDER = CNToDERName(rootName);
+    if (ENCODING_FAILED(rootNameDER)) {
+      abort();
+    }
+    Input rootNameDERInput;
+    if (rootNameDERInput.Init(rootNameDER.data(), rootNameDER.length())
+          != Success) {
+      abort();
+    }
+
+    serialNumberDER =
+      CreateEncodedSerialNumber(static_cast<long>(++rootIssuedCount));
+    if (ENCODING_FAILED(serialNumberDER)) {
+      abort();
+    }
+    Input serialNumberDERInput;
+    if (serialNumberDERInput.Init(serialNumberDER.data(),
+                                  serialNumberDER.length()) != Success) {
+      abort();
+    }
+
+    Input rootSPKIDER;
+    if (rootSPKIDER.Init(rootKeyPair->subjectPublicKeyInfo.data(),
+                         rootKeyPair->subjectPublicKeyInfo.length())
+          != Success) {
+      abort();
+    }
+    endEntityCertID.reset(new (std::nothrow) CertID(rootNameDERInput,
+                                                    rootSPKIDER,
+                                                    serialNumberDERInput));
+    if (!endEntityCertID) {
+      abort();
+    }
+  }
+
+  // Returns a response for endEntityCertID that also contains
+  // extraResponseCount responses for other certificates.
+  ByteString CreateResponse(OCSPResponseContext::CertStatus certStatus,
+                            const TestKeyPair& signerKeyPair,
+                            size_t extraResponseCount = 0,
+                            bool badSignature = false,
+               /*optional*/ const ByteString* certs = nullptr)
+  {
+    ByteString extraSingleResponses;
+    if (extraResponseCount > 0) {
+      ByteString otherSerialNumberDER(CreateEncodedSerialNumber(127));
+      EXPECT_FALSE(ENCODING_FAILED(otherSerialNumberDER));
+      Input otherSerialNumber;
+      EXPECT_EQ(Success, otherSerialNumber.Init(otherSerialNumberDER.data(),
+                                                otherSerialNumberDER.length()));
+      CertID otherCertID(endEntityCertID->issuer,
+                         endEntityCertID->issuerSubjectPublicKeyInfo,
+                         otherSerialNumber);
+      OCSPResponseContext otherContext(otherCertID, oneDayBeforeNow);
+      otherContext.certStatus = OCSPResponseContext::revoked;
+      otherContext.revocationTime = oneDayBeforeNow;
+      ByteString other(CreateEncodedOCSPSingleResponse(otherContext));
+      EXPECT_FALSE(ENCODING_FAILED(other));
+      extraSingleResponses.reserve(other.length() * extraResponseCount);
+      for (size_t i = 0; i < extraResponseCount; ++i) {
+        extraSingleResponses.append(other);
+      }
+    }
+
+    OCSPResponseContext context(*endEntityCertID, oneDayBeforeNow);
+    context.signerKeyPair.reset(signerKeyPair.Clone());
+    EXPECT_TRUE(context.signerKeyPair.get());
+    context.extraSingleResponses = extraSingleResponses;
+    context.badSignature = badSignature;
+    context.certs = certs;
+    context.certStatus = static_cast<uint8_t>(certStatus);
+    context.thisUpdate = oneDayBeforeNow;
+    context.nextUpdate = oneDayAfterNow;
+    return CreateEncodedOCSPResponse(context);
+  }
+
+  // Passes response to StreamingOCSPResponse chunkSize bytes at a time, the
+  // way data arriving from the network would be.
+  Result Stream(const ByteString& response, size_t chunkSize,
+                /*out*/ bool& expired, /*optional out*/ Time* validThrough)
+  {
+    DigestStreamNSS digest;
+    StreamingOCSPResponse streaming(trustDomain, *endEntityCertID, Now(),
+                                    END_ENTITY_MAX_LIFETIME_IN_DAYS, digest);
+    ByteString pending;
+    for (size_t offset = 0; offset < response.length(); offset += chunkSize) {
+      pending.append(response, offset, chunkSize);
+      for (;;) {
+        Input data;
+        Result rv = data.Init(pending.data(),
+                              std::min<size_t>(pending.length(), 0xFFFFu));
+        if (rv != Success) {
+          return rv;
+        }
+        size_t consumed;
+        rv = streaming.Update(data, consumed);
+        if (rv != Success) {
+          return rv;
+        }
+        if (consumed == 0) {
+          break;
+        }
+        pending.erase(0, consumed);
+      }
+    }
+    return streaming.Finish(expired, nullptr, validThrough);
+  }
+
+  // Checks that StreamingOCSPResponse has the same results as
+  // VerifyEncodedOCSPResponse for response, regardless of how it is split.
+  void ExpectSameResults(const ByteString& response, Result expectedResult)
+  {
+    Input responseInput;
+    ASSERT_EQ(Success,
+              responseInput.Init(response.data(), response.length()));
+    bool expectedExpired;
+    Time expectedValidThrough(Time::uninitialized);
+    ASSERT_EQ(expectedResult,
+              VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID, Now(),
+                                        END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                        responseInput, expectedExpired,
+                                        nullptr, &expectedValidThrough));
+
+    static const size_t CHUNK_SIZES[] = { 1, 2, 7, 100, 4096, 65535 };
+    for (size_t chunkSize : CHUNK_SIZES) {
+      bool expired;
+      Time validThrough(Time::uninitialized);
+      ASSERT_EQ(expectedResult, Stream(response, chunkSize, expired,
+                                       &validThrough));
+      ASSERT_EQ(expectedExpired, expired);
+      ASSERT_EQ(expectedValidThrough, validThrough);
+    }
+  }
+
+  static ScopedTestKeyPair rootKeyPair;
+  static uint32_t rootIssuedCount;
+  StreamingOCSPTestTrustDomain trustDomain;
+
+  // endEntityCertID references rootKeyPair, rootNameDER, and serialNumberDER.
+  ByteString rootNameDER;
+  ByteString serialNumberDER;
+  ScopedPtr<CertID, deleteCertID> endEntityCertID;
+};
+
+/*static*/ ScopedTestKeyPair pkixocsp_StreamingOCSPResponse::rootKeyPair;
+/*static*/ uint32_t pkixocsp_StreamingOCSPResponse::rootIssuedCount = 0;
+
+TEST_F(pkixocsp_StreamingOCSPResponse, good)
+{
+  ExpectSameResults(CreateResponse(OCSPResponseContext::good, *rootKeyPair),
+                    Success);
+}
+
+TEST_F(pkixocsp_StreamingOCSPResponse, revoked)
+{
+  ExpectSameResults(CreateResponse(OCSPResponseContext::revoked,
+                                   *rootKeyPair),
+                    Result::ERROR_REVOKED_CERTIFICATE);
+}
+
+TEST_F(pkixocsp_StreamingOCSPResponse, unknown)
+{
+  ExpectSameResults(CreateResponse(OCSPResponseContext::unknown,
+                                   *rootKeyPair),
+                    Result::ERROR_OCSP_UNKNOWN_CERT);
+}
+
+TEST_F(pkixocsp_StreamingOCSPResponse, good_with_other_responses)
+{
+  ExpectSameResults(CreateResponse(OCSPResponseContext::good, *rootKeyPair,
+                                   10),
+                    Success);
+}
+
+TEST_F(pkixocsp_StreamingOCSPResponse, bad_signature)
+{
+  ExpectSameResults(CreateResponse(OCSPResponseContext::good, *rootKeyPair, 0,
+                                   true),
+                    Result::ERROR_OCSP_BAD_SIGNATURE);
+}
+
+TEST_F(pkixocsp_StreamingOCSPResponse, unknown_signer)
+{
+  ScopedTestKeyPair unknownKeyPair(GenerateKeyPair());
+  ASSERT_TRUE(unknownKeyPair.get());
+  ExpectSameResults(CreateResponse(OCSPResponseContext::good, *unknownKeyPair),
+                    Result::ERROR_OCSP_INVALID_SIGNING_CERT);
+}
+
+TEST_F(pkixocsp_StreamingOCSPResponse, good_delegated)
+{
+  static const Input OCSPSigningEKUDER(tlv_id_kp_OCSPSigning);
+  const ByteString extensions[] = {
+    CreateEncodedEKUExtension(OCSPSigningEKUDER, Critical::No),
+    ByteString()
+  };
+  ScopedTestKeyPair signerKeyPair(GenerateKeyPair());
+  ASSERT_TRUE(signerKeyPair.get());
+  ByteString signerSerialNumberDER(
+    CreateEncodedSerialNumber(static_cast<long>(++rootIssuedCount)));
+  ByteString signerNameDER(CNToDERName("good_delegated"));
+  ByteString signerDER(CreateEncodedCertificate(
+                         v3, sha256WithRSAEncryption(), signerSerialNumberDER,
+                         rootNameDER, oneDayBeforeNow, oneDayAfterNow,
+                         signerNameDER, *signerKeyPair, extensions,
+                         *rootKeyPair, sha256WithRSAEncryption()));
+  ASSERT_FALSE(ENCODING_FAILED(signerDER));
+  ByteString certs[] = { signerDER, ByteString() };
+  ExpectSameResults(CreateResponse(OCSPResponseContext::good, *signerKeyPair,
+                                   0, false, certs),
+                    Success);
+}
+
+// The responder ID is kept in a fixed-size buffer, so a byName responder ID
+// that VerifyEncodedOCSPResponse accepts can be too long to stream.
+TEST_F(pkixocsp_StreamingOCSPResponse, responderID_too_long)
+{
+  static const Input OCSPSigningEKUDER(tlv_id_kp_OCSPSigning);
+  const ByteString extensions[] = {
+    CreateEncodedEKUExtension(OCSPSigningEKUDER, Critical::No),
+    ByteString()
+  };
+  ScopedTestKeyPair signerKeyPair(GenerateKeyPair());
+  ASSERT_TRUE(signerKeyPair.get());
+  ByteString signerSerialNumberDER(
+    CreateEncodedSerialNumber(static_cast<long>(++rootIssuedCount)));
+  ByteString signerNameDER(CNToDERName(
+    ByteString(StreamingOCSPResponse::MAX_RESPONDER_ID_LENGTH, 'a')));
+  ASSERT_FALSE(ENCODING_FAILED(signerNameDER));
+  ASSERT_GT(signerNameDER.length(),
+            size_t(StreamingOCSPResponse::MAX_RESPONDER_ID_LENGTH));
+  ByteString signerDER(CreateEncodedCertificate(
+                         v3, sha256WithRSAEncryption(), signerSerialNumberDER,
+                         rootNameDER, oneDayBeforeNow, oneDayAfterNow,
+                         signerNameDER, *signerKeyPair, extensions,
+                         *rootKeyPair, sha256WithRSAEncryption()));
+  ASSERT_FALSE(ENCODING_FAILED(signerDER));
+  ByteString certs[] = { signerDER, ByteString() };
+
+  OCSPResponseContext context(*endEntityCertID, oneDayBeforeNow);
+  context.signerNameDER = signerNameDER;
+  context.signerKeyPair.reset(signerKeyPair->Clone());
+  ASSERT_TRUE(context.signerKeyPair.get());
+  context.certs = certs;
+  context.thisUpdate = oneDayBeforeNow;
+  context.nextUpdate = oneDayAfterNow;
+  ByteString response(CreateEncodedOCSPResponse(context));
+  ASSERT_FALSE(ENCODING_FAILED(response));
+
+  Input responseInput;
+  ASSERT_EQ(Success, responseInput.Init(response.data(), response.length()));
+  bool expired;
+  ASSERT_EQ(Success,
+            VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID, Now(),
+                                      END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                      responseInput, expired));
+  ASSERT_EQ(Result::ERROR_OCSP_RESPONSE_FIELD_TOO_LONG,
+            Stream(response, 100, expired, nullptr));
+}
+
+// The signature is kept in a fixed-size buffer too.
+TEST_F(pkixocsp_StreamingOCSPResponse, signature_too_long)
+{
+  LongSignatureKeyPair signerKeyPair(
+    *rootKeyPair, StreamingOCSPResponse::MAX_SIGNATURE_LENGTH + 1);
+  ByteString response(CreateResponse(OCSPResponseContext::good,
+                                     signerKeyPair));
+  ASSERT_FALSE(ENCODING_FAILED(response));
+  bool expired;
+  ASSERT_EQ(Result::ERROR_OCSP_RESPONSE_FIELD_TOO_LONG,
+            Stream(response, 100, expired, nullptr));
+}
+
+TEST_F(pkixocsp_StreamingOCSPResponse, responseStatus)
+{
+  OCSPResponseContext context(*endEntityCertID, oneDayBeforeNow);
+  context.responseStatus = OCSPResponseContext::tryLater;
+  context.skipResponseBytes = true;
+  ByteString response(CreateEncodedOCSPResponse(context));
+  ASSERT_FALSE(ENCODING_FAILED(response));
+  bool expired;
+  ASSERT_EQ(Result::ERROR_OCSP_TRY_SERVER_LATER,
+            Stream(response, 1, expired, nullptr));
+}
+
+TEST_F(pkixocsp_StreamingOCSPResponse, truncated)
+{
+  ByteString response(CreateResponse(OCSPResponseContext::good,
+                                     *rootKeyPair));
+  ASSERT_FALSE(ENCODING_FAILED(response));
+  response.erase(response.length() - 1);
+  bool expired;
+  ASSERT_EQ(Result::ERROR_OCSP_MALFORMED_RESPONSE,
+            Stream(response, 7, expired, nullptr));
+}
+
+TEST_F(pkixocsp_StreamingOCSPResponse, trailing_data)
+{
+  ByteString response(CreateResponse(OCSPResponseContext::good,
+                                     *rootKeyPair));
+  ASSERT_FALSE(ENCODING_FAILED(response));
+
+  DigestStreamNSS digest;
+  StreamingOCSPResponse streaming(trustDomain, *endEntityCertID, Now(),
+                                  END_ENTITY_MAX_LIFETIME_IN_DAYS, digest);
+  response.push_back(0x00);
+  Input data;
+  ASSERT_EQ(Success, data.Init(response.data(), response.length()));
+  size_t consumed;
+  ASSERT_EQ(Success, streaming.Update(data, consumed));
+  // The caller is responsible for noticing that not everything was consumed.
+  ASSERT_EQ(response.length() - 1, consumed);
+  bool expired;
+  ASSERT_EQ(Success, streaming.Finish(expired));
+}
+
+TEST_F(pkixocsp_StreamingOCSPResponse, update_after_failure)
+{
+  static const uint8_t NOT_A_SEQUENCE[] = { 0x04, 0x00 };
+  DigestStreamNSS digest;
+  StreamingOCSPResponse streaming(trustDomain, *endEntityCertID, Now(),
+                                  END_ENTITY_MAX_LIFETIME_IN_DAYS, digest);
+  Input data(NOT_A_SEQUENCE);
+  size_t consumed;
+  ASSERT_EQ(Result::ERROR_OCSP_MALFORMED_RESPONSE,
+            streaming.Update(data, consumed));
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE,
+            streaming.Update(data, consumed));
+  bool expired;
+  ASSERT_EQ(Result::FATAL_ERROR_INVALID_STATE, streaming.Finish(expired));
+}
+
+// A response larger than VerifyEncodedOCSPResponse can handle, verified 16KB
+// at a time.
+TEST_F(pkixocsp_StreamingOCSPResponse, larger_than_input)
+{
+  static const size_t EXTRA_RESPONSE_COUNT = 1000;
+  ByteString response(CreateResponse(OCSPResponseContext::good, *rootKeyPair,
+                                     EXTRA_RESPONSE_COUNT));
+  ASSERT_FALSE(ENCODING_FAILED(response));
+
+  Input tooLarge;
+  ASSERT_EQ(Result::ERROR_BAD_DER,
+            tooLarge.Init(response.data(), response.length()));
+
+  bool expired;
+  Time validThrough(Time::uninitialized);
+  ASSERT_EQ(Success, Stream(response, 16384, expired, &validThrough));
+  ASSERT_FALSE(expired);
+  ASSERT_TRUE(validThrough >
+                TimeFromEpochInSeconds(static_cast<uint64_t>(now)));
+}
+
+// A response of over 10MB.
+TEST_F(pkixocsp_StreamingOCSPResponse, DISABLED_Benchmark_10MB)
+{
+  static const size_t EXTRA_RESPONSE_COUNT = 100000;
+  ByteString response(CreateResponse(OCSPResponseContext::good, *rootKeyPair,
+                                     EXTRA_RESPONSE_COUNT));
+  ASSERT_FALSE(ENCODING_FAILED(response));
+  ASSERT_GT(response.length(), 10u * 1000u * 1000u);
+
+  Benchmark("StreamingOCSPResponse 10MB", 3, [&]() {
+    bool expired;
+    Time validThrough(Time::uninitialized);
+    ASSERT_EQ(Success, Stream(response, 16384, expired, &validThrough));
+    ASSERT_FALSE(expired);
+    ASSERT_TRUE(validThrough >
+                  TimeFromEpochInSeconds(static_cast<uint64_t>(now)));
+  });
+}
@@ -22,6 +22,9 @@
  * limitations under the License.
  */
 
+#include <thread>
+#include <vector>
+
 #include "pkixgtest.h"
 
 using namespace mozilla::pkix;
@@ -885,6 +888,470 @@ TEST_F(pkixocsp_VerifyEncodedResponse_DelegatedResponder,
                                       response, expired));
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// OCSPSignerCache
+
+class pkixocsp_VerifyEncodedResponse_SignerCache
+  : public pkixocsp_VerifyEncodedResponse_DelegatedResponder
+{
+protected:
+  class TrustDomain final : public OCSPTestTrustDomain
+  {
+  public:
+    TrustDomain()
+      : signatureVerifications(0)
+    {
+    }
+
+    Result VerifyRSAPKCS1SignedDigest(const SignedDigest& signedDigest,
+                                      Input subjectPublicKeyInfo) override
+    {
+      ++signatureVerifications;
+      return TestVerifyRSAPKCS1SignedDigest(signedDigest,
+                                            subjectPublicKeyInfo);
+    }
+
+    Result DigestBuf(Input item, DigestAlgorithm digestAlg,
+                     /*out*/ uint8_t* digestBuf, size_t digestBufLen) override
+    {
+      if (InputsAreEqual(item, failDigestOf)) {
+        return Result::FATAL_ERROR_LIBRARY_FAILURE;
+      }
+      return TestDigestBuf(item, digestAlg, digestBuf, digestBufLen);
+    }
+
+    unsigned int signatureVerifications;
+    Input failDigestOf;
+  };
+
+  TrustDomain trustDomain;
+  OCSPSignerCache signerCache;
+};
+
+TEST_F(pkixocsp_VerifyEncodedResponse_SignerCache, good_byKey)
+{
+  ByteString responseString(
+               CreateEncodedIndirectOCSPSuccessfulResponse(
+                         "good_indirect_cached_byKey",
+                         OCSPResponseContext::good, byKey,
+                         sha256WithRSAEncryption()));
+  Input response;
+  ASSERT_EQ(Success,
+            response.Init(responseString.data(), responseString.length()));
+  bool expired;
+
+  // The first time, both the signer certificate and the response are
+  // verified.
+  ASSERT_EQ(Success,
+            VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID, Now(),
+                                      END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                      response, expired, nullptr, nullptr,
+                                      &signerCache));
+  ASSERT_FALSE(expired);
+  ASSERT_EQ(2u, trustDomain.signatureVerifications);
+
+  // The second time, only the response is verified.
+  ASSERT_EQ(Success,
+            VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID, Now(),
+                                      END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                      response, expired, nullptr, nullptr,
+                                      &signerCache));
+  ASSERT_FALSE(expired);
+  ASSERT_EQ(3u, trustDomain.signatureVerifications);
+
+  // After the cache is cleared, the signer certificate is verified again.
+  signerCache.Clear();
+  ASSERT_EQ(Success,
+            VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID, Now(),
+                                      END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                      response, expired, nullptr, nullptr,
+                                      &signerCache));
+  ASSERT_FALSE(expired);
+  ASSERT_EQ(5u, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_VerifyEncodedResponse_SignerCache, good_byName)
+{
+  ByteString responseString(
+               CreateEncodedIndirectOCSPSuccessfulResponse(
+                         "good_indirect_cached_byName",
+                         OCSPResponseContext::good,
+                         "good_indirect_cached_byName",
+                         sha256WithRSAEncryption()));
+  Input response;
+  ASSERT_EQ(Success,
+            response.Init(responseString.data(), responseString.length()));
+  bool expired;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_EQ(Success,
+              VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID, Now(),
+                                        END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                        response, expired, nullptr, nullptr,
+                                        &signerCache));
+    ASSERT_FALSE(expired);
+  }
+  ASSERT_EQ(4u, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_VerifyEncodedResponse_SignerCache, signer_expired)
+{
+  ByteString responseString(
+               CreateEncodedIndirectOCSPSuccessfulResponse(
+                         "good_indirect_cached_expired",
+                         OCSPResponseContext::good, byKey,
+                         sha256WithRSAEncryption()));
+  Input response;
+  ASSERT_EQ(Success,
+            response.Init(responseString.data(), responseString.length()));
+  bool expired;
+  ASSERT_EQ(Success,
+            VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID, Now(),
+                                      END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                      response, expired, nullptr, nullptr,
+                                      &signerCache));
+  ASSERT_FALSE(expired);
+
+  // The cached signer must not be used outside of its validity period.
+  Time afterSignerExpired(Now());
+  ASSERT_EQ(Success, afterSignerExpired.AddSeconds(3 * Time::ONE_DAY_IN_SECONDS));
+  ASSERT_EQ(Result::ERROR_OCSP_INVALID_SIGNING_CERT,
+            VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID,
+                                      afterSignerExpired,
+                                      END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                      response, expired, nullptr, nullptr,
+                                      &signerCache));
+}
+
+// The cache key is only computed for the certificate that matches the
+// responder ID, so failing to digest another embedded certificate doesn't
+// matter.
+TEST_F(pkixocsp_VerifyEncodedResponse_SignerCache,
+       good_unrelated_cert_not_digested)
+{
+  static const char* signerName = "good_indirect_cached_unrelated";
+
+  ByteString unrelatedDER;
+  ByteString unusedResponse(
+               CreateEncodedIndirectOCSPSuccessfulResponse(
+                         "good_indirect_cached_unrelated other",
+                         OCSPResponseContext::good, byKey,
+                         sha256WithRSAEncryption(), &OCSPSigningEKUDER,
+                         &unrelatedDER));
+  ASSERT_FALSE(ENCODING_FAILED(unusedResponse));
+
+  const ByteString extensions[] = {
+    CreateEncodedEKUExtension(OCSPSigningEKUDER, Critical::No),
+    ByteString()
+  };
+  ScopedTestKeyPair signerKeyPair(GenerateKeyPair());
+  ByteString signerDER(CreateEncodedCertificate(
+                         ++rootIssuedCount, sha256WithRSAEncryption(),
+                         rootName, oneDayBeforeNow, oneDayAfterNow,
+                         signerName, *signerKeyPair, extensions,
+                         *rootKeyPair));
+  ASSERT_FALSE(ENCODING_FAILED(signerDER));
+
+  ByteString certs[] = { unrelatedDER, signerDER, ByteString() };
+  ByteString responseString(
+               CreateEncodedOCSPSuccessfulResponse(
+                         OCSPResponseContext::good, *endEntityCertID,
+                         signerName, *signerKeyPair, oneDayBeforeNow,
+                         oneDayBeforeNow, &oneDayAfterNow,
+                         sha256WithRSAEncryption(), certs));
+  Input response;
+  ASSERT_EQ(Success,
+            response.Init(responseString.data(), responseString.length()));
+  ASSERT_EQ(Success,
+            trustDomain.failDigestOf.Init(unrelatedDER.data(),
+                                          unrelatedDER.length()));
+  bool expired;
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(Success,
+              VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID, Now(),
+                                        END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                        response, expired, nullptr, nullptr,
+                                        &signerCache));
+    ASSERT_FALSE(expired);
+  }
+  ASSERT_EQ(3u, trustDomain.signatureVerifications);
+}
+
+// If the cache key of the signer can't be computed, the signer is verified
+// without the cache.
+TEST_F(pkixocsp_VerifyEncodedResponse_SignerCache, good_signer_not_digested)
+{
+  ByteString signerDER;
+  ByteString responseString(
+               CreateEncodedIndirectOCSPSuccessfulResponse(
+                         "good_indirect_cached_not_digested",
+                         OCSPResponseContext::good, byKey,
+                         sha256WithRSAEncryption(), &OCSPSigningEKUDER,
+                         &signerDER));
+  Input response;
+  ASSERT_EQ(Success,
+            response.Init(responseString.data(), responseString.length()));
+  ASSERT_EQ(Success,
+            trustDomain.failDigestOf.Init(signerDER.data(),
+                                          signerDER.length()));
+  bool expired;
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(Success,
+              VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID, Now(),
+                                        END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                        response, expired, nullptr, nullptr,
+                                        &signerCache));
+    ASSERT_FALSE(expired);
+  }
+  ASSERT_EQ(4u, trustDomain.signatureVerifications);
+}
+
+TEST_F(pkixocsp_VerifyEncodedResponse_SignerCache, bad_signer_not_cached)
+{
+  ByteString responseString(
+               CreateEncodedIndirectOCSPSuccessfulResponse(
+                         "good_indirect_cached_wrong_eku",
+                         OCSPResponseContext::good, byKey,
+                         sha256WithRSAEncryption(), nullptr));
+  Input response;
+  ASSERT_EQ(Success,
+            response.Init(responseString.data(), responseString.length()));
+  bool expired;
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(Result::ERROR_OCSP_INVALID_SIGNING_CERT,
+              VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID, Now(),
+                                        END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                        response, expired, nullptr, nullptr,
+                                        &signerCache));
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Batch signature verification (TrustDomain::VerifySignedDigests)
+
+class pkixocsp_VerifyEncodedResponse_BatchVerification
+  : public pkixocsp_VerifyEncodedResponse_DelegatedResponder
+{
+protected:
+  static const size_t NO_FAILURE = static_cast<size_t>(-1);
+
+  // Counts the calls made to verify signatures. Unless useDefaultBatches is
+  // set, batches are verified here instead of by the default implementation,
+  // and the signature at index failSignature of each batch fails.
+  class TrustDomain : public OCSPTestTrustDomain
+  {
+  public:
+    TrustDomain()
+      : useDefaultBatches(false)
+      , failSignature(NO_FAILURE)
+      , singleVerifications(0)
+      , batches(0)
+      , batchedSignatures(0)
+    {
+    }
+
+    Result VerifyRSAPKCS1SignedDigest(const SignedDigest& signedDigest,
+                                      Input subjectPublicKeyInfo) override
+    {
+      ++singleVerifications;
+      return TestVerifyRSAPKCS1SignedDigest(signedDigest,
+                                            subjectPublicKeyInfo);
+    }
+
+    Result VerifySignedDigests(const SignedDigestToVerify* signatures,
+                               size_t count,
+                               /*out*/ Result* results) override
+    {
+      ++batches;
+      batchedSignatures += count;
+      if (useDefaultBatches) {
+        return OCSPTestTrustDomain::VerifySignedDigests(signatures, count,
+                                                        results);
+      }
+      for (size_t i = 0; i < count; ++i) {
+        EXPECT_EQ(PublicKeyType::RSA, signatures[i].publicKeyType);
+        results[i] = i == failSignature
+                   ? Result::ERROR_BAD_SIGNATURE
+                   : TestVerifyRSAPKCS1SignedDigest(
+                       *signatures[i].signedDigest,
+                       signatures[i].subjectPublicKeyInfo);
+      }
+      return Success;
+    }
+
+    bool useDefaultBatches;
+    size_t failSignature;
+    unsigned int singleVerifications;
+    unsigned int batches;
+    unsigned int batchedSignatures;
+  };
+
+  // Verifies responseString, first setting it to a response signed by a
+  // new delegated signer named certSubjectName if it is empty.
+  Result VerifyResponse(const char* certSubjectName,
+                        /*optional*/ OCSPSignerCache* signerCache = nullptr)
+  {
+    if (responseString.empty()) {
+      responseString = CreateEncodedIndirectOCSPSuccessfulResponse(
+                         certSubjectName, OCSPResponseContext::good, byKey,
+                         sha256WithRSAEncryption());
+      EXPECT_FALSE(ENCODING_FAILED(responseString));
+    }
+    Input response;
+    EXPECT_EQ(Success,
+              response.Init(responseString.data(), responseString.length()));
+    bool expired;
+    Result rv = VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID, Now(),
+                                          END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                          response, expired, nullptr, nullptr,
+                                          signerCache);
+    EXPECT_FALSE(expired);
+    return rv;
+  }
+
+  TrustDomain trustDomain;
+  ByteString responseString;
+};
+
+TEST_F(pkixocsp_VerifyEncodedResponse_BatchVerification, delegated_signer)
+{
+  // The signer certificate's signature and the response's signature are
+  // verified in one batch.
+  ASSERT_EQ(Success, VerifyResponse("batch_delegated_signer"));
+  ASSERT_EQ(1u, trustDomain.batches);
+  ASSERT_EQ(2u, trustDomain.batchedSignatures);
+  ASSERT_EQ(0u, trustDomain.singleVerifications);
+}
+
+TEST_F(pkixocsp_VerifyEncodedResponse_BatchVerification, default_implementation)
+{
+  trustDomain.useDefaultBatches = true;
+  ASSERT_EQ(Success, VerifyResponse("batch_default_implementation"));
+  ASSERT_EQ(1u, trustDomain.batches);
+  ASSERT_EQ(2u, trustDomain.singleVerifications);
+}
+
+TEST_F(pkixocsp_VerifyEncodedResponse_BatchVerification, cached_signer)
+{
+  OCSPSignerCache signerCache;
+  ASSERT_EQ(Success,
+            VerifyResponse("batch_cached_signer", &signerCache));
+  ASSERT_EQ(1u, trustDomain.batches);
+
+  // Only the response's signature is left to verify.
+  ASSERT_EQ(Success,
+            VerifyResponse("batch_cached_signer", &signerCache));
+  ASSERT_EQ(1u, trustDomain.batches);
+  ASSERT_EQ(1u, trustDomain.singleVerifications);
+}
+
+TEST_F(pkixocsp_VerifyEncodedResponse_BatchVerification, issuer_signed)
+{
+  responseString = CreateEncodedOCSPSuccessfulResponse(
+                     OCSPResponseContext::good, *endEntityCertID, byKey,
+                     *rootKeyPair, oneDayBeforeNow, oneDayBeforeNow,
+                     &oneDayAfterNow, sha256WithRSAEncryption());
+  ASSERT_EQ(Success, VerifyResponse(nullptr));
+  ASSERT_EQ(0u, trustDomain.batches);
+  ASSERT_EQ(1u, trustDomain.singleVerifications);
+}
+
+TEST_F(pkixocsp_VerifyEncodedResponse_BatchVerification, bad_signer_signature)
+{
+  trustDomain.failSignature = 0;
+  ASSERT_EQ(Result::ERROR_OCSP_INVALID_SIGNING_CERT,
+            VerifyResponse("batch_bad_signer_signature"));
+}
+
+TEST_F(pkixocsp_VerifyEncodedResponse_BatchVerification,
+       bad_response_signature)
+{
+  trustDomain.failSignature = 1;
+  ASSERT_EQ(Result::ERROR_OCSP_BAD_SIGNATURE,
+            VerifyResponse("batch_bad_response_signature"));
+}
+
+namespace {
+
+// A stand-in for a multi-buffer backend: the signatures of a batch are
+// verified concurrently, one lane (thread) per signature, instead of one
+// after another.
+class MultiLaneTrustDomain final : public OCSPTestTrustDomain
+{
+public:
+  Result VerifySignedDigests(const SignedDigestToVerify* signatures,
+                             size_t count, /*out*/ Result* results) override
+  {
+    std::vector<std::thread> lanes;
+    for (size_t i = 1; i < count; ++i) {
+      lanes.emplace_back([&, i]() {
+        results[i] = TestVerifyRSAPKCS1SignedDigest(
+                       *signatures[i].signedDigest,
+                       signatures[i].subjectPublicKeyInfo);
+      });
+    }
+    if (count > 0) {
+      results[0] = TestVerifyRSAPKCS1SignedDigest(
+                     *signatures[0].signedDigest,
+                     signatures[0].subjectPublicKeyInfo);
+    }
+    for (std::thread& lane : lanes) {
+      lane.join();
+    }
+    return Success;
+  }
+};
+
+} // unnamed namespace
+
+TEST_F(pkixocsp_VerifyEncodedResponse_BatchVerification, multi_lane_batch)
+{
+  trustDomain.useDefaultBatches = true;
+  ASSERT_EQ(Success, VerifyResponse("batch_multi_lane"));
+  Input response;
+  ASSERT_EQ(Success,
+            response.Init(responseString.data(), responseString.length()));
+
+  MultiLaneTrustDomain multiLaneTrustDomain;
+  bool expired;
+  ASSERT_EQ(Success,
+            VerifyEncodedOCSPResponse(multiLaneTrustDomain, *endEntityCertID,
+                                      Now(), END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                      response, expired));
+  ASSERT_FALSE(expired);
+}
+
+TEST_F(pkixocsp_VerifyEncodedResponse_BatchVerification,
+       DISABLED_Benchmark_DelegatedSigner)
+{
+  static const size_t ITERATIONS = 1000;
+
+  trustDomain.useDefaultBatches = true;
+  ASSERT_EQ(Success, VerifyResponse("batch_benchmark"));
+  Input response;
+  ASSERT_EQ(Success,
+            response.Init(responseString.data(), responseString.length()));
+
+  Benchmark("VerifyEncodedOCSPResponse delegated signer, one at a time",
+            ITERATIONS, [&]() {
+    bool expired;
+    ASSERT_EQ(Success,
+              VerifyEncodedOCSPResponse(trustDomain, *endEntityCertID, Now(),
+                                        END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                        response, expired));
+  });
+
+  MultiLaneTrustDomain multiLaneTrustDomain;
+  Benchmark("VerifyEncodedOCSPResponse delegated signer, multi-lane batch",
+            ITERATIONS, [&]() {
+    bool expired;
+    ASSERT_EQ(Success,
+              VerifyEncodedOCSPResponse(multiLaneTrustDomain,
+                                        *endEntityCertID, Now(),
+                                        END_ENTITY_MAX_LIFETIME_IN_DAYS,
+                                        response, expired));
+  });
+}
+
 class pkixocsp_VerifyEncodedResponse_GetCertTrust
   : public pkixocsp_VerifyEncodedResponse_DelegatedResponder {
 public:
@@ -119,28 +119,52 @@ TamperOnce(/*in/out*/ ByteString& item, const ByteString& from,
   return Success;
 }
 
+// Encodes with der::MeasureEncoding and der::WriteEncoding into a ByteString
+// that is allocated once, at its exact length. Returns an empty ByteString if
+// encoding fails.
+template <typename Encoder>
+static ByteString
+Encode(Encoder encode)
+{
+  der::EncodedLengths lengths;
+  size_t length;
+  if (der::MeasureEncoding(lengths, encode, length) != Success) {
+    return ByteString();
+  }
+  ByteString result(length, 0);
+  if (length > 0 &&
+      der::WriteEncoding(lengths, encode, &result[0], length) != Success) {
+    return ByteString();
+  }
+  return result;
+}
+
+static Result
+TLV(der::Writer& output, uint8_t tag, const ByteString& value)
+{
+  Result rv = output.WriteTagAndLength(tag, value.length());
+  if (rv != Success) {
+    return rv;
+  }
+  return output.Write(value.data(), value.length());
+}
+
 // Given a tag and a value, generates a DER-encoded tag-length-value item.
 ByteString
 TLV(uint8_t tag, size_t length, const ByteString& value)
 {
-  ByteString result;
-  result.push_back(tag);
-
-  if (value.length() < 128) {
-    result.push_back(static_cast<uint8_t>(length));
-  } else if (value.length() < 256) {
-    result.push_back(0x81u);
-    result.push_back(static_cast<uint8_t>(length));
-  } else if (value.length() < 65536) {
-    result.push_back(0x82u);
-    result.push_back(static_cast<uint8_t>(length / 256));
-    result.push_back(static_cast<uint8_t>(length % 256));
-  } else {
+  ByteString result(Encode([&](der::Writer& output) -> Result {
+    Result rv = output.WriteTagAndLength(tag, length);
+    if (rv != Success) {
+      return rv;
+    }
+    return output.Write(value.data(), value.length());
+  }));
+  if (ENCODING_FAILED(result)) {
     // It is MUCH more convenient for TLV to be infallible than for it to have
     // "proper" error handling.
     abort();
   }
-  result.append(value);
   return result;
 }
 
@@ -424,32 +448,46 @@ SignedData(const ByteString& tbsData,
 static ByteString
 Extension(Input extnID, Critical critical, const ByteString& extnValueBytes)
 {
-  ByteString encoded;
-
-  encoded.append(ByteString(extnID.UnsafeGetData(), extnID.GetLength()));
-
-  if (critical == Critical::Yes) {
-    encoded.append(Boolean(true));
-  }
-
-  ByteString extnValueSequence(TLV(der::SEQUENCE, extnValueBytes));
-  ByteString extnValue(TLV(der::OCTET_STRING, extnValueSequence));
-  encoded.append(extnValue);
-  return TLV(der::SEQUENCE, encoded);
+  return Encode([&](der::Writer& output) {
+    return der::Nested(output, der::SEQUENCE, [&](der::Writer& extension) {
+      Result rv = extension.Write(extnID);
+      if (rv != Success) {
+        return rv;
+      }
+      if (critical == Critical::Yes) {
+        static const uint8_t tlv_true[] = { der::BOOLEAN, 1, 0xff };
+        rv = extension.Write(Input(tlv_true));
+        if (rv != Success) {
+          return rv;
+        }
+      }
+      return der::Nested(extension, der::OCTET_STRING,
+                         [&](der::Writer& extnValue) {
+        return TLV(extnValue, der::SEQUENCE, extnValueBytes);
+      });
+    });
+  });
 }
 
 static ByteString
 EmptyExtension(Input extnID, Critical critical)
 {
-  ByteString encoded(extnID.UnsafeGetData(), extnID.GetLength());
-
-  if (critical == Critical::Yes) {
-    encoded.append(Boolean(true));
-  }
-
-  ByteString extnValue(TLV(der::OCTET_STRING, ByteString()));
-  encoded.append(extnValue);
-  return TLV(der::SEQUENCE, encoded);
+  return Encode([&](der::Writer& output) {
+    return der::Nested(output, der::SEQUENCE, [&](der::Writer& extension) {
+      Result rv = extension.Write(extnID);
+      if (rv != Success) {
+        return rv;
+      }
+      if (critical == Critical::Yes) {
+        static const uint8_t tlv_true[] = { der::BOOLEAN, 1, 0xff };
+        rv = extension.Write(Input(tlv_true));
+        if (rv != Success) {
+          return rv;
+        }
+      }
+      return extension.WriteTagAndLength(der::OCTET_STRING, 0);
+    });
+  });
 }
 
 std::string
@@ -636,6 +674,103 @@ TBSCertificate(long versionValue,
   return TLV(der::SEQUENCE, value);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// CRLs
+
+static ByteString
+ExtensionsSequence(const ByteString* extensions)
+{
+  ByteString extensionsValue;
+  while (!(*extensions).empty()) {
+    extensionsValue.append(*extensions);
+    ++extensions;
+  }
+  return TLV(der::SEQUENCE, extensionsValue);
+}
+
+// CertificateList  ::=  SEQUENCE  {
+//      tbsCertList          TBSCertList,
+//      signatureAlgorithm   AlgorithmIdentifier,
+//      signatureValue       BIT STRING  }
+//
+// TBSCertList  ::=  SEQUENCE  {
+//      version                 Version OPTIONAL,
+//                                   -- if present, MUST be v2
+//      signature               AlgorithmIdentifier,
+//      issuer                  Name,
+//      thisUpdate              Time,
+//      nextUpdate              Time OPTIONAL,
+//      revokedCertificates     SEQUENCE OF SEQUENCE  { ... }  OPTIONAL,
+//      crlExtensions           [0]  EXPLICIT Extensions OPTIONAL
+//                                   -- if present, version MUST be v2
+//                           }
+ByteString
+CreateEncodedCRL(long version, const TestSignatureAlgorithm& signature,
+                 const ByteString& issuerNameDER,
+                 time_t thisUpdateTime, time_t nextUpdateTime,
+                 const ByteString& revokedCertificates,
+                 /*optional*/ const ByteString* extensions,
+                 const TestKeyPair& issuerKeyPair,
+                 const TestSignatureAlgorithm& signatureAlgorithm)
+{
+  ByteString value;
+  if (version != static_cast<long>(der::Version::v1)) {
+    value.append(Integer(version));
+  }
+  value.append(signature.algorithmIdentifier);
+  value.append(issuerNameDER);
+  ByteString thisUpdate(TimeToTimeChoice(thisUpdateTime));
+  if (ENCODING_FAILED(thisUpdate)) {
+    return ByteString();
+  }
+  value.append(thisUpdate);
+  ByteString nextUpdate(TimeToTimeChoice(nextUpdateTime));
+  if (ENCODING_FAILED(nextUpdate)) {
+    return ByteString();
+  }
+  value.append(nextUpdate);
+  if (!revokedCertificates.empty()) {
+    value.append(TLV(der::SEQUENCE, revokedCertificates));
+  }
+  if (extensions) {
+    value.append(TLV(der::CONTEXT_SPECIFIC | der::CONSTRUCTED | 0,
+                     ExtensionsSequence(extensions)));
+  }
+  ByteString tbsCertList(TLV(der::SEQUENCE, value));
+
+  ByteString result(SignedData(tbsCertList, issuerKeyPair, signatureAlgorithm,
+                               false, nullptr));
+  if (ENCODING_FAILED(result)) {
+    return ByteString();
+  }
+
+  MaybeLogOutput(result, "crl");
+
+  return result;
+}
+
+// SEQUENCE  {
+//      userCertificate         CertificateSerialNumber,
+//      revocationDate          Time,
+//      crlEntryExtensions      Extensions OPTIONAL
+//                               -- if present, version MUST be v2
+//                           }
+ByteString
+CreateEncodedCRLEntry(const ByteString& serialNumber, time_t revocationTime,
+                      /*optional*/ const ByteString* extensions)
+{
+  ByteString value(serialNumber);
+  ByteString revocationDate(TimeToTimeChoice(revocationTime));
+  if (ENCODING_FAILED(revocationDate)) {
+    return ByteString();
+  }
+  value.append(revocationDate);
+  if (extensions) {
+    value.append(ExtensionsSequence(extensions));
+  }
+  return TLV(der::SEQUENCE, value);
+}
+
 // AttributeTypeAndValue ::= SEQUENCE {
 //   type     AttributeType,
 //   value    AttributeValue }
@@ -650,27 +785,40 @@ TBSCertificate(long versionValue,
 //       universalString         UniversalString (SIZE (1..MAX)),
 //       utf8String              UTF8String (SIZE (1..MAX)),
 //       bmpString               BMPString (SIZE (1..MAX)) }
+template <size_t N>
+static Result
+AVA(der::Writer& output, const uint8_t (&type)[N],
+    uint8_t directoryStringType, const ByteString& value)
+{
+  return der::Nested(output, der::SEQUENCE, [&](der::Writer& ava) {
+    Result rv = ava.Write(Input(type));
+    if (rv != Success) {
+      return rv;
+    }
+    return TLV(ava, directoryStringType, value);
+  });
+}
+
 template <size_t N>
 static ByteString
 AVA(const uint8_t (&type)[N], uint8_t directoryStringType,
     const ByteString& value)
 {
-  ByteString wrappedValue(TLV(directoryStringType, value));
-  ByteString ava;
-  ava.append(type, N);
-  ava.append(wrappedValue);
-  return TLV(der::SEQUENCE, ava);
+  return Encode([&](der::Writer& output) {
+    return AVA(output, type, directoryStringType, value);
+  });
 }
 
+// id-at OBJECT IDENTIFIER ::= { joint-iso-ccitt(2) ds(5) 4 }
+// id-at-commonName        AttributeType ::= { id-at 3 }
+// python DottedOIDToCode.py --tlv id-at-commonName 2.5.4.3
+static const uint8_t tlv_id_at_commonName[] = {
+  0x06, 0x03, 0x55, 0x04, 0x03
+};
+
 ByteString
 CN(const ByteString& value, uint8_t encodingTag)
 {
-  // id-at OBJECT IDENTIFIER ::= { joint-iso-ccitt(2) ds(5) 4 }
-  // id-at-commonName        AttributeType ::= { id-at 3 }
-  // python DottedOIDToCode.py --tlv id-at-commonName 2.5.4.3
-  static const uint8_t tlv_id_at_commonName[] = {
-    0x06, 0x03, 0x55, 0x04, 0x03
-  };
   return AVA(tlv_id_at_commonName, encodingTag, value);
 }
 
@@ -719,6 +867,19 @@ Name(const ByteString& rdns)
   return TLV(der::SEQUENCE, rdns);
 }
 
+ByteString
+CNToDERName(const ByteString& cn)
+{
+  // Name(RDN(CN(cn))), encoded without the intermediate ByteStrings.
+  return Encode([&](der::Writer& output) {
+    return der::Nested(output, der::SEQUENCE, [&](der::Writer& name) {
+      return der::Nested(name, der::SET, [&](der::Writer& rdn) {
+        return AVA(rdn, tlv_id_at_commonName, der::UTF8String, cn);
+      });
+    });
+  });
+}
+
 ByteString
 CreateEncodedSerialNumber(long serialNumberValue)
 {
@@ -834,6 +995,12 @@ CreateEncodedOCSPResponse(OCSPResponseContext& context)
   return result;
 }
 
+ByteString
+CreateEncodedOCSPSingleResponse(OCSPResponseContext& context)
+{
+  return SingleResponse(context);
+}
+
 // ResponseBytes ::= SEQUENCE {
 //    responseType            OBJECT IDENTIFIER,
 //    response                OCTET STRING }
@@ -933,6 +1100,7 @@ ResponseData(OCSPResponseContext& context)
   if (ENCODING_FAILED(response)) {
     return ByteString();
   }
+  response.append(context.extraSingleResponses);
   ByteString responses(TLV(der::SEQUENCE, response));
   ByteString responseExtensions;
   if (context.extensions || context.includeEmptyExtensions) {
@@ -1032,14 +1200,13 @@ SingleResponse(OCSPResponseContext& context)
 ByteString
 CertID(OCSPResponseContext& context)
 {
-  ByteString issuerName(context.certID.issuer.UnsafeGetData(),
-                        context.certID.issuer.GetLength());
-  ByteString issuerNameHash(HashedOctetString(issuerName));
-  if (ENCODING_FAILED(issuerNameHash)) {
+  uint8_t issuerNameHash[20];
+  if (TestDigestBuf(context.certID.issuer, DigestAlgorithm::sha1,
+                    issuerNameHash, sizeof(issuerNameHash)) != Success) {
     return ByteString();
   }
 
-  ByteString issuerKeyHash;
+  uint8_t issuerKeyHash[20];
   {
     // context.certID.issuerSubjectPublicKeyInfo is the entire
     // SubjectPublicKeyInfo structure, but we need just the subjectPublicKey
@@ -1058,28 +1225,34 @@ CertID(OCSPResponseContext& context)
           != Success) {
       return ByteString();
     }
-    issuerKeyHash = KeyHash(ByteString(subjectPublicKey.UnsafeGetData(),
-                                       subjectPublicKey.GetLength()));
-    if (ENCODING_FAILED(issuerKeyHash)) {
+    if (TestDigestBuf(subjectPublicKey, DigestAlgorithm::sha1, issuerKeyHash,
+                      sizeof(issuerKeyHash)) != Success) {
       return ByteString();
     }
   }
 
-  ByteString serialNumberValue(context.certID.serialNumber.UnsafeGetData(),
-                               context.certID.serialNumber.GetLength());
-  ByteString serialNumber(TLV(der::INTEGER, serialNumberValue));
-
   // python DottedOIDToCode.py --alg id-sha1 1.3.14.3.2.26
   static const uint8_t alg_id_sha1[] = {
     0x30, 0x07, 0x06, 0x05, 0x2b, 0x0e, 0x03, 0x02, 0x1a
   };
 
-  ByteString value;
-  value.append(alg_id_sha1, sizeof(alg_id_sha1));
-  value.append(issuerNameHash);
-  value.append(issuerKeyHash);
-  value.append(serialNumber);
-  return TLV(der::SEQUENCE, value);
+  return Encode([&](der::Writer& output) {
+    return der::Nested(output, der::SEQUENCE, [&](der::Writer& certID) {
+      Result rv = certID.Write(Input(alg_id_sha1));
+      if (rv != Success) {
+        return rv;
+      }
+      rv = der::TLV(certID, der::OCTET_STRING, Input(issuerNameHash));
+      if (rv != Success) {
+        return rv;
+      }
+      rv = der::TLV(certID, der::OCTET_STRING, Input(issuerKeyHash));
+      if (rv != Success) {
+        return rv;
+      }
+      return der::TLV(certID, der::INTEGER, context.certID.serialNumber);
+    });
+  });
 }
 
 // CertStatus ::= CHOICE {
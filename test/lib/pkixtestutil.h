@@ -190,16 +190,13 @@ ByteString RDN(const ByteString& avas);
 //
 ByteString Name(const ByteString& rdns);
 
-inline ByteString
-CNToDERName(const ByteString& cn)
-{
-  return Name(RDN(CN(cn)));
-}
+ByteString CNToDERName(const ByteString& cn);
 
 inline ByteString
 CNToDERName(const char* cn)
 {
-  return Name(RDN(CN(cn)));
+  return CNToDERName(ByteString(reinterpret_cast<const uint8_t*>(cn),
+                                std::strlen(cn)));
 }
 
 // GeneralName ::= CHOICE {
@@ -353,6 +350,28 @@ ByteString CreateEncodedCertificate(long version,
 
 ByteString CreateEncodedSerialNumber(long value);
 
+// serialNumber is assumed to be the DER encoding of an INTEGER. If extensions
+// is not null, it must point to an array of encoded extensions terminated
+// with an empty ByteString.
+ByteString CreateEncodedCRLEntry(const ByteString& serialNumber,
+                                 time_t revocationDate,
+                                 /*optional*/ const ByteString* extensions
+                                   = nullptr);
+
+// revokedCertificates is the concatenation of entries created with
+// CreateEncodedCRLEntry; if it is empty then the revokedCertificates field is
+// omitted. extensions is treated as in CreateEncodedCRLEntry, except that a
+// null extensions causes the crlExtensions field to be omitted. The version
+// field is omitted for v1.
+ByteString CreateEncodedCRL(long version,
+                            const TestSignatureAlgorithm& signature,
+                            const ByteString& issuerNameDER,
+                            time_t thisUpdate, time_t nextUpdate,
+                            const ByteString& revokedCertificates,
+                            /*optional*/ const ByteString* extensions,
+                            const TestKeyPair& issuerKeyPair,
+                            const TestSignatureAlgorithm& signatureAlgorithm);
+
 enum class Critical { No = 0, Yes = 1 };
 
 ByteString CreateEncodedBasicConstraints(bool isCA,
@@ -404,6 +423,9 @@ public:
 
   std::time_t producedAt;
 
+  ByteString extraSingleResponses; // Encoded SingleResponses to include after
+                                   // the one for certID.
+
   OCSPResponseExtension* extensions;
   bool includeEmptyExtensions; // If true, include the extension wrapper
                                // regardless of if there are any actual
@@ -430,6 +452,10 @@ public:
 
 ByteString CreateEncodedOCSPResponse(OCSPResponseContext& context);
 
+// Returns the encoded SingleResponse that CreateEncodedOCSPResponse would
+// include for context, for use in OCSPResponseContext::extraSingleResponses.
+ByteString CreateEncodedOCSPSingleResponse(OCSPResponseContext& context);
+
 } } } // namespace mozilla::pkix::test
 
 #endif // mozilla_pkix_test_pkixtestutils_h
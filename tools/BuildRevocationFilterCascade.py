@@ -0,0 +1,195 @@
+# This code is made available to you under your choice of the following sets
+# of licensing terms:
+###############################################################################
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+###############################################################################
+# Copyright 2015 Mozilla Contributors
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Builds a revocation filter cascade file, as used by
+mozilla::pkix::RevocationFilterCascade (see include/pkix/pkix.h for the
+format), from the sets of revoked and non-revoked certificates.
+
+Each input file contains one certificate per line: the hex-encoded SHA-256
+digest of the issuer's SubjectPublicKeyInfo, whitespace, and the hex-encoded
+value of the certificate's serial number. The non-revoked set must include
+every certificate that will be checked against the cascade; the cascade has
+no false positives or false negatives for certificates in either set.
+"""
+
+from __future__ import print_function
+import argparse
+import binascii
+import math
+import struct
+import sys
+
+MAGIC = b"pkfc"
+VERSION = 1
+MAX_LEVELS = 32
+ISSUER_SPKI_HASH_LENGTH = 32
+MAX_SERIAL_NUMBER_LENGTH = 127
+
+# The false positive rate of the first level. The following levels use 1/2,
+# which minimizes the total size (see the CRLite paper).
+FIRST_LEVEL_FALSE_POSITIVE_RATE = 1.0 / 64
+FALSE_POSITIVE_RATE = 0.5
+
+def murmurhash3_32(key, seed):
+    """
+    MurmurHash3_x86_32, reading blocks little-endian.
+
+    >>> hex(murmurhash3_32(b"", 0))
+    '0x0'
+    >>> hex(murmurhash3_32(b"hello", 0))
+    '0x248bfa47'
+    """
+    c1 = 0xcc9e2d51
+    c2 = 0x1b873593
+    mask = 0xffffffff
+
+    def rotl(x, r):
+        return ((x << r) | (x >> (32 - r))) & mask
+
+    h = seed
+    block_count = len(key) // 4
+    for i in range(block_count):
+        k = struct.unpack("<I", key[i * 4:i * 4 + 4])[0]
+        k = (k * c1) & mask
+        k = rotl(k, 15)
+        k = (k * c2) & mask
+        h ^= k
+        h = rotl(h, 13)
+        h = (h * 5 + 0xe6546b64) & mask
+
+    tail = bytearray(key[block_count * 4:])
+    k = 0
+    if len(tail) >= 3:
+        k ^= tail[2] << 16
+    if len(tail) >= 2:
+        k ^= tail[1] << 8
+    if len(tail) >= 1:
+        k ^= tail[0]
+        k = (k * c1) & mask
+        k = rotl(k, 15)
+        k = (k * c2) & mask
+        h ^= k
+
+    h ^= len(key)
+    h ^= h >> 16
+    h = (h * 0x85ebca6b) & mask
+    h ^= h >> 13
+    h = (h * 0xc2b2ae35) & mask
+    h ^= h >> 16
+    return h
+
+def bit_indexes(level, hash_count, bit_count, key):
+    return [murmurhash3_32(key, (level << 16) | i) % bit_count
+            for i in range(hash_count)]
+
+class Level(object):
+    def __init__(self, level, element_count, false_positive_rate):
+        self.level = level
+        self.hash_count = max(1, int(math.ceil(-math.log(false_positive_rate,
+                                                         2))))
+        self.bit_count = max(8, int(math.ceil(element_count *
+                                              self.hash_count /
+                                              math.log(2))))
+        self.bits = bytearray((self.bit_count + 7) // 8)
+
+    def add(self, key):
+        for bit in bit_indexes(self.level, self.hash_count, self.bit_count,
+                               key):
+            self.bits[bit // 8] |= 1 << (bit % 8)
+
+    def __contains__(self, key):
+        for bit in bit_indexes(self.level, self.hash_count, self.bit_count,
+                               key):
+            if not (self.bits[bit // 8] >> (bit % 8)) & 1:
+                return False
+        return True
+
+    def encode(self):
+        return (struct.pack(">IB", self.bit_count, self.hash_count) +
+                bytes(self.bits))
+
+def build_cascade(revoked, not_revoked):
+    """
+    Returns the encoded cascade for the given sets of keys, each of which is
+    the issuer SPKI digest followed by the serial number.
+    """
+    if revoked & not_revoked:
+        raise ValueError("A certificate cannot be both revoked and not "
+                         "revoked.")
+    levels = []
+    included, excluded = revoked, not_revoked
+    false_positive_rate = FIRST_LEVEL_FALSE_POSITIVE_RATE
+    while True:
+        if len(levels) == MAX_LEVELS:
+            raise ValueError("The cascade needs too many levels.")
+        level = Level(len(levels), len(included), false_positive_rate)
+        for key in included:
+            level.add(key)
+        levels.append(level)
+        false_positives = set(key for key in excluded if key in level)
+        if not false_positives:
+            break
+        included, excluded = false_positives, included
+        false_positive_rate = FALSE_POSITIVE_RATE
+    return (MAGIC + struct.pack(">BB", VERSION, len(levels)) +
+            b"".join(level.encode() for level in levels))
+
+def read_keys(path):
+    keys = set()
+    with open(path) as f:
+        for line_number, line in enumerate(f, 1):
+            fields = line.split()
+            if not fields:
+                continue
+            if len(fields) != 2:
+                raise ValueError("%s:%d: expected an issuer SPKI digest and a "
+                                 "serial number" % (path, line_number))
+            issuer_spki_hash = binascii.unhexlify(fields[0])
+            serial_number = binascii.unhexlify(fields[1])
+            if (len(issuer_spki_hash) != ISSUER_SPKI_HASH_LENGTH or
+                    not serial_number or
+                    len(serial_number) > MAX_SERIAL_NUMBER_LENGTH):
+                raise ValueError("%s:%d: invalid length" % (path, line_number))
+            keys.add(issuer_spki_hash + serial_number)
+    return keys
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Build a revocation filter cascade file.",
+        epilog="example: python %s --revoked revoked.txt "
+               "--not-revoked valid.txt --output revocations.pkfc"
+               % sys.argv[0])
+    parser.add_argument("--revoked", required=True,
+                        help="file listing the revoked certificates")
+    parser.add_argument("--not-revoked", required=True,
+                        help="file listing the non-revoked certificates")
+    parser.add_argument("--output", required=True,
+                        help="the cascade file to write")
+    args = parser.parse_args()
+
+    cascade = build_cascade(read_keys(args.revoked),
+                            read_keys(args.not_revoked))
+    with open(args.output, "wb") as f:
+        f.write(cascade)
+
+if __name__ == "__main__":
+    main()